@@ -1,3 +1,15 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include "maths.h"
+#include "GEMLoader.h"
+#include "GEMMappedLoader.h"
+#include "AnimationCompression.h"
+
 struct Bone
 {
 	std::string name;
@@ -5,34 +17,216 @@ struct Bone
 	int parentIndex;
 };
 
+// Index of a bone in its skeleton. Look it up once by name and keep it, -1 means the bone was not found.
+struct BoneHandle
+{
+	int index = -1;
+	bool valid() const
+	{
+		return index > -1;
+	}
+};
+
 struct Skeleton
 {
 	std::vector<Bone> bones;
+	std::vector<int> order; // Bone indices with every parent ahead of its children, built once at load
+	std::unordered_map<std::string, int> boneLookup;
 	Matrix globalInverse;
-	int findBone(std::string name)
+
+	static const int lodLevels = 3;
+	std::vector<int> lodBones[lodLevels]; // Bones sampled at each LOD level, level n skips bones within n steps of a leaf
+
+	// Called once the bones are in place
+	void build()
 	{
+		std::vector<int> depth(bones.size(), 0);
+		boneLookup.clear();
 		for (int i = 0; i < bones.size(); i++)
 		{
-			if (bones[i].name == name)
+			for (int parent = bones[i].parentIndex; parent > -1; parent = bones[parent].parentIndex)
+			{
+				depth[i]++;
+			}
+			boneLookup.insert({ bones[i].name, i });
+		}
+		order.resize(bones.size());
+		for (int i = 0; i < bones.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&depth](int a, int b) { return depth[a] < depth[b]; });
+
+		// Height is the number of steps down to the deepest leaf, so fingers and jaws have height 0
+		std::vector<int> height(bones.size(), 0);
+		for (int i = (int)order.size() - 1; i > -1; i--)
+		{
+			int parent = bones[order[i]].parentIndex;
+			if (parent > -1)
+			{
+				height[parent] = max(height[parent], height[order[i]] + 1);
+			}
+		}
+		for (int level = 0; level < lodLevels; level++)
+		{
+			lodBones[level].clear();
+			for (int i = 0; i < order.size(); i++)
 			{
-				return i;
+				if (height[order[i]] >= level)
+				{
+					lodBones[level].push_back(order[i]);
+				}
 			}
 		}
-		return -1;
 	}
+	int findBone(const std::string& name) const
+	{
+		auto it = boneLookup.find(name);
+		if (it == boneLookup.end())
+		{
+			return -1;
+		}
+		return it->second;
+	}
+	BoneHandle findBoneHandle(const std::string& name) const
+	{
+		BoneHandle handle;
+		handle.index = findBone(name);
+		return handle;
+	}
+};
+
+// Local transform of one bone, the output of the sampling stage
+struct BoneTransform
+{
+	Vec3 position;
+	Quaternion rotation;
+	Vec3 scale;
+
+	// Translation * rotation * scale, built directly rather than through three 4x4 multiplies
+	Matrix toMatrix() const
+	{
+		float aa = rotation.a * rotation.a, ab = rotation.a * rotation.b, ac = rotation.a * rotation.c;
+		float bb = rotation.b * rotation.b, bc = rotation.b * rotation.c, cc = rotation.c * rotation.c;
+		float da = rotation.d * rotation.a, db = rotation.d * rotation.b, dc = rotation.d * rotation.c;
+		Matrix m;
+		m[0] = (1 - 2 * (bb + cc)) * scale.x; m[1] = 2 * (ab - dc) * scale.y; m[2] = 2 * (ac + db) * scale.z; m[3] = position.x;
+		m[4] = 2 * (ab + dc) * scale.x; m[5] = (1 - 2 * (aa + cc)) * scale.y; m[6] = 2 * (bc - da) * scale.z; m[7] = position.y;
+		m[8] = 2 * (ac - db) * scale.x; m[9] = 2 * (bc + da) * scale.y; m[10] = (1 - 2 * (aa + bb)) * scale.z; m[11] = position.z;
+		return m;
+	}
+};
+
+enum class AnimationBlendMode
+{
+	Override, // Lerps the pose so far towards this clip by the weight
+	Additive // Adds this clip's difference from its first frame on top of the pose so far
 };
 
-struct AnimationFrame
+struct AnimationSequence;
+
+// One clip feeding the fused sampling pass
+struct AnimationBlendInput
 {
-	std::vector<Vec3> positions;
-	std::vector<Quaternion> rotations;
-	std::vector<Vec3> scales;
+	AnimationSequence* sequence;
+	int frame;
+	float interpolationFact;
+	float weight;
+	AnimationBlendMode mode;
+	const float* boneMask; // Optional per bone weight multiplier
 };
 
 struct AnimationSequence // This holds rescaled times
 {
-	std::vector<AnimationFrame> frames;
+	std::string name;
+	// The whole clip lives in one block with one track per bone. A track holds the positions for every frame,
+	// then the rotations, then the scales, so sampling a bone reads neighbouring keys and the bone loop walks
+	// the block front to back.
+	std::vector<float> keys;
+	int framesN = 0;
+	int bonesN = 0;
 	float ticksPerSecond;
+	CompressedSequence compressed; // Once filled, keys is released and sampling goes through this instead
+	std::vector<BoneTransform> referencePose; // First frame, what an additive layer of this clip is measured against
+
+	static const int floatsPerFrame = 10; // position (3) + rotation (4) + scale (3)
+
+	// Fills the block straight from the loaded GEM frames, one allocation per clip
+	void load(const GEMLoader::GEMAnimationSequence& gemseq, int _bonesN)
+	{
+		reset((int)gemseq.frames.size(), _bonesN, gemseq.ticksPerSecond);
+		for (int frame = 0; frame < framesN; frame++)
+		{
+			const GEMLoader::GEMAnimationFrame& gemframe = gemseq.frames[frame];
+			loadFrame(frame, gemframe.positions.data(), gemframe.rotations.data(), gemframe.scales.data());
+		}
+		loadReferencePose();
+	}
+	// Same, reading the frames from a memory-mapped file
+	void load(const GEMLoader::GEMMappedAnimationSequence& gemseq, int _bonesN)
+	{
+		reset((int)gemseq.framesN, _bonesN, gemseq.ticksPerSecond);
+		for (int frame = 0; frame < framesN; frame++)
+		{
+			loadFrame(frame, gemseq.positions(frame), gemseq.rotations(frame), gemseq.scales(frame));
+		}
+		loadReferencePose();
+	}
+	void reset(int _framesN, int _bonesN, float _ticksPerSecond)
+	{
+		framesN = _framesN;
+		bonesN = _bonesN;
+		ticksPerSecond = _ticksPerSecond;
+		keys.resize((size_t)framesN * bonesN * floatsPerFrame);
+	}
+	// Scatters one frame of bonesN positions, rotations and scales into the bone tracks
+	void loadFrame(int frame, const GEMLoader::GEMVec3* positions, const GEMLoader::GEMQuaternion* rotations, const GEMLoader::GEMVec3* scales)
+	{
+		for (int bone = 0; bone < bonesN; bone++)
+		{
+			memcpy(&keys[positionOffset(bone, frame)], &positions[bone], sizeof(Vec3));
+			memcpy(&keys[rotationOffset(bone, frame)], &rotations[bone], sizeof(Quaternion));
+			memcpy(&keys[scaleOffset(bone, frame)], &scales[bone], sizeof(Vec3));
+		}
+	}
+	void loadReferencePose()
+	{
+		referencePose.resize(bonesN);
+		for (int bone = 0; bone < bonesN && framesN > 0; bone++)
+		{
+			referencePose[bone].position = position(bone, 0);
+			referencePose[bone].rotation = rotation(bone, 0);
+			referencePose[bone].scale = this->scale(bone, 0);
+		}
+	}
+	size_t trackOffset(int bone) const
+	{
+		return (size_t)bone * framesN * floatsPerFrame;
+	}
+	size_t positionOffset(int bone, int frame) const
+	{
+		return trackOffset(bone) + (size_t)frame * 3;
+	}
+	size_t rotationOffset(int bone, int frame) const
+	{
+		return trackOffset(bone) + (size_t)framesN * 3 + (size_t)frame * 4;
+	}
+	size_t scaleOffset(int bone, int frame) const
+	{
+		return trackOffset(bone) + (size_t)framesN * 7 + (size_t)frame * 3;
+	}
+	const Vec3& position(int bone, int frame) const
+	{
+		return *reinterpret_cast<const Vec3*>(&keys[positionOffset(bone, frame)]);
+	}
+	const Quaternion& rotation(int bone, int frame) const
+	{
+		return *reinterpret_cast<const Quaternion*>(&keys[rotationOffset(bone, frame)]);
+	}
+	const Vec3& scale(int bone, int frame) const
+	{
+		return *reinterpret_cast<const Vec3*>(&keys[scaleOffset(bone, frame)]);
+	}
 	Vec3 interpolate(Vec3 p1, Vec3 p2, float t)
 	{
 		return ((p1 * (1.0f - t)) + (p2 * t));
@@ -43,18 +237,18 @@ struct AnimationSequence // This holds rescaled times
 	}
 	float duration()
 	{
-		return ((float)frames.size() / ticksPerSecond);
+		return ((float)framesN / ticksPerSecond);
 	}
 	void calcFrame(float t, int& frame, float& interpolationFact)
 	{
 		interpolationFact = t * ticksPerSecond;
 		frame = (int)floorf(interpolationFact);
 		interpolationFact = interpolationFact - (float)frame;
-		frame = min(frame, (int)(frames.size() - 1));
+		frame = min(frame, framesN - 1);
 	}
 	bool running(float t)
 	{
-		if ((int)floorf(t * ticksPerSecond) < frames.size())
+		if ((int)floorf(t * ticksPerSecond) < framesN)
 		{
 			return true;
 		}
@@ -62,16 +256,76 @@ struct AnimationSequence // This holds rescaled times
 	}
 	int nextFrame(int frame)
 	{
-		return min(frame + 1, (int)(frames.size() - 1));
+		return min(frame + 1, framesN - 1);
+	}
+	// Drops constant tracks, reduces keys under tolerance and packs rotations, then releases the raw keys.
+	// The error is measured in local bone space against every original frame.
+	void compress(const AnimationCompressionSettings& settings, AnimationCompressionReport& report)
+	{
+		report = AnimationCompressionReport();
+		report.bytesBefore = keys.size() * sizeof(float);
+		if (framesN == 0 || framesN > 65535 || !compressed.empty())
+		{
+			report.bytesAfter = compressed.empty() ? report.bytesBefore : compressed.bytes();
+			return;
+		}
+		for (int bone = 0; bone < bonesN; bone++)
+		{
+			// An error at a bone is carried out to its descendants, so long chains get a tighter rotation and scale budget
+			float reach = bone < settings.boneReach.size() ? max(settings.boneReach[bone], 1.0f) : 1.0f;
+			AnimationCompressor::addVec3Track(compressed, &position(bone, 0), framesN, settings.positionTolerance);
+			AnimationCompressor::addRotationTrack(compressed, &rotation(bone, 0), framesN, min(settings.rotationTolerance, settings.positionTolerance / reach));
+			AnimationCompressor::addVec3Track(compressed, &this->scale(bone, 0), framesN, min(settings.scaleTolerance, settings.positionTolerance / reach));
+		}
+		for (int bone = 0; bone < bonesN; bone++)
+		{
+			for (int frame = 0; frame < framesN; frame++)
+			{
+				report.maxPositionError = max(report.maxPositionError, AnimationCompressor::vec3Error(compressed.samplePosition(bone, (float)frame), position(bone, frame)));
+				report.maxRotationError = max(report.maxRotationError, AnimationCompressor::rotationError(compressed.sampleRotation(bone, (float)frame), rotation(bone, frame)));
+				report.maxScaleError = max(report.maxScaleError, AnimationCompressor::vec3Error(compressed.sampleScale(bone, (float)frame), this->scale(bone, frame)));
+			}
+		}
+		std::vector<float>().swap(keys);
+		report.bytesAfter = compressed.bytes();
+	}
+	BoneTransform sampleBone(int baseFrame, float interpolationFact, int boneIndex)
+	{
+		int next = nextFrame(baseFrame);
+		BoneTransform local;
+		if (!compressed.empty())
+		{
+			float time = (float)baseFrame + (next != baseFrame ? interpolationFact : 0.0f);
+			local.position = compressed.samplePosition(boneIndex, time);
+			local.rotation = compressed.sampleRotation(boneIndex, time);
+			local.scale = compressed.sampleScale(boneIndex, time);
+		}
+		else
+		{
+			local.position = interpolate(position(boneIndex, baseFrame), position(boneIndex, next), interpolationFact);
+			local.rotation = interpolate(rotation(boneIndex, baseFrame), rotation(boneIndex, next), interpolationFact);
+			local.scale = interpolate(this->scale(boneIndex, baseFrame), this->scale(boneIndex, next), interpolationFact);
+		}
+		return local;
+	}
+	void sampleLocalPose(int baseFrame, float interpolationFact, BoneTransform* local)
+	{
+		for (int i = 0; i < bonesN; i++)
+		{
+			local[i] = sampleBone(baseFrame, interpolationFact, i);
+		}
+	}
+	// Only the listed bones, the rest of local is left as it was
+	void sampleLocalPose(int baseFrame, float interpolationFact, BoneTransform* local, const std::vector<int>& bones)
+	{
+		for (int i = 0; i < bones.size(); i++)
+		{
+			local[bones[i]] = sampleBone(baseFrame, interpolationFact, bones[i]);
+		}
 	}
 	Matrix interpolateBoneToGlobal(Matrix* matrices, int baseFrame, float interpolationFact, Skeleton* skeleton, int boneIndex)
 	{
-		Matrix scale;
-		scale.scaling(interpolate(frames[baseFrame].scales[boneIndex], frames[nextFrame(baseFrame)].scales[boneIndex], interpolationFact));
-		Matrix rotation = interpolate(frames[baseFrame].rotations[boneIndex], frames[nextFrame(baseFrame)].rotations[boneIndex], interpolationFact).toMatrix();
-		Matrix translation;
-		translation.translation(interpolate(frames[baseFrame].positions[boneIndex], frames[nextFrame(baseFrame)].positions[boneIndex], interpolationFact));
-		Matrix local = translation * rotation * scale;// scale* rotation* translation;
+		Matrix local = sampleBone(baseFrame, interpolationFact, boneIndex).toMatrix();
 		if (skeleton->bones[boneIndex].parentIndex > -1)
 		{
 			Matrix global = matrices[skeleton->bones[boneIndex].parentIndex] * local;//local * matrices[skeleton->bones[boneIndex].parentIndex];
@@ -87,11 +341,55 @@ public:
 	std::map<std::string, AnimationSequence> animations;
 	Skeleton skeleton;
 
+	// Copies the skeleton and every clip out of a loaded GEM file
+	void load(const GEMLoader::GEMAnimation& gemanimation)
+	{
+		loadBones(gemanimation.bones, gemanimation.globalInverse);
+		for (int i = 0; i < gemanimation.animations.size(); i++) {
+			AnimationSequence& aseq = animations[gemanimation.animations[i].name];
+			aseq.name = gemanimation.animations[i].name;
+			aseq.load(gemanimation.animations[i], (int)gemanimation.bones.size());
+		}
+		skeleton.build();
+	}
+
+	// Same, with the clips read straight out of a memory-mapped file
+	void load(const GEMLoader::GEMMappedModel& model)
+	{
+		loadBones(model.bones, model.globalInverse);
+		for (int i = 0; i < model.animations.size(); i++) {
+			AnimationSequence& aseq = animations[model.animations[i].name];
+			aseq.name = model.animations[i].name;
+			aseq.load(model.animations[i], (int)model.bones.size());
+		}
+		skeleton.build();
+	}
+
+	void loadBones(const std::vector<GEMLoader::GEMBone>& gembones, const GEMLoader::GEMMatrix& globalInverse)
+	{
+		memcpy(&skeleton.globalInverse, &globalInverse, 16 * sizeof(float));
+
+		for (int i = 0; i < gembones.size(); i++) {
+			Bone bone;
+			bone.name = gembones[i].name;
+			memcpy(&bone.offset, &gembones[i].offset, 16 * sizeof(float));
+			bone.parentIndex = gembones[i].parentIndex;
+			skeleton.bones.push_back(bone);
+		}
+	}
+
 	bool hasAnimation(const std::string& name) const
 	{
 		return animations.find(name) != animations.end();
 	}
 
+	// Resolve a clip once and keep the pointer, map nodes never move. Returns nullptr if there is no such clip.
+	AnimationSequence* findClip(const std::string& name)
+	{
+		auto it = animations.find(name);
+		return it != animations.end() ? &it->second : nullptr;
+	}
+
 	void debugListAnimations() const
 	{
 		std::string msg = "[Animation] Available animations (" + std::to_string(animations.size()) + "): ";
@@ -114,10 +412,194 @@ public:
 
 	int bonesSize() { return (int)skeleton.bones.size(); }
 
+	// Compresses every clip and writes bytes before/after and the worst local error per clip to the debug output
+	void compress(AnimationCompressionSettings settings)
+	{
+		if (settings.boneReach.empty())
+		{
+			std::vector<Vec3> bindPositions(bonesSize());
+			for (int i = 0; i < bonesSize(); i++)
+			{
+				Matrix bind = skeleton.bones[i].offset.invert();
+				bindPositions[i] = Vec3(bind.m[3], bind.m[7], bind.m[11]);
+			}
+			settings.boneReach.assign(bonesSize(), 0.0f);
+			for (int i = 0; i < bonesSize(); i++)
+			{
+				for (int parent = skeleton.bones[i].parentIndex; parent > -1; parent = skeleton.bones[parent].parentIndex)
+				{
+					settings.boneReach[parent] = max(settings.boneReach[parent], AnimationCompressor::vec3Error(bindPositions[i], bindPositions[parent]));
+				}
+			}
+		}
+		size_t totalBefore = 0;
+		size_t totalAfter = 0;
+		for (auto& kv : animations)
+		{
+			if (!kv.second.compressed.empty())
+			{
+				continue; // Already compressed, for example when loaded from the asset cache
+			}
+			AnimationCompressionReport report;
+			kv.second.compress(settings, report);
+			totalBefore += report.bytesBefore;
+			totalAfter += report.bytesAfter;
+			std::string msg = "[Animation] \"" + kv.first + "\": " + std::to_string(report.bytesBefore) + " -> " + std::to_string(report.bytesAfter) + " bytes, max error pos " + std::to_string(report.maxPositionError) + " rot " + std::to_string(report.maxRotationError) + " rad scale " + std::to_string(report.maxScaleError) + "\n";
+			OutputDebugStringA(msg.c_str());
+		}
+		if (totalBefore == 0)
+		{
+			return;
+		}
+		std::string msg = "[Animation] Compressed " + std::to_string(animations.size()) + " clips: " + std::to_string(totalBefore) + " -> " + std::to_string(totalAfter) + " bytes\n";
+		OutputDebugStringA(msg.c_str());
+	}
+
+	// The pose is built in three stages that can be called and timed on their own:
+	// sampleLocalPose -> concatenate -> skin
+
+	// Stage 1: interpolated local TRS for every bone
+	void sampleLocalPose(const std::string& name, float t, BoneTransform* local)
+	{
+		AnimationSequence& sequence = animations.at(name);
+		int frame = 0;
+		float interpolationFact = 0;
+		sequence.calcFrame(t, frame, interpolationFact);
+		sequence.sampleLocalPose(frame, interpolationFact, local);
+	}
+
+	AnimationBlendInput blendInput(const std::string& name, float t, float weight, AnimationBlendMode mode, const float* boneMask)
+	{
+		return blendInput(&animations.at(name), t, weight, mode, boneMask);
+	}
+	AnimationBlendInput blendInput(AnimationSequence* clip, float t, float weight, AnimationBlendMode mode, const float* boneMask)
+	{
+		AnimationBlendInput input;
+		input.sequence = clip;
+		input.sequence->calcFrame(t, input.frame, input.interpolationFact);
+		input.weight = weight;
+		input.mode = mode;
+		input.boneMask = boneMask;
+		return input;
+	}
+
+	// Stage 1 over several clips at once. inputs[0] is the base pose, the rest are applied on top in order.
+	// Each bone is sampled from every clip and blended as TRS in one pass, and only the blended result is
+	// normalised and turned into a matrix, so extra layers cost one sample and a few adds per bone.
+	// With a bone list only those bones are sampled and the others keep their previous local transform.
+	void sampleLocalPose(const AnimationBlendInput* inputs, int inputsN, BoneTransform* local, const std::vector<int>* bones = nullptr)
+	{
+		if (inputsN == 1)
+		{
+			if (bones != nullptr)
+			{
+				inputs[0].sequence->sampleLocalPose(inputs[0].frame, inputs[0].interpolationFact, local, *bones);
+			}
+			else
+			{
+				inputs[0].sequence->sampleLocalPose(inputs[0].frame, inputs[0].interpolationFact, local);
+			}
+			return;
+		}
+		int count = bones != nullptr ? (int)bones->size() : bonesSize();
+		for (int j = 0; j < count; j++)
+		{
+			int bone = bones != nullptr ? (*bones)[j] : j;
+			BoneTransform result = inputs[0].sequence->sampleBone(inputs[0].frame, inputs[0].interpolationFact, bone);
+			for (int i = 1; i < inputsN; i++)
+			{
+				const AnimationBlendInput& input = inputs[i];
+				float w = input.boneMask != nullptr ? input.weight * input.boneMask[bone] : input.weight;
+				if (w <= 0)
+				{
+					continue;
+				}
+				BoneTransform layer = input.sequence->sampleBone(input.frame, input.interpolationFact, bone);
+				if (input.mode == AnimationBlendMode::Override)
+				{
+					result.position = (result.position * (1.0f - w)) + (layer.position * w);
+					result.scale = (result.scale * (1.0f - w)) + (layer.scale * w);
+					result.rotation = nlerp(result.rotation, layer.rotation, w);
+				}
+				else
+				{
+					const BoneTransform& reference = input.sequence->referencePose[bone];
+					result.position = result.position + ((layer.position - reference.position) * w);
+					result.scale = result.scale * Vec3(additiveScale(layer.scale.x, reference.scale.x, w), additiveScale(layer.scale.y, reference.scale.y, w), additiveScale(layer.scale.z, reference.scale.z, w));
+					Quaternion delta = nlerp(Quaternion(), multiply(reference.rotation.Conjugate(), layer.rotation), w);
+					result.rotation = multiply(result.rotation, delta);
+				}
+			}
+			local[bone] = result;
+			local[bone].rotation = result.rotation.Normalised();
+		}
+	}
+
+	// Not normalised, the fused pass normalises once per bone at the end
+	static Quaternion nlerp(const Quaternion& q1, const Quaternion& q2, float t)
+	{
+		float dp = q1.a * q2.a + q1.b * q2.b + q1.c * q2.c + q1.d * q2.d;
+		float t2 = dp < 0 ? -t : t;
+		return Quaternion(q1.a * (1.0f - t) + q2.a * t2, q1.b * (1.0f - t) + q2.b * t2, q1.c * (1.0f - t) + q2.c * t2, q1.d * (1.0f - t) + q2.d * t2);
+	}
+	static Quaternion multiply(const Quaternion& q1, const Quaternion& q2)
+	{
+		return Quaternion(
+			q1.d * q2.a + q1.a * q2.d + q1.b * q2.c - q1.c * q2.b,
+			q1.d * q2.b - q1.a * q2.c + q1.b * q2.d + q1.c * q2.a,
+			q1.d * q2.c + q1.a * q2.b - q1.b * q2.a + q1.c * q2.d,
+			q1.d * q2.d - q1.a * q2.a - q1.b * q2.b - q1.c * q2.c);
+	}
+	static float additiveScale(float scale, float reference, float w)
+	{
+		return reference != 0 ? 1.0f + (((scale / reference) - 1.0f) * w) : 1.0f;
+	}
+
+	// Weight 1 for the named bone and everything below it, 0 elsewhere. Use as the mask of an override layer.
+	std::vector<float> boneMask(const std::string& boneName)
+	{
+		std::vector<float> mask(bonesSize(), 0.0f);
+		int root = skeleton.findBone(boneName);
+		for (int i = 0; i < skeleton.order.size() && root > -1; i++)
+		{
+			int bone = skeleton.order[i];
+			int parent = skeleton.bones[bone].parentIndex;
+			if (bone == root || (parent > -1 && mask[parent] > 0))
+			{
+				mask[bone] = 1.0f;
+			}
+		}
+		return mask;
+	}
+
+	// Stage 2: local to model space, walking the bones parent first. rootTransform goes in front of the root bones,
+	// so every result already includes it.
+	void concatenate(const BoneTransform* local, Matrix* global, const Matrix& rootTransform)
+	{
+		for (int i = 0; i < skeleton.order.size(); i++)
+		{
+			int bone = skeleton.order[i];
+			int parent = skeleton.bones[bone].parentIndex;
+			global[bone] = (parent > -1 ? global[parent] : rootTransform).multiply(local[bone].toMatrix());
+		}
+	}
+
+	// Stage 3: skinning matrices for the shader, from the output of concatenate with the same coordTransform.
+	// world and skinning may be the same array.
+	void skin(const Matrix* world, Matrix* skinning, const Matrix& coordTransform)
+	{
+		// world already starts with coordTransform, so move it back past globalInverse
+		Matrix root = coordTransform.multiply(skeleton.globalInverse).multiply(coordTransform.invert());
+		for (int i = 0; i < bonesSize(); i++) {
+			skinning[i] = root.multiply(world[i]).multiply(skeleton.bones[i].offset);
+		}
+	}
+
 	void calcTransforms(Matrix* matrices, Matrix coordTransform)
 	{
+		Matrix root = coordTransform.multiply(skeleton.globalInverse);
 		for (int i = 0; i < bonesSize(); i++) {
-			matrices[i] = coordTransform * skeleton.globalInverse * matrices[i] * skeleton.bones[i].offset;
+			matrices[i] = root.multiply(matrices[i]).multiply(skeleton.bones[i].offset);
 		}
 	}
 };
@@ -127,9 +609,11 @@ class AnimationInstance
 public:
 	Animation* animation;
 	std::string usingAnimation;
+	AnimationSequence* clip = nullptr; // usingAnimation resolved, the per frame path only touches this
 	float t;
 	Matrix matrices[256]; // This is defined as 256 to match the maximum number in the shader
-	Matrix matricesPose[256]; // This is to store transforms needed for finding bone positions
+	Matrix matricesPose[256]; // World pose of every bone (coordTransform included) from the last evaluatePose, for bone queries
+	BoneTransform localPose[256];
 	Matrix coordTransform;
 	void init(Animation* _animation, int fromYZX)
 	{
@@ -143,29 +627,155 @@ public:
 			coordTransform.a[3][3] = 1.0f;
 		}
 	}
-	void update(std::string name, float dt)
+	// A clip played on top of the main one
+	struct Layer
+	{
+		AnimationSequence* clip = nullptr;
+		float t = 0;
+		float weight = 0;
+		bool loops = true;
+		AnimationBlendMode mode = AnimationBlendMode::Override;
+		const std::vector<float>* boneMask = nullptr;
+	};
+	static const int maxLayers = 4;
+	Layer layers[maxLayers];
+	int layersN = 0;
+
+	// The clip being faded out, it keeps playing until the fade ends
+	AnimationSequence* fadeClip = nullptr;
+	float fadeT = 0;
+	float fadeElapsed = 0;
+	float fadeDuration = 0;
+
+	bool poseDirty = false;
+	int lodLevel = 0; // Skeleton::lodBones level to sample, set by AnimationLODManager
+	bool posed = false; // Every bone has been sampled at least once, so skipped bones have something to hold
+	// Moves the clock and picks the clip without touching the pose, so the pose can be evaluated later,
+	// possibly on another thread alongside other instances
+	void advance(AnimationSequence* newClip, float dt)
 	{
-		if (name == usingAnimation)
+		if (newClip == clip)
 		{
 			t += dt;
 		}
 		else
 		{
-			usingAnimation = name;
+			clip = newClip;
+			usingAnimation = clip != nullptr ? clip->name : std::string();
 			t = 0;
+			fadeDuration = 0;
+		}
+		if (fading())
+		{
+			fadeT += dt;
+			fadeElapsed += dt;
+			if (fadeElapsed >= fadeDuration)
+			{
+				fadeDuration = 0;
+			}
+		}
+		for (int i = 0; i < layersN; i++)
+		{
+			layers[i].t += dt;
+			float duration = layers[i].clip->duration();
+			if (layers[i].t > duration)
+			{
+				layers[i].t = layers[i].loops ? fmodf(layers[i].t, duration) : duration;
+			}
+		}
+		poseDirty = clip != nullptr && (!animationFinished() || fading() || layersN > 0);
+	}
+	// Name based version, only resolves the clip when it changes
+	void advance(const std::string& name, float dt)
+	{
+		advance(clip != nullptr && name == usingAnimation ? clip : resolve(name), dt);
+	}
+	// Starts newClip from the beginning and blends to it from the current clip over duration seconds
+	void crossFade(AnimationSequence* newClip, float duration)
+	{
+		if (duration > 0 && clip != nullptr)
+		{
+			fadeClip = clip;
+			fadeT = t;
+			fadeElapsed = 0;
+			fadeDuration = duration;
+		}
+		else
+		{
+			fadeDuration = 0;
 		}
-		if (animationFinished() == true)
+		clip = newClip;
+		usingAnimation = clip != nullptr ? clip->name : std::string();
+		t = 0;
+	}
+	void crossFade(const std::string& name, float duration)
+	{
+		crossFade(resolve(name), duration);
+	}
+	bool fading() const
+	{
+		return fadeDuration > 0;
+	}
+	// Returns the layer index for setLayerWeight, or -1 if every layer is in use
+	int addLayer(AnimationSequence* layerClip, AnimationBlendMode mode, float weight, bool loops = true, const std::vector<float>* boneMask = nullptr)
+	{
+		if (layersN == maxLayers || layerClip == nullptr)
+		{
+			return -1;
+		}
+		Layer& layer = layers[layersN];
+		layer.clip = layerClip;
+		layer.t = 0;
+		layer.weight = weight;
+		layer.loops = loops;
+		layer.mode = mode;
+		layer.boneMask = boneMask;
+		return layersN++;
+	}
+	int addLayer(const std::string& name, AnimationBlendMode mode, float weight, bool loops = true, const std::vector<float>* boneMask = nullptr)
+	{
+		return addLayer(resolve(name), mode, weight, loops, boneMask);
+	}
+	void setLayerWeight(int layer, float weight)
+	{
+		layers[layer].weight = weight;
+	}
+	void clearLayers()
+	{
+		layersN = 0;
+	}
+	// Only reads the shared Animation, so instances can be evaluated in parallel
+	void evaluatePose()
+	{
+		if (!poseDirty)
 		{
 			return;
 		}
-		int frame = 0;
-		float interpolationFact = 0;
-		animation->calcFrame(name, t, frame, interpolationFact);
-		for (int i = 0; i < animation->bonesSize(); i++)
+		poseDirty = false;
+		AnimationBlendInput inputs[maxLayers + 2];
+		int inputsN = 0;
+		if (fading())
 		{
-			matrices[i] = animation->interpolateBoneToGlobal(name, matrices, frame, interpolationFact, i);
+			inputs[inputsN++] = animation->blendInput(fadeClip, fadeT, 1.0f, AnimationBlendMode::Override, nullptr);
 		}
-		animation->calcTransforms(matrices, coordTransform);
+		inputs[inputsN++] = animation->blendInput(clip, t, fading() ? fadeElapsed / fadeDuration : 1.0f, AnimationBlendMode::Override, nullptr);
+		for (int i = 0; i < layersN; i++)
+		{
+			if (layers[i].weight > 0)
+			{
+				inputs[inputsN++] = animation->blendInput(layers[i].clip, layers[i].t, layers[i].weight, layers[i].mode, layers[i].boneMask != nullptr ? layers[i].boneMask->data() : nullptr);
+			}
+		}
+		int level = min(max(lodLevel, 0), Skeleton::lodLevels - 1);
+		animation->sampleLocalPose(inputs, inputsN, localPose, posed && level > 0 ? &animation->skeleton.lodBones[level] : nullptr);
+		posed = true;
+		animation->concatenate(localPose, matricesPose, coordTransform);
+		animation->skin(matricesPose, matrices, coordTransform);
+	}
+	void update(const std::string& name, float dt)
+	{
+		advance(name, dt);
+		evaluatePose();
 	}
 	void resetAnimationTime()
 	{
@@ -173,29 +783,34 @@ public:
 	}
 	bool animationFinished()
 	{
-		if (t > animation->animations[usingAnimation].duration())
+		if (clip == nullptr || t > clip->duration())
 		{
 			return true;
 		}
 		return false;
 	}
-	Matrix findWorldMatrix(std::string boneName)
+	AnimationSequence* resolve(const std::string& name)
 	{
-		int boneID = animation->skeleton.findBone(boneName);
-		std::vector<int> boneChain;
-		int ID = boneID;
-		while (ID != -1)
-		{
-			boneChain.push_back(ID);
-			ID = animation->skeleton.bones[ID].parentIndex;
-		}
-		int frame = 0;
-		float interpolationFact = 0;
-		animation->calcFrame(usingAnimation, t, frame, interpolationFact);
-		for (int i = boneChain.size() - 1; i > -1; i = i - 1)
+		AnimationSequence* found = animation->findClip(name);
+		if (found == nullptr)
 		{
-			matricesPose[boneChain[i]] = animation->interpolateBoneToGlobal(usingAnimation, matricesPose, frame, interpolationFact, boneChain[i]);
+			std::string msg = "[Animation] No clip named \"" + name + "\"\n";
+			OutputDebugStringA(msg.c_str());
 		}
-		return coordTransform * matricesPose[boneID];//(matricesPose[boneID] * coordTransform);
+		return found;
 	}
-};
\ No newline at end of file
+	BoneHandle findBone(const std::string& boneName) const
+	{
+		return animation->skeleton.findBoneHandle(boneName);
+	}
+	// Bone transform from the last update, look the handle up once with findBone
+	const Matrix& findWorldMatrix(BoneHandle bone) const
+	{
+		static const Matrix identity;
+		return bone.valid() ? matricesPose[bone.index] : identity;
+	}
+	Matrix findWorldMatrix(const std::string& boneName) const
+	{
+		return findWorldMatrix(findBone(boneName));
+	}
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "maths.h"
+
+// Smallest-three quaternion in 48 bits: 2 bits for the index of the dropped (largest) component and
+// 15 bits for each of the other three, which always lie in [-1/sqrt(2), 1/sqrt(2)]
+struct PackedQuaternion
+{
+	unsigned short v[3];
+
+	static PackedQuaternion pack(const Quaternion& q)
+	{
+		int largest = 0;
+		for (int i = 1; i < 4; i++)
+		{
+			if (fabsf(q.q[i]) > fabsf(q.q[largest]))
+			{
+				largest = i;
+			}
+		}
+		float sign = q.q[largest] < 0 ? -1.0f : 1.0f; // q and -q are the same rotation, keep the dropped one positive
+		unsigned long long bits = (unsigned long long)largest << 45;
+		int shift = 30;
+		for (int i = 0; i < 4; i++)
+		{
+			if (i == largest)
+			{
+				continue;
+			}
+			float n = (q.q[i] * sign * 0.70710678f) + 0.5f; // [-1/sqrt(2), 1/sqrt(2)] -> [0, 1]
+			n = n < 0.0f ? 0.0f : (n > 1.0f ? 1.0f : n);
+			bits |= (unsigned long long)(n * 32767.0f + 0.5f) << shift;
+			shift -= 15;
+		}
+		PackedQuaternion p;
+		p.v[0] = (unsigned short)(bits >> 32);
+		p.v[1] = (unsigned short)(bits >> 16);
+		p.v[2] = (unsigned short)bits;
+		return p;
+	}
+
+	Quaternion unpack() const
+	{
+		unsigned long long bits = ((unsigned long long)v[0] << 32) | ((unsigned long long)v[1] << 16) | v[2];
+		int largest = (int)(bits >> 45) & 3;
+		Quaternion q;
+		float sum = 0;
+		int shift = 30;
+		for (int i = 0; i < 4; i++)
+		{
+			if (i == largest)
+			{
+				continue;
+			}
+			float n = (float)((bits >> shift) & 0x7FFF) * (1.0f / 32767.0f);
+			q.q[i] = (n - 0.5f) * 1.41421356f;
+			sum += q.q[i] * q.q[i];
+			shift -= 15;
+		}
+		q.q[largest] = sqrtf(1.0f - sum > 0 ? 1.0f - sum : 0.0f);
+		return q;
+	}
+};
+
+struct CompressedTrack
+{
+	unsigned int firstKey; // Index of the first key frame in keyFrames
+	unsigned int firstValue; // Index of the first value in vec3Keys or rotationKeys
+	unsigned int keysN; // 1 means the track is constant
+};
+
+// Key-reduced clip. Each bone has a position, rotation and scale track, and each track only keeps the frames
+// that could not be rebuilt within tolerance by interpolating its neighbours
+struct CompressedSequence
+{
+	std::vector<CompressedTrack> tracks; // 3 per bone: position, rotation, scale
+	std::vector<unsigned short> keyFrames;
+	std::vector<Vec3> vec3Keys; // Position and scale values
+	std::vector<PackedQuaternion> rotationKeys;
+
+	bool empty() const
+	{
+		return tracks.empty();
+	}
+	size_t bytes() const
+	{
+		return (tracks.size() * sizeof(CompressedTrack)) + (keyFrames.size() * sizeof(unsigned short)) + (vec3Keys.size() * sizeof(Vec3)) + (rotationKeys.size() * sizeof(PackedQuaternion));
+	}
+	// Finds the value of the last key at or before time and how far towards the next key time is
+	void locate(const CompressedTrack& track, float time, unsigned int& key, float& u) const
+	{
+		const unsigned short* frames = &keyFrames[track.firstKey];
+		unsigned int lo = 0;
+		unsigned int hi = track.keysN - 1;
+		while (lo < hi)
+		{
+			unsigned int mid = (lo + hi + 1) / 2;
+			if ((float)frames[mid] <= time)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid - 1;
+			}
+		}
+		key = track.firstValue + lo;
+		u = 0;
+		if (lo + 1 < track.keysN)
+		{
+			u = (time - (float)frames[lo]) / (float)(frames[lo + 1] - frames[lo]);
+		}
+	}
+	Vec3 sampleVec3(const CompressedTrack& track, float time) const
+	{
+		unsigned int key;
+		float u;
+		locate(track, time, key, u);
+		if (u <= 0)
+		{
+			return vec3Keys[key];
+		}
+		return (vec3Keys[key] * (1.0f - u)) + (vec3Keys[key + 1] * u);
+	}
+	Vec3 samplePosition(int bone, float time) const
+	{
+		return sampleVec3(tracks[bone * 3], time);
+	}
+	Vec3 sampleScale(int bone, float time) const
+	{
+		return sampleVec3(tracks[bone * 3 + 2], time);
+	}
+	Quaternion sampleRotation(int bone, float time) const
+	{
+		unsigned int key;
+		float u;
+		locate(tracks[bone * 3 + 1], time, key, u);
+		if (u <= 0)
+		{
+			return rotationKeys[key].unpack();
+		}
+		return Quaternion::slerp(rotationKeys[key].unpack(), rotationKeys[key + 1].unpack(), u);
+	}
+};
+
+struct AnimationCompressionSettings
+{
+	float positionTolerance = 0.001f; // Model units
+	float rotationTolerance = 0.001f; // Radians, tightened per bone so descendants move less than positionTolerance
+	float scaleTolerance = 0.001f; // Tightened the same way as rotations
+	std::vector<float> boneReach; // Per bone distance to its furthest descendant in the bind pose, filled by Animation::compress
+};
+
+struct AnimationCompressionReport
+{
+	size_t bytesBefore = 0;
+	size_t bytesAfter = 0;
+	float maxPositionError = 0;
+	float maxRotationError = 0;
+	float maxScaleError = 0;
+};
+
+class AnimationCompressor
+{
+public:
+	static float vec3Error(const Vec3& a, const Vec3& b)
+	{
+		Vec3 d = a - b;
+		return sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+	}
+	// Angle between two rotations, from the distance between them as |a - b| = 2 sin(theta / 4). Working from the
+	// dot product instead, 1 - dot * dot cancels away in float and leaves about 0.001 rad of noise on tiny angles.
+	// q and -q are the same rotation, so b is taken on a's side first.
+	static float rotationError(const Quaternion& a, const Quaternion& b)
+	{
+		float sign = (a.a * b.a + a.b * b.b + a.c * b.c + a.d * b.d) < 0 ? -1.0f : 1.0f;
+		float distance = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			float d = a.q[i] - (b.q[i] * sign);
+			distance += d * d;
+		}
+		float s = sqrtf(distance) * 0.5f;
+		return 4.0f * asinf(s < 1.0f ? s : 1.0f);
+	}
+
+	// Appends a position or scale track. values holds framesN contiguous keys.
+	static void addVec3Track(CompressedSequence& out, const Vec3* values, int framesN, float tolerance)
+	{
+		std::vector<int> keys;
+		reduce(values, values, framesN, tolerance, keys, [](const Vec3& a, const Vec3& b, float t) { return (a * (1.0f - t)) + (b * t); }, vec3Error);
+		CompressedTrack track;
+		track.firstKey = (unsigned int)out.keyFrames.size();
+		track.firstValue = (unsigned int)out.vec3Keys.size();
+		track.keysN = (unsigned int)keys.size();
+		for (int i = 0; i < keys.size(); i++)
+		{
+			out.keyFrames.push_back((unsigned short)keys[i]);
+			out.vec3Keys.push_back(values[keys[i]]);
+		}
+		out.tracks.push_back(track);
+	}
+
+	// Appends a rotation track. Keys are chosen against the quantized values so the tolerance covers the packing error too.
+	static void addRotationTrack(CompressedSequence& out, const Quaternion* values, int framesN, float tolerance)
+	{
+		std::vector<PackedQuaternion> packed(framesN);
+		std::vector<Quaternion> decoded(framesN);
+		for (int i = 0; i < framesN; i++)
+		{
+			packed[i] = PackedQuaternion::pack(values[i]);
+			decoded[i] = packed[i].unpack();
+		}
+		std::vector<int> keys;
+		reduce(values, decoded.data(), framesN, tolerance, keys, [](const Quaternion& a, const Quaternion& b, float t) { return Quaternion::slerp(a, b, t); }, rotationError);
+		CompressedTrack track;
+		track.firstKey = (unsigned int)out.keyFrames.size();
+		track.firstValue = (unsigned int)out.rotationKeys.size();
+		track.keysN = (unsigned int)keys.size();
+		for (int i = 0; i < keys.size(); i++)
+		{
+			out.keyFrames.push_back((unsigned short)keys[i]);
+			out.rotationKeys.push_back(packed[keys[i]]);
+		}
+		out.tracks.push_back(track);
+	}
+
+private:
+	// Greedy key reduction: from each kept key, extend the segment as far as every skipped frame can still be
+	// rebuilt within tolerance. A track that never leaves tolerance of its first frame collapses to one key.
+	template<typename T, typename Lerp, typename Error>
+	static void reduce(const T* values, const T* decoded, int framesN, float tolerance, std::vector<int>& keys, Lerp lerp, Error error)
+	{
+		keys.clear();
+		keys.push_back(0);
+		bool constant = true;
+		for (int i = 0; i < framesN && constant; i++)
+		{
+			constant = error(decoded[0], values[i]) <= tolerance;
+		}
+		if (constant)
+		{
+			return;
+		}
+		int start = 0;
+		while (start < framesN - 1)
+		{
+			int end = start + 1;
+			while (end + 1 < framesN && fits(values, decoded, start, end + 1, tolerance, lerp, error))
+			{
+				end++;
+			}
+			keys.push_back(end);
+			start = end;
+		}
+	}
+	template<typename T, typename Lerp, typename Error>
+	static bool fits(const T* values, const T* decoded, int start, int end, float tolerance, Lerp lerp, Error error)
+	{
+		float span = (float)(end - start);
+		for (int i = start + 1; i < end; i++)
+		{
+			if (error(lerp(decoded[start], decoded[end], (float)(i - start) / span), values[i]) > tolerance)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
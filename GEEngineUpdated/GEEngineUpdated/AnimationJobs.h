@@ -0,0 +1,22 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Animation.h"
+
+class AnimationJobs
+{
+public:
+	// Poses a batch of instances across the job system. Each job takes a run of whole instances, so every
+	// skeleton is still walked parent first on one thread while different instances sample in parallel.
+	// Call after advance() on each instance and before their matrices are uploaded.
+	static void evaluatePoses(JobSystem& jobs, AnimationInstance* const* instances, int instancesN, int grain = 4)
+	{
+		jobs.parallelFor(instancesN, grain, [instances](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				instances[i]->evaluatePose();
+			}
+		});
+	}
+};
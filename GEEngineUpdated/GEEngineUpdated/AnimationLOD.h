@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "maths.h"
+#include "Animation.h"
+
+struct AnimationLODLevel
+{
+	float distance; // Instances at least this far from the camera use this level
+	int updateInterval; // Evaluate the pose every Nth frame and hold it in between
+	int boneLevel; // Skeleton::lodBones level, 0 samples every bone
+};
+
+// Decides which instances get their pose evaluated each frame. Distant instances update less often and skip
+// their leaf bones, and the bone budget caps how many bones are sampled in one frame over all instances.
+// Instances that are not picked keep the pose they had, their clocks still advance.
+class AnimationLODManager
+{
+public:
+	std::vector<AnimationLODLevel> levels; // Sorted by distance, the first one should start at 0
+	int boneBudget = 0; // 0 means no cap
+
+	// Stats for the last schedule
+	int bonesScheduled = 0;
+	int instancesScheduled = 0;
+	int instancesHeld = 0;
+
+	void init()
+	{
+		levels = { { 0.0f, 1, 0 }, { 30.0f, 2, 1 }, { 60.0f, 4, 2 } };
+	}
+
+	// Returns the handle used with setPosition
+	int add(AnimationInstance* instance)
+	{
+		Entry entry;
+		entry.instance = instance;
+		entries.push_back(entry);
+		return (int)entries.size() - 1;
+	}
+
+	void setPosition(int handle, const Vec3& position)
+	{
+		entries[handle].position = position;
+	}
+
+	// Call once per frame after every instance has been advanced, then evaluate the returned instances,
+	// for example with AnimationJobs::evaluatePoses
+	void schedule(const Vec3& camera, std::vector<AnimationInstance*>& toEvaluate)
+	{
+		toEvaluate.clear();
+		candidates.clear();
+		bonesScheduled = 0;
+		instancesHeld = 0;
+		for (int i = 0; i < entries.size(); i++)
+		{
+			Entry& entry = entries[i];
+			entry.framesSinceUpdate++;
+			if (!entry.instance->poseDirty)
+			{
+				continue;
+			}
+			Vec3 offset = entry.position - camera;
+			float distance = sqrtf(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z);
+			const AnimationLODLevel& level = levelFor(distance);
+			entry.instance->lodLevel = level.boneLevel;
+			entry.distance = distance;
+			// How overdue the pose is, 1 means it is due this frame
+			entry.priority = (float)entry.framesSinceUpdate / (float)max(level.updateInterval, 1);
+			if (entry.priority >= 1.0f)
+			{
+				candidates.push_back(i);
+			}
+		}
+		// Most overdue first, then nearest, so a tight budget delays poses rather than starving anyone
+		std::sort(candidates.begin(), candidates.end(), [this](int a, int b)
+		{
+			if (entries[a].priority != entries[b].priority)
+			{
+				return entries[a].priority > entries[b].priority;
+			}
+			return entries[a].distance < entries[b].distance;
+		});
+		for (int i = 0; i < candidates.size(); i++)
+		{
+			Entry& entry = entries[candidates[i]];
+			int cost = bonesToSample(entry.instance);
+			// Always let the first one through so a budget smaller than one skeleton still makes progress
+			if (boneBudget > 0 && bonesScheduled + cost > boneBudget && !toEvaluate.empty())
+			{
+				instancesHeld++;
+				continue;
+			}
+			bonesScheduled += cost;
+			entry.framesSinceUpdate = 0;
+			toEvaluate.push_back(entry.instance);
+		}
+		instancesScheduled = (int)toEvaluate.size();
+		instancesHeld += (int)entries.size() - (int)candidates.size();
+	}
+
+private:
+	struct Entry
+	{
+		AnimationInstance* instance = nullptr;
+		Vec3 position;
+		float distance = 0;
+		float priority = 0;
+		int framesSinceUpdate = 0;
+	};
+	std::vector<Entry> entries;
+	std::vector<int> candidates;
+
+	const AnimationLODLevel& levelFor(float distance) const
+	{
+		static const AnimationLODLevel full = { 0.0f, 1, 0 };
+		const AnimationLODLevel* level = &full;
+		for (int i = 0; i < levels.size(); i++)
+		{
+			if (distance >= levels[i].distance)
+			{
+				level = &levels[i];
+			}
+		}
+		return *level;
+	}
+
+	int bonesToSample(AnimationInstance* instance) const
+	{
+		const Skeleton& skeleton = instance->animation->skeleton;
+		int level = min(max(instance->lodLevel, 0), Skeleton::lodLevels - 1);
+		return instance->posed ? (int)skeleton.lodBones[level].size() : (int)skeleton.bones.size();
+	}
+};
@@ -6,8 +6,9 @@
 
 struct AnimInfo {
 	std::string name;
-	bool loops;
-	float speed;
+	bool loops = false;
+	float speed = 1.0f;
+	AnimationSequence* clip = nullptr; // Resolved once in addState
 };
 
 template <typename StateEnum>
@@ -19,6 +20,9 @@ public:
 	StateEnum currentState;
 	StateEnum defaultState;
 	std::map<StateEnum, AnimInfo> config;
+	AnimInfo* current = nullptr; // config[currentState], kept so update does not search the map, null until that state is added
+	std::map<std::pair<StateEnum, StateEnum>, float> transitions; // Cross-fade seconds per from/to pair
+	float defaultFade = 0.0f; // Used when a pair has no entry, 0 cuts straight to the new clip
 
 	// Initialise with pointers and the "idle" state as a start state (usually)
 	void init(AnimationInstance* inst, animatedModel* model, StateEnum startState) {
@@ -29,8 +33,16 @@ public:
 	}
 
 	// Register an animation state
-	void addState(StateEnum state, std::string gemName, bool loops, float speed = 1.0f) {
-		config[state] = { gemName, loops, speed };
+	void addState(StateEnum state, const std::string& gemName, bool loops, float speed = 1.0f) {
+		config[state] = { gemName, loops, speed, animInstance->resolve(gemName) };
+		if (state == currentState) {
+			current = &config[state];
+		}
+	}
+
+	// Cross-fade between two states instead of cutting
+	void addTransition(StateEnum from, StateEnum to, float duration) {
+		transitions[{ from, to }] = duration;
 	}
 
 	// Switch states
@@ -39,15 +51,43 @@ public:
 			return;
 		}
 
+		// A state that was never added has no clip, so stay in the one playing
+		auto state = config.find(newState);
+		if (state == config.end()) {
+			return;
+		}
+
+		auto transition = transitions.find({ currentState, newState });
+		float fade = transition != transitions.end() ? transition->second : defaultFade;
 		currentState = newState;
-		animInstance->resetAnimationTime();
+		current = &state->second;
+		if (fade > 0.0f) {
+			animInstance->crossFade(current->clip, fade);
+		}
+		else {
+			animInstance->resetAnimationTime();
+		}
 	}
 
 	void update(float dt) {
-		AnimInfo& currentAnim = config[currentState];
+		advance(dt);
+		animInstance->evaluatePose();
+	}
+
+	// Steps the clip time and state machine but leaves the pose to a later evaluatePose,
+	// so many instances can be posed together with AnimationJobs::evaluatePoses
+	void advance(float dt) {
+		if (current == nullptr) {
+			auto state = config.find(currentState);
+			if (state == config.end()) {
+				return; // Nothing to play until the start state is added
+			}
+			current = &state->second;
+		}
+		AnimInfo& currentAnim = *current;
 
 		// Update the instance
-		animInstance->update(currentAnim.name, dt * currentAnim.speed);
+		animInstance->advance(currentAnim.clip, dt * currentAnim.speed);
 
 		// Check if the animation has finished
 		if (animInstance->animationFinished()) {
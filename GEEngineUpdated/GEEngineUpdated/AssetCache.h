@@ -0,0 +1,452 @@
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "GEMLoader.h"
+#include "GEMMappedLoader.h"
+#include "Animation.h"
+#include "Collision.h"
+
+// When a cooked file was made from, so a stale one can be spotted without reading the source
+struct AssetSourceStamp
+{
+	unsigned long long bytes = 0;
+	unsigned long long writeTime = 0; // FILETIME of the last write
+};
+
+// One mesh ready for upload. vertices is laid out exactly as STATIC_VERTEX or ANIMATED_VERTEX, so it goes to the
+// vertex buffer as it is.
+struct CookedMesh
+{
+	GEMLoader::GEMMaterial material;
+	BoundingBox bounds;
+	unsigned int vertexStride = 0;
+	unsigned int verticesN = 0;
+	const void* vertices = nullptr;
+	GEMLoader::GEMSpan<unsigned int> indices;
+
+	bool isAnimated() const
+	{
+		return vertexStride == sizeof(GEMLoader::GEMAnimatedVertex);
+	}
+};
+
+// A model loaded either from its cooked .gemc file or, when that is missing or stale, from the .gem itself.
+// The vertex and index data point into whichever file is mapped, so upload before this goes out of scope.
+class CookedModel
+{
+public:
+	std::vector<CookedMesh> meshes;
+	unsigned int isAnimated = 0;
+	bool fromCache = false;
+
+	CookedModel() = default;
+	CookedModel(const CookedModel&) = delete;
+	CookedModel& operator=(const CookedModel&) = delete;
+
+	void close()
+	{
+		meshes.clear();
+		isAnimated = 0;
+		fromCache = false;
+		cooked.close();
+		source.close();
+	}
+
+	// Parses a cooked file made from a source matching stamp, or hashing to sourceHash if only the timestamp
+	// differs. animation receives the skeleton and the already compressed clips. Returns false if the file is
+	// missing, from another version or stale, leaving animation untouched.
+	bool loadCooked(const std::string& cookedFilename, const std::string& sourceFilename, const AssetSourceStamp& stamp, Animation* animation);
+
+	// Parses the .gem, computes the bounds and, for animated models, loads and compresses the clips
+	void loadSource(const std::string& sourceFilename, Animation* animation)
+	{
+		close();
+		source.load(sourceFilename);
+		isAnimated = source.isAnimated;
+		meshes.resize(source.meshes.size());
+		for (int i = 0; i < source.meshes.size(); i++)
+		{
+			GEMLoader::GEMMappedMesh& gemmesh = source.meshes[i];
+			CookedMesh& mesh = meshes[i];
+			mesh.material = gemmesh.material;
+			mesh.indices = gemmesh.indices;
+			if (gemmesh.isAnimated())
+			{
+				mesh.vertexStride = sizeof(GEMLoader::GEMAnimatedVertex);
+				mesh.verticesN = gemmesh.verticesAnimated.size;
+				mesh.vertices = gemmesh.verticesAnimated.data;
+				for (unsigned int j = 0; j < mesh.verticesN; j++)
+				{
+					const GEMLoader::GEMVec3& p = gemmesh.verticesAnimated[j].position;
+					mesh.bounds.extend(Vec3(p.x, p.y, p.z));
+				}
+			}
+			else
+			{
+				mesh.vertexStride = sizeof(GEMLoader::GEMStaticVertex);
+				mesh.verticesN = gemmesh.verticesStatic.size;
+				mesh.vertices = gemmesh.verticesStatic.data;
+				for (unsigned int j = 0; j < mesh.verticesN; j++)
+				{
+					const GEMLoader::GEMVec3& p = gemmesh.verticesStatic[j].position;
+					mesh.bounds.extend(Vec3(p.x, p.y, p.z));
+				}
+			}
+		}
+		if (isAnimated && animation != nullptr)
+		{
+			animation->load(source);
+			animation->compress(AnimationCompressionSettings());
+		}
+	}
+
+	// Hash of the mapped source, only valid after loadSource
+	unsigned long long sourceHash() const;
+
+private:
+	GEMLoader::GEMMappedFile cooked;
+	GEMLoader::GEMMappedModel source;
+
+	// Arrays are written by AssetCache::writeArray as a count, padding to 16 bytes, then the elements
+	template<typename T>
+	bool readArray(GEMLoader::GEMSpan<T>& span)
+	{
+		unsigned int n = 0;
+		if (!cooked.read(n) || !cooked.align(16))
+		{
+			return false;
+		}
+		span.data = reinterpret_cast<const T*>(cooked.take((size_t)n * sizeof(T)));
+		span.size = n;
+		return span.data != nullptr;
+	}
+
+	template<typename T>
+	bool readArray(std::vector<T>& values)
+	{
+		GEMLoader::GEMSpan<T> span;
+		if (!readArray(span))
+		{
+			return false;
+		}
+		values.assign(span.data, span.data + span.size);
+		return true;
+	}
+};
+
+// Cooks .gem models into .gemc files next to them: vertex and index blobs in the layout the vertex buffer wants,
+// bounds, and compressed animation clips, stamped with the source size, write time and content hash.
+// load() uses the cooked file when it matches the source and re-cooks it when it does not.
+class AssetCache
+{
+public:
+	static const unsigned int magic = 0x434D4547; // "GEMC"
+	static const unsigned int version = 2; // 2: clips reduced against the exact rotation error
+
+	static std::string cookedFilename(const std::string& filename)
+	{
+		return filename + "c";
+	}
+
+	// 64 bit FNV-1a
+	static unsigned long long hash(const void* data, size_t bytes)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		unsigned long long h = 14695981039346656037ULL;
+		for (size_t i = 0; i < bytes; i++)
+		{
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static bool stamp(const std::string& filename, AssetSourceStamp& out)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes))
+		{
+			return false;
+		}
+		out.bytes = ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+		out.writeTime = ((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	// Loads filename through its cooked file, cooking it first if needed. animation may be nullptr for static models.
+	static void load(const std::string& filename, CookedModel& model, Animation* animation)
+	{
+		AssetSourceStamp sourceStamp;
+		std::string cooked = cookedFilename(filename);
+		if (stamp(filename, sourceStamp) && model.loadCooked(cooked, filename, sourceStamp, animation))
+		{
+			return;
+		}
+		model.loadSource(filename, animation);
+		if (!write(cooked, model, animation, sourceStamp, model.sourceHash()))
+		{
+			std::string msg = "[AssetCache] Could not write " + cooked + "\n";
+			OutputDebugStringA(msg.c_str());
+		}
+	}
+
+	// "*.gem" also matches .gemc files through their 8.3 short names, so check the extension again
+	static bool isSource(const std::string& filename)
+	{
+		return filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".gem") == 0;
+	}
+
+	// Brings every .gem in directory up to date, returns how many had to be cooked
+	static int cookAll(const std::string& directory)
+	{
+		int cookedN = 0;
+		WIN32_FIND_DATAA found;
+		HANDLE search = FindFirstFileA((directory + "*.gem").c_str(), &found);
+		if (search == INVALID_HANDLE_VALUE)
+		{
+			return 0;
+		}
+		do
+		{
+			if (!isSource(found.cFileName))
+			{
+				continue;
+			}
+			CookedModel model;
+			Animation animation;
+			load(directory + found.cFileName, model, &animation);
+			cookedN += model.fromCache ? 0 : 1;
+		} while (FindNextFileA(search, &found));
+		FindClose(search);
+		std::string msg = "[AssetCache] Cooked " + std::to_string(cookedN) + " models in " + directory + "\n";
+		OutputDebugStringA(msg.c_str());
+		return cookedN;
+	}
+
+	static bool write(const std::string& filename, const CookedModel& model, const Animation* animation, const AssetSourceStamp& sourceStamp, unsigned long long sourceHash)
+	{
+		// Written to the side and moved over, so a half written file is never picked up
+		std::string temporary = filename + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			if (!file)
+			{
+				return false;
+			}
+			const unsigned int header[2] = { magic, version };
+			writeValue(file, header);
+			writeValue(file, sourceHash);
+			writeValue(file, sourceStamp.bytes);
+			writeValue(file, sourceStamp.writeTime);
+			writeValue(file, model.isAnimated);
+			writeValue(file, (unsigned int)model.meshes.size());
+			for (int i = 0; i < model.meshes.size(); i++)
+			{
+				const CookedMesh& mesh = model.meshes[i];
+				writeValue(file, (unsigned int)mesh.material.properties.size());
+				for (int j = 0; j < mesh.material.properties.size(); j++)
+				{
+					writeString(file, mesh.material.properties[j].name);
+					writeString(file, mesh.material.properties[j].value);
+				}
+				writeValue(file, mesh.bounds);
+				writeValue(file, mesh.vertexStride);
+				writeValue(file, mesh.verticesN);
+				pad(file, 16);
+				file.write(static_cast<const char*>(mesh.vertices), (std::streamsize)mesh.verticesN * mesh.vertexStride);
+				writeArray(file, mesh.indices.data, mesh.indices.size);
+			}
+			bool animated = model.isAnimated && animation != nullptr;
+			writeValue(file, (unsigned int)(animated ? 1 : 0));
+			if (animated)
+			{
+				const Skeleton& skeleton = animation->skeleton;
+				writeValue(file, (unsigned int)skeleton.bones.size());
+				for (int i = 0; i < skeleton.bones.size(); i++)
+				{
+					writeString(file, skeleton.bones[i].name);
+					writeValue(file, skeleton.bones[i].offset);
+					writeValue(file, skeleton.bones[i].parentIndex);
+				}
+				writeValue(file, skeleton.globalInverse);
+				writeValue(file, (unsigned int)animation->animations.size());
+				for (auto& kv : animation->animations)
+				{
+					const AnimationSequence& sequence = kv.second;
+					writeString(file, kv.first);
+					writeValue(file, sequence.framesN);
+					writeValue(file, sequence.bonesN);
+					writeValue(file, sequence.ticksPerSecond);
+					writeArray(file, sequence.referencePose.data(), (unsigned int)sequence.referencePose.size());
+					writeArray(file, sequence.keys.data(), (unsigned int)sequence.keys.size()); // Empty once compressed
+					writeArray(file, sequence.compressed.tracks.data(), (unsigned int)sequence.compressed.tracks.size());
+					writeArray(file, sequence.compressed.keyFrames.data(), (unsigned int)sequence.compressed.keyFrames.size());
+					writeArray(file, sequence.compressed.vec3Keys.data(), (unsigned int)sequence.compressed.vec3Keys.size());
+					writeArray(file, sequence.compressed.rotationKeys.data(), (unsigned int)sequence.compressed.rotationKeys.size());
+				}
+			}
+			if (!file)
+			{
+				return false;
+			}
+		}
+		return MoveFileExA(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	// Overwrites the write time in a cooked file's header
+	static bool restamp(const std::string& filename, const AssetSourceStamp& sourceStamp)
+	{
+		std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(writeTimeOffset);
+		writeValue(file, sourceStamp.writeTime);
+		return (bool)file;
+	}
+
+private:
+	// magic, version, source hash, source bytes, then the write time
+	static const size_t writeTimeOffset = (2 * sizeof(unsigned int)) + (2 * sizeof(unsigned long long));
+
+	template<typename T>
+	static void writeValue(std::ostream& file, const T& value)
+	{
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	static void writeString(std::ofstream& file, const std::string& str)
+	{
+		writeValue(file, (int)str.size());
+		file.write(str.data(), str.size());
+	}
+
+	// Count, padding up to 16 bytes, then the elements, so the arrays can be used in place once mapped
+	template<typename T>
+	static void writeArray(std::ofstream& file, const T* values, unsigned int n)
+	{
+		writeValue(file, n);
+		pad(file, 16);
+		if (n > 0)
+		{
+			file.write(reinterpret_cast<const char*>(values), (std::streamsize)n * sizeof(T));
+		}
+	}
+
+	static void pad(std::ofstream& file, size_t alignment)
+	{
+		static const char zeros[16] = {};
+		size_t position = (size_t)file.tellp();
+		file.write(zeros, (alignment - (position % alignment)) % alignment);
+	}
+};
+
+inline unsigned long long CookedModel::sourceHash() const
+{
+	return AssetCache::hash(source.fileData(), source.fileBytes());
+}
+
+inline bool CookedModel::loadCooked(const std::string& cookedFilename, const std::string& sourceFilename, const AssetSourceStamp& stamp, Animation* animation)
+{
+	close();
+	if (!cooked.open(cookedFilename))
+	{
+		return false;
+	}
+	unsigned int fileMagic = 0;
+	unsigned int fileVersion = 0;
+	unsigned long long hash = 0;
+	AssetSourceStamp cookedStamp;
+	if (!cooked.read(fileMagic) || fileMagic != AssetCache::magic || !cooked.read(fileVersion) || fileVersion != AssetCache::version ||
+		!cooked.read(hash) || !cooked.read(cookedStamp.bytes) || !cooked.read(cookedStamp.writeTime) || cookedStamp.bytes != stamp.bytes)
+	{
+		close();
+		return false;
+	}
+	// Copying or checking out a file changes its time but not its contents, so fall back to the hash. If that
+	// matches, the new time is written into the cooked file so the source is only hashed once.
+	if (cookedStamp.writeTime != stamp.writeTime)
+	{
+		GEMLoader::GEMMappedFile sourceFile;
+		if (!sourceFile.open(sourceFilename) || AssetCache::hash(sourceFile.data(), sourceFile.bytes()) != hash)
+		{
+			close();
+			return false;
+		}
+		size_t position = cooked.position();
+		cooked.close();
+		AssetCache::restamp(cookedFilename, stamp);
+		if (!cooked.open(cookedFilename) || !cooked.take(position))
+		{
+			close();
+			return false;
+		}
+	}
+
+	// Every count is checked against what is left of the file before anything is sized from it, so a damaged
+	// count fails the load, and the file is cooked again, rather than throwing bad_alloc
+	unsigned int meshesN = 0;
+	bool ok = cooked.read(isAnimated) && cooked.read(meshesN) && cooked.fits(meshesN, sizeof(unsigned int) + sizeof(BoundingBox));
+	meshes.resize(ok ? meshesN : 0);
+	for (unsigned int i = 0; i < meshes.size() && ok; i++)
+	{
+		CookedMesh& mesh = meshes[i];
+		unsigned int propertiesN = 0;
+		ok = cooked.read(propertiesN) && cooked.fits(propertiesN, sizeof(int) * 2);
+		mesh.material.properties.resize(ok ? propertiesN : 0);
+		for (unsigned int j = 0; j < mesh.material.properties.size() && ok; j++)
+		{
+			ok = cooked.readString(mesh.material.properties[j].name) && cooked.readString(mesh.material.properties[j].value);
+		}
+		ok = ok && cooked.read(mesh.bounds) && cooked.read(mesh.vertexStride) && cooked.read(mesh.verticesN) && cooked.align(16);
+		mesh.vertices = ok ? cooked.take((size_t)mesh.verticesN * mesh.vertexStride) : nullptr;
+		ok = ok && mesh.vertices != nullptr;
+		ok = ok && readArray(mesh.indices);
+	}
+	unsigned int animated = 0;
+	ok = ok && cooked.read(animated);
+	// Cooked without its clips, the caller now wants them
+	ok = ok && !(isAnimated && !animated && animation != nullptr);
+	if (ok && animated && animation != nullptr)
+	{
+		// Read into a scratch animation so a damaged file never leaves the caller's half filled
+		Animation loaded;
+		unsigned int bonesN = 0;
+		ok = cooked.read(bonesN) && cooked.fits(bonesN, sizeof(int) + sizeof(GEMLoader::GEMMatrix) + sizeof(int));
+		std::vector<GEMLoader::GEMBone> bones(ok ? bonesN : 0);
+		for (unsigned int i = 0; i < bones.size() && ok; i++)
+		{
+			ok = cooked.readString(bones[i].name) && cooked.read(bones[i].offset) && cooked.read(bones[i].parentIndex);
+		}
+		GEMLoader::GEMMatrix globalInverse;
+		unsigned int clipsN = 0;
+		ok = ok && cooked.read(globalInverse) && cooked.read(clipsN);
+		if (ok)
+		{
+			loaded.loadBones(bones, globalInverse);
+		}
+		for (unsigned int i = 0; i < clipsN && ok; i++)
+		{
+			std::string name;
+			ok = cooked.readString(name);
+			AnimationSequence& sequence = loaded.animations[name];
+			sequence.name = name;
+			ok = ok && cooked.read(sequence.framesN) && cooked.read(sequence.bonesN) && cooked.read(sequence.ticksPerSecond) &&
+				readArray(sequence.referencePose) && readArray(sequence.keys) && readArray(sequence.compressed.tracks) &&
+				readArray(sequence.compressed.keyFrames) && readArray(sequence.compressed.vec3Keys) && readArray(sequence.compressed.rotationKeys);
+		}
+		if (ok)
+		{
+			loaded.skeleton.build();
+			*animation = std::move(loaded);
+		}
+	}
+	if (!ok)
+	{
+		close();
+		return false;
+	}
+	fromCache = true;
+	return true;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "JobSystem.h"
+#include "TextureDecoder.h"
+#include "AssetCache.h"
+
+class Mesh;
+
+template<typename T>
+using AssetFuture = std::shared_future<std::shared_ptr<T>>;
+
+// Everything a StaticMesh or AnimatedMesh needs, parsed off the main thread
+struct LoadedModel
+{
+	std::string filename;
+	bool animated = false;
+	CookedModel cooked;
+	Animation animation;
+	std::vector<std::string> textureNames; // Albedo per mesh, as TextureManager knows it
+	std::vector<AssetFuture<DecodedTexture>> textures; // The distinct albedo textures, decoded alongside the model
+	std::vector<Mesh*> meshes; // Created by the uploader
+};
+
+// Creates the GPU side of finished assets. All calls come from the thread that calls AssetLoader::finish, in
+// the order the assets were requested, so an implementation can use the device without locking.
+class AssetUploader
+{
+public:
+	virtual ~AssetUploader() {}
+	virtual void uploadModel(LoadedModel& model) = 0;
+	virtual void uploadImage(DecodedTexture& image) = 0;
+	// After the last upload of a batch, while its assets are still alive, for uploaders that work on them together
+	virtual void finish() {}
+};
+
+// Stands in for the device in headless runs and only counts what would have been uploaded
+class NullAssetUploader : public AssetUploader
+{
+public:
+	int modelsN = 0;
+	int imagesN = 0;
+	size_t bytes = 0;
+
+	void uploadModel(LoadedModel& model) override
+	{
+		modelsN++;
+		for (int i = 0; i < model.cooked.meshes.size(); i++)
+		{
+			const CookedMesh& mesh = model.cooked.meshes[i];
+			bytes += ((size_t)mesh.verticesN * mesh.vertexStride) + mesh.indices.bytes();
+		}
+		for (int i = 0; i < model.textures.size(); i++)
+		{
+			uploadImage(*model.textures[i].get());
+		}
+	}
+
+	void uploadImage(DecodedTexture& image) override
+	{
+		imagesN++;
+		bytes += image.bytes();
+	}
+};
+
+// Reads, parses and decodes assets on a JobSystem. Each request returns a future that is ready once its CPU
+// side is, and finish() hands everything to an AssetUploader on the calling thread. Models start decoding
+// their albedo textures as soon as their materials have been read, and each file is only loaded once.
+class AssetLoader
+{
+public:
+	// Textures are decoded into buffers from the pool when there is one, the uploader can hand them back to it
+	void init(JobSystem* _jobs, TextureBufferPool* _buffers = nullptr)
+	{
+		jobs = _jobs;
+		buffers = _buffers;
+	}
+
+	// Cooked textures only read their mips no wider or taller than tailSize, the rest are streamed in later
+	void streamTextures(int tailSize)
+	{
+		textureMaxSize = tailSize;
+	}
+
+	// Where the albedo named in a model's material is found, the path stored in the model is from the artist's machine
+	static std::string texturePath(const std::string& rawPath)
+	{
+		size_t lastSlash = rawPath.find_last_of("\\/");
+		std::string filename = (lastSlash == std::string::npos) ? rawPath : rawPath.substr(lastSlash + 1);
+		return "Resources/Models/Textures/" + filename;
+	}
+
+	AssetFuture<LoadedModel> loadModel(const std::string& filename, bool animated)
+	{
+		std::shared_ptr<std::promise<std::shared_ptr<LoadedModel>>> promise;
+		AssetFuture<LoadedModel> future;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = models.find(filename);
+			if (it != models.end())
+			{
+				return it->second;
+			}
+			promise = std::make_shared<std::promise<std::shared_ptr<LoadedModel>>>();
+			future = promise->get_future().share();
+			models[filename] = future;
+			Request request;
+			request.model = future;
+			requests.push_back(request);
+		}
+		// Outside the lock, with no worker threads the job runs right here and requests its textures
+		jobs->run(counter, [this, filename, animated, promise]()
+		{
+			std::shared_ptr<LoadedModel> model = std::make_shared<LoadedModel>();
+			model->filename = filename;
+			model->animated = animated;
+			AssetCache::load(filename, model->cooked, animated ? &model->animation : nullptr);
+			for (int i = 0; i < model->cooked.meshes.size(); i++)
+			{
+				std::string rawPath = model->cooked.meshes[i].material.find("albedo").getValue();
+				if (std::find(model->textureNames.begin(), model->textureNames.end(), rawPath) == model->textureNames.end())
+				{
+					model->textures.push_back(decode(rawPath, texturePath(rawPath)));
+				}
+				model->textureNames.push_back(rawPath);
+			}
+			promise->set_value(model);
+		});
+		return future;
+	}
+
+	AssetFuture<DecodedTexture> loadImage(const std::string& name, const std::string& filename)
+	{
+		AssetFuture<DecodedTexture> future = decode(name, filename);
+		std::lock_guard<std::mutex> lock(mutex);
+		Request request;
+		request.image = future;
+		requests.push_back(request);
+		return future;
+	}
+
+	// Helps with the jobs until everything requested so far is loaded, then uploads it all in request order
+	void finish(AssetUploader& uploader)
+	{
+		jobs->wait(counter);
+		std::vector<Request> finished;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.swap(requests);
+			models.clear();
+			images.clear();
+		}
+		for (int i = 0; i < finished.size(); i++)
+		{
+			if (finished[i].model.valid())
+			{
+				uploader.uploadModel(*finished[i].model.get());
+			}
+			else
+			{
+				uploader.uploadImage(*finished[i].image.get());
+			}
+		}
+		uploader.finish();
+	}
+
+private:
+	struct Request
+	{
+		AssetFuture<LoadedModel> model;
+		AssetFuture<DecodedTexture> image;
+	};
+
+	JobSystem* jobs = nullptr;
+	TextureBufferPool* buffers = nullptr;
+	int textureMaxSize = 0;
+	JobCounter counter;
+	std::mutex mutex;
+	std::vector<Request> requests;
+	std::map<std::string, AssetFuture<LoadedModel>> models;
+	std::map<std::string, AssetFuture<DecodedTexture>> images;
+
+	AssetFuture<DecodedTexture> decode(const std::string& name, const std::string& filename)
+	{
+		std::shared_ptr<std::promise<std::shared_ptr<DecodedTexture>>> promise;
+		AssetFuture<DecodedTexture> future;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = images.find(name);
+			if (it != images.end())
+			{
+				return it->second;
+			}
+			promise = std::make_shared<std::promise<std::shared_ptr<DecodedTexture>>>();
+			future = promise->get_future().share();
+			images[name] = future;
+		}
+		TextureBufferPool* pool = buffers;
+		int maxSize = textureMaxSize;
+		jobs->run(counter, [name, filename, promise, pool, maxSize]()
+		{
+			std::shared_ptr<DecodedTexture> image = std::make_shared<DecodedTexture>();
+			image->name = name;
+			TextureDecoder::decode(filename, *image, pool, MipSettings(), nullptr, maxSize);
+			promise->set_value(image);
+		});
+		return future;
+	}
+};
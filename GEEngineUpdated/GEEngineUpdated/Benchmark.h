@@ -0,0 +1,1143 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "GEMLoader.h"
+#include "GEMMappedLoader.h"
+#include "Animation.h"
+#include "AnimationJobs.h"
+#include "AnimationLOD.h"
+#include "AssetCache.h"
+#include "AssetLoader.h"
+#include "TextureDecoder.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "TexturePacker.h"
+#include "DescriptorAllocator.h"
+#include "UploadRing.h"
+#include "FramePacing.h"
+#include "CommandRecording.h"
+#include "ConstantAllocator.h"
+#include "ShaderConstants.h"
+
+// Headless benchmarks, started with "-bench" on the command line. Nothing here needs a window or a device.
+// Results go to the debug output and to benchmark.txt in the working directory.
+class Benchmark
+{
+public:
+	static void run()
+	{
+		std::string report;
+		report += animation(1000, 120);
+		report += animationStages(1000);
+		report += animationUpdate(10000);
+		report += animationLOD(1000, 120);
+		report += modelLoading("Resources/Models/Ash_Tree_Full_01j.gem", 20);
+		report += modelLoading("Resources/Models/TRex.gem", 20);
+		report += modelLoader("Resources/Models/", 10);
+		report += assetCache("Resources/Models/Ash_Tree_Full_01j.gem", 20);
+		report += assetCache("Resources/Models/TRex.gem", 20);
+		report += assetLoader("Resources/Models/", 5);
+		report += textureDecoding("Resources/Models/Textures/", 3);
+		report += mipGeneration("Resources/Models/Textures/TX_Grass_Sets_01a_ALB.png", 5);
+		report += blockCompression("Resources/Models/Textures/TX_Grass_Sets_01a_ALB.png", { TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC7 }, 2);
+		report += blockCompression("Resources/Models/Textures/CarbineTextures/AC5_Collimator_Albedo_nh.png", { TextureFormat::BC5 }, 2);
+		report += textureStreaming(256, 64 * 1024 * 1024, 1200, 120);
+		report += texturePacking("Resources/Models/Textures/");
+		report += descriptorAllocation(1000000);
+		report += uploadRing(2000, 16);
+		report += framePacing(600);
+		report += parallelRecording(10000, 100);
+		report += constantAllocation(600);
+		report += constantUpdates(10000, 100);
+
+		OutputDebugStringA(report.c_str());
+		std::ofstream file("benchmark.txt");
+		file << report;
+	}
+
+	static double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	static void loadTRex(Animation& animation)
+	{
+		GEMLoader::GEMModelLoader loader;
+		std::vector<GEMLoader::GEMMesh> gemmeshes;
+		GEMLoader::GEMAnimation gemanimation;
+		loader.load("Resources/Models/TRex.gem", gemmeshes, gemanimation);
+		animation.load(gemanimation);
+		animation.compress(AnimationCompressionSettings());
+	}
+
+	// Everything a mesh needs before upload (vertices, indices, bounds, compressed clips) from the .gem against
+	// the cooked .gemc
+	static std::string assetCache(const std::string& filename, int repeats)
+	{
+		{
+			CookedModel model;
+			Animation animation;
+			AssetCache::load(filename, model, &animation); // Makes sure the cooked file is up to date
+		}
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			CookedModel model;
+			Animation animation;
+			model.loadSource(filename, &animation);
+		}
+		double sourceMs = elapsedMs(start) / repeats;
+
+		int fromCache = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			CookedModel model;
+			Animation animation;
+			AssetCache::load(filename, model, &animation);
+			fromCache += model.fromCache ? 1 : 0;
+		}
+		double cookedMs = elapsedMs(start) / repeats;
+
+		std::string report = "[Benchmark] Asset cache, " + filename + ", ms per load over " + std::to_string(repeats) + " loads\n";
+		report += "  from .gem: " + std::to_string(sourceMs) + "\n";
+		report += "  from .gemc: " + std::to_string(cookedMs) + " (" + std::to_string(fromCache) + " cache hits)\n";
+		return report;
+	}
+
+	// The .gem files in a directory, sorted
+	static std::vector<std::string> sourceFiles(const std::string& directory)
+	{
+		std::vector<std::string> filenames;
+		WIN32_FIND_DATAA found;
+		HANDLE search = FindFirstFileA((directory + "*.gem").c_str(), &found);
+		if (search != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if (AssetCache::isSource(found.cFileName))
+				{
+					filenames.push_back(found.cFileName);
+				}
+			} while (FindNextFileA(search, &found));
+			FindClose(search);
+		}
+		std::sort(filenames.begin(), filenames.end());
+		return filenames;
+	}
+
+	// Builds the mip chain of one decoded image with each filter, at each thread count
+	static std::string mipGeneration(const std::string& filename, int repeats)
+	{
+		MipSettings noMips;
+		noMips.enabled = false;
+		DecodedTexture decoded;
+		if (!TextureDecoder::decode(filename, decoded, nullptr, noMips))
+		{
+			return "[Benchmark] Mip generation, could not load " + filename + "\n";
+		}
+		std::vector<MipLevel> levels;
+		std::vector<unsigned char> chain(MipGenerator::layout(decoded.width, decoded.height, 0, levels));
+		memcpy(chain.data(), decoded.texels.data(), decoded.texels.size());
+
+		std::vector<int> threadCounts;
+		int hardwareThreads = max((int)std::thread::hardware_concurrency(), 1);
+		for (int threadsN = 1; threadsN < hardwareThreads; threadsN *= 2)
+		{
+			threadCounts.push_back(threadsN);
+		}
+		threadCounts.push_back(hardwareThreads);
+
+		std::string report = "[Benchmark] Mip generation, " + filename + " " + std::to_string(decoded.width) + "x" + std::to_string(decoded.height) + ", " + std::to_string(levels.size()) + " levels, ms per chain over " + std::to_string(repeats) + " chains\n";
+		const char* filterNames[] = { "box", "kaiser" };
+		MipFilter filters[] = { MipFilter::Box, MipFilter::Kaiser };
+		for (int f = 0; f < 2; f++)
+		{
+			MipSettings settings;
+			settings.filter = filters[f];
+			double singleThreadMs = 0;
+			for (int threadsN : threadCounts)
+			{
+				JobSystem jobs;
+				jobs.init(threadsN);
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				for (int r = 0; r < repeats; r++)
+				{
+					MipGenerator::generate(&jobs, chain.data(), levels, settings);
+				}
+				double ms = elapsedMs(start) / repeats;
+				if (threadsN == 1)
+				{
+					singleThreadMs = ms;
+				}
+				report += "  " + std::string(filterNames[f]) + ", " + std::to_string(threadsN) + " threads: " + std::to_string(ms) + " ms, " + std::to_string(singleThreadMs / ms) + "x\n";
+			}
+		}
+		return report;
+	}
+
+	// Compresses the mip chain of one image to each format at each quality, on every hardware thread. Throughput
+	// counts every level, PSNR is of the top level against the source.
+	static std::string blockCompression(const std::string& filename, const std::vector<TextureFormat>& formats, int repeats)
+	{
+		DecodedTexture decoded;
+		if (!TextureDecoder::decodeSource(filename, decoded, nullptr))
+		{
+			return "[Benchmark] Block compression, could not load " + filename + "\n";
+		}
+		size_t texelsN = 0;
+		for (int l = 0; l < decoded.levels.size(); l++)
+		{
+			texelsN += (size_t)decoded.levels[l].width * decoded.levels[l].height;
+		}
+		JobSystem jobs;
+		jobs.init();
+
+		std::string report = "[Benchmark] Block compression, " + filename + " " + std::to_string(decoded.width) + "x" + std::to_string(decoded.height) + ", " + std::to_string(decoded.levels.size()) + " levels, ms per chain over " + std::to_string(repeats) + " chains\n";
+		const char* qualityNames[] = { "fast", "quality" };
+		BlockQuality qualities[] = { BlockQuality::Fast, BlockQuality::Quality };
+		for (int f = 0; f < formats.size(); f++)
+		{
+			std::vector<MipLevel> blockLevels;
+			std::vector<unsigned char> blocks(BlockCompression::layout(decoded.width, decoded.height, (int)decoded.levels.size(), formats[f], blockLevels));
+			std::vector<unsigned char> restored((size_t)decoded.rowPitch * decoded.height);
+			for (int q = 0; q < 2; q++)
+			{
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				for (int r = 0; r < repeats; r++)
+				{
+					BlockCompression::compress(&jobs, decoded.texels.data(), decoded.levels, formats[f], qualities[q], blocks.data(), blockLevels);
+				}
+				double ms = elapsedMs(start) / repeats;
+				BlockCompression::decompress(formats[f], blocks.data(), blockLevels[0], restored.data(), decoded.rowPitch);
+				double psnr = BlockCompression::psnr(formats[f], decoded.texels.data(), restored.data(), decoded.width, decoded.height, decoded.rowPitch);
+				report += "  " + std::string(BlockCompression::name(formats[f])) + " " + qualityNames[q] + ": " + std::to_string(ms) + " ms, " + std::to_string((texelsN / 1000000.0) / (ms / 1000.0)) + " Mpixels/s, " + std::to_string(psnr) + " dB\n";
+			}
+		}
+		return report;
+	}
+
+	// Streams a grid of simulated 2048x2048 BC1 textures, one per object, within a budget while the camera flies a
+	// loop over them. Loads land the update after they are issued, so runs repeat exactly. Reports the hit rate
+	// and bytes resident every interval frames.
+	static std::string textureStreaming(int texturesN, size_t budgetBytes, int frames, int interval)
+	{
+		SimulatedTextureSource source;
+		TextureStreamer streamer;
+		streamer.init(budgetBytes, &source, nullptr, false);
+		int side = (int)ceilf(sqrtf((float)texturesN));
+		float spacing = 10.0f;
+		std::vector<Vec3> positions;
+		for (int i = 0; i < texturesN; i++)
+		{
+			streamer.add("Texture" + std::to_string(i), "", 2048, 2048, 12, TextureFormat::BC1, -1);
+			positions.push_back(Vec3((i % side) * spacing, 0, (i / side) * spacing));
+		}
+		float centre = (side - 1) * spacing * 0.5f;
+		float radius = side * spacing * 0.35f;
+		float viewDistance = 40.0f;
+
+		std::string report = "[Benchmark] Texture streaming, " + std::to_string(texturesN) + " textures, " + std::to_string(budgetBytes / (1024 * 1024)) + " MB budget, " + std::to_string(frames) + " frames\n";
+		TextureStreamStats window;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < frames; frame++)
+		{
+			float angle = (2.0f * (float)M_PI * frame) / frames;
+			Vec3 camera(centre + (radius * cosf(angle)), 2.0f, centre + (radius * sinf(angle)));
+			for (int i = 0; i < texturesN; i++)
+			{
+				Vec3 offset = positions[i] - camera;
+				float distance = offset.length(offset);
+				if (distance < viewDistance)
+				{
+					streamer.requestScreenSize(i, TextureStreamer::screenSize(4.0f, distance, 60.0f, 1024));
+				}
+			}
+			streamer.update();
+			window.requests += streamer.frameStats.requests;
+			window.hits += streamer.frameStats.hits;
+			window.loadsIssued += streamer.frameStats.loadsIssued;
+			window.evictions += streamer.frameStats.evictions;
+			window.bytesLoaded += streamer.frameStats.bytesLoaded;
+			if ((frame + 1) % interval == 0)
+			{
+				report += "  frame " + std::to_string(frame + 1) + ": hit rate " + std::to_string(window.hitRate() * 100.0f) + "%, resident " + std::to_string(streamer.frameStats.bytesResident / (1024.0 * 1024.0)) + " MB, loads " + std::to_string(window.loadsIssued) + ", evictions " + std::to_string(window.evictions) + ", loaded " + std::to_string(window.bytesLoaded / (1024.0 * 1024.0)) + " MB\n";
+				window = TextureStreamStats();
+			}
+		}
+		double ms = elapsedMs(start);
+		report += "  total: hit rate " + std::to_string(streamer.totals.hitRate() * 100.0f) + "%, loads " + std::to_string(streamer.totals.loadsIssued) + ", evictions " + std::to_string(streamer.totals.evictions) + ", loaded " + std::to_string(streamer.totals.bytesLoaded / (1024.0 * 1024.0)) + " MB, " + std::to_string(ms / frames) + " ms per frame\n";
+		return report;
+	}
+
+	// A frame of drawsN draws that each set W and VP and copy their buffer into the frame's constants, over shaders
+	// laid out as the game's are. By name goes through a shader map, a scan of the shader's buffers and the
+	// variable map, with the names passed by value as Shaders used to take them. Handles were found up front.
+	static std::string constantUpdates(int drawsN, int framesN)
+	{
+		const char* shaderNames[] = { "plane", "StaticModelUntextured", "static", "animated", "GrassInstanced" };
+		std::map<std::string, std::vector<ConstantBufferValues>> shaders;
+		for (const char* shaderName : shaderNames)
+		{
+			ConstantBufferValues values;
+			values.name = "staticMeshBuffer";
+			values.constantBufferData["W"] = ConstantBufferVariable{ 0, 64 };
+			values.constantBufferData["VP"] = ConstantBufferVariable{ 64, 64 };
+			values.init(128);
+			shaders[shaderName].push_back(values);
+		}
+		std::vector<std::pair<ConstantHandle, ConstantHandle>> handles;
+		std::vector<ConstantBufferValues*> buffers;
+		for (int s = 0; s < 5; s++)
+		{
+			ConstantBufferValues& values = shaders[shaderNames[s]][0];
+			handles.push_back(std::make_pair(values.find("W"), values.find("VP")));
+			buffers.push_back(&values);
+		}
+		auto updateByName = [&](std::string name, std::string constantBufferName, std::string variableName, void* data)
+		{
+			std::vector<ConstantBufferValues>& shaderBuffers = shaders[name];
+			for (int i = 0; i < shaderBuffers.size(); i++)
+			{
+				if (shaderBuffers[i].name == constantBufferName)
+				{
+					shaderBuffers[i].update(variableName, data);
+					return;
+				}
+			}
+		};
+
+		std::vector<unsigned char> memory(8 * 1024 * 1024);
+		FrameConstantAllocator constants;
+		constants.init(memory.data(), memory.size(), 1);
+		Matrix w;
+		Matrix vp;
+		double times[2];
+		for (int byHandle = 0; byHandle < 2; byHandle++)
+		{
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int frame = 0; frame < framesN; frame++)
+			{
+				constants.beginFrame(frame);
+				for (int i = 0; i < drawsN; i++)
+				{
+					int s = i % 5;
+					w.a[0][3] = (float)i;
+					if (byHandle)
+					{
+						handles[s].first.update(&w);
+						handles[s].second.update(&vp);
+					}
+					else
+					{
+						updateByName(shaderNames[s], "staticMeshBuffer", "W", &w);
+						updateByName(shaderNames[s], "staticMeshBuffer", "VP", &vp);
+					}
+					ConstantAllocation allocation;
+					if (constants.allocate(buffers[s]->cbSizeInBytes, allocation))
+					{
+						memcpy(allocation.data, buffers[s]->buffer.data(), buffers[s]->cbSizeInBytes);
+					}
+				}
+			}
+			times[byHandle] = elapsedMs(start) / framesN;
+		}
+		return "[Benchmark] Constant updates, " + std::to_string(drawsN) + " draws setting W and VP: by name " + std::to_string(times[0]) + " ms a frame (" + std::to_string((times[0] * 1000000.0) / drawsN) + " ns a draw), by handle " + std::to_string(times[1]) + " ms a frame (" +
+			std::to_string((times[1] * 1000000.0) / drawsN) + " ns a draw), " + std::to_string(times[0] / times[1]) + "x\n";
+	}
+
+	// Constants for a frame of static draws (W and VP, 256 bytes) and animated ones (W, VP and 256 bones, 16640
+	// bytes), 9 static to each animated, through a FrameConstantAllocator with 8MB a frame and 2 frames in flight.
+	// Against it, the old rings of 1024 slots per constant buffer: their fixed size, and how many draws a frame
+	// reused a slot the GPU could still be reading from the frame before.
+	static std::string constantAllocation(int framesN)
+	{
+		const int framesInFlight = 2;
+		const size_t staticBytes = 256;
+		const size_t animatedBytes = 16640;
+		size_t ringBytes = (staticBytes + animatedBytes) * 1024;
+		std::vector<unsigned char> memory(8 * 1024 * 1024 * framesInFlight);
+		std::vector<unsigned char> values(animatedBytes, 3);
+		std::string report = "[Benchmark] Constant allocation, " + std::to_string(framesN) + " frames, " + std::to_string(framesInFlight) + " frames in flight. 1024 slot rings: " + std::to_string(ringBytes / (1024.0 * 1024.0)) + " MB\n";
+		const int drawCounts[] = { 200, 1000, 5000 };
+		for (int d = 0; d < 3; d++)
+		{
+			int drawsN = drawCounts[d];
+			int animatedN = drawsN / 10;
+			int staticN = drawsN - animatedN;
+			int ringOverwrites = 0;
+			for (int n : { staticN, animatedN })
+			{
+				ringOverwrites += (n * framesInFlight) > 1024 ? (n * framesInFlight) - 1024 : 0;
+			}
+			ringOverwrites = ringOverwrites > drawsN ? drawsN : ringOverwrites;
+
+			FrameConstantAllocator constants;
+			constants.init(memory.data(), memory.size(), framesInFlight);
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int frame = 0; frame < framesN; frame++)
+			{
+				constants.beginFrame(frame);
+				for (int i = 0; i < drawsN; i++)
+				{
+					size_t bytes = (i % 10) == 9 ? animatedBytes : staticBytes;
+					ConstantAllocation allocation;
+					if (constants.allocate(bytes, allocation))
+					{
+						memcpy(allocation.data, values.data(), bytes);
+					}
+				}
+			}
+			constants.beginFrame(framesN);
+			double ms = elapsedMs(start) / framesN;
+			report += "  " + std::to_string(drawsN) + " draws: " + std::to_string((constants.peak() * framesInFlight) / (1024.0 * 1024.0)) + " MB used over the frames in flight, " + std::to_string(constants.totalOverflows() / framesN) + " overflows a frame, " + std::to_string(ms) +
+				" ms a frame to allocate and fill. Rings reused " + std::to_string(ringOverwrites) + " slots in flight a frame\n";
+		}
+		return report;
+	}
+
+	// Records drawsN draws a frame through ParallelRecorder on the null backend, for 1, 2, 4... threads. Each draw
+	// stands in for binding and filling its constants with a few hundred multiply adds, every seventh one eight
+	// times as many, as a draw with several materials would. Checks every frame executes the draws in order.
+	static std::string parallelRecording(int drawsN, int framesN)
+	{
+		std::vector<float> costs(drawsN);
+		for (int i = 0; i < drawsN; i++)
+		{
+			costs[i] = (i % 7) == 0 ? 8.0f : 1.0f;
+		}
+		std::vector<unsigned int> results(drawsN);
+		std::vector<int> threadCounts;
+		int hardwareThreads = max((int)std::thread::hardware_concurrency(), 1);
+		for (int threadsN = 1; threadsN < hardwareThreads; threadsN *= 2)
+		{
+			threadCounts.push_back(threadsN);
+		}
+		threadCounts.push_back(hardwareThreads);
+
+		std::string report = "[Benchmark] Parallel recording, " + std::to_string(drawsN) + " draws, " + std::to_string(framesN) + " frames\n";
+		const char* names[] = { "by count", "by cost" };
+		for (int byCost = 0; byCost < 2; byCost++)
+		{
+			double singleThreadMs = 0;
+			for (int threadsN : threadCounts)
+			{
+				JobSystem jobs;
+				jobs.init(threadsN);
+				NullRecordingBackend backend(8);
+				ParallelRecorder recorder;
+				recorder.init(&jobs, &backend);
+				auto recordRange = [&](int list, int begin, int end)
+				{
+					for (int i = begin; i < end; i++)
+					{
+						unsigned int value = (unsigned int)i;
+						int steps = (int)costs[i] * 256;
+						for (int s = 0; s < steps; s++)
+						{
+							value = (value * 1664525) + 1013904223;
+						}
+						results[i] = value;
+						backend.record(list, i);
+					}
+				};
+				int outOfOrder = 0;
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				for (int frame = 0; frame < framesN; frame++)
+				{
+					backend.executed.clear();
+					if (byCost)
+					{
+						recorder.record(costs, recordRange);
+					}
+					else
+					{
+						recorder.record(drawsN, recordRange);
+					}
+					for (int i = 0; i < drawsN; i++)
+					{
+						outOfOrder += (i < backend.executed.size() && backend.executed[i] == i) ? 0 : 1;
+					}
+				}
+				double ms = elapsedMs(start) / framesN;
+				if (threadsN == 1)
+				{
+					singleThreadMs = ms;
+				}
+				report += "  " + std::string(names[byCost]) + ", " + std::to_string(threadsN) + " threads: " + std::to_string(ms) + " ms/frame, " + std::to_string(singleThreadMs / ms) + "x, " + std::to_string(recorder.listsUsed) + " lists, " +
+					std::to_string(outOfOrder) + " draws out of order, " + std::to_string(backend.errorsN) + " list errors\n";
+			}
+		}
+		return report;
+	}
+
+	// Frame pacing of each frames in flight setting, and of low latency mode, for a GPU bound, a CPU bound and a
+	// balanced frame with 4ms of jitter, played through FramePacing::simulate
+	static std::string framePacing(int framesN)
+	{
+		const float cpuMs[] = { 8.0f, 14.0f, 11.0f };
+		const float gpuMs[] = { 14.0f, 8.0f, 11.0f };
+		const char* names[] = { "GPU bound", "CPU bound", "balanced" };
+		std::string report = "[Benchmark] Frame pacing, " + std::to_string(framesN) + " simulated frames\n";
+		for (int c = 0; c < 3; c++)
+		{
+			for (int framesInFlight = 2; framesInFlight <= 4; framesInFlight++)
+			{
+				FramePacing pacing = FramePacing::simulate(framesInFlight, 0, cpuMs[c], gpuMs[c], 4.0f, framesN);
+				report += "  " + pacing.report(std::string(names[c]) + ", " + std::to_string(framesInFlight) + " frames in flight");
+			}
+			FramePacing pacing = FramePacing::simulate(2, 1, cpuMs[c], gpuMs[c], 4.0f, framesN);
+			report += "  " + pacing.report(std::string(names[c]) + ", low latency");
+		}
+		return report;
+	}
+
+	// Stages uploadsN uploads of 4KB to 4MB through a 64MB ring against a FakeUploadQueue, submitting every
+	// perFrame uploads as a frame would and letting the fake GPU finish each batch two frames later. The
+	// synchronous path stalled once per upload.
+	static std::string uploadRing(int uploadsN, int perFrame)
+	{
+		std::vector<unsigned char> memory(64 * 1024 * 1024);
+		std::vector<unsigned char> source(4 * 1024 * 1024, 7);
+		FakeUploadQueue queue;
+		UploadRing ring;
+		ring.init(memory.data(), memory.size(), &queue);
+		unsigned int seed = 12345;
+		size_t bytes = 0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < uploadsN; i++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			size_t size = (size_t)4096 << ((seed >> 8) % 11);
+			UploadAllocation allocation;
+			if (ring.allocate(size, 512, allocation))
+			{
+				memcpy(allocation.data, source.data(), size);
+				bytes += size;
+			}
+			if ((i + 1) % perFrame == 0)
+			{
+				UploadToken token = ring.submit();
+				queue.finishUpTo(token > 2 ? token - 2 : 0);
+			}
+		}
+		ring.wait(ring.submit());
+		double ms = elapsedMs(start);
+		return "[Benchmark] Upload ring, " + std::to_string(uploadsN) + " uploads, " + std::to_string(bytes / (1024.0 * 1024.0)) + " MB: " + std::to_string(ring.submitsN) + " submits and " + std::to_string(ring.stallsN) +
+			" stalls, against " + std::to_string(uploadsN) + " of each synchronously, " + std::to_string((bytes / (1024.0 * 1024.0)) / (ms / 1000.0)) + " MB/s staged\n";
+	}
+
+	// Churns the 16384 slot heap the way streaming and reloading would, with a pseudo random mix of single slots
+	// and tables of 2 to 8 freed in a different order, plus a few transient tables a frame. A bump pointer would run
+	// out after 16384 slots.
+	static std::string descriptorAllocation(int operations)
+	{
+		DescriptorAllocator allocator;
+		allocator.init(16384, 2048, 2);
+		std::vector<DescriptorHandle> live;
+		unsigned int seed = 12345;
+		int failed = 0;
+		int handedOut = 0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < operations; i++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			unsigned int r = (seed >> 8) & 0xffff;
+			if (live.size() < 3000 && (r % 3 != 0 || live.empty()))
+			{
+				DescriptorHandle handle = (r & 4) ? allocator.allocateRange(2 + (r % 7)) : allocator.allocate();
+				if (handle.valid())
+				{
+					live.push_back(handle);
+					handedOut += handle.count;
+				}
+				else
+				{
+					failed++;
+				}
+			}
+			else
+			{
+				int victim = (int)(r % live.size());
+				allocator.free(live[victim]);
+				live[victim] = live.back();
+				live.pop_back();
+			}
+			if ((i % 1000) == 0)
+			{
+				allocator.beginFrame(i / 1000);
+				for (int t = 0; t < 64; t++)
+				{
+					allocator.allocateTransient(4);
+				}
+			}
+		}
+		double ms = elapsedMs(start);
+		return "[Benchmark] Descriptor allocation, " + std::to_string(operations) + " operations: " + std::to_string((ms * 1000000.0) / operations) + " ns each, " + std::to_string(handedOut) + " slots handed out, peak " +
+			std::to_string(allocator.peak()) + " of " + std::to_string(allocator.persistentCapacity()) + " live, " + std::to_string(failed) + " failed\n";
+	}
+
+	// Groups every image under a directory into texture arrays, and packs the ones smaller than half a page into
+	// atlas pages. Descriptor table changes are for drawing each texture once, with one table per array and only
+	// the slice changing inside it.
+	static std::string texturePacking(const std::string& directory)
+	{
+		std::vector<std::string> filenames;
+		TextureCache::sourceFiles(directory, filenames);
+		std::sort(filenames.begin(), filenames.end());
+		std::vector<std::pair<std::string, std::string>> files;
+		for (int i = 0; i < filenames.size(); i++)
+		{
+			files.push_back(std::make_pair(filenames[i], filenames[i]));
+		}
+		JobSystem jobs;
+		jobs.init();
+		TextureBufferPool pool;
+		std::vector<DecodedTexture> decoded;
+		TextureDecoder::decodeBatch(jobs, files, decoded, &pool);
+		std::vector<const DecodedTexture*> textures;
+		for (int i = 0; i < decoded.size(); i++)
+		{
+			if (decoded[i].valid())
+			{
+				textures.push_back(&decoded[i]);
+			}
+		}
+
+		std::string report = "[Benchmark] Texture packing, " + std::to_string(textures.size()) + " images in " + directory + "\n";
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<std::vector<int>> groups;
+		TextureArrayPacker::group(textures, 64, groups);
+		int arraysN = 0;
+		size_t arrayBytes = 0;
+		for (int g = 0; g < groups.size(); g++)
+		{
+			if (groups[g].size() < 2)
+			{
+				continue;
+			}
+			std::vector<const DecodedTexture*> slices;
+			for (int s = 0; s < groups[g].size(); s++)
+			{
+				slices.push_back(textures[groups[g][s]]);
+			}
+			DecodedTexture array;
+			TextureArrayPacker::build(slices, array);
+			arraysN++;
+			arrayBytes += array.bytes();
+			array.release();
+		}
+		double arrayMs = elapsedMs(start);
+		report += "  arrays: " + std::to_string(arraysN) + " arrays and " + std::to_string(groups.size() - arraysN) + " single textures, descriptor table changes " + std::to_string(textures.size()) + " -> " + std::to_string(groups.size()) + ", " +
+			std::to_string(arrayBytes / (1024.0 * 1024.0)) + " MB built in " + std::to_string(arrayMs) + " ms\n";
+
+		for (int pageSize = 2048; pageSize <= 4096; pageSize *= 2)
+		{
+			std::vector<std::pair<int, int>> sizes;
+			for (int i = 0; i < textures.size(); i++)
+			{
+				if (textures[i]->width < pageSize / 2 && textures[i]->height < pageSize / 2)
+				{
+					sizes.push_back(std::make_pair(textures[i]->width, textures[i]->height));
+				}
+			}
+			AtlasPacker packer;
+			packer.pageSize = pageSize;
+			std::vector<AtlasRect> rects;
+			start = std::chrono::high_resolution_clock::now();
+			int pagesN = packer.pack(sizes, rects);
+			double packMs = elapsedMs(start);
+			report += "  atlas " + std::to_string(pageSize) + ": " + std::to_string(sizes.size()) + " images on " + std::to_string(pagesN) + " pages, " + std::to_string(packer.occupancy(rects, pagesN) * 100.0f) + "% occupied, packed in " + std::to_string(packMs) + " ms\n";
+		}
+		for (int i = 0; i < decoded.size(); i++)
+		{
+			decoded[i].release();
+		}
+		return report;
+	}
+
+	// Decodes every image under a directory as one TextureManager batch at each thread count. The decoded
+	// buffers go back to the pool after each pass, as they would after upload, so later passes reuse them.
+	static std::string textureDecoding(const std::string& directory, int repeats)
+	{
+		std::vector<std::string> filenames;
+		TextureCache::sourceFiles(directory, filenames);
+		std::sort(filenames.begin(), filenames.end());
+		std::vector<std::pair<std::string, std::string>> files;
+		for (int i = 0; i < filenames.size(); i++)
+		{
+			files.push_back(std::make_pair(filenames[i], filenames[i]));
+		}
+
+		std::vector<int> threadCounts;
+		int hardwareThreads = max((int)std::thread::hardware_concurrency(), 1);
+		for (int threadsN = 1; threadsN < hardwareThreads; threadsN *= 2)
+		{
+			threadCounts.push_back(threadsN);
+		}
+		threadCounts.push_back(hardwareThreads);
+
+		std::string report = "[Benchmark] Texture decoding, " + std::to_string(files.size()) + " images in " + directory + ", ms per batch over " + std::to_string(repeats) + " batches\n";
+		double singleThreadMs = 0;
+		for (int threadsN : threadCounts)
+		{
+			JobSystem jobs;
+			jobs.init(threadsN);
+			TextureBufferPool pool;
+			size_t bytes = 0;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int r = 0; r < repeats; r++)
+			{
+				std::vector<DecodedTexture> decoded;
+				TextureDecoder::decodeBatch(jobs, files, decoded, &pool);
+				bytes = 0;
+				for (int i = 0; i < decoded.size(); i++)
+				{
+					bytes += decoded[i].bytes();
+				}
+			}
+			double ms = elapsedMs(start) / repeats;
+			if (threadsN == 1)
+			{
+				singleThreadMs = ms;
+			}
+			report += "  " + std::to_string(threadsN) + " threads: " + std::to_string(ms) + " ms, " + std::to_string(files.size() * 1000.0 / ms) + " images/s, " + std::to_string(bytes / (ms * 1000.0)) + " MB/s decoded, " + std::to_string(singleThreadMs / ms) + "x, " + std::to_string(pool.reuses) + "/" + std::to_string(pool.reuses + pool.allocations) + " buffers reused\n";
+		}
+		return report;
+	}
+
+	// Startup loading of every model in a directory and its albedo textures through the AssetLoader, with a
+	// NullAssetUploader in place of the device, at each thread count
+	static std::string assetLoader(const std::string& directory, int repeats)
+	{
+		std::vector<std::string> filenames = sourceFiles(directory);
+		std::vector<bool> animated(filenames.size());
+		for (int f = 0; f < filenames.size(); f++)
+		{
+			GEMLoader::GEMModelLoader loader;
+			animated[f] = loader.isAnimatedModel(directory + filenames[f]);
+		}
+
+		std::vector<int> threadCounts;
+		int hardwareThreads = max((int)std::thread::hardware_concurrency(), 1);
+		for (int threadsN = 1; threadsN < hardwareThreads; threadsN *= 2)
+		{
+			threadCounts.push_back(threadsN);
+		}
+		threadCounts.push_back(hardwareThreads);
+
+		std::string report = "[Benchmark] AssetLoader, " + std::to_string(filenames.size()) + " models and their textures, ms per load over " + std::to_string(repeats) + " loads\n";
+		double singleThreadMs = 0;
+		for (int threadsN : threadCounts)
+		{
+			JobSystem jobs;
+			jobs.init(threadsN);
+			NullAssetUploader uploader;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int r = 0; r < repeats; r++)
+			{
+				uploader = NullAssetUploader();
+				AssetLoader assets;
+				assets.init(&jobs);
+				for (int f = 0; f < filenames.size(); f++)
+				{
+					assets.loadModel(directory + filenames[f], animated[f]);
+				}
+				assets.finish(uploader);
+			}
+			double ms = elapsedMs(start) / repeats;
+			if (threadsN == 1)
+			{
+				singleThreadMs = ms;
+			}
+			report += "  " + std::to_string(threadsN) + " threads: " + std::to_string(ms) + " ms, " + std::to_string(singleThreadMs / ms) + "x, " + std::to_string(uploader.imagesN) + " textures, " + std::to_string(uploader.bytes / (1024 * 1024)) + " MB\n";
+		}
+		return report;
+	}
+
+	// Times GEMModelLoader on every .gem file in a directory, so a slow path creeping back into the loader shows up
+	static std::string modelLoader(const std::string& directory, int repeats)
+	{
+		std::vector<std::string> filenames = sourceFiles(directory);
+		std::string report = "[Benchmark] GEMModelLoader, ms per load over " + std::to_string(repeats) + " loads\n";
+		double totalMs = 0;
+		size_t totalBytes = 0;
+		for (int f = 0; f < filenames.size(); f++)
+		{
+			std::string filename = directory + filenames[f];
+			GEMLoader::GEMModelLoader loader;
+			bool animated = loader.isAnimatedModel(filename);
+			size_t bytes = 0;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int r = 0; r < repeats; r++)
+			{
+				std::vector<GEMLoader::GEMMesh> gemmeshes;
+				GEMLoader::GEMAnimation gemanimation;
+				if (animated)
+				{
+					loader.load(filename, gemmeshes, gemanimation);
+				}
+				else
+				{
+					loader.load(filename, gemmeshes);
+				}
+				bytes = 0;
+				for (int i = 0; i < gemmeshes.size(); i++)
+				{
+					bytes += (gemmeshes[i].verticesStatic.size() * sizeof(GEMLoader::GEMStaticVertex)) + (gemmeshes[i].verticesAnimated.size() * sizeof(GEMLoader::GEMAnimatedVertex)) + (gemmeshes[i].indices.size() * sizeof(unsigned int));
+				}
+			}
+			double ms = elapsedMs(start) / repeats;
+			totalMs += ms;
+			totalBytes += bytes;
+			report += "  " + filenames[f] + ": " + std::to_string(ms) + " ms, " + std::to_string(bytes / (ms * 1000.0)) + " MB/s of geometry\n";
+		}
+		report += "  all " + std::to_string(filenames.size()) + " files: " + std::to_string(totalMs) + " ms, " + std::to_string(totalBytes / (totalMs * 1000.0)) + " MB/s of geometry\n";
+		return report;
+	}
+
+	// Loads a model the way StaticMesh/AnimatedMesh used to (ifstream, then a per vertex copy into a second vector)
+	// and from a mapping, up to the point the vertices would be handed to the upload buffer, which is stood in for
+	// by a copy into staging. Intermediate bytes are what each path allocates on the heap for vertices and indices.
+	static std::string modelLoading(const std::string& filename, int repeats)
+	{
+		std::vector<unsigned char> staging;
+		size_t streamedBytes = 0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			GEMLoader::GEMModelLoader loader;
+			std::vector<GEMLoader::GEMMesh> gemmeshes;
+			GEMLoader::GEMAnimation gemanimation;
+			if (loader.isAnimatedModel(filename))
+			{
+				loader.load(filename, gemmeshes, gemanimation);
+				Animation animation;
+				animation.load(gemanimation);
+			}
+			else
+			{
+				loader.load(filename, gemmeshes);
+			}
+			streamedBytes = 0;
+			for (int i = 0; i < gemmeshes.size(); i++)
+			{
+				std::vector<unsigned char> vertices;
+				const unsigned char* source = gemmeshes[i].isAnimated() ? (const unsigned char*)gemmeshes[i].verticesAnimated.data() : (const unsigned char*)gemmeshes[i].verticesStatic.data();
+				size_t stride = gemmeshes[i].isAnimated() ? sizeof(GEMLoader::GEMAnimatedVertex) : sizeof(GEMLoader::GEMStaticVertex);
+				size_t verticesN = gemmeshes[i].isAnimated() ? gemmeshes[i].verticesAnimated.size() : gemmeshes[i].verticesStatic.size();
+				for (size_t j = 0; j < verticesN; j++)
+				{
+					vertices.insert(vertices.end(), source + (j * stride), source + ((j + 1) * stride));
+				}
+				stage(staging, vertices.data(), vertices.size());
+				stage(staging, gemmeshes[i].indices.data(), gemmeshes[i].indices.size() * sizeof(unsigned int));
+				streamedBytes += (2 * vertices.size()) + (gemmeshes[i].indices.size() * sizeof(unsigned int));
+			}
+		}
+		double streamedMs = elapsedMs(start) / repeats;
+
+		start = std::chrono::high_resolution_clock::now();
+		size_t fileBytes = 0;
+		for (int r = 0; r < repeats; r++)
+		{
+			GEMLoader::GEMMappedModel model;
+			model.load(filename);
+			if (model.isAnimated)
+			{
+				Animation animation;
+				animation.load(model);
+			}
+			for (int i = 0; i < model.meshes.size(); i++)
+			{
+				const GEMLoader::GEMMappedMesh& mesh = model.meshes[i];
+				if (mesh.isAnimated())
+				{
+					stage(staging, mesh.verticesAnimated.data, mesh.verticesAnimated.bytes());
+				}
+				else
+				{
+					stage(staging, mesh.verticesStatic.data, mesh.verticesStatic.bytes());
+				}
+				stage(staging, mesh.indices.data, mesh.indices.bytes());
+			}
+			fileBytes = model.fileBytes();
+		}
+		double mappedMs = elapsedMs(start) / repeats;
+
+		std::string report = "[Benchmark] Model loading, " + filename + " (" + std::to_string(fileBytes) + " bytes), ms per load over " + std::to_string(repeats) + " loads\n";
+		report += "  ifstream + vertex copy: " + std::to_string(streamedMs) + " ms, " + std::to_string(streamedBytes) + " intermediate bytes\n";
+		report += "  memory-mapped: " + std::to_string(mappedMs) + " ms, 0 intermediate bytes\n";
+		return report;
+	}
+
+	static void stage(std::vector<unsigned char>& staging, const void* data, size_t bytes)
+	{
+		staging.resize(bytes > staging.size() ? bytes : staging.size());
+		memcpy(staging.data(), data, bytes);
+	}
+
+	// Per instance update: looking the clip up by name for every bone as update used to, against a resolved clip
+	static std::string animationUpdate(int updatesN)
+	{
+		Animation animation;
+		loadTRex(animation);
+		const std::string name = animation.animations.begin()->first;
+		AnimationSequence* clip = animation.findClip(name);
+		float duration = clip->duration();
+		const float dt = 1.0f / 60.0f;
+
+		AnimationInstance byName;
+		byName.init(&animation, 0);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		float t = 0;
+		for (int i = 0; i < updatesN; i++)
+		{
+			t = fmodf(t + dt, duration);
+			int frame = 0;
+			float interpolationFact = 0;
+			animation.calcFrame(name, t, frame, interpolationFact);
+			for (int bone = 0; bone < animation.bonesSize(); bone++)
+			{
+				byName.matrices[bone] = animation.interpolateBoneToGlobal(name, byName.matrices, frame, interpolationFact, bone);
+			}
+			animation.calcTransforms(byName.matrices, byName.coordTransform);
+		}
+		double byNameUs = elapsedMs(start) * 1000.0 / updatesN;
+
+		// The same loop with the clip resolved up front, so the difference is only the lookups
+		start = std::chrono::high_resolution_clock::now();
+		t = 0;
+		for (int i = 0; i < updatesN; i++)
+		{
+			t = fmodf(t + dt, duration);
+			int frame = 0;
+			float interpolationFact = 0;
+			clip->calcFrame(t, frame, interpolationFact);
+			for (int bone = 0; bone < animation.bonesSize(); bone++)
+			{
+				byName.matrices[bone] = clip->interpolateBoneToGlobal(byName.matrices, frame, interpolationFact, &animation.skeleton, bone);
+			}
+			animation.calcTransforms(byName.matrices, byName.coordTransform);
+		}
+		double resolvedUs = elapsedMs(start) * 1000.0 / updatesN;
+
+		AnimationInstance byClip;
+		byClip.init(&animation, 0);
+		byClip.advance(clip, 0);
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < updatesN; i++)
+		{
+			byClip.advance(clip, dt);
+			if (byClip.animationFinished())
+			{
+				byClip.resetAnimationTime();
+				byClip.advance(clip, 0);
+			}
+			byClip.evaluatePose();
+		}
+		double byClipUs = elapsedMs(start) * 1000.0 / updatesN;
+
+		std::string report = "[Benchmark] Animation update, us per instance over " + std::to_string(updatesN) + " updates\n";
+		report += "  clip looked up by name per bone: " + std::to_string(byNameUs) + "\n";
+		report += "  same loop, clip resolved once: " + std::to_string(resolvedUs) + "\n";
+		report += "  AnimationInstance with a resolved clip: " + std::to_string(byClipUs) + "\n";
+		return report;
+	}
+
+	// A crowd spread from 0 to 200 units away, posed at full rate, with LOD, and with LOD plus a bone budget
+	static std::string animationLOD(int instancesN, int framesN)
+	{
+		Animation animation;
+		loadTRex(animation);
+		std::vector<AnimationSequence*> clips;
+		for (auto& kv : animation.animations)
+		{
+			clips.push_back(&kv.second);
+		}
+		std::vector<AnimationInstance> instances(instancesN);
+		std::string report = "[Benchmark] Animation LOD: " + std::to_string(instancesN) + " TRex instances 0-200 units away, " + std::to_string(framesN) + " frames\n";
+		const float dt = 1.0f / 60.0f;
+		const int budgets[3] = { -1, 0, 8000 }; // -1 runs without LOD
+		for (int b = 0; b < 3; b++)
+		{
+			AnimationLODManager lod;
+			lod.init();
+			lod.boneBudget = max(budgets[b], 0);
+			for (int i = 0; i < instancesN; i++)
+			{
+				instances[i] = AnimationInstance();
+				instances[i].init(&animation, 0);
+				instances[i].advance(clips[i % clips.size()], 0);
+				lod.setPosition(lod.add(&instances[i]), Vec3(200.0f * (float)i / (float)instancesN, 0, 0));
+			}
+			std::vector<AnimationInstance*> toEvaluate;
+			long long bones = 0;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int frame = 0; frame < framesN; frame++)
+			{
+				for (int i = 0; i < instancesN; i++)
+				{
+					instances[i].advance(instances[i].clip, dt);
+					if (!instances[i].poseDirty)
+					{
+						instances[i].resetAnimationTime();
+						instances[i].advance(instances[i].clip, 0);
+					}
+				}
+				if (budgets[b] < 0)
+				{
+					for (int i = 0; i < instancesN; i++)
+					{
+						instances[i].evaluatePose();
+					}
+					bones += (long long)instancesN * animation.bonesSize();
+					continue;
+				}
+				lod.schedule(Vec3(0, 0, 0), toEvaluate);
+				for (int i = 0; i < toEvaluate.size(); i++)
+				{
+					toEvaluate[i]->evaluatePose();
+				}
+				bones += lod.bonesScheduled;
+			}
+			double ms = elapsedMs(start) / framesN;
+			std::string name = budgets[b] < 0 ? "no LOD" : (budgets[b] == 0 ? "LOD" : "LOD, budget " + std::to_string(budgets[b]) + " bones");
+			report += "  " + name + ": " + std::to_string(ms) + " ms/frame, " + std::to_string(bones / framesN) + " bones sampled/frame\n";
+		}
+		return report;
+	}
+
+	// Times each stage of pose evaluation on one thread, reported per pose
+	static std::string animationStages(int posesN)
+	{
+		Animation animation;
+		loadTRex(animation);
+
+		const std::string clip = animation.animations.begin()->first;
+		float duration = animation.animations[clip].duration();
+		std::vector<BoneTransform> local(animation.bonesSize());
+		std::vector<Matrix> global(animation.bonesSize());
+		std::vector<Matrix> skinning(animation.bonesSize());
+		Matrix coordTransform;
+		double sampleMs = 0;
+		double concatenateMs = 0;
+		double skinMs = 0;
+		for (int i = 0; i < posesN; i++)
+		{
+			float t = fmodf((float)i * 0.013f, duration);
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			animation.sampleLocalPose(clip, t, local.data());
+			sampleMs += elapsedMs(start);
+			start = std::chrono::high_resolution_clock::now();
+			animation.concatenate(local.data(), global.data(), coordTransform);
+			concatenateMs += elapsedMs(start);
+			start = std::chrono::high_resolution_clock::now();
+			animation.skin(global.data(), skinning.data(), coordTransform);
+			skinMs += elapsedMs(start);
+		}
+		std::string report = "[Benchmark] Animation stages, us per pose over " + std::to_string(posesN) + " poses\n";
+		report += "  sample: " + std::to_string(sampleMs * 1000.0 / posesN) + "\n";
+		report += "  concatenate: " + std::to_string(concatenateMs * 1000.0 / posesN) + "\n";
+		report += "  skin: " + std::to_string(skinMs * 1000.0 / posesN) + "\n";
+
+		// Fused blend pass with 1 to 4 clips active
+		std::vector<std::string> clips;
+		for (auto& kv : animation.animations)
+		{
+			clips.push_back(kv.first);
+		}
+		for (int inputsN = 1; inputsN <= 4; inputsN++)
+		{
+			AnimationBlendInput inputs[4];
+			double blendMs = 0;
+			for (int i = 0; i < posesN; i++)
+			{
+				for (int j = 0; j < inputsN; j++)
+				{
+					const std::string& name = clips[j % clips.size()];
+					inputs[j] = animation.blendInput(name, fmodf((float)i * 0.013f, animation.animations[name].duration()), 0.5f, j == 3 ? AnimationBlendMode::Additive : AnimationBlendMode::Override, nullptr);
+				}
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				animation.sampleLocalPose(inputs, inputsN, local.data());
+				blendMs += elapsedMs(start);
+			}
+			report += "  sample, " + std::to_string(inputsN) + " clips blended: " + std::to_string(blendMs * 1000.0 / posesN) + "\n";
+		}
+		return report;
+	}
+
+	// Animates instancesN TRex instances, spread over every clip, and reports ms per frame for 1, 2, 4... threads
+	static std::string animation(int instancesN, int framesN)
+	{
+		Animation animation;
+		loadTRex(animation);
+
+		std::vector<AnimationSequence*> clips;
+		for (auto& kv : animation.animations)
+		{
+			clips.push_back(&kv.second);
+		}
+		std::vector<AnimationInstance> instances(instancesN);
+		std::vector<AnimationInstance*> pointers(instancesN);
+		for (int i = 0; i < instancesN; i++)
+		{
+			instances[i].init(&animation, 0);
+			pointers[i] = &instances[i];
+		}
+
+		std::vector<int> threadCounts;
+		int hardwareThreads = max((int)std::thread::hardware_concurrency(), 1);
+		for (int threadsN = 1; threadsN < hardwareThreads; threadsN *= 2)
+		{
+			threadCounts.push_back(threadsN);
+		}
+		threadCounts.push_back(hardwareThreads);
+
+		std::string report = "[Benchmark] Animation: " + std::to_string(instancesN) + " TRex instances, " + std::to_string(animation.bonesSize()) + " bones, " + std::to_string(framesN) + " frames\n";
+		double singleThreadMs = 0;
+		const float dt = 1.0f / 60.0f;
+		for (int threadsN : threadCounts)
+		{
+			JobSystem jobs;
+			jobs.init(threadsN);
+			// Stagger the instances so they are not all sampling the same keys
+			for (int i = 0; i < instancesN; i++)
+			{
+				AnimationSequence* clip = clips[i % clips.size()];
+				instances[i].clip = nullptr;
+				instances[i].advance(clip, 0);
+				instances[i].t = fmodf((float)i * 0.037f, clip->duration());
+			}
+			std::chrono::high_resolution_clock::time_point start;
+			for (int frame = -10; frame < framesN; frame++) // The first 10 frames are warm up
+			{
+				if (frame == 0)
+				{
+					start = std::chrono::high_resolution_clock::now();
+				}
+				for (int i = 0; i < instancesN; i++)
+				{
+					instances[i].advance(instances[i].clip, dt);
+					if (!instances[i].poseDirty)
+					{
+						instances[i].resetAnimationTime();
+						instances[i].advance(instances[i].clip, 0);
+					}
+				}
+				AnimationJobs::evaluatePoses(jobs, pointers.data(), instancesN);
+			}
+			double ms = elapsedMs(start) / framesN;
+			if (threadsN == 1)
+			{
+				singleThreadMs = ms;
+			}
+			report += "  " + std::to_string(threadsN) + " threads: " + std::to_string(ms) + " ms/frame, " + std::to_string(singleThreadMs / ms) + "x\n";
+		}
+		return report;
+	}
+};
@@ -0,0 +1,1175 @@
+#pragma once
+
+#include <string.h>
+#include <vector>
+#include "maths.h"
+#include "JobSystem.h"
+#include "MipGenerator.h"
+
+enum class TextureFormat
+{
+	RGBA8,
+	BC1, // RGB, 4 bits per texel, for opaque albedo
+	BC3, // BC1 colour plus a BC4 alpha block, 8 bits per texel, for albedo with alpha
+	BC5, // Two BC4 blocks for red and green, 8 bits per texel, for normal maps
+	BC7 // Modes 5 and 6, 8 bits per texel, best quality
+};
+
+enum class BlockQuality
+{
+	Fast, // Bounding box endpoints, one pass
+	Quality // Principal axis endpoints refined by least squares, more candidates tried
+};
+
+// Encodes and decodes 4x4 texel blocks. Works on plain memory, so it runs without a device.
+class BlockCompression
+{
+public:
+	static bool isBlock(TextureFormat format)
+	{
+		return format != TextureFormat::RGBA8;
+	}
+
+	static unsigned int blockBytes(TextureFormat format)
+	{
+		switch (format)
+		{
+		case TextureFormat::RGBA8:
+			return 0;
+		case TextureFormat::BC1:
+			return 8;
+		default:
+			return 16;
+		}
+	}
+
+	static const char* name(TextureFormat format)
+	{
+		switch (format)
+		{
+		case TextureFormat::BC1:
+			return "BC1";
+		case TextureFormat::BC3:
+			return "BC3";
+		case TextureFormat::BC5:
+			return "BC5";
+		case TextureFormat::BC7:
+			return "BC7";
+		default:
+			return "RGBA8";
+		}
+	}
+
+	// The smallest mip a texture can be created from, as D3D12 wants the top level of a block compressed texture
+	// to be whole blocks
+	static int lastTopLevel(int width, int height, int levelsN, TextureFormat format)
+	{
+		if (!isBlock(format))
+		{
+			return levelsN - 1;
+		}
+		int level = 0;
+		while (level + 1 < levelsN)
+		{
+			int w = width >> (level + 1);
+			int h = height >> (level + 1);
+			if (w < 4 || h < 4 || (w % 4) != 0 || (h % 4) != 0)
+			{
+				break;
+			}
+			level++;
+		}
+		return level;
+	}
+
+	// Same as MipGenerator::layout, with each row holding a row of blocks for block formats
+	static size_t layout(int width, int height, int levelsCount, TextureFormat format, std::vector<MipLevel>& levels)
+	{
+		size_t bytes = MipGenerator::layout(width, height, levelsCount, levels);
+		if (!isBlock(format))
+		{
+			return bytes;
+		}
+		size_t offset = 0;
+		for (int i = 0; i < levels.size(); i++)
+		{
+			size_t placement = MipGenerator::placementAlignment;
+			unsigned int pitch = MipGenerator::pitchAlignment;
+			offset = (offset + placement - 1) & ~(placement - 1);
+			levels[i].rowsN = (levels[i].height + 3) / 4;
+			levels[i].rowBytes = ((levels[i].width + 3) / 4) * blockBytes(format);
+			levels[i].rowPitch = (levels[i].rowBytes + pitch - 1) & ~(pitch - 1);
+			levels[i].offset = offset;
+			offset += (size_t)levels[i].rowPitch * levels[i].rowsN;
+		}
+		return offset;
+	}
+
+	// Compresses every level of an RGBA8 chain into a chain laid out by layout(). Block rows are split across jobs
+	// when there are any. Blocks hanging over the edge of a level repeat its last row and column.
+	static void compress(JobSystem* jobs, const unsigned char* texels, const std::vector<MipLevel>& levels, TextureFormat format, BlockQuality quality, unsigned char* blocks, const std::vector<MipLevel>& blockLevels)
+	{
+		unsigned int bytesPerBlock = blockBytes(format);
+		for (int l = 0; l < levels.size(); l++)
+		{
+			const MipLevel& src = levels[l];
+			const MipLevel& dst = blockLevels[l];
+			auto rows = [&](int begin, int end)
+			{
+				unsigned char block[64];
+				for (int by = begin; by < end; by++)
+				{
+					for (int bx = 0; bx < (src.width + 3) / 4; bx++)
+					{
+						gather(texels + src.offset, src.rowPitch, src.width, src.height, bx, by, block);
+						encodeBlock(format, quality, block, blocks + dst.offset + ((size_t)by * dst.rowPitch) + (bx * bytesPerBlock));
+					}
+				}
+			};
+			if (jobs == nullptr)
+			{
+				rows(0, dst.rowsN);
+			}
+			else
+			{
+				jobs->parallelFor(dst.rowsN, 4, rows);
+			}
+		}
+	}
+
+	// Decodes one level back to RGBA8, for checking what the compression lost
+	static void decompress(TextureFormat format, const unsigned char* blocks, const MipLevel& blockLevel, unsigned char* texels, unsigned int rowPitch)
+	{
+		unsigned int bytesPerBlock = blockBytes(format);
+		unsigned char block[64];
+		for (int by = 0; by < blockLevel.rowsN; by++)
+		{
+			for (int bx = 0; bx < (blockLevel.width + 3) / 4; bx++)
+			{
+				decodeBlock(format, blocks + ((size_t)by * blockLevel.rowPitch) + (bx * bytesPerBlock), block);
+				for (int y = 0; y < 4 && (by * 4) + y < blockLevel.height; y++)
+				{
+					for (int x = 0; x < 4 && (bx * 4) + x < blockLevel.width; x++)
+					{
+						memcpy(texels + ((size_t)((by * 4) + y) * rowPitch) + (((bx * 4) + x) * 4), block + (((y * 4) + x) * 4), 4);
+					}
+				}
+			}
+		}
+	}
+
+	// Peak signal to noise ratio in dB over the channels format keeps, capped at 99 for a perfect match
+	static double psnr(TextureFormat format, const unsigned char* a, const unsigned char* b, int width, int height, unsigned int rowPitch)
+	{
+		int channelsN = format == TextureFormat::BC1 ? 3 : (format == TextureFormat::BC5 ? 2 : 4);
+		double error = 0;
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char* rowA = a + ((size_t)y * rowPitch);
+			const unsigned char* rowB = b + ((size_t)y * rowPitch);
+			for (int x = 0; x < width; x++)
+			{
+				for (int c = 0; c < channelsN; c++)
+				{
+					double d = (double)rowA[(x * 4) + c] - rowB[(x * 4) + c];
+					error += d * d;
+				}
+			}
+		}
+		double mse = error / ((double)width * height * channelsN);
+		return mse <= 0 ? 99.0 : min(10.0 * log10((255.0 * 255.0) / mse), 99.0);
+	}
+
+	// block is 16 RGBA8 texels, row by row
+	static void encodeBlock(TextureFormat format, BlockQuality quality, const unsigned char* block, unsigned char* out)
+	{
+		switch (format)
+		{
+		case TextureFormat::BC1:
+			encodeBC1(block, quality, out, false);
+			break;
+		case TextureFormat::BC3:
+			encodeBC4(block, 3, quality, out);
+			encodeBC1(block, quality, out + 8, true);
+			break;
+		case TextureFormat::BC5:
+			encodeBC4(block, 0, quality, out);
+			encodeBC4(block, 1, quality, out + 8);
+			break;
+		case TextureFormat::BC7:
+			encodeBC7(block, quality, out);
+			break;
+		default:
+			break;
+		}
+	}
+
+	static void decodeBlock(TextureFormat format, const unsigned char* in, unsigned char* block)
+	{
+		switch (format)
+		{
+		case TextureFormat::BC1:
+			decodeBC1(in, block, false);
+			break;
+		case TextureFormat::BC3:
+			decodeBC1(in + 8, block, true);
+			decodeBC4(in, block, 3);
+			break;
+		case TextureFormat::BC5:
+			for (int i = 0; i < 16; i++)
+			{
+				block[(i * 4) + 2] = 0;
+				block[(i * 4) + 3] = 255;
+			}
+			decodeBC4(in, block, 0);
+			decodeBC4(in + 8, block, 1);
+			break;
+		case TextureFormat::BC7:
+			decodeBC7(in, block);
+			break;
+		default:
+			break;
+		}
+	}
+
+private:
+	// Appends values to a block from the lowest bit up, as BC7 packs its fields
+	struct BitWriter
+	{
+		unsigned char* out;
+		int position = 0;
+
+		void write(unsigned int value, int bits)
+		{
+			for (int i = 0; i < bits; i++)
+			{
+				if ((value >> i) & 1)
+				{
+					out[position >> 3] |= (unsigned char)(1 << (position & 7));
+				}
+				position++;
+			}
+		}
+	};
+
+	struct BitReader
+	{
+		const unsigned char* in;
+		int position = 0;
+
+		unsigned int read(int bits)
+		{
+			unsigned int value = 0;
+			for (int i = 0; i < bits; i++)
+			{
+				value |= (unsigned int)((in[position >> 3] >> (position & 7)) & 1) << i;
+				position++;
+			}
+			return value;
+		}
+	};
+
+	static void gather(const unsigned char* texels, unsigned int rowPitch, int width, int height, int bx, int by, unsigned char* block)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			int sy = min((by * 4) + y, height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				int sx = min((bx * 4) + x, width - 1);
+				memcpy(block + (((y * 4) + x) * 4), texels + ((size_t)sy * rowPitch) + (sx * 4), 4);
+			}
+		}
+	}
+
+	// Per channel minimum and maximum of the 16 texels
+	static void bounds(const unsigned char* block, unsigned char* low, unsigned char* high)
+	{
+#if defined(MATHS_SIMD_SSE)
+		__m128i mn = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+		__m128i mx = mn;
+		for (int i = 1; i < 4; i++)
+		{
+			__m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + (i * 16)));
+			mn = _mm_min_epu8(mn, texels);
+			mx = _mm_max_epu8(mx, texels);
+		}
+		mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 8));
+		mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 4));
+		mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 8));
+		mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+		int packedLow = _mm_cvtsi128_si32(mn);
+		int packedHigh = _mm_cvtsi128_si32(mx);
+		memcpy(low, &packedLow, 4);
+		memcpy(high, &packedHigh, 4);
+#else
+		for (int c = 0; c < 4; c++)
+		{
+			low[c] = 255;
+			high[c] = 0;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				low[c] = min(low[c], block[(i * 4) + c]);
+				high[c] = max(high[c], block[(i * 4) + c]);
+			}
+		}
+#endif
+	}
+
+	// The corners of the bounding box along the diagonal the texels follow, pulled in by a sixteenth of the
+	// range to allow for the interpolated points
+	static void boxEndpoints(const unsigned char* block, int channelsN, float* e0, float* e1)
+	{
+		unsigned char low[4];
+		unsigned char high[4];
+		bounds(block, low, high);
+		int major = 0;
+		for (int c = 1; c < channelsN; c++)
+		{
+			major = (high[c] - low[c]) > (high[major] - low[major]) ? c : major;
+		}
+		float mean[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < channelsN; c++)
+			{
+				mean[c] += block[(i * 4) + c] / 16.0f;
+			}
+		}
+		for (int c = 0; c < channelsN; c++)
+		{
+			float covariance = 0;
+			for (int i = 0; i < 16; i++)
+			{
+				covariance += (block[(i * 4) + c] - mean[c]) * (block[(i * 4) + major] - mean[major]);
+			}
+			float inset = (high[c] - low[c]) / 16.0f;
+			e0[c] = high[c] - inset;
+			e1[c] = low[c] + inset;
+			if (covariance < 0)
+			{
+				float t = e0[c];
+				e0[c] = e1[c];
+				e1[c] = t;
+			}
+		}
+	}
+
+	// The line through the texels with the least squared distance to them, cut where the texels end
+	static void axisEndpoints(const float* texels, int channelsN, float* e0, float* e1)
+	{
+		float mean[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < channelsN; c++)
+			{
+				mean[c] += texels[(i * 4) + c] / 16.0f;
+			}
+		}
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int a = 0; a < channelsN; a++)
+			{
+				for (int b = 0; b < channelsN; b++)
+				{
+					covariance[a][b] += (texels[(i * 4) + a] - mean[a]) * (texels[(i * 4) + b] - mean[b]);
+				}
+			}
+		}
+		// Power iteration from the widest channel
+		float axis[4] = { 0, 0, 0, 0 };
+		int widest = 0;
+		for (int c = 1; c < channelsN; c++)
+		{
+			widest = covariance[c][c] > covariance[widest][widest] ? c : widest;
+		}
+		axis[widest] = 1.0f;
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = { 0, 0, 0, 0 };
+			float length = 0;
+			for (int a = 0; a < channelsN; a++)
+			{
+				for (int b = 0; b < channelsN; b++)
+				{
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length += next[a] * next[a];
+			}
+			if (length <= 1e-12f)
+			{
+				break;
+			}
+			length = 1.0f / sqrtf(length);
+			for (int c = 0; c < channelsN; c++)
+			{
+				axis[c] = next[c] * length;
+			}
+		}
+		float tMin = 1e30f;
+		float tMax = -1e30f;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0;
+			for (int c = 0; c < channelsN; c++)
+			{
+				t += (texels[(i * 4) + c] - mean[c]) * axis[c];
+			}
+			tMin = min(tMin, t);
+			tMax = max(tMax, t);
+		}
+		for (int c = 0; c < channelsN; c++)
+		{
+			e0[c] = clamp(mean[c] + (tMax * axis[c]), 0.0f, 255.0f);
+			e1[c] = clamp(mean[c] + (tMin * axis[c]), 0.0f, 255.0f);
+		}
+	}
+
+	// Endpoints minimising the squared error for texels already assigned interpolation weights, where weight 0 is
+	// all e0 and 1 is all e1. Leaves the endpoints alone when every texel got the same weight.
+	static void leastSquares(const float* texels, int channelsN, const float* weights, float* e0, float* e1)
+	{
+		float aa = 0;
+		float ab = 0;
+		float bb = 0;
+		float ax[4] = { 0, 0, 0, 0 };
+		float bx[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			float b = weights[i];
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channelsN; c++)
+			{
+				ax[c] += a * texels[(i * 4) + c];
+				bx[c] += b * texels[(i * 4) + c];
+			}
+		}
+		float determinant = (aa * bb) - (ab * ab);
+		if (fabsf(determinant) < 1e-6f)
+		{
+			return;
+		}
+		float inverse = 1.0f / determinant;
+		for (int c = 0; c < channelsN; c++)
+		{
+			e0[c] = clamp(((bb * ax[c]) - (ab * bx[c])) * inverse, 0.0f, 255.0f);
+			e1[c] = clamp(((aa * bx[c]) - (ab * ax[c])) * inverse, 0.0f, 255.0f);
+		}
+	}
+
+	static void toFloat(const unsigned char* block, float* texels)
+	{
+		for (int i = 0; i < 64; i++)
+		{
+			texels[i] = block[i];
+		}
+	}
+
+	// Picks the closest palette entry for every texel and returns the total squared error
+	static int selectIndices(const unsigned char* block, int channelsN, const int palette[][4], int paletteN, unsigned char* indices)
+	{
+		int total = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestError = 0x7fffffff;
+			for (int p = 0; p < paletteN; p++)
+			{
+				int error = 0;
+				for (int c = 0; c < channelsN; c++)
+				{
+					int d = block[(i * 4) + c] - palette[p][c];
+					error += d * d;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			indices[i] = (unsigned char)best;
+			total += bestError;
+		}
+		return total;
+	}
+
+	// ---- BC1 ----
+
+	static unsigned short to565(const float* c)
+	{
+		int r = (int)((clamp(c[0], 0.0f, 255.0f) * 31.0f / 255.0f) + 0.5f);
+		int g = (int)((clamp(c[1], 0.0f, 255.0f) * 63.0f / 255.0f) + 0.5f);
+		int b = (int)((clamp(c[2], 0.0f, 255.0f) * 31.0f / 255.0f) + 0.5f);
+		return (unsigned short)((r << 11) | (g << 5) | b);
+	}
+
+	static void from565(unsigned short v, int* c)
+	{
+		int r = (v >> 11) & 31;
+		int g = (v >> 5) & 63;
+		int b = v & 31;
+		c[0] = (r << 3) | (r >> 2);
+		c[1] = (g << 2) | (g >> 4);
+		c[2] = (b << 3) | (b >> 2);
+		c[3] = 255;
+	}
+
+	// The colours a BC1 block decodes to. Palette order is c0, c1, then the two in between.
+	static void paletteBC1(unsigned short c0, unsigned short c1, bool fourColour, int palette[4][4])
+	{
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (int c = 0; c < 4; c++)
+		{
+			if (fourColour || c0 > c1)
+			{
+				palette[2][c] = ((2 * palette[0][c]) + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + (2 * palette[1][c])) / 3;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+	}
+
+	// fourColour is set inside BC3, where the colour block always has four colours
+	static void encodeBC1(const unsigned char* block, BlockQuality quality, unsigned char* out, bool fourColour)
+	{
+		static const float weightOf[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		float texels[64];
+		toFloat(block, texels);
+		float e0[4];
+		float e1[4];
+		if (quality == BlockQuality::Fast)
+		{
+			boxEndpoints(block, 3, e0, e1);
+		}
+		else
+		{
+			axisEndpoints(texels, 3, e0, e1);
+		}
+
+		unsigned short bestC0 = 0;
+		unsigned short bestC1 = 0;
+		unsigned char bestIndices[16];
+		int bestError = 0x7fffffff;
+		int passes = quality == BlockQuality::Fast ? 1 : 3;
+		for (int pass = 0; pass < passes; pass++)
+		{
+			unsigned short c0 = to565(e0);
+			unsigned short c1 = to565(e1);
+			if (c0 < c1)
+			{
+				unsigned short t = c0;
+				c0 = c1;
+				c1 = t;
+			}
+			int palette[4][4];
+			paletteBC1(c0, c1, true, palette);
+			unsigned char indices[16];
+			int error = selectIndices(block, 3, palette, c0 == c1 ? 1 : 4, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				bestC0 = c0;
+				bestC1 = c1;
+				memcpy(bestIndices, indices, 16);
+			}
+			if (pass + 1 < passes)
+			{
+				float weights[16];
+				for (int i = 0; i < 16; i++)
+				{
+					weights[i] = weightOf[indices[i]];
+				}
+				from565f(c0, e0);
+				from565f(c1, e1);
+				leastSquares(texels, 3, weights, e0, e1);
+			}
+		}
+
+		unsigned int packed = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			packed |= (unsigned int)bestIndices[i] << (i * 2);
+		}
+		memcpy(out, &bestC0, 2);
+		memcpy(out + 2, &bestC1, 2);
+		memcpy(out + 4, &packed, 4);
+	}
+
+	static void from565f(unsigned short v, float* c)
+	{
+		int decoded[4];
+		from565(v, decoded);
+		for (int i = 0; i < 3; i++)
+		{
+			c[i] = (float)decoded[i];
+		}
+	}
+
+	static void decodeBC1(const unsigned char* in, unsigned char* block, bool fourColour)
+	{
+		unsigned short c0;
+		unsigned short c1;
+		unsigned int packed;
+		memcpy(&c0, in, 2);
+		memcpy(&c1, in + 2, 2);
+		memcpy(&packed, in + 4, 4);
+		int palette[4][4];
+		paletteBC1(c0, c1, fourColour, palette);
+		for (int i = 0; i < 16; i++)
+		{
+			int index = (packed >> (i * 2)) & 3;
+			for (int c = 0; c < 4; c++)
+			{
+				block[(i * 4) + c] = (unsigned char)palette[index][c];
+			}
+		}
+	}
+
+	// ---- BC4, one channel ----
+
+	// Palette order is a0, a1, then six interpolated values, or four and then 0 and 255 when a0 <= a1
+	static void paletteBC4(int a0, int a1, int palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1)
+		{
+			for (int i = 1; i < 7; i++)
+			{
+				palette[i + 1] = (((7 - i) * a0) + (i * a1) + 3) / 7;
+			}
+		}
+		else
+		{
+			for (int i = 1; i < 5; i++)
+			{
+				palette[i + 1] = (((5 - i) * a0) + (i * a1) + 2) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	static int selectBC4(const unsigned char* block, int channel, int a0, int a1, unsigned char* indices)
+	{
+		int palette[8];
+		paletteBC4(a0, a1, palette);
+		int total = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int v = block[(i * 4) + channel];
+			int best = 0;
+			int bestError = 0x7fffffff;
+			for (int p = 0; p < 8; p++)
+			{
+				int error = (v - palette[p]) * (v - palette[p]);
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			indices[i] = (unsigned char)best;
+			total += bestError;
+		}
+		return total;
+	}
+
+	static void encodeBC4(const unsigned char* block, int channel, BlockQuality quality, unsigned char* out)
+	{
+		int low = 255;
+		int high = 0;
+		int innerLow = 255; // Ignoring 0 and 255, which the six value mode has for free
+		int innerHigh = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int v = block[(i * 4) + channel];
+			low = min(low, v);
+			high = max(high, v);
+			if (v != 0 && v != 255)
+			{
+				innerLow = min(innerLow, v);
+				innerHigh = max(innerHigh, v);
+			}
+		}
+
+		int bestA0 = high;
+		int bestA1 = low;
+		unsigned char bestIndices[16];
+		int bestError = selectBC4(block, channel, high, low, bestIndices);
+		if (quality == BlockQuality::Quality && bestError > 0)
+		{
+			unsigned char indices[16];
+			// Nudging the ends inwards trades the extremes for finer steps in between
+			for (int inHigh = 0; inHigh <= 4; inHigh++)
+			{
+				for (int inLow = 0; inLow <= 4; inLow++)
+				{
+					int a0 = high - inHigh;
+					int a1 = low + inLow;
+					if (a0 <= a1)
+					{
+						continue;
+					}
+					int error = selectBC4(block, channel, a0, a1, indices);
+					if (error < bestError)
+					{
+						bestError = error;
+						bestA0 = a0;
+						bestA1 = a1;
+						memcpy(bestIndices, indices, 16);
+					}
+				}
+			}
+			if (innerLow <= innerHigh)
+			{
+				int error = selectBC4(block, channel, innerLow, innerHigh, indices);
+				if (error < bestError)
+				{
+					bestError = error;
+					bestA0 = innerLow;
+					bestA1 = innerHigh;
+					memcpy(bestIndices, indices, 16);
+				}
+			}
+		}
+
+		unsigned long long packed = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			packed |= (unsigned long long)bestIndices[i] << (i * 3);
+		}
+		out[0] = (unsigned char)bestA0;
+		out[1] = (unsigned char)bestA1;
+		for (int i = 0; i < 6; i++)
+		{
+			out[2 + i] = (unsigned char)(packed >> (i * 8));
+		}
+	}
+
+	static void decodeBC4(const unsigned char* in, unsigned char* block, int channel)
+	{
+		int palette[8];
+		paletteBC4(in[0], in[1], palette);
+		unsigned long long packed = 0;
+		for (int i = 0; i < 6; i++)
+		{
+			packed |= (unsigned long long)in[2 + i] << (i * 8);
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			block[(i * 4) + channel] = (unsigned char)palette[(packed >> (i * 3)) & 7];
+		}
+	}
+
+	// ---- BC7, modes 5 and 6 only ----
+	// Mode 6 has RGBA endpoints of 7 bits plus a shared low bit each and 4 bit indices, which suits texels whose
+	// alpha follows their colour. Mode 5 keeps RGB endpoints of 7 bits and alpha endpoints of 8 bits apart, with
+	// 2 bit indices for each, which suits cut out alpha.
+
+	static const int* weightsBC7()
+	{
+		static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		return weights;
+	}
+
+	static void paletteBC7(const int* e0, const int* e1, int palette[16][4])
+	{
+		const int* weights = weightsBC7();
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				palette[i][c] = (((64 - weights[i]) * e0[c]) + (weights[i] * e1[c]) + 32) >> 6;
+			}
+		}
+	}
+
+	// Rounds an endpoint to 7 bits with the given low bit
+	static void quantiseBC7(const float* e, int pBit, int* q)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int v = (int)(((e[c] - pBit) / 2.0f) + 0.5f);
+			v = clamp(v, 0, 127);
+			q[c] = (v << 1) | pBit;
+		}
+	}
+
+	static int quantisationError(const float* e, const int* q)
+	{
+		int total = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			int d = (int)(e[c] + 0.5f) - q[c];
+			total += d * d;
+		}
+		return total;
+	}
+
+	// Writes whichever mode loses less. Fast mode only tries mode 5 when alpha is not constant.
+	static void encodeBC7(const unsigned char* block, BlockQuality quality, unsigned char* out)
+	{
+		int error = encodeBC7Mode6(block, quality, out);
+		bool constantAlpha = true;
+		for (int i = 1; i < 16; i++)
+		{
+			constantAlpha = constantAlpha && block[(i * 4) + 3] == block[3];
+		}
+		if (error == 0 || (quality == BlockQuality::Fast && constantAlpha))
+		{
+			return;
+		}
+		unsigned char mode5[16];
+		if (encodeBC7Mode5(block, quality, mode5) < error)
+		{
+			memcpy(out, mode5, 16);
+		}
+	}
+
+	// Returns the squared error of the block written
+	static int encodeBC7Mode6(const unsigned char* block, BlockQuality quality, unsigned char* out)
+	{
+		float texels[64];
+		toFloat(block, texels);
+		float e0[4];
+		float e1[4];
+		if (quality == BlockQuality::Fast)
+		{
+			boxEndpoints(block, 4, e0, e1);
+		}
+		else
+		{
+			axisEndpoints(texels, 4, e0, e1);
+		}
+
+		int best0[4];
+		int best1[4];
+		unsigned char bestIndices[16];
+		int bestError = 0x7fffffff;
+		int passes = quality == BlockQuality::Fast ? 1 : 3;
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (int p0 = 0; p0 < 2; p0++)
+			{
+				for (int p1 = 0; p1 < 2; p1++)
+				{
+					int q0[4];
+					int q1[4];
+					quantiseBC7(e0, p0, q0);
+					quantiseBC7(e1, p1, q1);
+					// Fast mode only tries the low bits that round the endpoints best
+					if (quality == BlockQuality::Fast)
+					{
+						int other0[4];
+						int other1[4];
+						quantiseBC7(e0, 1 - p0, other0);
+						quantiseBC7(e1, 1 - p1, other1);
+						if (quantisationError(e0, other0) < quantisationError(e0, q0) || quantisationError(e1, other1) < quantisationError(e1, q1))
+						{
+							continue;
+						}
+					}
+					int palette[16][4];
+					paletteBC7(q0, q1, palette);
+					unsigned char indices[16];
+					int error = selectIndices(block, 4, palette, 16, indices);
+					if (error < bestError)
+					{
+						bestError = error;
+						memcpy(best0, q0, sizeof(best0));
+						memcpy(best1, q1, sizeof(best1));
+						memcpy(bestIndices, indices, 16);
+					}
+				}
+			}
+			if (pass + 1 < passes)
+			{
+				float weights[16];
+				for (int i = 0; i < 16; i++)
+				{
+					weights[i] = weightsBC7()[bestIndices[i]] / 64.0f;
+				}
+				for (int c = 0; c < 4; c++)
+				{
+					e0[c] = (float)best0[c];
+					e1[c] = (float)best1[c];
+				}
+				leastSquares(texels, 4, weights, e0, e1);
+			}
+		}
+
+		// The first index is stored with 3 bits, so its top bit has to be 0
+		if (bestIndices[0] >= 8)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				int t = best0[c];
+				best0[c] = best1[c];
+				best1[c] = t;
+			}
+			for (int i = 0; i < 16; i++)
+			{
+				bestIndices[i] = (unsigned char)(15 - bestIndices[i]);
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer;
+		writer.out = out;
+		writer.write(1 << 6, 7); // Mode 6
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write(best0[c] >> 1, 7);
+			writer.write(best1[c] >> 1, 7);
+		}
+		writer.write(best0[0] & 1, 1);
+		writer.write(best1[0] & 1, 1);
+		writer.write(bestIndices[0], 3);
+		for (int i = 1; i < 16; i++)
+		{
+			writer.write(bestIndices[i], 4);
+		}
+		return bestError;
+	}
+
+	static int expandBC7(int v, int bits)
+	{
+		return (v << (8 - bits)) | (v >> ((2 * bits) - 8));
+	}
+
+	static void paletteBC7Mode5(const int* e0, const int* e1, int palette[4][4])
+	{
+		static const int weights[4] = { 0, 21, 43, 64 };
+		for (int i = 0; i < 4; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				palette[i][c] = (((64 - weights[i]) * e0[c]) + (weights[i] * e1[c]) + 32) >> 6;
+			}
+		}
+	}
+
+	// Colour endpoints are fitted like BC1 at 7 bits, alpha spans its range, and each gets its own indices
+	static int encodeBC7Mode5(const unsigned char* block, BlockQuality quality, unsigned char* out)
+	{
+		static const float weightOf[4] = { 0.0f, 21.0f / 64.0f, 43.0f / 64.0f, 1.0f };
+		float texels[64];
+		toFloat(block, texels);
+		float e0[4];
+		float e1[4];
+		if (quality == BlockQuality::Fast)
+		{
+			boxEndpoints(block, 3, e0, e1);
+		}
+		else
+		{
+			axisEndpoints(texels, 3, e0, e1);
+		}
+		int low = 255;
+		int high = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			low = min(low, (int)block[(i * 4) + 3]);
+			high = max(high, (int)block[(i * 4) + 3]);
+		}
+
+		int q0[4] = { 0, 0, 0, high };
+		int q1[4] = { 0, 0, 0, low };
+		int best0[4];
+		int best1[4];
+		unsigned char colourIndices[16];
+		int colourError = 0x7fffffff;
+		int passes = quality == BlockQuality::Fast ? 1 : 3;
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				q0[c] = expandBC7(clamp((int)((e0[c] * 127.0f / 255.0f) + 0.5f), 0, 127), 7);
+				q1[c] = expandBC7(clamp((int)((e1[c] * 127.0f / 255.0f) + 0.5f), 0, 127), 7);
+			}
+			int palette[4][4];
+			paletteBC7Mode5(q0, q1, palette);
+			unsigned char indices[16];
+			int error = selectIndices(block, 3, palette, 4, indices);
+			if (error < colourError)
+			{
+				colourError = error;
+				memcpy(best0, q0, sizeof(best0));
+				memcpy(best1, q1, sizeof(best1));
+				memcpy(colourIndices, indices, 16);
+			}
+			if (pass + 1 < passes)
+			{
+				float weights[16];
+				for (int i = 0; i < 16; i++)
+				{
+					weights[i] = weightOf[indices[i]];
+				}
+				leastSquares(texels, 3, weights, e0, e1);
+			}
+		}
+
+		int palette[4][4];
+		paletteBC7Mode5(best0, best1, palette);
+		unsigned char alphaIndices[16];
+		int alphaError = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestError = 0x7fffffff;
+			for (int p = 0; p < 4; p++)
+			{
+				int d = block[(i * 4) + 3] - palette[p][3];
+				if (d * d < bestError)
+				{
+					bestError = d * d;
+					best = p;
+				}
+			}
+			alphaIndices[i] = (unsigned char)best;
+			alphaError += bestError;
+		}
+
+		// Both first indices are stored with 1 bit, so their top bits have to be 0
+		if (colourIndices[0] >= 2)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int t = best0[c];
+				best0[c] = best1[c];
+				best1[c] = t;
+			}
+			for (int i = 0; i < 16; i++)
+			{
+				colourIndices[i] = (unsigned char)(3 - colourIndices[i]);
+			}
+		}
+		if (alphaIndices[0] >= 2)
+		{
+			int t = best0[3];
+			best0[3] = best1[3];
+			best1[3] = t;
+			for (int i = 0; i < 16; i++)
+			{
+				alphaIndices[i] = (unsigned char)(3 - alphaIndices[i]);
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer;
+		writer.out = out;
+		writer.write(1 << 5, 6); // Mode 5
+		writer.write(0, 2); // No channel rotation
+		for (int c = 0; c < 3; c++)
+		{
+			writer.write(best0[c] >> 1, 7);
+			writer.write(best1[c] >> 1, 7);
+		}
+		writer.write(best0[3], 8);
+		writer.write(best1[3], 8);
+		for (int i = 0; i < 16; i++)
+		{
+			writer.write(colourIndices[i], i == 0 ? 1 : 2);
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			writer.write(alphaIndices[i], i == 0 ? 1 : 2);
+		}
+		return colourError + alphaError;
+	}
+
+	// Anything other than modes 5 and 6 decodes as transparent black, this is only used to check our own output
+	static void decodeBC7(const unsigned char* in, unsigned char* block)
+	{
+		if ((in[0] & 0x3f) == (1 << 5))
+		{
+			decodeBC7Mode5(in, block);
+			return;
+		}
+		if ((in[0] & 0x7f) != (1 << 6))
+		{
+			memset(block, 0, 64);
+			return;
+		}
+		BitReader reader;
+		reader.in = in;
+		reader.read(7);
+		int e0[4];
+		int e1[4];
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] = reader.read(7) << 1;
+			e1[c] = reader.read(7) << 1;
+		}
+		int p0 = reader.read(1);
+		int p1 = reader.read(1);
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] |= p0;
+			e1[c] |= p1;
+		}
+		int palette[16][4];
+		paletteBC7(e0, e1, palette);
+		for (int i = 0; i < 16; i++)
+		{
+			int index = reader.read(i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+			{
+				block[(i * 4) + c] = (unsigned char)palette[index][c];
+			}
+		}
+	}
+
+	static void decodeBC7Mode5(const unsigned char* in, unsigned char* block)
+	{
+		BitReader reader;
+		reader.in = in;
+		reader.read(6);
+		int rotation = reader.read(2);
+		int e0[4];
+		int e1[4];
+		for (int c = 0; c < 3; c++)
+		{
+			e0[c] = expandBC7(reader.read(7), 7);
+			e1[c] = expandBC7(reader.read(7), 7);
+		}
+		e0[3] = reader.read(8);
+		e1[3] = reader.read(8);
+		int palette[4][4];
+		paletteBC7Mode5(e0, e1, palette);
+		int colourIndices[16];
+		for (int i = 0; i < 16; i++)
+		{
+			colourIndices[i] = reader.read(i == 0 ? 1 : 2);
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			int alphaIndex = reader.read(i == 0 ? 1 : 2);
+			unsigned char* texel = block + (i * 4);
+			for (int c = 0; c < 3; c++)
+			{
+				texel[c] = (unsigned char)palette[colourIndices[i]][c];
+			}
+			texel[3] = (unsigned char)palette[alphaIndex][3];
+			if (rotation != 0)
+			{
+				unsigned char t = texel[3];
+				texel[3] = texel[rotation - 1];
+				texel[rotation - 1] = t;
+			}
+		}
+	}
+};
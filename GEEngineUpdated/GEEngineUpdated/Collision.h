@@ -34,6 +34,21 @@ struct BoundingBox {
         if (p.y > max.y) max.y = p.y;
         if (p.z > max.z) max.z = p.z;
     }
+
+    // Box enclosing this box after transforming it, e.g. local mesh bounds into world space
+    BoundingBox transform(const Matrix& m) const {
+        Vec3 corners[8] = {
+            Vec3(min.x, min.y, min.z), Vec3(max.x, min.y, min.z), Vec3(min.x, max.y, min.z), Vec3(max.x, max.y, min.z),
+            Vec3(min.x, min.y, max.z), Vec3(max.x, min.y, max.z), Vec3(min.x, max.y, max.z), Vec3(max.x, max.y, max.z)
+        };
+        m.transformPoints(corners, corners, 8);
+
+        BoundingBox box;
+        for (int i = 0; i < 8; i++) {
+            box.extend(corners[i]);
+        }
+        return box;
+    }
 };
 
 struct Ray {
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "JobSystem.h"
+
+// A run of draws, [begin, end), recorded into one command list
+struct DrawRange
+{
+	int begin = 0;
+	int end = 0;
+};
+
+// Cuts a frame's draws into contiguous runs, one per command list, keeping their order so that executing the
+// lists one after another draws everything in the order it was submitted
+class DrawPartitioner
+{
+public:
+	// At most listsN runs of about the same number of draws, none shorter than minPerList unless there is only one
+	static void split(int count, int listsN, int minPerList, std::vector<DrawRange>& ranges)
+	{
+		ranges.clear();
+		if (count <= 0)
+		{
+			return;
+		}
+		minPerList = minPerList < 1 ? 1 : minPerList;
+		int runsN = runsFor(count, listsN, minPerList);
+		int begin = 0;
+		for (int i = 0; i < runsN; i++)
+		{
+			// Spread the remainder over the first runs
+			int end = begin + (count / runsN) + (i < count % runsN ? 1 : 0);
+			ranges.push_back(DrawRange{ begin, end });
+			begin = end;
+		}
+	}
+
+	// Same, balancing costs[i], e.g. each draw's index count, rather than the number of draws. Each run ends at the
+	// first draw that takes it past its share of the total.
+	static void splitByCost(const std::vector<float>& costs, int listsN, int minPerList, std::vector<DrawRange>& ranges)
+	{
+		ranges.clear();
+		int count = (int)costs.size();
+		if (count == 0)
+		{
+			return;
+		}
+		minPerList = minPerList < 1 ? 1 : minPerList;
+		int runsN = runsFor(count, listsN, minPerList);
+		double total = 0;
+		for (int i = 0; i < count; i++)
+		{
+			total += costs[i];
+		}
+		int begin = 0;
+		double done = 0;
+		for (int r = 0; r < runsN && begin < count; r++)
+		{
+			int end = count;
+			if (r < runsN - 1)
+			{
+				double target = (total * (r + 1)) / runsN;
+				end = begin;
+				while (end < count && (end - begin < minPerList || done < target))
+				{
+					done += costs[end];
+					end++;
+				}
+				// Leave enough for the runs still to come
+				int left = (runsN - r - 1) * minPerList;
+				if (count - end < left)
+				{
+					end = count - left > begin ? count - left : begin + 1;
+				}
+			}
+			ranges.push_back(DrawRange{ begin, end });
+			begin = end;
+		}
+	}
+
+private:
+	static int runsFor(int count, int listsN, int minPerList)
+	{
+		int runsN = count / minPerList;
+		runsN = runsN > listsN ? listsN : runsN;
+		return runsN < 1 ? 1 : runsN;
+	}
+};
+
+// Where recorded lists go. Core's backend has an allocator and a command list per list slot per frame in flight,
+// the null backend just remembers what was recorded so the partitioning and ordering run without a GPU.
+class RecordingBackend
+{
+public:
+	virtual ~RecordingBackend() {}
+	virtual int listsN() const = 0;
+	// Opens slot list of the frame being recorded on the calling thread, with the frame's render targets,
+	// viewport, root signature and descriptor heaps already set. Nothing else carries over from other lists.
+	virtual void begin(int list) = 0;
+	virtual void end(int list) = 0;
+	// Submits lists 0 to count - 1 in that order, in one batch, after everything recorded on the frame so far
+	virtual void execute(int count) = 0;
+};
+
+// Records what each list was given, as ints the caller picks, usually draw indices, and what order lists were
+// executed in. Flags a list recorded from two threads at once, or used while not open.
+class NullRecordingBackend : public RecordingBackend
+{
+public:
+	std::vector<int> executed; // Everything submitted so far, in execution order
+	int batchesN = 0;
+	std::atomic<int> errorsN;
+
+	NullRecordingBackend(int _listsN = 8) : errorsN(0), slots(_listsN)
+	{
+		for (int i = 0; i < _listsN; i++)
+		{
+			slots[i].reset(new Slot());
+		}
+	}
+
+	int listsN() const override
+	{
+		return (int)slots.size();
+	}
+
+	void begin(int list) override
+	{
+		Slot& slot = *slots[list];
+		if (slot.open.exchange(true))
+		{
+			errorsN++;
+		}
+		slot.commands.clear();
+	}
+
+	void record(int list, int command)
+	{
+		Slot& slot = *slots[list];
+		if (!slot.open)
+		{
+			errorsN++;
+		}
+		slot.commands.push_back(command);
+	}
+
+	void end(int list) override
+	{
+		if (!slots[list]->open.exchange(false))
+		{
+			errorsN++;
+		}
+	}
+
+	void execute(int count) override
+	{
+		for (int i = 0; i < count; i++)
+		{
+			Slot& slot = *slots[i];
+			if (slot.open)
+			{
+				errorsN++;
+			}
+			executed.insert(executed.end(), slot.commands.begin(), slot.commands.end());
+		}
+		batchesN++;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<bool> open;
+		std::vector<int> commands;
+		Slot() : open(false) {}
+	};
+
+	std::vector<std::unique_ptr<Slot>> slots;
+};
+
+// Records a frame's draws on the job system, a run per command list, then executes the lists in order. Whatever
+// records a run must bind its own pipeline state and per draw resources, since lists start from scratch, and
+// must only touch state that is safe to write from several threads. Under 2 * minPerList draws there is one list
+// and nothing in parallel, just an extra submit, which is why the game's handful of draws stay on the main thread.
+class ParallelRecorder
+{
+public:
+	int minPerList = 64; // Fewer draws than this are not worth a list of their own
+	int listsUsed = 0; // By the last record
+
+	void init(JobSystem* _jobs, RecordingBackend* _backend)
+	{
+		jobs = _jobs;
+		backend = _backend;
+	}
+
+	// Calls recordRange(list, begin, end) for each run of [0, count), from whichever thread picks the run up
+	template<typename F>
+	void record(int count, F recordRange)
+	{
+		DrawPartitioner::split(count, maxLists(), minPerList, ranges);
+		run(recordRange);
+	}
+
+	// Same, splitting by cost
+	template<typename F>
+	void record(const std::vector<float>& costs, F recordRange)
+	{
+		DrawPartitioner::splitByCost(costs, maxLists(), minPerList, ranges);
+		run(recordRange);
+	}
+
+	const std::vector<DrawRange>& lastRanges() const
+	{
+		return ranges;
+	}
+
+private:
+	JobSystem* jobs = nullptr;
+	RecordingBackend* backend = nullptr;
+	std::vector<DrawRange> ranges;
+
+	int maxLists() const
+	{
+		int threads = jobs->threadsN();
+		return threads < backend->listsN() ? threads : backend->listsN();
+	}
+
+	template<typename F>
+	void run(F& recordRange)
+	{
+		listsUsed = (int)ranges.size();
+		if (listsUsed == 0)
+		{
+			return;
+		}
+		JobCounter counter;
+		for (int i = 0; i < listsUsed; i++)
+		{
+			DrawRange range = ranges[i];
+			jobs->run(counter, [this, &recordRange, i, range]()
+			{
+				backend->begin(i);
+				recordRange(i, range.begin, range.end);
+				backend->end(i);
+			});
+		}
+		jobs->wait(counter);
+		backend->execute(listsUsed);
+	}
+};
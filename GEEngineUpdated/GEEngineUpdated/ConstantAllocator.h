@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Where a draw's constants went. data is offset bytes into the allocator's memory.
+struct ConstantAllocation
+{
+	size_t offset = 0;
+	unsigned char* data = nullptr;
+};
+
+// Hands out constant buffer space from one persistently mapped buffer split between the frames in flight. Each
+// frame bumps through its own part, 256 byte aligned as constant buffer views need, and gets all of it back when
+// it comes round again, once its fence has been waited on. Allocating is one atomic add, so threads recording the
+// same frame can share it. A full part fails the allocation and counts an overflow, rather than wrapping onto
+// constants the GPU may still be reading.
+class FrameConstantAllocator
+{
+public:
+	static const size_t alignment = 256;
+
+	FrameConstantAllocator() : used(0), overflows(0) {}
+
+	void init(unsigned char* _memory, size_t capacity, unsigned int framesN)
+	{
+		framesN = framesN == 0 ? 1 : framesN;
+		memory = _memory;
+		partN = (capacity / framesN) & ~(alignment - 1);
+		partsN = framesN;
+		frame = 0;
+		used = 0;
+		overflows = 0;
+		peakN = 0;
+		overflowsN = 0;
+	}
+
+	bool allocate(size_t bytes, ConstantAllocation& allocation)
+	{
+		bytes = (bytes + alignment - 1) & ~(alignment - 1);
+		size_t start = used.fetch_add(bytes);
+		if (start + bytes > partN)
+		{
+			overflows++;
+			return false;
+		}
+		allocation.offset = (frame * partN) + start;
+		allocation.data = memory + allocation.offset;
+		return true;
+	}
+
+	// Starts frameIndex once the GPU has finished with it, handing its part out again
+	void beginFrame(unsigned int frameIndex)
+	{
+		size_t usedN = usedThisFrame();
+		peakN = usedN > peakN ? usedN : peakN;
+		overflowsN += overflows;
+		frame = frameIndex % partsN;
+		used = 0;
+		overflows = 0;
+	}
+
+	// Per frame
+	size_t partCapacity() const
+	{
+		return partN;
+	}
+
+	size_t usedThisFrame() const
+	{
+		size_t usedN = used;
+		return usedN > partN ? partN : usedN;
+	}
+
+	// Allocations that did not fit in the frame being recorded
+	int overflowsThisFrame() const
+	{
+		return overflows;
+	}
+
+	// Most any finished frame used
+	size_t peak() const
+	{
+		return peakN;
+	}
+
+	// Over every finished frame
+	int totalOverflows() const
+	{
+		return overflowsN;
+	}
+
+private:
+	unsigned char* memory = nullptr;
+	size_t partN = 0;
+	unsigned int partsN = 1;
+	unsigned int frame = 0;
+	std::atomic<size_t> used; // Bytes handed out this frame, past partN once it has overflowed
+	std::atomic<int> overflows;
+	size_t peakN = 0;
+	int overflowsN = 0;
+};
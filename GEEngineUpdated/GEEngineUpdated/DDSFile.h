@@ -0,0 +1,206 @@
+#pragma once
+
+#include <Windows.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "GEMMappedLoader.h"
+#include "AssetCache.h"
+#include "BlockCompression.h"
+
+// The parts of a DDS file with the DX10 extension header that cooked textures use. Levels follow the headers
+// back to back with no row padding, as the format defines.
+struct DDSPixelFormat
+{
+	unsigned int size = 32;
+	unsigned int flags = 0;
+	unsigned int fourCC = 0;
+	unsigned int rgbBitCount = 0;
+	unsigned int masks[4] = {};
+};
+
+struct DDSHeader
+{
+	unsigned int size = 124;
+	unsigned int flags = 0;
+	unsigned int height = 0;
+	unsigned int width = 0;
+	unsigned int pitchOrLinearSize = 0;
+	unsigned int depth = 0;
+	unsigned int mipMapCount = 0;
+	unsigned int reserved1[11] = {}; // Free for tools, cooked textures keep the source stamp here
+	DDSPixelFormat pixelFormat;
+	unsigned int caps = 0;
+	unsigned int caps2 = 0;
+	unsigned int caps3 = 0;
+	unsigned int caps4 = 0;
+	unsigned int reserved2 = 0;
+};
+
+struct DDSHeaderDX10
+{
+	unsigned int dxgiFormat = 0;
+	unsigned int resourceDimension = 3; // D3D12_RESOURCE_DIMENSION_TEXTURE2D
+	unsigned int miscFlag = 0;
+	unsigned int arraySize = 1;
+	unsigned int miscFlags2 = 0;
+};
+
+// What a cooked texture holds. data points into the mapped file.
+struct DDSInfo
+{
+	TextureFormat format = TextureFormat::RGBA8;
+	bool srgb = false;
+	int width = 0;
+	int height = 0;
+	int levelsN = 0;
+	AssetSourceStamp source;
+	const unsigned char* data = nullptr;
+	size_t bytes = 0;
+};
+
+class DDSFile
+{
+public:
+	static const unsigned int magic = 0x20534444; // "DDS "
+	static const unsigned int fourCCDX10 = 0x30315844; // "DX10"
+	static const unsigned int stampTag = 0x504D5453; // "STMP", marks reserved1 as holding the source stamp
+
+	// The cooked file sits next to its source, Textures/foo.png becomes Textures/foo.dds
+	static std::string cookedFilename(const std::string& filename)
+	{
+		size_t dot = filename.find_last_of('.');
+		size_t slash = filename.find_last_of("\\/");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		{
+			return filename + ".dds";
+		}
+		return filename.substr(0, dot) + ".dds";
+	}
+
+	// Values of DXGI_FORMAT, without needing dxgi.h
+	static unsigned int dxgiFormat(TextureFormat format, bool srgb)
+	{
+		switch (format)
+		{
+		case TextureFormat::BC1:
+			return srgb ? 72 : 71;
+		case TextureFormat::BC3:
+			return srgb ? 78 : 77;
+		case TextureFormat::BC5:
+			return 83; // BC5 has no sRGB form
+		case TextureFormat::BC7:
+			return srgb ? 99 : 98;
+		default:
+			return srgb ? 29 : 28;
+		}
+	}
+
+	static bool fromDXGIFormat(unsigned int dxgi, TextureFormat& format, bool& srgb)
+	{
+		const TextureFormat formats[] = { TextureFormat::RGBA8, TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC5, TextureFormat::BC7 };
+		for (int f = 0; f < 5; f++)
+		{
+			for (int s = 0; s < 2; s++)
+			{
+				if (dxgiFormat(formats[f], s == 1) == dxgi)
+				{
+					format = formats[f];
+					srgb = s == 1 && formats[f] != TextureFormat::BC5;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Writes a chain laid out by BlockCompression::layout, dropping the row padding
+	static bool write(const std::string& filename, TextureFormat format, bool srgb, const std::vector<MipLevel>& levels, const unsigned char* data, const AssetSourceStamp& source)
+	{
+		DDSHeader header;
+		header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000; // Caps, height, width, pixel format, mip count
+		header.height = levels[0].height;
+		header.width = levels[0].width;
+		header.pitchOrLinearSize = BlockCompression::isBlock(format) ? levels[0].rowBytes * levels[0].rowsN : levels[0].rowBytes;
+		header.flags |= BlockCompression::isBlock(format) ? 0x80000 : 0x8; // Linear size or pitch
+		header.mipMapCount = (unsigned int)levels.size();
+		header.reserved1[0] = stampTag;
+		header.reserved1[1] = (unsigned int)(source.bytes & 0xffffffff);
+		header.reserved1[2] = (unsigned int)(source.bytes >> 32);
+		header.reserved1[3] = (unsigned int)(source.writeTime & 0xffffffff);
+		header.reserved1[4] = (unsigned int)(source.writeTime >> 32);
+		header.pixelFormat.flags = 0x4; // FourCC
+		header.pixelFormat.fourCC = fourCCDX10;
+		header.caps = 0x1000 | (levels.size() > 1 ? 0x400000 | 0x8 : 0); // Texture, mipmap, complex
+		DDSHeaderDX10 dx10;
+		dx10.dxgiFormat = dxgiFormat(format, srgb);
+
+		// Written to the side and moved over, so a half written file is never picked up
+		std::string temporary = filename + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			if (!file)
+			{
+				return false;
+			}
+			const unsigned int fileMagic = magic;
+			file.write(reinterpret_cast<const char*>(&fileMagic), sizeof(fileMagic));
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(&dx10), sizeof(dx10));
+			for (int l = 0; l < levels.size(); l++)
+			{
+				for (int y = 0; y < levels[l].rowsN; y++)
+				{
+					file.write(reinterpret_cast<const char*>(data + levels[l].offset + ((size_t)y * levels[l].rowPitch)), levels[l].rowBytes);
+				}
+			}
+			if (!file)
+			{
+				return false;
+			}
+		}
+		return MoveFileExA(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	// Maps a DDS file and checks it is one this engine can upload, with every level present
+	static bool open(const std::string& filename, GEMLoader::GEMMappedFile& file, DDSInfo& info)
+	{
+		unsigned int fileMagic = 0;
+		DDSHeader header;
+		DDSHeaderDX10 dx10;
+		if (!file.open(filename) || !file.read(fileMagic) || fileMagic != magic || !file.read(header) || header.size != sizeof(DDSHeader))
+		{
+			return false;
+		}
+		if (header.pixelFormat.fourCC != fourCCDX10 || !file.read(dx10) || dx10.resourceDimension != 3 || dx10.arraySize != 1)
+		{
+			return false;
+		}
+		if (!fromDXGIFormat(dx10.dxgiFormat, info.format, info.srgb))
+		{
+			return false;
+		}
+		info.width = (int)header.width;
+		info.height = (int)header.height;
+		info.levelsN = header.mipMapCount == 0 ? 1 : (int)header.mipMapCount;
+		info.source = AssetSourceStamp();
+		if (header.reserved1[0] == stampTag)
+		{
+			info.source.bytes = ((unsigned long long)header.reserved1[2] << 32) | header.reserved1[1];
+			info.source.writeTime = ((unsigned long long)header.reserved1[4] << 32) | header.reserved1[3];
+		}
+		std::vector<MipLevel> levels;
+		BlockCompression::layout(info.width, info.height, info.levelsN, info.format, levels);
+		if ((int)levels.size() != info.levelsN)
+		{
+			return false;
+		}
+		info.bytes = 0;
+		for (int l = 0; l < levels.size(); l++)
+		{
+			info.bytes += (size_t)levels[l].rowBytes * levels[l].rowsN;
+		}
+		info.data = file.take(info.bytes);
+		return info.data != nullptr;
+	}
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+// A slot, or the first of a range of slots, in a descriptor heap. generation is the slot's at the time it was
+// handed out, so a handle kept after it was freed is caught rather than pointing at whatever took the slot next.
+struct DescriptorHandle
+{
+	static const unsigned int invalidIndex = 0xffffffff;
+	unsigned int index = invalidIndex;
+	unsigned int count = 0;
+	unsigned int generation = 0;
+
+	bool valid() const
+	{
+		return index != invalidIndex;
+	}
+};
+
+// Hands out the slots of a descriptor heap without touching the device, so it runs headless. The front of the
+// heap is persistent, allocated and freed explicitly. The back is a transient region split between the frames in
+// flight, handed out by bumping through the current frame's part and reset when that frame comes round again.
+// Single slots and ranges, for descriptor tables, are both first fit over one sorted list of free spans that
+// merges neighbours as they come back, and a span that reaches the untouched top of the persistent region goes
+// back to it. So freeing everything always leaves the whole region in one piece, however it was handed out.
+class DescriptorAllocator
+{
+public:
+	void init(unsigned int capacity, unsigned int transientCapacity, unsigned int framesN)
+	{
+		framesN = framesN == 0 ? 1 : framesN;
+		transientCapacity = transientCapacity > capacity ? capacity : transientCapacity;
+		persistentN = capacity - transientCapacity;
+		transientPartN = transientCapacity / framesN;
+		generations.assign(capacity, 0);
+		counts.assign(capacity, 0);
+		spans.clear();
+		top = 0;
+		liveN = 0;
+		peakN = 0;
+		transientUsed.assign(framesN, 0);
+		transientEpochs.assign(framesN, 0);
+		frame = 0;
+	}
+
+	DescriptorHandle allocate()
+	{
+		unsigned int index = DescriptorHandle::invalidIndex;
+		if (!spans.empty())
+		{
+			index = spans[0].start;
+			spans[0].start++;
+			spans[0].count--;
+			if (spans[0].count == 0)
+			{
+				spans.erase(spans.begin());
+			}
+		}
+		else if (top < persistentN)
+		{
+			index = top++;
+		}
+		return take(index, 1);
+	}
+
+	// count slots next to each other, for a descriptor table
+	DescriptorHandle allocateRange(unsigned int count)
+	{
+		if (count <= 1)
+		{
+			return count == 1 ? allocate() : DescriptorHandle();
+		}
+		for (int i = 0; i < spans.size(); i++)
+		{
+			if (spans[i].count >= count)
+			{
+				unsigned int index = spans[i].start;
+				spans[i].start += count;
+				spans[i].count -= count;
+				if (spans[i].count == 0)
+				{
+					spans.erase(spans.begin() + i);
+				}
+				return take(index, count);
+			}
+		}
+		if (persistentN - top >= count)
+		{
+			unsigned int index = top;
+			top += count;
+			return take(index, count);
+		}
+		return DescriptorHandle();
+	}
+
+	// Returns the slots and clears handle. False, leaving everything alone, when handle was already freed.
+	bool free(DescriptorHandle& handle)
+	{
+		if (!isLive(handle) || handle.index >= persistentN)
+		{
+			return false;
+		}
+		generations[handle.index]++;
+		counts[handle.index] = 0;
+		liveN -= handle.count;
+		giveBack(handle.index, handle.count);
+		handle = DescriptorHandle();
+		return true;
+	}
+
+	// Whether handle still refers to the allocation it was given for
+	bool isLive(const DescriptorHandle& handle) const
+	{
+		if (!handle.valid() || handle.index >= generations.size())
+		{
+			return false;
+		}
+		if (handle.index >= persistentN)
+		{
+			unsigned int part = transientPart(handle.index);
+			return part < transientEpochs.size() && transientEpochs[part] == handle.generation;
+		}
+		return counts[handle.index] == handle.count && generations[handle.index] == handle.generation;
+	}
+
+	// Slots that last until this frame comes round again. Invalid when the frame's part is full.
+	DescriptorHandle allocateTransient(unsigned int count)
+	{
+		DescriptorHandle handle;
+		if (count == 0 || transientUsed[frame] + count > transientPartN)
+		{
+			return handle;
+		}
+		handle.index = persistentN + (frame * transientPartN) + transientUsed[frame];
+		handle.count = count;
+		handle.generation = transientEpochs[frame];
+		transientUsed[frame] += count;
+		return handle;
+	}
+
+	// Starts frameIndex once the GPU has finished with it, which hands its transient part out again
+	void beginFrame(unsigned int frameIndex)
+	{
+		frame = frameIndex % transientUsed.size();
+		transientUsed[frame] = 0;
+		transientEpochs[frame]++;
+	}
+
+	unsigned int persistentCapacity() const
+	{
+		return persistentN;
+	}
+
+	unsigned int live() const
+	{
+		return liveN;
+	}
+
+	unsigned int peak() const
+	{
+		return peakN;
+	}
+
+	unsigned int transientUsedThisFrame() const
+	{
+		return transientUsed.empty() ? 0 : transientUsed[frame];
+	}
+
+private:
+	struct Span
+	{
+		unsigned int start;
+		unsigned int count;
+	};
+
+	unsigned int persistentN = 0;
+	unsigned int transientPartN = 0;
+	std::vector<unsigned int> generations; // Per slot, bumped on free
+	std::vector<unsigned int> counts; // At the first slot of each live allocation, 0 elsewhere
+	std::vector<Span> spans; // Sorted by start, never touching each other
+	unsigned int top = 0; // Persistent slots from here up have never been handed out
+	unsigned int liveN = 0;
+	unsigned int peakN = 0;
+	std::vector<unsigned int> transientUsed; // Per frame
+	std::vector<unsigned int> transientEpochs; // Per frame, bumped each time it is reset
+	unsigned int frame = 0;
+
+	DescriptorHandle take(unsigned int index, unsigned int count)
+	{
+		DescriptorHandle handle;
+		if (index == DescriptorHandle::invalidIndex)
+		{
+			return handle;
+		}
+		handle.index = index;
+		handle.count = count;
+		handle.generation = generations[index];
+		counts[index] = count;
+		liveN += count;
+		peakN = liveN > peakN ? liveN : peakN;
+		return handle;
+	}
+
+	unsigned int transientPart(unsigned int index) const
+	{
+		return transientPartN == 0 ? (unsigned int)transientEpochs.size() : (index - persistentN) / transientPartN;
+	}
+
+	void giveBack(unsigned int start, unsigned int count)
+	{
+		int i = (int)(std::lower_bound(spans.begin(), spans.end(), start, [](const Span& span, unsigned int value) { return span.start < value; }) - spans.begin());
+		spans.insert(spans.begin() + i, Span{ start, count });
+		if (i + 1 < spans.size() && spans[i].start + spans[i].count == spans[i + 1].start)
+		{
+			spans[i].count += spans[i + 1].count;
+			spans.erase(spans.begin() + i + 1);
+		}
+		if (i > 0 && spans[i - 1].start + spans[i - 1].count == spans[i].start)
+		{
+			spans[i - 1].count += spans[i].count;
+			spans.erase(spans.begin() + i);
+			i--;
+		}
+		// A span reaching the top goes back to it, so later ranges can grow into it
+		if (spans[i].start + spans[i].count == top)
+		{
+			top = spans[i].start;
+			spans.erase(spans.begin() + i);
+		}
+	}
+};
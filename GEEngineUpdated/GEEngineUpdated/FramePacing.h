@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// CPU side frame timings, one sample per frame: the time from one beginFrame to the next, and how much of it the
+// CPU spent waiting for the GPU or the swap chain before it could start recording. More frames in flight trade a
+// shorter wait for more latency, this shows where a setting lands.
+class FramePacing
+{
+public:
+	std::vector<float> frameMs;
+	std::vector<float> waitMs;
+	std::vector<float> latencyMs; // Only filled by simulate, the CPU cannot see when the GPU finished a frame
+
+	void add(float frame, float wait)
+	{
+		frameMs.push_back(frame);
+		waitMs.push_back(wait);
+	}
+
+	int count() const
+	{
+		return (int)frameMs.size();
+	}
+
+	void reset()
+	{
+		frameMs.clear();
+		waitMs.clear();
+		latencyMs.clear();
+	}
+
+	static float average(const std::vector<float>& values)
+	{
+		double total = 0;
+		for (int i = 0; i < values.size(); i++)
+		{
+			total += values[i];
+		}
+		return values.empty() ? 0.0f : (float)(total / values.size());
+	}
+
+	// fraction from 0 to 1, 0.95 for the 95th percentile
+	static float percentile(const std::vector<float>& values, float fraction)
+	{
+		if (values.empty())
+		{
+			return 0.0f;
+		}
+		std::vector<float> sorted = values;
+		std::sort(sorted.begin(), sorted.end());
+		int i = (int)(fraction * (sorted.size() - 1) + 0.5f);
+		return sorted[i];
+	}
+
+	std::string report(const std::string& label) const
+	{
+		float frame = average(frameMs);
+		float wait = average(waitMs);
+		std::string line = "[FramePacing] " + label + ": " + std::to_string(count()) + " frames, " + std::to_string(frame > 0 ? 1000.0f / frame : 0.0f) + " fps, frame " + std::to_string(frame) + " ms (p95 " +
+			std::to_string(percentile(frameMs, 0.95f)) + ", p99 " + std::to_string(percentile(frameMs, 0.99f)) + "), CPU wait " + std::to_string(wait) + " ms (" + std::to_string(frame > 0 ? (wait * 100.0f) / frame : 0.0f) + "%)";
+		if (!latencyMs.empty())
+		{
+			line += ", latency " + std::to_string(average(latencyMs)) + " ms";
+		}
+		return line + "\n";
+	}
+
+	// Plays frames through the CPU and GPU the way Core pipelines them. Frame i records once the GPU has finished
+	// frame i - framesInFlight, and with maxLatency it also waits for the swap chain, i.e. for frame i - maxLatency.
+	// The GPU starts a frame once it is submitted and the previous one is done. cpuMs and gpuMs vary by up to
+	// jitter either way. Latency runs from the start of recording to the GPU finishing.
+	static FramePacing simulate(int framesInFlight, int maxLatency, float cpuMs, float gpuMs, float jitter, int framesN)
+	{
+		FramePacing pacing;
+		std::vector<double> gpuEnd(framesN, 0.0);
+		double cpuEnd = 0;
+		double lastStart = 0;
+		unsigned int seed = 12345;
+		for (int i = 0; i < framesN; i++)
+		{
+			double ready = cpuEnd;
+			if (i >= framesInFlight)
+			{
+				ready = gpuEnd[i - framesInFlight] > ready ? gpuEnd[i - framesInFlight] : ready;
+			}
+			if (maxLatency > 0 && i >= maxLatency)
+			{
+				ready = gpuEnd[i - maxLatency] > ready ? gpuEnd[i - maxLatency] : ready;
+			}
+			double start = ready;
+			double waited = ready - cpuEnd;
+			seed = (seed * 1103515245) + 12345;
+			double cpu = cpuMs + (jitter * ((((seed >> 8) & 0xffff) / 32767.5) - 1.0));
+			seed = (seed * 1103515245) + 12345;
+			double gpu = gpuMs + (jitter * ((((seed >> 8) & 0xffff) / 32767.5) - 1.0));
+			cpuEnd = start + cpu;
+			double gpuStart = i > 0 && gpuEnd[i - 1] > cpuEnd ? gpuEnd[i - 1] : cpuEnd;
+			gpuEnd[i] = gpuStart + gpu;
+			if (i > 0)
+			{
+				pacing.add((float)(start - lastStart), (float)waited);
+				pacing.latencyMs.push_back((float)(gpuEnd[i] - start));
+			}
+			lastStart = start;
+		}
+		return pacing;
+	}
+};
@@ -292,40 +292,14 @@ namespace GEMLoader
 			// If it's static
 			if (isAnimated == 0)
 			{
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					GEMStaticVertex v;
-					file.read(reinterpret_cast<char*>(&v), sizeof(GEMStaticVertex));
-					mesh.verticesStatic.push_back(v);
-				}
-
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					unsigned int index = 0;
-					file.read(reinterpret_cast<char*>(&index), sizeof(unsigned int));
-					mesh.indices.push_back(index);
-				}
+				loadArray(file, mesh.verticesStatic);
+				loadArray(file, mesh.indices);
 			}
 			// If it's animated
 			else
 			{
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					GEMAnimatedVertex v;
-					file.read(reinterpret_cast<char*>(&v), sizeof(GEMAnimatedVertex));
-					mesh.verticesAnimated.push_back(v);
-				}
-
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					unsigned int index = 0;
-					file.read(reinterpret_cast<char*>(&index), sizeof(unsigned int));
-					mesh.indices.push_back(index);
-				}
+				loadArray(file, mesh.verticesAnimated);
+				loadArray(file, mesh.indices);
 			}
 		}
 
@@ -368,41 +342,40 @@ namespace GEMLoader
 			return q;
 		}
 
-		// Loads data for a single animation frame, including position, rotation, and scale for each bone
-		void loadFrame(GEMAnimationSequence& aseq, std::ifstream& file, int bonesN)
+		// Reads an element count followed by that many elements, sized once and pulled in with a single read
+		template<typename T>
+		void loadArray(std::ifstream& file, std::vector<T>& values)
 		{
-			GEMAnimationFrame frame;
-
-			// Load positions
-			for (int i = 0; i < bonesN; i++)
-			{
-				GEMVec3 p = loadVec3(file);
-				frame.positions.push_back(p);
-			}
-
-			// Load rotations
-			for (int i = 0; i < bonesN; i++)
+			unsigned int n = 0;
+			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
+			values.resize(n);
+			if (n > 0)
 			{
-				GEMQuaternion q = loadQuaternion(file);
-				frame.rotations.push_back(q);
+				file.read(reinterpret_cast<char*>(values.data()), sizeof(T) * n);
 			}
+		}
 
-			// Load scales
-			for (int i = 0; i < bonesN; i++)
+		// Loads data for a single animation frame, including position, rotation, and scale for each bone
+		void loadFrame(GEMAnimationFrame& frame, std::ifstream& file, int bonesN)
+		{
+			frame.positions.resize(bonesN);
+			frame.rotations.resize(bonesN);
+			frame.scales.resize(bonesN);
+			if (bonesN > 0)
 			{
-				GEMVec3 s = loadVec3(file);
-				frame.scales.push_back(s);
+				file.read(reinterpret_cast<char*>(frame.positions.data()), sizeof(GEMVec3) * bonesN);
+				file.read(reinterpret_cast<char*>(frame.rotations.data()), sizeof(GEMQuaternion) * bonesN);
+				file.read(reinterpret_cast<char*>(frame.scales.data()), sizeof(GEMVec3) * bonesN);
 			}
-
-			aseq.frames.push_back(frame);
 		}
 
 		// Loads multiple frames for an animation sequence
 		void loadFrames(GEMAnimationSequence& aseq, std::ifstream& file, int bonesN, int frames)
 		{
+			aseq.frames.resize(frames > 0 ? frames : 0);
 			for (int i = 0; i < frames; i++)
 			{
-				loadFrame(aseq, file, bonesN);
+				loadFrame(aseq.frames[i], file, bonesN);
 			}
 		}
 
@@ -448,9 +421,8 @@ namespace GEMLoader
 			// Load each mesh
 			for (unsigned int i = 0; i < n; i++)
 			{
-				GEMMesh mesh;
-				loadMesh(file, mesh, isAnimated);
-				meshes.push_back(mesh);
+				meshes.emplace_back();
+				loadMesh(file, meshes.back(), isAnimated);
 			}
 			file.close();
 		}
@@ -477,9 +449,8 @@ namespace GEMLoader
 			// Load each mesh
 			for (unsigned int i = 0; i < n; i++)
 			{
-				GEMMesh mesh;
-				loadMesh(file, mesh, isAnimated);
-				meshes.push_back(mesh);
+				meshes.emplace_back();
+				loadMesh(file, meshes.back(), isAnimated);
 			}
 
 			// Read skeleton (bone) data
@@ -507,7 +478,7 @@ namespace GEMLoader
 				file.read(reinterpret_cast<char*>(&frames), sizeof(int));
 				file.read(reinterpret_cast<char*>(&aseq.ticksPerSecond), sizeof(float));
 				loadFrames(aseq, file, bonesN, frames);
-				animation.animations.push_back(aseq);
+				animation.animations.push_back(std::move(aseq));
 			}
 			file.close();
 		}
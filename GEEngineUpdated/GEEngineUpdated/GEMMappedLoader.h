@@ -0,0 +1,386 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "GEMLoader.h"
+
+namespace GEMLoader
+{
+
+	// A read-only view of count elements that lives inside a mapped file. The GEM format packs everything
+	// back to back, so data is not necessarily aligned to T; x86 and x64 read unaligned floats and ints fine.
+	template<typename T>
+	struct GEMSpan
+	{
+		const T* data = nullptr;
+		unsigned int size = 0;
+
+		const T& operator[](unsigned int i) const
+		{
+			return data[i];
+		}
+		bool empty() const
+		{
+			return size == 0;
+		}
+		unsigned int bytes() const
+		{
+			return size * sizeof(T);
+		}
+	};
+
+	// Same as GEMMesh, but the vertex and index arrays point into the mapped file instead of being copied.
+	// Only the material strings are copied out.
+	struct GEMMappedMesh
+	{
+		GEMMaterial material;
+		GEMSpan<GEMStaticVertex> verticesStatic;
+		GEMSpan<GEMAnimatedVertex> verticesAnimated;
+		GEMSpan<unsigned int> indices;
+
+		bool isAnimated() const
+		{
+			return !verticesAnimated.empty();
+		}
+	};
+
+	// An animation sequence whose frames stay in the mapped file. Each frame is bonesN positions, then bonesN
+	// rotations, then bonesN scales, exactly as GEMModelLoader::loadFrame reads them.
+	struct GEMMappedAnimationSequence
+	{
+		std::string name;
+		float ticksPerSecond;
+		unsigned int framesN = 0;
+		unsigned int bonesN = 0;
+		const unsigned char* frames = nullptr;
+
+		size_t frameBytes() const
+		{
+			return (size_t)bonesN * ((2 * sizeof(GEMVec3)) + sizeof(GEMQuaternion));
+		}
+		const GEMVec3* positions(unsigned int frame) const
+		{
+			return reinterpret_cast<const GEMVec3*>(frames + (frame * frameBytes()));
+		}
+		const GEMQuaternion* rotations(unsigned int frame) const
+		{
+			return reinterpret_cast<const GEMQuaternion*>(frames + (frame * frameBytes()) + (bonesN * sizeof(GEMVec3)));
+		}
+		const GEMVec3* scales(unsigned int frame) const
+		{
+			return reinterpret_cast<const GEMVec3*>(frames + (frame * frameBytes()) + (bonesN * (sizeof(GEMVec3) + sizeof(GEMQuaternion))));
+		}
+	};
+
+	// A read-only memory mapping of a whole file, read front to back through a cursor. Every read is bounds
+	// checked and returns false once the file runs out.
+	class GEMMappedFile
+	{
+	public:
+		GEMMappedFile() = default;
+		GEMMappedFile(const GEMMappedFile&) = delete;
+		GEMMappedFile& operator=(const GEMMappedFile&) = delete;
+
+		~GEMMappedFile()
+		{
+			close();
+		}
+
+		bool open(const std::string& filename)
+		{
+			close();
+			file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				close();
+				return false;
+			}
+			size = (size_t)fileSize.QuadPart;
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL)
+			{
+				view = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			}
+			if (view == nullptr)
+			{
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close()
+		{
+			if (view != nullptr)
+			{
+				UnmapViewOfFile(view);
+				view = nullptr;
+			}
+			if (mapping != NULL)
+			{
+				CloseHandle(mapping);
+				mapping = NULL;
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+				file = INVALID_HANDLE_VALUE;
+			}
+			size = 0;
+			cursor = 0;
+		}
+
+		bool isOpen() const
+		{
+			return view != nullptr;
+		}
+		const unsigned char* data() const
+		{
+			return view;
+		}
+		size_t bytes() const
+		{
+			return size;
+		}
+		size_t position() const
+		{
+			return cursor;
+		}
+		bool atEnd() const
+		{
+			return cursor == size;
+		}
+
+		// Returns a pointer to the next bytes and moves past them, or nullptr if the file is too short
+		const unsigned char* take(size_t n)
+		{
+			if (view == nullptr || n > size - cursor)
+			{
+				return nullptr;
+			}
+			const unsigned char* p = view + cursor;
+			cursor += n;
+			return p;
+		}
+
+		// Whether count items of at least minBytes each could still be in the file, so that a damaged count is
+		// refused before anything is sized from it
+		bool fits(size_t count, size_t minBytes) const
+		{
+			return count <= (size - cursor) / minBytes;
+		}
+
+		// Moves the cursor on to the next multiple of alignment
+		bool align(size_t alignment)
+		{
+			size_t padding = (alignment - (cursor % alignment)) % alignment;
+			return take(padding) != nullptr;
+		}
+
+		template<typename T>
+		bool read(T& value)
+		{
+			const unsigned char* p = take(sizeof(T));
+			if (p == nullptr)
+			{
+				return false;
+			}
+			memcpy(&value, p, sizeof(T));
+			return true;
+		}
+
+		// An unsigned int count followed by that many T
+		template<typename T>
+		bool readSpan(GEMSpan<T>& span)
+		{
+			unsigned int n = 0;
+			if (!read(n))
+			{
+				return false;
+			}
+			const unsigned char* p = take((size_t)n * sizeof(T));
+			if (p == nullptr)
+			{
+				return false;
+			}
+			span.data = reinterpret_cast<const T*>(p);
+			span.size = n;
+			return true;
+		}
+
+		// Same, copied out into a vector
+		template<typename T>
+		bool readVector(std::vector<T>& values)
+		{
+			GEMSpan<T> span;
+			if (!readSpan(span))
+			{
+				return false;
+			}
+			values.resize(span.size);
+			if (span.size > 0)
+			{
+				memcpy(values.data(), span.data, span.bytes());
+			}
+			return true;
+		}
+
+		// An int length followed by that many characters, stopping at an embedded zero like loadString does
+		bool readString(std::string& str)
+		{
+			int l = 0;
+			if (!read(l) || l < 0)
+			{
+				return false;
+			}
+			const unsigned char* p = take(l);
+			if (p == nullptr)
+			{
+				return false;
+			}
+			str.assign(reinterpret_cast<const char*>(p), strnlen(reinterpret_cast<const char*>(p), l));
+			return true;
+		}
+
+	private:
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+		const unsigned char* view = nullptr;
+		size_t size = 0;
+		size_t cursor = 0;
+	};
+
+	// Memory-maps a GEM model file so meshes can be uploaded straight from the mapped pages. The spans stay
+	// valid until close() or destruction, so upload before letting this go out of scope.
+	class GEMMappedModel
+	{
+	public:
+		std::vector<GEMMappedMesh> meshes;
+		std::vector<GEMBone> bones;
+		GEMMatrix globalInverse;
+		std::vector<GEMMappedAnimationSequence> animations;
+		unsigned int isAnimated = 0;
+
+		GEMMappedModel() = default;
+		GEMMappedModel(const GEMMappedModel&) = delete;
+		GEMMappedModel& operator=(const GEMMappedModel&) = delete;
+
+		// Maps and parses the whole file. Like GEMModelLoader, a file that is not a GEM model ends the program.
+		void load(std::string filename)
+		{
+			close();
+			if (!file.open(filename) || !parse())
+			{
+				std::cout << filename << " is not a GE Model File" << std::endl;
+				close();
+				exit(0);
+			}
+		}
+
+		void close()
+		{
+			meshes.clear();
+			bones.clear();
+			animations.clear();
+			file.close();
+		}
+
+		// Size of the mapped file in bytes
+		size_t fileBytes() const
+		{
+			return file.bytes();
+		}
+
+		// The whole mapped file
+		const unsigned char* fileData() const
+		{
+			return file.data();
+		}
+
+	private:
+		GEMMappedFile file;
+
+		bool parse()
+		{
+			unsigned int n = 0;
+			// A mesh is at least its property count and two span counts
+			if (!file.read(n) || n != 4058972161 || !file.read(isAnimated) || !file.read(n) || !file.fits(n, sizeof(unsigned int) * 3))
+			{
+				return false;
+			}
+			meshes.resize(n);
+			for (unsigned int i = 0; i < n; i++)
+			{
+				GEMMappedMesh& mesh = meshes[i];
+				unsigned int propertiesN = 0;
+				if (!file.read(propertiesN) || !file.fits(propertiesN, sizeof(int) * 2))
+				{
+					return false;
+				}
+				mesh.material.properties.resize(propertiesN);
+				for (unsigned int j = 0; j < propertiesN; j++)
+				{
+					if (!file.readString(mesh.material.properties[j].name) || !file.readString(mesh.material.properties[j].value))
+					{
+						return false;
+					}
+				}
+				bool ok = isAnimated == 0 ? file.readSpan(mesh.verticesStatic) : file.readSpan(mesh.verticesAnimated);
+				if (!ok || !file.readSpan(mesh.indices))
+				{
+					return false;
+				}
+			}
+
+			// Static files end after the meshes
+			if (isAnimated == 0)
+			{
+				return true;
+			}
+
+			unsigned int bonesN = 0;
+			if (!file.read(bonesN) || !file.fits(bonesN, sizeof(int) + sizeof(GEMMatrix) + sizeof(int)))
+			{
+				return false;
+			}
+			bones.resize(bonesN);
+			for (unsigned int i = 0; i < bonesN; i++)
+			{
+				if (!file.readString(bones[i].name) || !file.read(bones[i].offset) || !file.read(bones[i].parentIndex))
+				{
+					return false;
+				}
+			}
+			if (!file.read(globalInverse) || !file.read(n) || !file.fits(n, sizeof(int) * 2 + sizeof(float)))
+			{
+				return false;
+			}
+			animations.resize(n);
+			for (unsigned int i = 0; i < n; i++)
+			{
+				GEMMappedAnimationSequence& aseq = animations[i];
+				int framesN = 0;
+				if (!file.readString(aseq.name) || !file.read(framesN) || framesN < 0 || !file.read(aseq.ticksPerSecond))
+				{
+					return false;
+				}
+				aseq.framesN = (unsigned int)framesN;
+				aseq.bonesN = bonesN;
+				aseq.frames = file.take(aseq.frameBytes() * aseq.framesN);
+				if (aseq.frames == nullptr)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+};
@@ -0,0 +1,8 @@
+// Runs HeadlessTests on its own, without Windows or a GPU. Not part of the game's build, which runs the same
+// checks under "-test". The exit code is the number of failed checks.
+#include "HeadlessTests.h"
+
+int main()
+{
+	return HeadlessTests::run();
+}
@@ -0,0 +1,443 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "JobSystem.h"
+#include "DescriptorAllocator.h"
+#include "UploadRing.h"
+#include "FramePacing.h"
+#include "CommandRecording.h"
+#include "ShaderConstants.h"
+#include "ConstantAllocator.h"
+
+// The checks that need neither Windows nor a GPU: the job system, descriptor and constant allocation, the upload
+// ring and command recording against their fake and null backends, and frame pacing. Tests runs them with the
+// rest under "-test", and HeadlessTests.cpp runs them alone on any platform, e.g.
+// g++ -std=c++14 -pthread HeadlessTests.cpp.
+class HeadlessTests
+{
+public:
+	static int run()
+	{
+		HeadlessTests tests;
+		tests.nestedJobSystems();
+		tests.descriptorFragmentation();
+		tests.uploadRing();
+		tests.framePacing();
+		tests.parallelRecording();
+		tests.frameConstants();
+
+		tests.summarise();
+		fputs(tests.report.c_str(), stdout);
+		return tests.failuresN;
+	}
+
+protected:
+	std::string report;
+	std::string current;
+	int checksN = 0;
+	int failuresN = 0;
+
+	void begin(const std::string& name)
+	{
+		current = name;
+		report += "[Test] " + name + "\n";
+	}
+
+	void check(bool condition, const std::string& what)
+	{
+		checksN++;
+		if (!condition)
+		{
+			failuresN++;
+			report += "  FAILED " + current + ": " + what + "\n";
+		}
+	}
+
+	static bool near(float a, float b, float tolerance)
+	{
+		float scale = fabsf(a) > fabsf(b) ? fabsf(a) : fabsf(b);
+		return fabsf(a - b) <= tolerance * (scale > 1.0f ? scale : 1.0f);
+	}
+
+	void summarise()
+	{
+		report += std::to_string(checksN - failuresN) + " of " + std::to_string(checksN) + " checks passed\n";
+	}
+
+	// Jobs on one pool that run and wait on a smaller one must use the smaller pool's queues, not the index of
+	// the worker they happen to be on. Each outer job holds its thread until all of them have started, so every
+	// outer worker ends up calling into the inner pool.
+	void nestedJobSystems()
+	{
+		begin("JobSystem nested pools");
+		const int outerN = 6;
+		const int innerN = 100;
+		JobSystem outer;
+		JobSystem inner;
+		outer.init(outerN);
+		inner.init(2);
+		std::atomic<int> started(0);
+		std::atomic<int> sum(0);
+		outer.parallelFor(outerN, 1, [&](int begin, int end)
+		{
+			started++;
+			// Bounded, in case a thread never turns up
+			for (int spins = 0; started < outerN && spins < 1000000; spins++)
+			{
+				std::this_thread::yield();
+			}
+			inner.parallelFor(innerN, 7, [&sum](int innerBegin, int innerEnd)
+			{
+				sum += innerEnd - innerBegin;
+			});
+		});
+		check(sum == outerN * innerN, "every inner job ran once, " + std::to_string(sum.load()) + " of " + std::to_string(outerN * innerN));
+	}
+
+	// Churning single slots must not fragment the heap: once everything is freed a range the size of the whole
+	// persistent region fits again, and freed singles merge into gaps a range can use
+	void descriptorFragmentation()
+	{
+		begin("DescriptorAllocator fragmentation");
+		const unsigned int capacity = 1024;
+		DescriptorAllocator allocator;
+		allocator.init(capacity + 64, 64, 2);
+		check(allocator.persistentCapacity() == capacity, "the transient region comes off the back");
+
+		unsigned int seed = 3;
+		std::vector<DescriptorHandle> handles;
+		for (int round = 0; round < 20; round++)
+		{
+			while (handles.size() < 600)
+			{
+				handles.push_back(allocator.allocate());
+			}
+			// Free a random half, in random order
+			for (int i = 0; i < 300; i++)
+			{
+				seed = (seed * 1103515245) + 12345;
+				int victim = (int)((seed >> 16) % handles.size());
+				allocator.free(handles[victim]);
+				handles[victim] = handles.back();
+				handles.pop_back();
+			}
+		}
+		bool allValid = true;
+		for (int i = 0; i < handles.size(); i++)
+		{
+			allValid = allValid && handles[i].valid();
+			allocator.free(handles[i]);
+		}
+		check(allValid, "single allocations succeed while there is room");
+		check(allocator.live() == 0, "everything was freed");
+		DescriptorHandle whole = allocator.allocateRange(capacity);
+		check(whole.valid() && whole.index == 0, "after churning singles the whole region is one range again");
+		allocator.free(whole);
+
+		// Singles freed between live allocations merge into a gap a range fits in
+		DescriptorHandle a = allocator.allocate();
+		DescriptorHandle b = allocator.allocate();
+		DescriptorHandle c = allocator.allocate();
+		DescriptorHandle d = allocator.allocate();
+		DescriptorHandle table = allocator.allocateRange(8);
+		unsigned int bIndex = b.index;
+		allocator.free(b);
+		allocator.free(c);
+		DescriptorHandle pair = allocator.allocateRange(2);
+		check(pair.valid() && pair.index == bIndex, "two freed singles next to each other take a range of two");
+		check(table.valid() && allocator.live() == 12, "live counts every slot handed out");
+
+		// Freeing the allocation nearest the top hands its slots back to the top
+		allocator.free(table);
+		allocator.free(d);
+		DescriptorHandle rest = allocator.allocateRange(capacity - 3);
+		check(rest.valid() && rest.index == 3, "slots freed at the top go back to it");
+
+		DescriptorHandle stale = a;
+		check(allocator.free(a) && !allocator.free(stale), "a handle can only be freed once");
+		DescriptorHandle reused = allocator.allocate();
+		check(reused.index == stale.index && !allocator.isLive(stale) && allocator.isLive(reused), "a stale handle is not live once its slot is reused");
+	}
+
+	// The ring against FakeUploadQueue: an allocation that would run off the end starts again at the front and
+	// waits only for the oldest batch it overlaps, nothing handed out overlaps a batch the queue has not finished,
+	// and an upload bigger than the ring is refused so the caller stages it alone, in the open batch
+	void uploadRing()
+	{
+		begin("UploadRing");
+		const size_t capacity = 1024;
+		std::vector<unsigned char> memory(capacity);
+		FakeUploadQueue queue;
+		UploadRing ring;
+		ring.init(memory.data(), capacity, &queue);
+
+		UploadAllocation a;
+		UploadAllocation b;
+		UploadAllocation c;
+		check(ring.allocate(384, 256, a) && a.offset == 0 && a.token == 1, "the first allocation is at the front, in batch 1");
+		check(ring.submit() == 1, "submit sends batch 1");
+		check(ring.allocate(384, 256, b) && b.offset == 512 && b.token == 2, "the next is aligned after it, in batch 2");
+		ring.submit();
+		check(ring.allocate(256, 256, c) && c.offset == 0 && c.data == memory.data(), "an allocation past the end wraps to the front");
+		check(ring.stallsN == 1 && queue.waitsN == 1 && queue.done == 1, "wrapping waited for the oldest batch only");
+		check(ring.used() == 896, "in use runs from the end of batch 1 to the wrapped allocation");
+
+		UploadToken external = ring.addExternal();
+		check(external == c.token && ring.submit() == external, "a separately staged copy goes out with the open batch");
+		UploadAllocation tooBig;
+		int stalls = ring.stallsN;
+		check(!ring.allocate(capacity + 1, 256, tooBig) && ring.stallsN == stalls && ring.used() == 896, "an upload bigger than the ring is refused without waiting or taking space");
+		queue.finishUpTo(external);
+		check(ring.isComplete(external), "the separate copy completes with its batch");
+
+		// Random uploads, submits and completions. Nothing handed out may overlap an unfinished allocation.
+		struct Live
+		{
+			size_t offset;
+			size_t bytes;
+			UploadToken token;
+		};
+		std::vector<Live> live;
+		unsigned int seed = 17;
+		auto random = [&seed](unsigned int n)
+		{
+			seed = (seed * 1103515245) + 12345;
+			return (seed >> 16) % n;
+		};
+		bool separate = true;
+		bool inside = true;
+		for (int i = 0; i < 5000; i++)
+		{
+			size_t bytes = 1 + random(600);
+			size_t alignment = (size_t)1 << random(9);
+			UploadAllocation allocation;
+			if (!ring.allocate(bytes, alignment, allocation))
+			{
+				separate = false;
+				break;
+			}
+			ring.retire();
+			for (int l = 0; l < live.size(); l++)
+			{
+				if (live[l].token <= queue.done)
+				{
+					live[l] = live.back();
+					live.pop_back();
+					l--;
+					continue;
+				}
+				separate = separate && (allocation.offset + bytes <= live[l].offset || live[l].offset + live[l].bytes <= allocation.offset);
+			}
+			inside = inside && allocation.offset % alignment == 0 && allocation.offset + bytes <= capacity;
+			live.push_back(Live{ allocation.offset, bytes, allocation.token });
+			if (random(3) == 0)
+			{
+				ring.submit();
+			}
+			if (random(4) == 0)
+			{
+				queue.finishUpTo(queue.done + 1);
+			}
+		}
+		check(separate, "no allocation overlaps one whose batch has not finished");
+		check(inside, "every allocation is aligned and inside the ring");
+		check(ring.stallsN > 0 && ring.submitsN > 0, "the run filled the ring and had to wait");
+	}
+
+	// The statistics on known values, and the simulated pipeline: one frame in flight runs the CPU and GPU one
+	// after the other, two overlap them so the slower one sets the pace, a third only adds latency, and a swap
+	// chain latency of one undoes the overlap again
+	void framePacing()
+	{
+		begin("FramePacing");
+		std::vector<float> values;
+		for (int i = 1; i <= 100; i++)
+		{
+			values.push_back((float)(101 - i));
+		}
+		check(near(FramePacing::average(values), 50.5f, 1e-5f), "average");
+		check(FramePacing::percentile(values, 0.95f) == 95.0f && FramePacing::percentile(values, 0.0f) == 1.0f && FramePacing::percentile(values, 1.0f) == 100.0f, "percentiles pick from the sorted values");
+		check(FramePacing::average(std::vector<float>()) == 0.0f && FramePacing::percentile(std::vector<float>(), 0.5f) == 0.0f, "no samples gives 0");
+
+		// 5 ms of CPU and 10 of GPU a frame, then the other way round, with no jitter
+		FramePacing serialGPU = FramePacing::simulate(1, 0, 5.0f, 10.0f, 0.0f, 200);
+		FramePacing serialCPU = FramePacing::simulate(1, 0, 10.0f, 5.0f, 0.0f, 200);
+		check(near(FramePacing::average(serialGPU.frameMs), 15.0f, 0.01f) && near(FramePacing::average(serialGPU.waitMs), 10.0f, 0.01f), "one frame in flight waits out the whole GPU frame");
+		check(near(FramePacing::average(serialCPU.frameMs), 15.0f, 0.01f), "one frame in flight serialises a CPU bound frame too");
+
+		FramePacing pipelinedGPU = FramePacing::simulate(2, 0, 5.0f, 10.0f, 0.0f, 200);
+		FramePacing pipelinedCPU = FramePacing::simulate(2, 0, 10.0f, 5.0f, 0.0f, 200);
+		check(near(FramePacing::percentile(pipelinedGPU.frameMs, 0.5f), 10.0f, 0.01f), "two in flight run a GPU bound frame at the GPU's pace");
+		check(near(FramePacing::average(pipelinedCPU.frameMs), 10.0f, 0.01f) && FramePacing::average(pipelinedCPU.waitMs) < 0.01f, "two in flight never make a CPU bound frame wait");
+
+		FramePacing deepGPU = FramePacing::simulate(3, 0, 5.0f, 10.0f, 0.0f, 200);
+		FramePacing capped = FramePacing::simulate(3, 1, 5.0f, 10.0f, 0.0f, 200);
+		check(FramePacing::average(deepGPU.latencyMs) > FramePacing::average(pipelinedGPU.latencyMs) + 5.0f, "a third frame in flight only adds latency when GPU bound");
+		check(near(FramePacing::average(capped.frameMs), 15.0f, 0.01f) && near(FramePacing::average(capped.latencyMs), 15.0f, 0.01f), "a swap chain latency of one waits like one frame in flight");
+	}
+
+	// Draws recorded across workers into the null backend come out exactly once each, in submission order, with
+	// no list opened twice or used while closed. Per draw constants written on those workers stay out of the
+	// shared values.
+	void parallelRecording()
+	{
+		begin("Parallel command recording");
+		JobSystem jobs;
+		jobs.init(4);
+		NullRecordingBackend backend(8);
+		ParallelRecorder recorder;
+		recorder.init(&jobs, &backend);
+		recorder.minPerList = 16;
+
+		const int drawsN = 1000;
+		recorder.record(drawsN, [&backend](int list, int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				backend.record(list, i);
+			}
+		});
+		bool inOrder = (int)backend.executed.size() == drawsN;
+		for (int i = 0; i < backend.executed.size() && inOrder; i++)
+		{
+			inOrder = backend.executed[i] == i;
+		}
+		check(recorder.listsUsed == 4, "a list per thread, " + std::to_string(recorder.listsUsed));
+		check(inOrder, "every draw is recorded exactly once, in order");
+		check(backend.errorsN == 0 && backend.batchesN == 1, "lists were opened once each and executed in one batch");
+
+		// Uneven costs, e.g. index counts, split by cost rather than count
+		std::vector<float> costs(drawsN);
+		unsigned int seed = 5;
+		for (int i = 0; i < drawsN; i++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			costs[i] = (i % 50 == 0) ? 5000.0f : (float)(1 + ((seed >> 16) % 100));
+		}
+		backend.executed.clear();
+		recorder.record(costs, [&backend](int list, int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				backend.record(list, i);
+			}
+		});
+		inOrder = (int)backend.executed.size() == drawsN;
+		for (int i = 0; i < backend.executed.size() && inOrder; i++)
+		{
+			inOrder = backend.executed[i] == i;
+		}
+		check(inOrder, "split by cost, every draw is still recorded exactly once, in order");
+		const std::vector<DrawRange>& ranges = recorder.lastRanges();
+		bool contiguous = !ranges.empty() && ranges.front().begin == 0 && ranges.back().end == drawsN;
+		for (int i = 1; i < ranges.size(); i++)
+		{
+			contiguous = contiguous && ranges[i].begin == ranges[i - 1].end && ranges[i].end > ranges[i].begin;
+		}
+		check(contiguous, "the runs cover every draw with no gaps");
+		check(backend.errorsN == 0 && backend.batchesN == 2, "no list was misused");
+
+		// Each draw writes W into its own copy, as DrawConstants does, while the shared values stay as they were
+		ConstantBufferValues values;
+		values.constantBufferData["VP"] = ConstantBufferVariable{ 0, 64 };
+		values.constantBufferData["W"] = ConstantBufferVariable{ 64, 64 };
+		values.init(128);
+		ConstantHandle vp = values.find("VP");
+		ConstantHandle w = values.find("W");
+		float shared[16] = {};
+		shared[0] = 7.0f;
+		vp.update(shared);
+		std::vector<std::vector<unsigned char>> draws(drawsN);
+		jobs.parallelFor(drawsN, 8, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				draws[i] = values.buffer;
+				float world[16] = {};
+				world[3] = (float)i;
+				w.update(draws[i].data(), world);
+			}
+		});
+		bool own = true;
+		for (int i = 0; i < drawsN; i++)
+		{
+			const float* drawVP = reinterpret_cast<const float*>(draws[i].data());
+			const float* drawW = reinterpret_cast<const float*>(draws[i].data() + 64);
+			own = own && drawW[3] == (float)i && drawVP[0] == 7.0f;
+		}
+		const float* sharedW = reinterpret_cast<const float*>(values.buffer.data() + 64);
+		check(own, "each draw keeps its own W over the shared VP");
+		check(sharedW[3] == 0.0f, "per draw writes leave the shared values alone");
+	}
+
+	// A full frame fails its allocations rather than handing out space past its part, which would be another
+	// frame's constants, so a draw that cannot get any is skipped instead of binding a stale address
+	void frameConstants()
+	{
+		begin("FrameConstantAllocator");
+		const size_t capacity = 4096;
+		std::vector<unsigned char> memory(capacity);
+		FrameConstantAllocator constants;
+		constants.init(memory.data(), capacity, 2);
+		size_t part = constants.partCapacity();
+		check(part == 2048, "each frame gets half the buffer");
+
+		ConstantAllocation allocation;
+		int fittedN = 0;
+		while (constants.allocate(200, allocation))
+		{
+			fittedN++;
+		}
+		check(fittedN == 8, "allocations round up to 256 bytes and fill the part");
+		check(constants.overflowsThisFrame() == 1, "the one that did not fit counts as an overflow");
+		check(!constants.allocate(1, allocation) && constants.overflowsThisFrame() == 2, "once full every allocation fails");
+		check(constants.usedThisFrame() == part, "used stops at the part");
+
+		// Threads racing for the next frame's part get distinct slots inside it and nothing more
+		constants.beginFrame(1);
+		check(constants.overflowsThisFrame() == 0 && constants.totalOverflows() == 2, "a new frame starts clear and keeps the count");
+		JobSystem jobs;
+		jobs.init(4);
+		const int triesN = 64;
+		std::vector<size_t> offsets(triesN, ~size_t(0));
+		jobs.parallelFor(triesN, 1, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				ConstantAllocation mine;
+				if (constants.allocate(256, mine))
+				{
+					offsets[i] = mine.offset;
+				}
+			}
+		});
+		std::vector<bool> taken(part / 256, false);
+		bool inside = true;
+		bool distinct = true;
+		int grantedN = 0;
+		for (int i = 0; i < triesN; i++)
+		{
+			if (offsets[i] == ~size_t(0))
+			{
+				continue;
+			}
+			grantedN++;
+			inside = inside && offsets[i] >= part && offsets[i] + 256 <= part * 2;
+			if (inside)
+			{
+				size_t slot = (offsets[i] - part) / 256;
+				distinct = distinct && !taken[slot];
+				taken[slot] = true;
+			}
+		}
+		check(grantedN == (int)(part / 256), "exactly the part's worth is handed out");
+		check(inside, "every allocation lies inside frame 1's part");
+		check(distinct, "no two threads share an allocation");
+		check(constants.overflowsThisFrame() == triesN - grantedN, "the rest count as overflows");
+	}
+};
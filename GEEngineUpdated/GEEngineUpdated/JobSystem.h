@@ -0,0 +1,224 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+// Counts outstanding jobs in a group so a caller can wait for all of them
+struct JobCounter
+{
+	std::atomic<int> remaining;
+	JobCounter() : remaining(0) {}
+};
+
+// Work-stealing pool. Every worker owns a queue, pops its own newest job first and steals the oldest job from
+// another queue when it runs dry. The thread that calls wait() also runs jobs, so it always counts as one thread.
+class JobSystem
+{
+public:
+	~JobSystem()
+	{
+		shutdown();
+	}
+
+	// threadsN includes the calling thread, 0 uses every hardware thread
+	void init(int threadsN = 0)
+	{
+		shutdown();
+		if (threadsN <= 0)
+		{
+			threadsN = (int)std::thread::hardware_concurrency();
+		}
+		threadsN = threadsN < 1 ? 1 : threadsN;
+		running = true;
+		pending = 0;
+		queues.clear();
+		for (int i = 0; i < threadsN; i++)
+		{
+			queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+		}
+		for (int i = 1; i < threadsN; i++)
+		{
+			threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+		}
+	}
+
+	void shutdown()
+	{
+		if (threads.empty())
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			running = false;
+		}
+		wake.notify_all();
+		for (int i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+		threads.clear();
+	}
+
+	int threadsN() const
+	{
+		return queues.empty() ? 1 : (int)queues.size();
+	}
+
+	void run(JobCounter& counter, std::function<void()> job)
+	{
+		counter.remaining++;
+		if (threads.empty())
+		{
+			job();
+			counter.remaining--;
+			return;
+		}
+		WorkQueue& queue = *queues[localQueue()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back(Job{ std::move(job), &counter });
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			pending++;
+		}
+		wake.notify_one();
+	}
+
+	// Runs other jobs until the group is done rather than blocking
+	void wait(JobCounter& counter)
+	{
+		while (counter.remaining > 0)
+		{
+			Job job;
+			if (take(localQueue(), job))
+			{
+				execute(job);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// Splits [0, count) into runs of grain and calls f(begin, end) for each, returning once they have all finished
+	template<typename F>
+	void parallelFor(int count, int grain, F f)
+	{
+		grain = grain < 1 ? 1 : grain;
+		if (threads.empty() || count <= grain)
+		{
+			f(0, count);
+			return;
+		}
+		JobCounter counter;
+		for (int begin = 0; begin < count; begin += grain)
+		{
+			int end = begin + grain < count ? begin + grain : count;
+			run(counter, [&f, begin, end]() { f(begin, end); });
+		}
+		wait(counter);
+	}
+
+private:
+	struct Job
+	{
+		std::function<void()> function;
+		JobCounter* counter;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> queues; // Queue 0 belongs to whichever thread drives the system
+	std::vector<std::thread> threads;
+	std::atomic<bool> running;
+	std::atomic<int> pending;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+
+	// The queue a worker owns, kept with the pool it belongs to, since a job can run or wait on another pool.
+	// Threads that are not this pool's workers share queue 0.
+	struct LocalQueue
+	{
+		const JobSystem* owner;
+		int index;
+	};
+
+	static LocalQueue& localSlot()
+	{
+		thread_local LocalQueue local = { nullptr, 0 };
+		return local;
+	}
+
+	int localQueue() const
+	{
+		const LocalQueue& local = localSlot();
+		return local.owner == this ? local.index : 0;
+	}
+
+	bool take(int index, Job& job)
+	{
+		{
+			WorkQueue& own = *queues[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				pending--;
+				return true;
+			}
+		}
+		for (int i = 1; i < queues.size(); i++)
+		{
+			WorkQueue& victim = *queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty())
+			{
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				pending--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void execute(Job& job)
+	{
+		job.function();
+		job.counter->remaining--;
+	}
+
+	void workerLoop(int index)
+	{
+		localSlot() = LocalQueue{ this, index };
+		while (true)
+		{
+			Job job;
+			if (take(index, job))
+			{
+				execute(job);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wake.wait(lock, [this]() { return !running || pending > 0; });
+			if (!running)
+			{
+				return;
+			}
+		}
+	}
+};
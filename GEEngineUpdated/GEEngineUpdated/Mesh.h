@@ -7,6 +7,9 @@
 #include "Math.h"
 
 #include "GEMLoader.h"
+#include "GEMMappedLoader.h"
+#include "AssetCache.h"
+#include "AssetLoader.h"
 #include "Animation.h"
 #include "Textures.h"
 #include "Shader.h"
@@ -30,6 +33,10 @@ struct ANIMATED_VERTEX {
 	float boneWeights[4];
 };
 
+// The GEM vertices are uploaded as they are, so the layouts have to match byte for byte
+static_assert(sizeof(STATIC_VERTEX) == sizeof(GEMLoader::GEMStaticVertex), "STATIC_VERTEX must match GEMStaticVertex");
+static_assert(sizeof(ANIMATED_VERTEX) == sizeof(GEMLoader::GEMAnimatedVertex), "ANIMATED_VERTEX must match GEMAnimatedVertex");
+
 class VertexLayoutCache {
 public:
 	static const D3D12_INPUT_LAYOUT_DESC& getStaticLayout() {
@@ -90,7 +97,7 @@ public:
 
 	~Mesh() { clean(); }
 
-	void init(Core* core, void* vertices, int vertexSizeInBytes, int numVertices, unsigned int* indices, int numIndices) {
+	void init(Core* core, const void* vertices, int vertexSizeInBytes, int numVertices, const unsigned int* indices, int numIndices) {
 		D3D12_HEAP_PROPERTIES heapprops;
 		memset(&heapprops, 0, sizeof(D3D12_HEAP_PROPERTIES));
 		heapprops.Type = D3D12_HEAP_TYPE_DEFAULT;
@@ -112,7 +119,7 @@ public:
 		//allocate memory 
 		core->device->CreateCommittedResource(&heapprops, D3D12_HEAP_FLAG_NONE, &vbDesc, D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&vertexBuffer));
 		//copy vertices using helper function
-		core->uploadResource(vertexBuffer, vertices, numVertices * vertexSizeInBytes, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+		core->uploadResource(vertexBuffer, vertices, numVertices * vertexSizeInBytes);
 
 		//fill in view in helper function
 		vbView.BufferLocation = vertexBuffer->GetGPUVirtualAddress();
@@ -132,7 +139,7 @@ public:
 
 		HRESULT hr;
 		hr = core->device->CreateCommittedResource(&heapprops, D3D12_HEAP_FLAG_NONE, &ibDesc, D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&indexBuffer));
-		core->uploadResource(indexBuffer, indices, numIndices * sizeof(unsigned int), D3D12_RESOURCE_STATE_INDEX_BUFFER);
+		core->uploadResource(indexBuffer, indices, numIndices * sizeof(unsigned int));
 
 		ibView.BufferLocation = indexBuffer->GetGPUVirtualAddress();
 		ibView.Format = DXGI_FORMAT_R32_UINT;
@@ -162,6 +169,36 @@ public:
 		}
 	}
 
+	// Uploads straight from a memory-mapped GEM file, the vertices are never copied into a vector
+	void init(Core* core, const GEMLoader::GEMSpan<GEMLoader::GEMStaticVertex>& vertices, const GEMLoader::GEMSpan<unsigned int>& indices) {
+		init(core, vertices.data, sizeof(STATIC_VERTEX), vertices.size, indices.data, indices.size);
+		inputLayoutDesc = VertexLayoutCache::getStaticLayout();
+
+		boundingBox = BoundingBox();
+		for (unsigned int i = 0; i < vertices.size; i++) {
+			const GEMLoader::GEMVec3& p = vertices[i].position;
+			boundingBox.extend(Vec3(p.x, p.y, p.z));
+		}
+	}
+
+	void init(Core* core, const GEMLoader::GEMSpan<GEMLoader::GEMAnimatedVertex>& vertices, const GEMLoader::GEMSpan<unsigned int>& indices) {
+		init(core, vertices.data, sizeof(ANIMATED_VERTEX), vertices.size, indices.data, indices.size);
+		inputLayoutDesc = VertexLayoutCache::getAnimatedLayout();
+
+		boundingBox = BoundingBox();
+		for (unsigned int i = 0; i < vertices.size; i++) {
+			const GEMLoader::GEMVec3& p = vertices[i].position;
+			boundingBox.extend(Vec3(p.x, p.y, p.z));
+		}
+	}
+
+	// Uploads a cooked mesh, the bounds come precomputed
+	void init(Core* core, const CookedMesh& cooked) {
+		init(core, cooked.vertices, cooked.vertexStride, cooked.verticesN, cooked.indices.data, cooked.indices.size);
+		inputLayoutDesc = cooked.isAnimated() ? VertexLayoutCache::getAnimatedLayout() : VertexLayoutCache::getStaticLayout();
+		boundingBox = cooked.bounds;
+	}
+
 	void initInstances(Core* core, std::vector<Matrix>& matrices) {
 		numInstances = (unsigned int)matrices.size();
 		int bufferSize = numInstances * sizeof(Matrix);
@@ -188,7 +225,7 @@ public:
 		core->device->CreateCommittedResource(&heapprops, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&instanceBuffer));
 
 		// Upload Data
-		core->uploadResource(instanceBuffer, &matrices[0], bufferSize, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+		core->uploadResource(instanceBuffer, &matrices[0], bufferSize);
 
 		// Create the View
 		instanceView.BufferLocation = instanceBuffer->GetGPUVirtualAddress();
@@ -233,20 +270,17 @@ class StaticMesh {
 public:
 	std::vector<Mesh*> meshes;
 	std::vector<std::string> textureFilenames;
+	UINT texBindPoint = 0; // Of the static shader's texture, set by staticModel::initPipeline
 
 	void init(Core* core, std::string filename, TextureManager* textureManager) {
-		GEMLoader::GEMModelLoader loader;
-		std::vector<GEMLoader::GEMMesh> gemmeshes;
-		loader.load(filename, gemmeshes);
+		// Loaded from the cooked file when it is up to date, mapped so the vertices go from the file pages straight
+		// into the upload buffer
+		CookedModel model;
+		AssetCache::load(filename, model, nullptr);
+		std::vector<CookedMesh>& gemmeshes = model.meshes;
 
 		for (int i = 0; i < gemmeshes.size(); i++) {
 			Mesh* mesh = new Mesh();
-			std::vector<STATIC_VERTEX> vertices;
-			for (int j = 0; j < gemmeshes[i].verticesStatic.size(); j++) {
-				STATIC_VERTEX v;
-				memcpy(&v, &gemmeshes[i].verticesStatic[j], sizeof(STATIC_VERTEX));
-				vertices.push_back(v);
-			}
 			std::string rawPath = gemmeshes[i].material.find("albedo").getValue();
 
 			size_t lastSlash = rawPath.find_last_of("\\/");
@@ -256,14 +290,30 @@ public:
 
 			textureManager->loadTexture(core, rawPath, fullPath);
 			textureFilenames.push_back(rawPath);
-			mesh->init(core, vertices, gemmeshes[i].indices);
+			mesh->init(core, gemmeshes[i]);
 			meshes.push_back(mesh);
 		}
 	}
 
+	// Takes over meshes an AssetUploader has already created
+	void init(LoadedModel& model) {
+		meshes = model.meshes;
+		textureFilenames = model.textureNames;
+	}
+
+	// Meshes whose textures share an array only change the slice between draws
 	void draw(Core* core, Shaders* shaders, TextureManager* textureManager) {
+		int bound = -1;
 		for (int i = 0; i < meshes.size(); i++) {
-			shaders->updateTexturePS(core, "static", "tex", textureManager->find(textureFilenames[i]));
+			int heapOffset = textureManager->find(textureFilenames[i]);
+			unsigned int slice = textureManager->findSlice(textureFilenames[i]);
+			if (heapOffset != bound) {
+				shaders->updateTexturePS(core, texBindPoint, heapOffset, slice);
+				bound = heapOffset;
+			}
+			else {
+				shaders->updateSlicePS(core, slice);
+			}
 			meshes[i]->draw(core);
 		}
 	}
@@ -274,23 +324,17 @@ public:
 	std::vector<Mesh*> meshes;
 	Animation animation;
 	std::vector<std::string> textureFilenames;
+	UINT texBindPoint = 0; // Of the animated shader's texture, set by animatedModel::initPipeline
 
 
 	void init(Core* core, std::string filename, TextureManager* textureManager) {
-		GEMLoader::GEMModelLoader loader;
-		std::vector<GEMLoader::GEMMesh> gemmeshes;
-		GEMLoader::GEMAnimation gemanimation;
-		loader.load(filename, gemmeshes, gemanimation);
+		// The clips come back already compressed
+		CookedModel model;
+		AssetCache::load(filename, model, &animation);
+		std::vector<CookedMesh>& gemmeshes = model.meshes;
 
 		for (int i = 0; i < gemmeshes.size(); i++) {
 			Mesh* mesh = new Mesh();
-			std::vector<ANIMATED_VERTEX> vertices;
-
-			for (int j = 0; j < gemmeshes[i].verticesAnimated.size(); j++) {
-				ANIMATED_VERTEX v;
-				memcpy(&v, &gemmeshes[i].verticesAnimated[j], sizeof(ANIMATED_VERTEX));
-				vertices.push_back(v);
-			}
 			std::string rawPath = gemmeshes[i].material.find("albedo").getValue();
 
 			size_t lastSlash = rawPath.find_last_of("\\/");
@@ -300,55 +344,83 @@ public:
 
 			textureManager->loadTexture(core, rawPath, fullPath);
 			textureFilenames.push_back(rawPath);
-			mesh->init(core, vertices, gemmeshes[i].indices);
+			mesh->init(core, gemmeshes[i]);
 			meshes.push_back(mesh);
 		}
+	}
 
-		memcpy(&animation.skeleton.globalInverse, &gemanimation.globalInverse, 16 * sizeof(float));
+	void init(LoadedModel& model) {
+		meshes = model.meshes;
+		textureFilenames = model.textureNames;
+		animation = std::move(model.animation);
+	}
 
-		for (int i = 0; i < gemanimation.bones.size(); i++) {
-			Bone bone;
-			bone.name = gemanimation.bones[i].name;
-			memcpy(&bone.offset, &gemanimation.bones[i].offset, 16 * sizeof(float));
-			bone.parentIndex = gemanimation.bones[i].parentIndex;
-			animation.skeleton.bones.push_back(bone);
+	// Meshes whose textures share an array only change the slice between draws
+	void draw(Core* core, Shaders* shaders, TextureManager* textureManager) {
+		int bound = -1;
+		for (int i = 0; i < meshes.size(); i++) {
+			int heapOffset = textureManager->find(textureFilenames[i]);
+			unsigned int slice = textureManager->findSlice(textureFilenames[i]);
+			if (heapOffset != bound) {
+				shaders->updateTexturePS(core, texBindPoint, heapOffset, slice);
+				bound = heapOffset;
+			}
+			else {
+				shaders->updateSlicePS(core, slice);
+			}
+			meshes[i]->draw(core);
 		}
+	}
+};
 
-		for (int i = 0; i < gemanimation.animations.size(); i++) {
-			std::string name = gemanimation.animations[i].name;
-			AnimationSequence aseq;
-			aseq.ticksPerSecond = gemanimation.animations[i].ticksPerSecond;
-
-			for (int j = 0; j < gemanimation.animations[i].frames.size(); j++) {
-				AnimationFrame frame;
-
-				for (int index = 0; index < gemanimation.animations[i].frames[j].positions.size(); index++) {
-					Vec3 p;
-					Quaternion q;
-					Vec3 s;
-					memcpy(&p, &gemanimation.animations[i].frames[j].positions[index], sizeof(Vec3));
-					frame.positions.push_back(p);
-					memcpy(&q, &gemanimation.animations[i].frames[j].rotations[index], sizeof(Quaternion));
-					frame.rotations.push_back(q);
-					memcpy(&s, &gemanimation.animations[i].frames[j].scales[index], sizeof(Vec3));
-					frame.scales.push_back(s);
-				}
-
-				aseq.frames.push_back(frame);
-			}
 
-			animation.animations.insert({ name, aseq });
+// Uploads what AssetLoader has loaded through the device. The copies are staged in Core's upload ring and go to
+// the copy queue in batches, so nothing here waits for the GPU. When the texture manager packs, textures are held
+// until finish so they can be packed together.
+class CoreAssetUploader : public AssetUploader {
+public:
+	Core* core;
+	TextureManager* textureManager;
+	std::vector<std::shared_ptr<DecodedTexture>> held; // Keeps model textures alive until finish
+	std::vector<DecodedTexture*> pending;
+
+	CoreAssetUploader(Core* _core, TextureManager* _textureManager) : core(_core), textureManager(_textureManager) {}
+
+	void uploadModel(LoadedModel& model) override {
+		for (int i = 0; i < model.textures.size(); i++) {
+			if (textureManager->packing) {
+				held.push_back(model.textures[i].get());
+			}
+			uploadImage(*model.textures[i].get());
+		}
+		for (int i = 0; i < model.cooked.meshes.size(); i++) {
+			Mesh* mesh = new Mesh();
+			mesh->init(core, model.cooked.meshes[i]);
+			model.meshes.push_back(mesh);
 		}
+		// The CPU copies are not needed once they are on the GPU
+		model.textures.clear();
+		model.cooked.close();
 	}
 
-	void draw(Core* core, Shaders* shaders, TextureManager* textureManager) {
-		for (int i = 0; i < meshes.size(); i++) {
-			shaders->updateTexturePS(core, "animated", "tex", textureManager->find(textureFilenames[i]));
-			meshes[i]->draw(core);
+	void uploadImage(DecodedTexture& image) override {
+		if (!image.valid()) {
+			return;
+		}
+		if (textureManager->packing) {
+			pending.push_back(&image);
+		}
+		else {
+			textureManager->loadTexture(core, image);
 		}
 	}
-};
 
+	void finish() override {
+		textureManager->loadTexturesPacked(core, pending);
+		pending.clear();
+		held.clear();
+	}
+};
 
 class InstancedMesh {
 public:
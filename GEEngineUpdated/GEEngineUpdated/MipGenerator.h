@@ -0,0 +1,362 @@
+#pragma once
+
+#include <vector>
+#include "maths.h"
+#include "JobSystem.h"
+
+enum class MipFilter
+{
+	Box, // 2x2 average, cheapest
+	Kaiser // Kaiser windowed sinc over 12 texels, keeps distant textures sharper
+};
+
+struct MipSettings
+{
+	bool enabled = true;
+	bool srgb = true; // Colour channels are sRGB encoded and are filtered in linear space, alpha is always linear
+	MipFilter filter = MipFilter::Kaiser;
+};
+
+// Where one mip level lives in a buffer holding the whole chain
+struct MipLevel
+{
+	int width = 0;
+	int height = 0;
+	unsigned int rowPitch = 0;
+	size_t offset = 0;
+	int rowsN = 0; // Rows of texels, or of blocks for block compressed formats
+	unsigned int rowBytes = 0; // Bytes of each row that are used
+};
+
+// Builds mip chains on the CPU from RGBA8 texels. Everything here works on plain memory, so it runs without a
+// device. The chain is laid out the way GetCopyableFootprints places RGBA8 subresources: rows 256 byte aligned
+// and levels 512 byte aligned, so it can be uploaded as it is.
+class MipGenerator
+{
+public:
+	// Same as D3D12_TEXTURE_DATA_PITCH_ALIGNMENT and D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+	static const unsigned int pitchAlignment = 256;
+	static const unsigned int placementAlignment = 512;
+
+	// Down to 1x1
+	static int levelsN(int width, int height)
+	{
+		int levels = 1;
+		while (width > 1 || height > 1)
+		{
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+			levels++;
+		}
+		return levels;
+	}
+
+	static unsigned int rowPitch(int width)
+	{
+		unsigned int alignment = pitchAlignment;
+		return ((width * 4) + alignment - 1) & ~(alignment - 1);
+	}
+
+	// Fills in levels for a chain of levelsN levels (0 for all of them) and returns the bytes it needs
+	static size_t layout(int width, int height, int levelsCount, std::vector<MipLevel>& levels)
+	{
+		int allLevels = levelsN(width, height);
+		levelsCount = (levelsCount <= 0 || levelsCount > allLevels) ? allLevels : levelsCount;
+		levels.resize(levelsCount);
+		size_t offset = 0;
+		for (int i = 0; i < levelsCount; i++)
+		{
+			size_t alignment = placementAlignment;
+			offset = (offset + alignment - 1) & ~(alignment - 1);
+			levels[i].width = width;
+			levels[i].height = height;
+			levels[i].rowPitch = rowPitch(width);
+			levels[i].offset = offset;
+			levels[i].rowsN = height;
+			levels[i].rowBytes = width * 4;
+			offset += (size_t)levels[i].rowPitch * height;
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		return offset;
+	}
+
+	// Fills levels 1 onwards in texels from level 0. Each level is filtered from the one above it, kept in float
+	// so the error does not build up, and the rows of a level are split across jobs when there are any.
+	static void generate(JobSystem* jobs, unsigned char* texels, const std::vector<MipLevel>& levels, const MipSettings& settings)
+	{
+		if (levels.size() < 2)
+		{
+			return;
+		}
+		Kernel kernel = settings.filter == MipFilter::Kaiser ? kaiserKernel() : boxKernel();
+		const Tables& tables = getTables();
+
+		std::vector<float> source; // The level being filtered, as linear float RGBA. Level 0 is read from texels.
+		std::vector<float> filtered; // The next level, as linear float RGBA
+		std::vector<float> horizontal; // Source rows filtered horizontally only
+		for (int l = 1; l < levels.size(); l++)
+		{
+			const MipLevel& src = levels[l - 1];
+			const MipLevel& dst = levels[l];
+			const unsigned char* srcTexels = texels + src.offset;
+			bool fromTexels = l == 1;
+
+			// A source row as linear float RGBA, decoded into scratch when it is still in texels
+			auto sourceRow = [&](int y, float* scratch) -> const float*
+			{
+				if (fromTexels)
+				{
+					decodeRow(srcTexels + ((size_t)y * src.rowPitch), src.width, settings.srgb, tables, scratch);
+					return scratch;
+				}
+				return source.data() + ((size_t)y * src.width * 4);
+			};
+
+			bool keep = l + 1 < levels.size();
+			filtered.resize(keep ? (size_t)dst.width * dst.height * 4 : 0);
+			unsigned char* dstTexels = texels + dst.offset;
+
+			// Box only needs the two source rows under each output row, so filter them as they are needed
+			if (settings.filter == MipFilter::Box)
+			{
+				parallelFor(jobs, dst.height, [&](int begin, int end)
+				{
+					std::vector<float> scratch(fromTexels ? (size_t)src.width * 4 : 0);
+					std::vector<float> rows((size_t)dst.width * 4 * 2);
+					std::vector<float> row(keep ? 0 : (size_t)dst.width * 4);
+					for (int y = begin; y < end; y++)
+					{
+						for (int t = 0; t < 2; t++)
+						{
+							filterRow(sourceRow(clampIndex((2 * y) + t, src.height), scratch.data()), src.width, rows.data() + ((size_t)t * dst.width * 4), dst.width, kernel);
+						}
+						float* out = keep ? filtered.data() + ((size_t)y * dst.width * 4) : row.data();
+						filterColumn(rows.data(), dst.width, 2, 0, out, kernel);
+						encodeRow(out, dst.width, settings.srgb, tables, dstTexels + ((size_t)y * dst.rowPitch));
+					}
+				});
+				source.swap(filtered);
+				continue;
+			}
+
+			// Otherwise every source row is filtered across to the destination width first
+			horizontal.resize((size_t)src.height * dst.width * 4);
+			parallelFor(jobs, src.height, [&](int begin, int end)
+			{
+				std::vector<float> scratch(fromTexels ? (size_t)src.width * 4 : 0);
+				for (int y = begin; y < end; y++)
+				{
+					filterRow(sourceRow(y, scratch.data()), src.width, horizontal.data() + ((size_t)y * dst.width * 4), dst.width, kernel);
+				}
+			});
+
+			// Then down, straight into this level and into the float copy the next level is filtered from
+			parallelFor(jobs, dst.height, [&](int begin, int end)
+			{
+				std::vector<float> row(keep ? 0 : (size_t)dst.width * 4);
+				for (int y = begin; y < end; y++)
+				{
+					float* out = keep ? filtered.data() + ((size_t)y * dst.width * 4) : row.data();
+					filterColumn(horizontal.data(), dst.width, src.height, y, out, kernel);
+					encodeRow(out, dst.width, settings.srgb, tables, dstTexels + ((size_t)y * dst.rowPitch));
+				}
+			});
+			source.swap(filtered);
+		}
+	}
+
+private:
+	static const int maxTaps = 12;
+
+	// Weights for output texel x are applied to source texels 2x + first onwards, clamped to the edge
+	struct Kernel
+	{
+		int first = 0;
+		int tapsN = 0;
+		float weights[maxTaps];
+	};
+
+	struct Tables
+	{
+		float toLinear[256]; // sRGB byte to linear
+		unsigned char toSRGB[4096]; // 12 bit linear to sRGB byte, finer than a byte where the curve is steep
+	};
+
+	template<typename F>
+	static void parallelFor(JobSystem* jobs, int count, F f)
+	{
+		if (jobs == nullptr)
+		{
+			f(0, count);
+			return;
+		}
+		jobs->parallelFor(count, 16, f);
+	}
+
+	static const Tables& getTables()
+	{
+		static Tables tables = buildTables();
+		return tables;
+	}
+
+	static Tables buildTables()
+	{
+		Tables tables;
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			tables.toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; i++)
+		{
+			float c = i / 4095.0f;
+			float s = c <= 0.0031308f ? c * 12.92f : (1.055f * powf(c, 1.0f / 2.4f)) - 0.055f;
+			tables.toSRGB[i] = (unsigned char)((s * 255.0f) + 0.5f);
+		}
+		return tables;
+	}
+
+	static Kernel boxKernel()
+	{
+		Kernel kernel;
+		kernel.first = 0;
+		kernel.tapsN = 2;
+		kernel.weights[0] = 0.5f;
+		kernel.weights[1] = 0.5f;
+		return kernel;
+	}
+
+	// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+	static double besselI0(double x)
+	{
+		double sum = 1.0;
+		double term = 1.0;
+		for (int k = 1; k < 32; k++)
+		{
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Sinc windowed by a Kaiser window (alpha 4) three destination texels wide each side. The output texel centre
+	// sits between source texels 2x and 2x + 1, so the taps are at half texel offsets and the kernel is symmetric.
+	static Kernel kaiserKernel()
+	{
+		const double alpha = 4.0;
+		const double radius = 3.0;
+		Kernel kernel;
+		kernel.first = -5;
+		kernel.tapsN = maxTaps;
+		double sum = 0;
+		double weights[maxTaps];
+		for (int t = 0; t < maxTaps; t++)
+		{
+			double x = ((t + kernel.first) - 0.5) / 2.0; // Source texel centre relative to the output one, in output texels
+			double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			double r = x / radius;
+			double window = fabs(r) >= 1.0 ? 0.0 : besselI0(alpha * sqrt(1.0 - (r * r))) / besselI0(alpha);
+			weights[t] = sinc * window;
+			sum += weights[t];
+		}
+		for (int t = 0; t < maxTaps; t++)
+		{
+			kernel.weights[t] = (float)(weights[t] / sum);
+		}
+		return kernel;
+	}
+
+	static void decodeRow(const unsigned char* texels, int width, bool srgb, const Tables& tables, float* out)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				out[(x * 4) + c] = srgb ? tables.toLinear[texels[(x * 4) + c]] : texels[(x * 4) + c] / 255.0f;
+			}
+			out[(x * 4) + 3] = texels[(x * 4) + 3] / 255.0f;
+		}
+	}
+
+	static void encodeRow(const float* in, int width, bool srgb, const Tables& tables, unsigned char* texels)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				float v = in[(x * 4) + c];
+				v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); // The Kaiser lobes can overshoot
+				texels[(x * 4) + c] = (srgb && c < 3) ? tables.toSRGB[(int)((v * 4095.0f) + 0.5f)] : (unsigned char)((v * 255.0f) + 0.5f);
+			}
+		}
+	}
+
+	static int clampIndex(int i, int n)
+	{
+		return i < 0 ? 0 : (i >= n ? n - 1 : i);
+	}
+
+	static void filterRow(const float* src, int srcWidth, float* dst, int dstWidth, const Kernel& kernel)
+	{
+		for (int x = 0; x < dstWidth; x++)
+		{
+			int first = (2 * x) + kernel.first;
+			bool inside = first >= 0 && first + kernel.tapsN <= srcWidth;
+#if defined(MATHS_SIMD_SSE)
+			__m128 acc = _mm_setzero_ps();
+			for (int t = 0; t < kernel.tapsN; t++)
+			{
+				int i = inside ? first + t : clampIndex(first + t, srcWidth);
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + (i * 4)), _mm_set1_ps(kernel.weights[t])));
+			}
+			_mm_storeu_ps(dst + (x * 4), acc);
+#else
+			float acc[4] = { 0, 0, 0, 0 };
+			for (int t = 0; t < kernel.tapsN; t++)
+			{
+				int i = inside ? first + t : clampIndex(first + t, srcWidth);
+				for (int c = 0; c < 4; c++)
+				{
+					acc[c] += src[(i * 4) + c] * kernel.weights[t];
+				}
+			}
+			for (int c = 0; c < 4; c++)
+			{
+				dst[(x * 4) + c] = acc[c];
+			}
+#endif
+		}
+	}
+
+	// Output row y from the horizontally filtered rows, width texels wide
+	static void filterColumn(const float* rows, int width, int srcHeight, int y, float* dst, const Kernel& kernel)
+	{
+		const float* taps[maxTaps];
+		for (int t = 0; t < kernel.tapsN; t++)
+		{
+			taps[t] = rows + ((size_t)clampIndex((2 * y) + kernel.first + t, srcHeight) * width * 4);
+		}
+		for (int x = 0; x < width * 4; x += 4)
+		{
+#if defined(MATHS_SIMD_SSE)
+			__m128 acc = _mm_setzero_ps();
+			for (int t = 0; t < kernel.tapsN; t++)
+			{
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(taps[t] + x), _mm_set1_ps(kernel.weights[t])));
+			}
+			_mm_storeu_ps(dst + x, acc);
+#else
+			for (int c = 0; c < 4; c++)
+			{
+				float acc = 0;
+				for (int t = 0; t < kernel.tapsN; t++)
+				{
+					acc += taps[t][x + c] * kernel.weights[t];
+				}
+				dst[x + c] = acc;
+			}
+#endif
+		}
+	}
+};
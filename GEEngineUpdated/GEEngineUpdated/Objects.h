@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include "core.h"
 #include "maths.h"
 #include "Mesh.h"
@@ -11,6 +12,7 @@ class Plane {
 public:
 	Mesh mesh;
 	std::string shaderName;
+	MeshConstants constants;
 
 	void init(Core* core, PSOManager* psos, Shaders* shaders) {
 		std::vector<STATIC_VERTEX> vertices;
@@ -30,6 +32,7 @@ public:
 		mesh.init(core, vertices, indices);
 		shaders->load(core, "plane", "Resources/Shaders/VS.hlsl", "Resources/Shaders/PSSolid.hlsl");
 		psos->createPSO(core, "planePSO", shaders->find("plane")->vs, shaders->find("plane")->ps, VertexLayoutCache::getStaticLayout());
+		constants.init(shaders, "plane");
 	}
 
 	STATIC_VERTEX addVertex(Vec3 p, Vec3 n, float tu, float tv) {
@@ -43,9 +46,15 @@ public:
 	}
 
 	void draw(Core* core, PSOManager* psos, Shaders* shaders, Matrix& vp, Matrix& w) {
-		shaders->updateConstantVS("plane", "staticMeshBuffer", "VP", &vp);
-		shaders->updateConstantVS("plane", "staticMeshBuffer", "W", &w);
-		shaders->apply(core, shaderName);
+		DrawConstants draw;
+		if (!shaders->beginDraw(core, constants.shader, draw)) {
+			return;
+		}
+		draw.set(constants.VP, &vp);
+		draw.set(constants.W, &w);
+		if (!shaders->apply(core, constants.shader, draw)) {
+			return;
+		}
 		psos->bind(core, "planePSO");
 		mesh.draw(core);
 	}
@@ -57,6 +66,7 @@ public:
 	// Create instance of mesh
 	Mesh mesh;
 	std::string shaderName;
+	MeshConstants constants;
 
 
 	// Helper function for plane
@@ -131,6 +141,7 @@ public:
 		shaders->load(core, "StaticModelUntextured", "Resources/Shaders/VS.hlsl", "Resources/Shaders/PSSolid.hlsl");
 		shaderName = "StaticModelUntextured";
 		psos->createPSO(core, "StaticModelUntexturedPSO", shaders->find("StaticModelUntextured")->vs, shaders->find("StaticModelUntextured")->ps, VertexLayoutCache::getStaticLayout());
+		constants.init(shaders, "StaticModelUntextured");
 	}
 
 	// draw function for spinning lights and pulsing triangle
@@ -139,9 +150,15 @@ public:
 		Matrix cubeWorld;
 		core->beginRenderPass();
 
-		shaders->updateConstantVS("StaticModelUntextured", "staticMeshBuffer", "VP", &vp);
-		shaders->updateConstantVS("StaticModelUntextured", "staticMeshBuffer", "W", &w);
-		shaders->apply(core, shaderName);
+		DrawConstants draw;
+		if (!shaders->beginDraw(core, constants.shader, draw)) {
+			return;
+		}
+		draw.set(constants.VP, &vp);
+		draw.set(constants.W, &w);
+		if (!shaders->apply(core, constants.shader, draw)) {
+			return;
+		}
 		psos->bind(core, "StaticModelUntexturedPSO");
 		mesh.draw(core);
 	}
@@ -153,6 +170,7 @@ public:
 	// Create instance of mesh
 	Mesh mesh;
 	std::string shaderName;
+	MeshConstants constants;
 
 
 	// Helper function for plane
@@ -210,6 +228,7 @@ public:
 		shaders->load(core, "StaticModelUntextured", "Resources/Shaders/VS.hlsl", "Resources/Shaders/PSSolid.hlsl");
 		shaderName = "StaticModelUntextured";
 		psos->createPSO(core, "StaticModelUntexturedPSO", shaders->find("StaticModelUntextured")->vs, shaders->find("StaticModelUntextured")->ps, VertexLayoutCache::getStaticLayout());
+		constants.init(shaders, "StaticModelUntextured");
 	}
 
 	// draw function for spinning lights and pulsing triangle
@@ -219,9 +238,15 @@ public:
 		cubeWorld.scaling(Vec3(20.0f, 20.0f, 20.0f));
 		core->beginRenderPass();
 
-		shaders->updateConstantVS("StaticModelUntextured", "staticMeshBuffer", "VP", &vp);
-		shaders->updateConstantVS("StaticModelUntextured", "staticMeshBuffer", "W", &cubeWorld);
-		shaders->apply(core, shaderName);
+		DrawConstants draw;
+		if (!shaders->beginDraw(core, constants.shader, draw)) {
+			return;
+		}
+		draw.set(constants.VP, &vp);
+		draw.set(constants.W, &cubeWorld);
+		if (!shaders->apply(core, constants.shader, draw)) {
+			return;
+		}
 		psos->bind(core, "StaticModelUntexturedPSO");
 		mesh.draw(core);
 	}
@@ -231,24 +256,49 @@ class staticModel {
 public:
 	StaticMesh mesh;
 	std::string shaderName;
+	MeshConstants constants;
 	std::vector<std::string> textureFilenames;
 	void init(Core* core, PSOManager* psos, Shaders* shaders, std::string filename, TextureManager* textureManager) {
-		shaderName = "static";
 		mesh.init(core, filename, textureManager);
+		initPipeline(core, psos, shaders);
+	}
+
+	// From a model AssetLoader has loaded and uploaded
+	void init(Core* core, PSOManager* psos, Shaders* shaders, LoadedModel& model) {
+		mesh.init(model);
+		initPipeline(core, psos, shaders);
+	}
+
+	void initPipeline(Core* core, PSOManager* psos, Shaders* shaders) {
+		shaderName = "static";
 		shaders->load(core, "static", "Resources/Shaders/VS.hlsl", "Resources/Shaders/PSSolid.hlsl");
 		psos->createPSO(core, "staticPSO", shaders->find("static")->vs, shaders->find("static")->ps, VertexLayoutCache::getStaticLayout());
+		constants.init(shaders, "static");
+		mesh.texBindPoint = shaders->findTexturePS("static", "tex");
 		//texture->load("Resources/Models/Textures/T-rex_Base_Color_alb.png");
 	}
 
-	void update(Shaders* shaders, Matrix& w) {
-		shaders->updateConstantVS("static", "staticMeshBuffer", "W", &w);
+	// Box around every mesh once placed by w
+	BoundingBox worldBounds(const Matrix& w) const {
+		BoundingBox bounds;
+		for (int i = 0; i < mesh.meshes.size(); i++) {
+			BoundingBox placed = mesh.meshes[i]->boundingBox.transform(w);
+			bounds.extend(placed.min);
+			bounds.extend(placed.max);
+		}
+		return bounds;
 	}
 
 	void draw(Core* core, PSOManager* psos, Shaders* shaders, Matrix& vp, Matrix& w, TextureManager* textureManager) {
-		
-		shaders->updateConstantVS("static", "staticMeshBuffer", "VP", &vp);
-		shaders->updateConstantVS("static", "staticMeshBuffer", "W", &w);
-		shaders->apply(core, shaderName);
+		DrawConstants draw;
+		if (!shaders->beginDraw(core, constants.shader, draw)) {
+			return;
+		}
+		draw.set(constants.VP, &vp);
+		draw.set(constants.W, &w);
+		if (!shaders->apply(core, constants.shader, draw)) {
+			return;
+		}
 		psos->bind(core, "staticPSO");
 		mesh.draw(core, shaders, textureManager);
 	}
@@ -257,24 +307,38 @@ public:
 class animatedModel {
 public:
 	AnimatedMesh mesh;
+	MeshConstants constants;
 	std::vector<std::string> textureFilenames;
 
 	void init(Core* core, PSOManager* psos, Shaders* shaders, std::string filename, TextureManager* textureManager) {
 		mesh.init(core, filename, textureManager);
-		shaders->load(core, "animated", "Resources/Shaders/VSAnimated.hlsl", "Resources/Shaders/PS.hlsl");
-		psos->createPSO(core, "animatedPSO", shaders->find("animated")->vs, shaders->find("animated")->ps, VertexLayoutCache::getAnimatedLayout());
+		initPipeline(core, psos, shaders);
+	}
+
+	void init(Core* core, PSOManager* psos, Shaders* shaders, LoadedModel& model) {
+		mesh.init(model);
+		initPipeline(core, psos, shaders);
 	}
 
-	void update(Shaders* shaders, Matrix& w) {
-		shaders->updateConstantVS("animated", "staticMeshBuffer", "W", &w);
+	void initPipeline(Core* core, PSOManager* psos, Shaders* shaders) {
+		shaders->load(core, "animated", "Resources/Shaders/VSAnimated.hlsl", "Resources/Shaders/PS.hlsl");
+		psos->createPSO(core, "animatedPSO", shaders->find("animated")->vs, shaders->find("animated")->ps, VertexLayoutCache::getAnimatedLayout());
+		constants.init(shaders, "animated");
+		mesh.texBindPoint = shaders->findTexturePS("animated", "tex");
 	}
 
 	void draw(Core* core, PSOManager* psos, Shaders* shaders, AnimationInstance* instance, Matrix& vp, Matrix& w, TextureManager* textureManager) {
+		DrawConstants draw;
+		if (!shaders->beginDraw(core, constants.shader, draw)) {
+			return;
+		}
+		draw.set(constants.W, &w);
+		draw.set(constants.VP, &vp);
+		draw.set(constants.bones, instance->matrices);
+		if (!shaders->apply(core, constants.shader, draw)) {
+			return;
+		}
 		psos->bind(core, "animatedPSO");
-		shaders->updateConstantVS("animated", "staticMeshBuffer", "W", &w);
-		shaders->updateConstantVS("animated", "staticMeshBuffer", "VP", &vp);
-		shaders->updateConstantVS("animated", "staticMeshBuffer", "bones", instance->matrices);
-		shaders->apply(core, "animated");
 		
 		mesh.draw(core, shaders, textureManager);
 	}
@@ -282,24 +346,35 @@ public:
 
 class Grass {
 public:
-	Mesh mesh;
+	// Points at ownedMesh when built from a file. Built from a LoadedModel it is borrowed: the meshes CoreAssetUploader
+	// creates are never freed, like the models AssetLoader caches, so they outlive the grass. Either way the grass
+	// gives the mesh its instance buffer, so it is not for drawing elsewhere.
+	Mesh* mesh = nullptr;
+	std::unique_ptr<Mesh> ownedMesh;
 	std::vector<Matrix> instances;
+	Shader* shader = nullptr;
+	ConstantHandle vpConstant;
+	ConstantHandle timeConstant;
+	UINT texBindPoint = 0;
 
 	void init(Core* core, PSOManager* psos, Shaders* shaders, std::string modelFile, int count) {
-		GEMLoader::GEMModelLoader loader;
-		std::vector<GEMLoader::GEMMesh> gemmeshes;
-		loader.load(modelFile, gemmeshes);
-
+		CookedModel model;
+		AssetCache::load(modelFile, model, nullptr);
 
 		// Init mesh geometry
-		std::vector<STATIC_VERTEX> vertices;
-		for (int j = 0; j < gemmeshes[0].verticesStatic.size(); j++) {
-			STATIC_VERTEX v;
-			memcpy(&v, &gemmeshes[0].verticesStatic[j], sizeof(STATIC_VERTEX));
-			vertices.push_back(v);
-		}
-		mesh.init(core, vertices, gemmeshes[0].indices);
+		ownedMesh.reset(new Mesh());
+		mesh = ownedMesh.get();
+		mesh->init(core, model.meshes[0]);
+		scatter(core, psos, shaders, count);
+	}
+
+	// From a model AssetLoader has loaded and uploaded
+	void init(Core* core, PSOManager* psos, Shaders* shaders, LoadedModel& model, int count) {
+		mesh = model.meshes[0];
+		scatter(core, psos, shaders, count);
+	}
 
+	void scatter(Core* core, PSOManager* psos, Shaders* shaders, int count) {
 		for (int i = 0; i < count; i++) {
 			float rX = ((float)rand() / RAND_MAX) * 100.0f - 50.0f; // -50 to 50
 			float rZ = ((float)rand() / RAND_MAX) * 100.0f - 50.0f; // -50 to 50
@@ -313,29 +388,35 @@ public:
 			instances.push_back(T.multiply(R).multiply(S));
 		}
 
-		mesh.initInstances(core, instances);
+		mesh->initInstances(core, instances);
 
 		shaders->load(core, "GrassInstanced", "Resources/Shaders/VSInstanced.hlsl", "Resources/Shaders/PS.hlsl");
 
 		// Use the NEW Instanced Layout
 		psos->createPSO(core, "GrassPSO", shaders->find("GrassInstanced")->vs, shaders->find("GrassInstanced")->ps, VertexLayoutCache::getInstancedLayout());
+		shader = shaders->find("GrassInstanced");
+		vpConstant = shaders->findConstantVS("GrassInstanced", "staticMeshBuffer", "VP");
+		timeConstant = shaders->findConstantVS("GrassInstanced", "TimeBuffer", "time");
+		texBindPoint = shaders->findTexturePS("GrassInstanced", "tex");
 	}
 
 	void draw(Core* core, PSOManager* psos, Shaders* shaders, Matrix& vp, float dt, TextureManager* texMan) {
 		psos->bind(core, "GrassPSO");
 
 		// We ONLY send VP. 'W' is handled automatically per-instance by the vertex buffer!
-		shaders->updateConstantVS("GrassInstanced", "staticMeshBuffer", "VP", &vp);
+		vpConstant.update(&vp);
 
 		// Update Time
 		static float t = 0; t += dt;
-		shaders->updateConstantVS("GrassInstanced", "TimeBuffer", "time", &t);
+		timeConstant.update(&t);
 
-		shaders->updateTexturePS(core, "GrassInstanced", "tex", texMan->find("GrassTexture")); // Ensure you load "GrassTexture"
-		shaders->apply(core, "GrassInstanced");
+		shaders->updateTexturePS(core, texBindPoint, texMan->find("GrassTexture"), texMan->findSlice("GrassTexture")); // Ensure you load "GrassTexture"
+		if (!shaders->apply(core, shader)) {
+			return;
+		}
 
 		// Single efficient draw call
-		mesh.drawInstanced(core);
+		mesh->drawInstanced(core);
 	}
 };
 
@@ -347,15 +428,20 @@ public:
 
 	// We reuse your existing Plane mesh for the billboard
 	Plane* planeMesh = nullptr;
+	MeshConstants constants; // Of the static shader
+	UINT texBindPoint = 0;
 
 	// Transform
 	Vec3 position;
 	float scale = 0.15f;
 	float randomRotation = 0.0f;
 
-	void init(Plane* mesh) {
+	// The static shader has to be loaded already
+	void init(Shaders* shaders, Plane* mesh) {
 		planeMesh = mesh;
 		active = false;
+		constants.init(shaders, "static");
+		texBindPoint = shaders->findTexturePS("static", "tex");
 	}
 
 	void activate(Vec3 gunTipPos) {
@@ -404,10 +490,16 @@ public:
 		Matrix world = T.multiply(rot).multiply(S);
 
 		psos->bind(core, "transparent");
-		shaders->updateTexturePS(core, "static", "tex", texMan->find("MuzzleFlashTex"));
-		shaders->updateConstantVS("static", "staticMeshBuffer", "W", &world);
-		shaders->updateConstantVS("static", "staticMeshBuffer", "VP", &vp);
-		shaders->apply(core, "static");
+		shaders->updateTexturePS(core, texBindPoint, texMan->find("MuzzleFlashTex"), texMan->findSlice("MuzzleFlashTex"));
+		DrawConstants draw;
+		if (!shaders->beginDraw(core, constants.shader, draw)) {
+			return;
+		}
+		draw.set(constants.W, &world);
+		draw.set(constants.VP, &vp);
+		if (!shaders->apply(core, constants.shader, draw)) {
+			return;
+		}
 
 		planeMesh->mesh.draw(core);
 	}
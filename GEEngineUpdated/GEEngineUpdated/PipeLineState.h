@@ -145,9 +145,14 @@ public:
         psos[name] = pso;
     }
 
+    // Only looks, so draws recorded on several threads can bind at once
     void bind(Core* core, std::string name)
     {
-        core->getCommandList()->SetPipelineState(psos[name]);
+        auto pso = psos.find(name);
+        if (pso != psos.end())
+        {
+            core->getCommandList()->SetPipelineState(pso->second);
+        }
     }
 
     ~PSOManager()
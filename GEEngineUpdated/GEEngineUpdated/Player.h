@@ -65,7 +65,7 @@ public:
     MuzzleFlash flash;
 
     // Initialization
-    void init(Core* core, PSOManager* psos, Shaders* shaders, TextureManager* textureManager) {
+    void init(Core* core, PSOManager* psos, Shaders* shaders, LoadedModel& gun) {
         position = Vec3(0.0f, 2.0f, -5.0f); // Start slightly back and up
         worldUp = Vec3(0.0f, 1.0f, 0.0f);
         yaw = 0.0f;
@@ -77,7 +77,7 @@ public:
         yVelocity = 0.0f;
         isGrounded = false;
 
-        gunModel.init(core, psos, shaders, "Resources/Models/AutomaticCarbine.gem", textureManager);
+        gunModel.init(core, psos, shaders, gun);
         gunAnimInstance.init(&gunModel.mesh.animation, 0);
         playerAnim.init(&gunAnimInstance, &gunModel, PlayerState::Idle);
 
@@ -94,8 +94,8 @@ public:
         playerAnim.addState(PlayerState::MeleeAttack, "10 melee attack", false);
     }
 
-    void setFlashMesh(Plane* p) {
-        flash.init(p);
+    void setFlashMesh(Shaders* shaders, Plane* p) {
+        flash.init(shaders, p);
     }
 
     void processInput(Window& win, GameInput& input, float dt) {
@@ -223,11 +223,17 @@ public:
         Matrix finalGunMatrix = gunLogic.multiply(gunScale);
 
         // Bind and Draw
+        DrawConstants draw;
+        if (!shaders->beginDraw(core, gunModel.constants.shader, draw)) {
+            return;
+        }
+        draw.set(gunModel.constants.W, &finalGunMatrix);
+        draw.set(gunModel.constants.VP, &vp);
+        draw.set(gunModel.constants.bones, gunAnimInstance.matrices);
+        if (!shaders->apply(core, gunModel.constants.shader, draw)) {
+            return;
+        }
         psos->bind(core, "animatedPSO");
-        shaders->updateConstantVS("animated", "staticMeshBuffer", "W", &finalGunMatrix);
-        shaders->updateConstantVS("animated", "staticMeshBuffer", "VP", &vp);
-        shaders->updateConstantVS("animated", "staticMeshBuffer", "bones", gunAnimInstance.matrices);
-        shaders->apply(core, "animated");
         gunModel.mesh.draw(core, shaders, textureManager);
 
     }
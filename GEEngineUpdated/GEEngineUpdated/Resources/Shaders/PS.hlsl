@@ -1,4 +1,8 @@
-Texture2D tex : register(t0);
+Texture2DArray tex : register(t0);
+cbuffer textureSlice : register(b1)
+{
+    uint slice;
+};
 SamplerState samplerLinear : register(s0);
 struct PS_INPUT
 {
@@ -9,6 +13,6 @@ struct PS_INPUT
 };
 float4 PS(PS_INPUT input) : SV_Target0
 {
-    float4 colour = tex.Sample(samplerLinear, input.TexCoords);
+    float4 colour = tex.Sample(samplerLinear, float3(input.TexCoords, slice));
     return float4(colour.rgb, 1.0);
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 // PS_Grass.hlsl
-Texture2D tex : register(t0);
+Texture2DArray tex : register(t0);
+cbuffer textureSlice : register(b1)
+{
+    uint slice;
+};
 SamplerState samplerLinear : register(s0);
 
 struct PS_INPUT
@@ -13,7 +17,7 @@ struct PS_INPUT
 
 float4 PS(PS_INPUT input) : SV_Target0
 {
-    float4 color = tex.Sample(samplerLinear, input.texCoord);
+    float4 color = tex.Sample(samplerLinear, float3(input.texCoord, slice));
     
     // Alpha Clipping: If pixel is transparent, don't draw it (Grass blades)
     if (color.a < 0.5f)
@@ -9,73 +9,40 @@
 #include <vector>
 
 #include "Core.h"
+#include "ShaderConstants.h"
 
 #pragma comment(lib, "dxguid.lib")
 
-struct ConstantBufferVariable
-{
-	unsigned int offset;
-	unsigned int size;
-};
-
-class ConstantBuffer
+// Copies its values into the frame's constants for each draw
+class ConstantBuffer : public ConstantBufferValues
 {
 public:
-	std::string name;
-	std::map<std::string, ConstantBufferVariable> constantBufferData;
-	ID3D12Resource* constantBuffer;
-	unsigned char* buffer;
-	unsigned int cbSizeInBytes;
-	unsigned int numInstances;
-	unsigned int offsetIndex;
-	void init(Core* core, unsigned int sizeInBytes, unsigned int maxDrawCalls = 1024)
-	{
-		cbSizeInBytes = (sizeInBytes + 255) & ~255;
-		unsigned int cbSizeInBytesAligned = cbSizeInBytes * maxDrawCalls;
-		numInstances = maxDrawCalls;
-		offsetIndex = 0;
-		HRESULT hr;
-		D3D12_HEAP_PROPERTIES heapprops;
-		memset(&heapprops, 0, sizeof(D3D12_HEAP_PROPERTIES));
-		heapprops.Type = D3D12_HEAP_TYPE_UPLOAD;
-		heapprops.CreationNodeMask = 1;
-		heapprops.VisibleNodeMask = 1;
-		D3D12_RESOURCE_DESC cbDesc;
-		memset(&cbDesc, 0, sizeof(D3D12_RESOURCE_DESC));
-		cbDesc.Width = cbSizeInBytesAligned;
-		cbDesc.Height = 1;
-		cbDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-		cbDesc.DepthOrArraySize = 1;
-		cbDesc.MipLevels = 1;
-		cbDesc.SampleDesc.Count = 1;
-		cbDesc.SampleDesc.Quality = 0;
-		cbDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-		hr = core->device->CreateCommittedResource(&heapprops, D3D12_HEAP_FLAG_NONE, &cbDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, __uuidof(ID3D12Resource), (void**)&constantBuffer);
-		D3D12_RANGE readRange = { 0, 0 };
-		hr = constantBuffer->Map(0, &readRange, (void**)&buffer);
-	}
-	void update(std::string name, void* data) // Data is immediatly visible
+	// Returns where the values went, or 0 when the frame is out of space. Core reports that, and the draw has to
+	// be skipped rather than bind 0 or an address from an earlier frame. Only reads the values, so draws recorded on
+	// several threads can share them as long as nothing updates them meanwhile.
+	D3D12_GPU_VIRTUAL_ADDRESS upload(Core* core) const
 	{
-		ConstantBufferVariable cbVariable = constantBufferData[name];
-		unsigned int offset = offsetIndex * cbSizeInBytes;
-		memcpy(&buffer[offset + cbVariable.offset], data, cbVariable.size);
-	}
-	D3D12_GPU_VIRTUAL_ADDRESS getGPUAddress() const
-	{
-		return (constantBuffer->GetGPUVirtualAddress() + (offsetIndex * cbSizeInBytes));
-	}
-	void next()
-	{
-		offsetIndex++;
-		if (offsetIndex >= numInstances)
+		ConstantAllocation allocation;
+		if (!core->constants.allocate(cbSizeInBytes, allocation))
 		{
-			offsetIndex = 0;
+			return 0;
 		}
+		memcpy(allocation.data, buffer.data(), cbSizeInBytes);
+		return core->constantsGPUAddress + allocation.offset;
 	}
-	void free()
+};
+
+// One draw's own vertex constants, written straight into the frame's constant space. They start as a copy of the
+// shader's values, so whatever the draw does not set carries over from those, but what it sets no other draw sees.
+// Draws recorded on several threads at once need this, as the shader's values are shared between them.
+struct DrawConstants
+{
+	unsigned char* data = nullptr; // Null when the shader has no vertex constants
+	D3D12_GPU_VIRTUAL_ADDRESS address = 0;
+
+	void set(const ConstantHandle& handle, const void* value)
 	{
-		constantBuffer->Unmap(0, NULL);
-		constantBuffer->Release();
+		handle.update(data, value);
 	}
 };
 
@@ -100,8 +67,14 @@ public:
 			ID3D12ShaderReflectionConstantBuffer* constantBuffer = reflection->GetConstantBufferByIndex(i);
 			D3D12_SHADER_BUFFER_DESC cbDesc;
 			constantBuffer->GetDesc(&cbDesc);
+			// Only b0 is a constant buffer, b1 is the root constant holding the texture array slice
+			D3D12_SHADER_INPUT_BIND_DESC cbBindDesc;
+			reflection->GetResourceBindingDescByName(cbDesc.Name, &cbBindDesc);
+			if (cbBindDesc.BindPoint != 0)
+			{
+				continue;
+			}
 			buffer.name = cbDesc.Name;
-			unsigned int totalSize = 0;
 			for (int j = 0; j < cbDesc.Variables; j++)
 			{
 				ID3D12ShaderReflectionVariable* var = constantBuffer->GetVariableByIndex(j);
@@ -111,9 +84,9 @@ public:
 				bufferVariable.offset = vDesc.StartOffset;
 				bufferVariable.size = vDesc.Size;
 				buffer.constantBufferData.insert({ vDesc.Name, bufferVariable });
-				totalSize += bufferVariable.size;
 			}
-			buffer.init(core, totalSize);
+			// The reflected size, which counts the padding between variables
+			buffer.init(cbDesc.Size);
 			buffers.push_back(buffer);
 		}
 		for (int i = 0; i < desc.BoundResources; i++)
@@ -149,7 +122,19 @@ public:
 		}
 		initConstantBuffers(core, vs, vsConstantBuffers);
 	}
-	void updateConstant(std::string constantBufferName, std::string variableName, void* data, std::vector<ConstantBuffer>& buffers)
+	// Invalid when the shader has no such variable
+	ConstantHandle findConstant(const std::string& constantBufferName, const std::string& variableName, std::vector<ConstantBuffer>& buffers)
+	{
+		for (int i = 0; i < buffers.size(); i++)
+		{
+			if (buffers[i].name == constantBufferName)
+			{
+				return buffers[i].find(variableName);
+			}
+		}
+		return ConstantHandle();
+	}
+	void updateConstant(const std::string& constantBufferName, const std::string& variableName, void* data, std::vector<ConstantBuffer>& buffers)
 	{
 		for (int i = 0; i < buffers.size(); i++)
 		{
@@ -160,42 +145,93 @@ public:
 			}
 		}
 	}
-	void updateConstantVS(std::string constantBufferName, std::string variableName, void* data)
+	void updateConstantVS(const std::string& constantBufferName, const std::string& variableName, void* data)
 	{
 		updateConstant(constantBufferName, variableName, data, vsConstantBuffers);
 	}
-	void updateConstantPS(std::string constantBufferName, std::string variableName, void* data)
+	void updateConstantPS(const std::string& constantBufferName, const std::string& variableName, void* data)
 	{
 		updateConstant(constantBufferName, variableName, data, psConstantBuffers);
 	}
 
 	
 
-	void apply(Core* core)
+	// Binds a copy of the shader's constants. False, binding nothing, when the frame is out of constant space, and
+	// the draw has to be skipped.
+	bool apply(Core* core)
 	{
-		for (int i = 0; i < vsConstantBuffers.size(); i++)
+		D3D12_GPU_VIRTUAL_ADDRESS vsAddress = 0;
+		D3D12_GPU_VIRTUAL_ADDRESS psAddress = 0;
+		if (!vsConstantBuffers.empty())
+		{
+			vsAddress = vsConstantBuffers[0].upload(core);
+			if (vsAddress == 0)
+			{
+				return false;
+			}
+		}
+		if (!psConstantBuffers.empty())
 		{
-			core->getCommandList()->SetGraphicsRootConstantBufferView(0, vsConstantBuffers[i].getGPUAddress());
-			vsConstantBuffers[i].next();
+			psAddress = psConstantBuffers[0].upload(core);
+			if (psAddress == 0)
+			{
+				return false;
+			}
 		}
-		for (int i = 0; i < psConstantBuffers.size(); i++)
+		if (vsAddress != 0)
 		{
-			core->getCommandList()->SetGraphicsRootConstantBufferView(1, psConstantBuffers[i].getGPUAddress());
-			psConstantBuffers[i].next();
+			core->getCommandList()->SetGraphicsRootConstantBufferView(0, vsAddress);
 		}
+		if (psAddress != 0)
+		{
+			core->getCommandList()->SetGraphicsRootConstantBufferView(1, psAddress);
+		}
+		return true;
 	}
-	void free()
+	// Starts draw's copy of the vertex constants. False when the frame is out of constant space, which Core
+	// reports, and the draw has to be skipped.
+	bool beginDraw(Core* core, DrawConstants& draw)
 	{
-		ps->Release();
-		vs->Release();
-		for (auto cb : psConstantBuffers)
+		draw = DrawConstants();
+		if (vsConstantBuffers.empty())
+		{
+			return true;
+		}
+		const ConstantBuffer& values = vsConstantBuffers[0];
+		ConstantAllocation allocation;
+		if (!core->constants.allocate(values.cbSizeInBytes, allocation))
 		{
-			cb.free();
+			return false;
 		}
-		for (auto cb : vsConstantBuffers)
+		memcpy(allocation.data, values.buffer.data(), values.cbSizeInBytes);
+		draw.data = allocation.data;
+		draw.address = core->constantsGPUAddress + allocation.offset;
+		return true;
+	}
+	// Binds draw's vertex constants and a copy of the pixel constants. Only reads the shader, so it is safe on any
+	// thread. False, binding nothing, when the frame is out of constant space.
+	bool apply(Core* core, const DrawConstants& draw)
+	{
+		D3D12_GPU_VIRTUAL_ADDRESS psAddress = 0;
+		if (!psConstantBuffers.empty())
+		{
+			psAddress = psConstantBuffers[0].upload(core);
+			if (psAddress == 0)
+			{
+				return false;
+			}
+			core->getCommandList()->SetGraphicsRootConstantBufferView(1, psAddress);
+		}
+		if (draw.data != nullptr)
 		{
-			cb.free();
+			core->getCommandList()->SetGraphicsRootConstantBufferView(0, draw.address);
 		}
+		return true;
+	}
+	void free()
+	{
+		ps->Release();
+		vs->Release();
 	}
 };
 
@@ -223,30 +259,78 @@ public:
 		shader.loadVS(core, readFile(vsfilename));
 		shaders.insert({ shadername, shader });
 	}
-	void updateConstantVS(std::string name, std::string constantBufferName, std::string variableName, void* data)
+	// By name, for setup. Per draw, find a ConstantHandle once and update that.
+	void updateConstantVS(const std::string& name, const std::string& constantBufferName, const std::string& variableName, void* data)
 	{
 		shaders[name].updateConstantVS(constantBufferName, variableName, data);
 	}
-	void updateConstantPS(std::string name, std::string constantBufferName, std::string variableName, void* data)
+	void updateConstantPS(const std::string& name, const std::string& constantBufferName, const std::string& variableName, void* data)
 	{
 		shaders[name].updateConstantPS(constantBufferName, variableName, data);
 	}
 
-	void updateTexturePS(Core* core, const std::string& shaderName, const std::string& textureName, int heapOffset) {
-		UINT bindPoint = shaders[shaderName].textureBindPoints[textureName];
+	ConstantHandle findConstantVS(const std::string& name, const std::string& constantBufferName, const std::string& variableName)
+	{
+		Shader& shader = shaders[name];
+		return shader.findConstant(constantBufferName, variableName, shader.vsConstantBuffers);
+	}
+	ConstantHandle findConstantPS(const std::string& name, const std::string& constantBufferName, const std::string& variableName)
+	{
+		Shader& shader = shaders[name];
+		return shader.findConstant(constantBufferName, variableName, shader.psConstantBuffers);
+	}
+
+	// The bind point to hand updateTexturePS per draw. Only looks, so draws can call it from any thread.
+	UINT findTexturePS(const std::string& shaderName, const std::string& textureName)
+	{
+		auto shader = shaders.find(shaderName);
+		if (shader == shaders.end())
+		{
+			return 0;
+		}
+		auto bindPoint = shader->second.textureBindPoints.find(textureName);
+		return bindPoint != shader->second.textureBindPoints.end() ? bindPoint->second : 0;
+	}
+
+	// Every texture is an array, slice picks the one to sample
+	void updateTexturePS(Core* core, const std::string& shaderName, const std::string& textureName, int heapOffset, unsigned int slice = 0) {
+		updateTexturePS(core, findTexturePS(shaderName, textureName), heapOffset, slice);
+	}
+
+	void updateTexturePS(Core* core, UINT bindPoint, int heapOffset, unsigned int slice = 0) {
 		D3D12_GPU_DESCRIPTOR_HANDLE handle = core->srvHeap.gpuHandle;
 
 		handle.ptr = handle.ptr + (UINT64)(heapOffset - bindPoint) * (UINT64)core->srvHeap.incrementSize;
 		core->getCommandList()->SetGraphicsRootDescriptorTable(2, handle);
+		updateSlicePS(core, slice);
 	}
 
-	Shader* find(std::string name)
+	// Changes the slice alone, for the next draw from the same array
+	void updateSlicePS(Core* core, unsigned int slice) {
+		core->getCommandList()->SetGraphicsRoot32BitConstant(3, slice, 0);
+	}
+
+	// Stays valid for as long as Shaders does
+	Shader* find(const std::string& name)
 	{
 		return &shaders[name];
 	}
-	void apply(Core* core, std::string name)
+	bool apply(Core* core, const std::string& name)
+	{
+		return shaders[name].apply(core);
+	}
+	bool apply(Core* core, Shader* shader)
+	{
+		return shader->apply(core);
+	}
+	// Per draw constants, for draws that may be recorded on worker threads
+	bool beginDraw(Core* core, Shader* shader, DrawConstants& draw)
+	{
+		return shader->beginDraw(core, draw);
+	}
+	bool apply(Core* core, Shader* shader, const DrawConstants& draw)
 	{
-		shaders[name].apply(core);
+		return shader->apply(core, draw);
 	}
 	~Shaders()
 	{
@@ -256,4 +340,20 @@ public:
 			shaders.erase(it++);
 		}
 	}
-};
\ No newline at end of file
+};
+
+// What a mesh draw sets, found once for a shader with staticMeshBuffer. Only the animated shader has bones.
+struct MeshConstants
+{
+	Shader* shader = nullptr;
+	ConstantHandle W;
+	ConstantHandle VP;
+	ConstantHandle bones;
+	void init(Shaders* shaders, const std::string& shaderName)
+	{
+		shader = shaders->find(shaderName);
+		W = shaders->findConstantVS(shaderName, "staticMeshBuffer", "W");
+		VP = shaders->findConstantVS(shaderName, "staticMeshBuffer", "VP");
+		bones = shaders->findConstantVS(shaderName, "staticMeshBuffer", "bones");
+	}
+};
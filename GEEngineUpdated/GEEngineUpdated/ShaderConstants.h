@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct ConstantBufferVariable
+{
+	unsigned int offset;
+	unsigned int size;
+};
+
+// A variable found once, with Shaders::findConstantVS or findConstantPS, so that setting it per draw is a
+// memcpy into its buffer rather than looking up the shader, the buffer and the variable by name. It points into
+// the buffer's values, which stay put once the shader is loaded, and keeps its offset for writing into a draw's
+// own copy of them.
+struct ConstantHandle
+{
+	unsigned char* data = nullptr;
+	unsigned int offset = 0;
+	unsigned int size = 0;
+
+	bool valid() const
+	{
+		return data != nullptr;
+	}
+
+	void update(const void* value) const
+	{
+		if (data != nullptr)
+		{
+			memcpy(data, value, size);
+		}
+	}
+
+	// Into values laid out like the buffer, e.g. a DrawConstants
+	void update(unsigned char* values, const void* value) const
+	{
+		if (data != nullptr && values != nullptr)
+		{
+			memcpy(values + offset, value, size);
+		}
+	}
+};
+
+// A constant buffer's values, kept on the CPU until a draw copies them to the GPU. Values not updated carry over
+// from the draw before.
+class ConstantBufferValues
+{
+public:
+	std::string name;
+	std::map<std::string, ConstantBufferVariable> constantBufferData;
+	std::vector<unsigned char> buffer;
+	unsigned int cbSizeInBytes = 0;
+
+	void init(unsigned int sizeInBytes)
+	{
+		cbSizeInBytes = (sizeInBytes + 255) & ~255;
+		buffer.assign(cbSizeInBytes, 0);
+	}
+
+	void update(const std::string& variableName, const void* data)
+	{
+		ConstantBufferVariable cbVariable = constantBufferData[variableName];
+		memcpy(&buffer[cbVariable.offset], data, cbVariable.size);
+	}
+
+	// Invalid when there is no such variable
+	ConstantHandle find(const std::string& variableName)
+	{
+		ConstantHandle handle;
+		auto it = constantBufferData.find(variableName);
+		if (it != constantBufferData.end())
+		{
+			handle.data = &buffer[it->second.offset];
+			handle.offset = it->second.offset;
+			handle.size = it->second.size;
+		}
+		return handle;
+	}
+};
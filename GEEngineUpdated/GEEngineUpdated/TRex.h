@@ -28,12 +28,12 @@ public:
 
     BoundingBox collider;
 
-    void init(Core* core, PSOManager* psos, Shaders* shaders, TextureManager* texMan) {
+    void init(Core* core, PSOManager* psos, Shaders* shaders, LoadedModel& loaded) {
         position = Vec3(25.0f, 0.0f, 5.0f);
         scale = 0.01f;
 
-        // Load Assets
-        model.init(core, psos, shaders, "Resources/Models/TRex.gem", texMan);
+        // Assets were loaded by the AssetLoader
+        model.init(core, psos, shaders, loaded);
         animInstance.init(&model.mesh.animation, 0);
         animManager.init(&animInstance, &model, TrexState::Idle);
 
@@ -44,6 +44,11 @@ public:
         animManager.addState(TrexState::Roar, "roar", false);
         animManager.addState(TrexState::Attack, "attack", false);
         animManager.addState(TrexState::Die, "death", false);
+
+        // Blend the locomotion clips into each other rather than snapping
+        animManager.defaultFade = 0.2f;
+        animManager.addTransition(TrexState::Idle, TrexState::Run, 0.3f);
+        animManager.addTransition(TrexState::Run, TrexState::Idle, 0.3f);
     }
 
     void update(float dt, Window& win, Vec3 playerPos) {
@@ -92,7 +97,7 @@ public:
             }
         }
 
-        animManager.update(dt);
+        animManager.advance(dt); // The pose is evaluated through the animation LOD in main
 
         
     }
@@ -106,13 +111,18 @@ public:
 
         transform = T.multiply(R).multiply(S);
 
-        psos->bind(core, "animatedPSO");
-
-        shaders->updateConstantVS("animated", "staticMeshBuffer", "W", &transform);
-        shaders->updateConstantVS("animated", "staticMeshBuffer", "VP", &vp);
-        shaders->updateConstantVS("animated", "staticMeshBuffer", "bones", animInstance.matrices);
+        DrawConstants draw;
+        if (!shaders->beginDraw(core, model.constants.shader, draw)) {
+            return;
+        }
+        draw.set(model.constants.W, &transform);
+        draw.set(model.constants.VP, &vp);
+        draw.set(model.constants.bones, animInstance.matrices);
+        if (!shaders->apply(core, model.constants.shader, draw)) {
+            return;
+        }
 
-        shaders->apply(core, "animated");
+        psos->bind(core, "animatedPSO");
         model.mesh.draw(core, shaders, texMan);
     }
 
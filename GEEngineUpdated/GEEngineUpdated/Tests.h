@@ -0,0 +1,828 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "maths.h"
+#include "Collision.h"
+#include "Animation.h"
+#include "AnimationLOD.h"
+#include "MipGenerator.h"
+#include "BlockCompression.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "TexturePacker.h"
+#include "HeadlessTests.h"
+
+// Headless checks, started with "-test" on the command line. Each one asserts what a module promises, so unlike
+// the benchmarks a wrong answer fails rather than just printing. Failures go to the debug output and to tests.txt
+// in the working directory, and the exit code is the number of failed checks.
+class Tests : public HeadlessTests
+{
+public:
+	static int run()
+	{
+		Tests tests;
+		tests.simdKernels();
+		tests.boundsTransform();
+		tests.animationCompression();
+		tests.animationBlending();
+		tests.nestedJobSystems();
+		tests.animationLOD();
+		tests.mipGenerator();
+		tests.linearTextures();
+		tests.blockCompression();
+		tests.textureStreaming();
+		tests.atlasPacking();
+		tests.descriptorFragmentation();
+		tests.uploadRing();
+		tests.framePacing();
+		tests.parallelRecording();
+		tests.frameConstants();
+
+		tests.summarise();
+		OutputDebugStringA(tests.report.c_str());
+		std::ofstream file("tests.txt");
+		file << tests.report;
+		return tests.failuresN;
+	}
+
+private:
+	// The SIMD multiply, invert and batch transforms against the scalar code, over pseudo random matrices. The
+	// batch sizes leave a remainder so the scalar tail runs too.
+	void simdKernels()
+	{
+		begin("SIMD matrix and vector kernels");
+		unsigned int seed = 12345;
+		auto random = [&seed]()
+		{
+			seed = (seed * 1103515245) + 12345;
+			return ((((seed >> 8) & 0xffff) / 32767.5f) - 1.0f) * 4.0f;
+		};
+		for (int i = 0; i < 200; i++)
+		{
+			Matrix a;
+			Matrix b;
+			for (int e = 0; e < 16; e++)
+			{
+				a.m[e] = random();
+				b.m[e] = random();
+			}
+			// Keep a well conditioned so the two inverses can be compared closely
+			for (int d = 0; d < 4; d++)
+			{
+				a.a[d][d] += 10.0f;
+			}
+			Matrix simd = a.multiply(b);
+			Matrix scalar = a.multiplyScalar(b);
+			Matrix simdInverse = a.invert();
+			Matrix scalarInverse = a.invertScalar();
+			bool multiplied = true;
+			bool inverted = true;
+			for (int e = 0; e < 16; e++)
+			{
+				multiplied = multiplied && near(simd.m[e], scalar.m[e], 1e-5f);
+				inverted = inverted && near(simdInverse.m[e], scalarInverse.m[e], 1e-4f);
+			}
+			check(multiplied, "multiply matches multiplyScalar for matrix " + std::to_string(i));
+			check(inverted, "invert matches invertScalar for matrix " + std::to_string(i));
+
+			const int vectorsN = 23;
+			std::vector<Vec3> in(vectorsN);
+			for (int v = 0; v < vectorsN; v++)
+			{
+				in[v] = Vec3(random(), random(), random());
+			}
+			std::vector<Vec3> points(vectorsN);
+			std::vector<Vec3> vectors(vectorsN);
+			a.transformPoints(in.data(), points.data(), vectorsN);
+			a.transformVectors(in.data(), vectors.data(), vectorsN);
+			bool transformed = true;
+			for (int v = 0; v < vectorsN; v++)
+			{
+				Vec3 point = a.mulPoint(in[v]);
+				Vec3 vector = a.mulVec(in[v]);
+				transformed = transformed && near(points[v].x, point.x, 1e-5f) && near(points[v].y, point.y, 1e-5f) && near(points[v].z, point.z, 1e-5f);
+				transformed = transformed && near(vectors[v].x, vector.x, 1e-5f) && near(vectors[v].y, vector.y, 1e-5f) && near(vectors[v].z, vector.z, 1e-5f);
+			}
+			check(transformed, "transformPoints and transformVectors match mulPoint and mulVec for matrix " + std::to_string(i));
+		}
+	}
+
+	// Local bounds taken into world space enclose every transformed corner and nothing more for a scale and
+	// translation, and stay the tight box around the rotated corners for a rotation
+	void boundsTransform()
+	{
+		begin("BoundingBox::transform");
+		BoundingBox local;
+		local.extend(Vec3(-100.0f, 0.0f, -50.0f));
+		local.extend(Vec3(100.0f, 400.0f, 50.0f));
+
+		Matrix placed;
+		placed.scaling(Vec3(0.01f, 0.01f, 0.01f));
+		placed.translation(Vec3(5.0f, 0.0f, 0.0f));
+		BoundingBox world = local.transform(placed);
+		check(near(world.min.x, 4.0f, 1e-5f) && near(world.min.y, 0.0f, 1e-5f) && near(world.min.z, -0.5f, 1e-5f), "scaled and translated min");
+		check(near(world.max.x, 6.0f, 1e-5f) && near(world.max.y, 4.0f, 1e-5f) && near(world.max.z, 0.5f, 1e-5f), "scaled and translated max");
+
+		// A quarter turn about y swaps the x and z extents
+		Matrix turned;
+		turned.rotAroundY(1.5707963f);
+		world = local.transform(turned);
+		check(near(world.max.x - world.min.x, 100.0f, 1e-4f) && near(world.max.z - world.min.z, 200.0f, 1e-4f), "quarter turn swaps the x and z extents");
+		check(near(world.min.y, 0.0f, 1e-4f) && near(world.max.y, 400.0f, 1e-4f), "quarter turn about y keeps the y extent");
+	}
+
+	// Key reduction keeps every original frame within the settings' tolerances, a bone's rotation and scale within
+	// the budget its reach tightens them to, and a constant track down to one key. Rotations are checked against
+	// the 48 bit packing alone too, for every choice of dropped component and sign.
+	void animationCompression()
+	{
+		begin("Animation compression");
+		unsigned int seed = 99;
+		auto random = [&seed]()
+		{
+			seed = (seed * 1103515245) + 12345;
+			return (((seed >> 8) & 0xffff) / 32767.5f) - 1.0f;
+		};
+		auto axisAngle = [](float x, float y, float z, float angle)
+		{
+			float length = sqrtf((x * x) + (y * y) + (z * z));
+			float s = sinf(angle * 0.5f) / length;
+			return Quaternion(x * s, y * s, z * s, cosf(angle * 0.5f));
+		};
+
+		float worstPacking = 0;
+		for (int i = 0; i < 4000; i++)
+		{
+			Quaternion q = axisAngle(random(), random(), random(), random() * 3.14159265f);
+			// Also a quaternion led by each component in turn, either way round
+			if (i < 8)
+			{
+				q = Quaternion(0.1f, -0.2f, 0.3f, 0.1f);
+				q.q[i % 4] = i < 4 ? 0.9f : -0.9f;
+				float length = sqrtf((q.a * q.a) + (q.b * q.b) + (q.c * q.c) + (q.d * q.d));
+				for (int c = 0; c < 4; c++)
+				{
+					q.q[c] /= length;
+				}
+			}
+			float error = AnimationCompressor::rotationError(PackedQuaternion::pack(q).unpack(), q);
+			worstPacking = error > worstPacking ? error : worstPacking;
+		}
+		check(worstPacking < 2e-4f, "48 bit rotations round trip within 2e-4 rad, worst " + std::to_string(worstPacking));
+
+		// Bone 0 turns and sways smoothly, bone 1 never moves, bone 2 jumps halfway and wobbles, bone 3 shakes
+		// at random so most of its frames have to stay
+		const int bonesN = 4;
+		const int framesN = 200;
+		AnimationSequence clip;
+		clip.reset(framesN, bonesN, 30.0f);
+		for (int frame = 0; frame < framesN; frame++)
+		{
+			float t = (float)frame / 30.0f;
+			Vec3 positions[bonesN] = { Vec3(sinf(t), 0.5f * t, cosf(t * 0.5f)), Vec3(0.0f, 1.0f, 0.0f), Vec3(frame < 100 ? 0.0f : 2.0f, 0.1f * sinf(t * 3.0f), 0.0f), Vec3(0.01f * random(), 0.0f, 0.0f) };
+			Quaternion rotations[bonesN] = { axisAngle(0.0f, 1.0f, 0.0f, t), Quaternion(), axisAngle(1.0f, 0.0f, 0.0f, 0.3f * sinf(t * 2.0f)), axisAngle(random(), random(), random() + 2.0f, 0.05f * random()) };
+			Vec3 scales[bonesN] = { Vec3(1.0f, 1.0f, 1.0f), Vec3(1.0f, 1.0f, 1.0f), Vec3(1.0f + (0.1f * sinf(t)), 1.0f, 1.0f), Vec3(1.0f, 1.0f, 1.0f) };
+			for (int bone = 0; bone < bonesN; bone++)
+			{
+				memcpy(&clip.keys[clip.positionOffset(bone, frame)], &positions[bone], sizeof(Vec3));
+				memcpy(&clip.keys[clip.rotationOffset(bone, frame)], &rotations[bone], sizeof(Quaternion));
+				memcpy(&clip.keys[clip.scaleOffset(bone, frame)], &scales[bone], sizeof(Vec3));
+			}
+		}
+		AnimationSequence original = clip;
+		AnimationCompressionSettings settings;
+		settings.boneReach = { 4.0f, 1.0f, 0.5f, 2.0f };
+		AnimationCompressionReport report;
+		clip.compress(settings, report);
+
+		check(report.maxPositionError <= settings.positionTolerance, "reported position error " + std::to_string(report.maxPositionError) + " within tolerance");
+		check(report.maxRotationError <= settings.rotationTolerance, "reported rotation error " + std::to_string(report.maxRotationError) + " within tolerance");
+		check(report.maxScaleError <= settings.scaleTolerance, "reported scale error " + std::to_string(report.maxScaleError) + " within tolerance");
+		check(report.bytesAfter < report.bytesBefore && clip.keys.empty(), "the clip got smaller and the raw keys were released");
+
+		// Measured again here rather than trusting the report, with each bone's own tightened budget
+		bool positions = true;
+		bool rotations = true;
+		bool scales = true;
+		for (int bone = 0; bone < bonesN; bone++)
+		{
+			float reach = settings.boneReach[bone] > 1.0f ? settings.boneReach[bone] : 1.0f;
+			float rotationBudget = min(settings.rotationTolerance, settings.positionTolerance / reach);
+			float scaleBudget = min(settings.scaleTolerance, settings.positionTolerance / reach);
+			for (int frame = 0; frame < framesN; frame++)
+			{
+				positions = positions && AnimationCompressor::vec3Error(clip.compressed.samplePosition(bone, (float)frame), original.position(bone, frame)) <= settings.positionTolerance;
+				rotations = rotations && AnimationCompressor::rotationError(clip.compressed.sampleRotation(bone, (float)frame), original.rotation(bone, frame)) <= rotationBudget;
+				scales = scales && AnimationCompressor::vec3Error(clip.compressed.sampleScale(bone, (float)frame), original.scale(bone, frame)) <= scaleBudget;
+			}
+		}
+		check(positions, "every frame's position is within tolerance");
+		check(rotations, "every frame's rotation is within its bone's budget");
+		check(scales, "every frame's scale is within its bone's budget");
+		const CompressedSequence& compressed = clip.compressed;
+		check(compressed.tracks[3].keysN == 1 && compressed.tracks[4].keysN == 1 && compressed.tracks[5].keysN == 1, "a bone that never moves keeps one key per track");
+		check(compressed.tracks[0].keysN < framesN / 2, "a smooth track drops most of its keys, kept " + std::to_string(compressed.tracks[0].keysN));
+	}
+
+	// Cross-fades and layers on constant clips, so every pose has an exact answer: a fade starts on the outgoing
+	// clip and ends on the new one, a full weight override is its clip, and an additive layer adds nothing at its
+	// reference frame and exactly its offset from it elsewhere
+	void animationBlending()
+	{
+		begin("Animation blending");
+		Animation animation;
+		for (int i = 0; i < 2; i++)
+		{
+			Bone bone;
+			bone.name = i == 0 ? "root" : "child";
+			bone.parentIndex = i - 1;
+			animation.skeleton.bones.push_back(bone);
+		}
+		animation.skeleton.build();
+		auto makeClip = [&animation](const std::string& name, Vec3 frame0, Vec3 frame1, Quaternion rotation)
+		{
+			AnimationSequence& clip = animation.animations[name];
+			clip.name = name;
+			clip.reset(2, 2, 1.0f);
+			Vec3 scale(1.0f, 1.0f, 1.0f);
+			for (int bone = 0; bone < 2; bone++)
+			{
+				for (int frame = 0; frame < 2; frame++)
+				{
+					Vec3 position = frame == 0 ? frame0 : frame1;
+					memcpy(&clip.keys[clip.positionOffset(bone, frame)], &position, sizeof(Vec3));
+					memcpy(&clip.keys[clip.rotationOffset(bone, frame)], &rotation, sizeof(Quaternion));
+					memcpy(&clip.keys[clip.scaleOffset(bone, frame)], &scale, sizeof(Vec3));
+				}
+			}
+			clip.loadReferencePose();
+			return &clip;
+		};
+		float s = sinf(0.5f);
+		float c = cosf(0.5f);
+		AnimationSequence* idle = makeClip("idle", Vec3(1.0f, 0.0f, 0.0f), Vec3(1.0f, 0.0f, 0.0f), Quaternion());
+		AnimationSequence* run = makeClip("run", Vec3(0.0f, 2.0f, 0.0f), Vec3(0.0f, 2.0f, 0.0f), Quaternion(0.0f, s, 0.0f, c));
+		AnimationSequence* aim = makeClip("aim", Vec3(0.0f, 0.0f, 3.0f), Vec3(0.0f, 0.0f, 3.0f), Quaternion(s, 0.0f, 0.0f, c));
+		AnimationSequence* breathe = makeClip("breathe", Vec3(0.0f, 1.0f, 0.0f), Vec3(0.0f, 1.5f, 0.0f), Quaternion());
+		// Either sign of the rotation is the same pose
+		auto matches = [](const AnimationInstance& instance, Vec3 position, Quaternion rotation)
+		{
+			bool same = true;
+			for (int bone = 0; bone < 2; bone++)
+			{
+				const BoneTransform& local = instance.localPose[bone];
+				float dot = (local.rotation.a * rotation.a) + (local.rotation.b * rotation.b) + (local.rotation.c * rotation.c) + (local.rotation.d * rotation.d);
+				same = same && near(local.position.x, position.x, 1e-5f) && near(local.position.y, position.y, 1e-5f) && near(local.position.z, position.z, 1e-5f);
+				same = same && near(fabsf(dot), 1.0f, 1e-5f) && near(local.scale.x, 1.0f, 1e-5f);
+			}
+			return same;
+		};
+
+		AnimationInstance instance;
+		instance.init(&animation, 0);
+		instance.advance(idle, 0.0f);
+		instance.evaluatePose();
+		check(matches(instance, Vec3(1.0f, 0.0f, 0.0f), Quaternion()), "a single clip poses as its keys");
+		instance.crossFade(run, 0.5f);
+		instance.advance(run, 0.0f);
+		instance.evaluatePose();
+		check(instance.fading() && matches(instance, Vec3(1.0f, 0.0f, 0.0f), Quaternion()), "a fade starts on the outgoing clip");
+		instance.advance(run, 0.25f);
+		instance.evaluatePose();
+		float h = 1.0f / sqrtf(2.0f + (2.0f * c));
+		check(matches(instance, Vec3(0.5f, 1.0f, 0.0f), Quaternion(0.0f, s * h, 0.0f, (1.0f + c) * h)), "halfway through a fade is halfway between the clips");
+		instance.advance(run, 0.3f);
+		instance.evaluatePose();
+		check(!instance.fading() && matches(instance, Vec3(0.0f, 2.0f, 0.0f), Quaternion(0.0f, s, 0.0f, c)), "a finished fade is the new clip");
+
+		int layer = instance.addLayer(aim, AnimationBlendMode::Override, 1.0f);
+		instance.advance(run, 0.0f);
+		instance.evaluatePose();
+		check(layer == 0 && matches(instance, Vec3(0.0f, 0.0f, 3.0f), Quaternion(s, 0.0f, 0.0f, c)), "a full weight override is its clip");
+		instance.setLayerWeight(layer, 0.0f);
+		instance.advance(run, 0.0f);
+		instance.evaluatePose();
+		check(matches(instance, Vec3(0.0f, 2.0f, 0.0f), Quaternion(0.0f, s, 0.0f, c)), "a zero weight layer is skipped");
+
+		instance.clearLayers();
+		instance.addLayer(breathe, AnimationBlendMode::Additive, 1.0f);
+		instance.advance(run, 0.0f);
+		instance.evaluatePose();
+		check(matches(instance, Vec3(0.0f, 2.0f, 0.0f), Quaternion(0.0f, s, 0.0f, c)), "an additive layer at its reference frame changes nothing");
+		instance.advance(run, 1.0f);
+		instance.evaluatePose();
+		check(matches(instance, Vec3(0.0f, 2.5f, 0.0f), Quaternion(0.0f, s, 0.0f, c)), "an additive layer adds its offset from the reference frame");
+	}
+
+	// Leaf bones drop out a level at a time, distant instances update at their level's interval, and a bone budget
+	// caps each frame while the most overdue instances go first so nobody is starved
+	void animationLOD()
+	{
+		begin("AnimationLODManager");
+		// root - spine - neck - head, with a hand off the root, so heights are 3, 2, 1, 0 and 0
+		Animation animation;
+		const char* names[] = { "root", "spine", "neck", "head", "hand" };
+		const int parents[] = { -1, 0, 1, 2, 0 };
+		for (int i = 0; i < 5; i++)
+		{
+			Bone bone;
+			bone.name = names[i];
+			bone.parentIndex = parents[i];
+			animation.skeleton.bones.push_back(bone);
+		}
+		animation.skeleton.build();
+		const Skeleton& skeleton = animation.skeleton;
+		check(skeleton.lodBones[0].size() == 5 && skeleton.lodBones[1].size() == 3 && skeleton.lodBones[2].size() == 2, "each level drops the bones within that many steps of a leaf");
+		bool parentsFirst = true;
+		for (int level = 0; level < Skeleton::lodLevels; level++)
+		{
+			for (int i = 0; i < skeleton.lodBones[level].size(); i++)
+			{
+				int parent = skeleton.bones[skeleton.lodBones[level][i]].parentIndex;
+				for (int j = i; j < skeleton.lodBones[level].size() && parent > -1; j++)
+				{
+					parentsFirst = parentsFirst && skeleton.lodBones[level][j] != parent;
+				}
+			}
+		}
+		check(parentsFirst, "every level lists parents ahead of their children");
+
+		// One instance per level, at 0, 40 and 80 units, updating every 1, 2 and 4 frames
+		std::vector<AnimationInstance> instances(3);
+		AnimationLODManager lod;
+		lod.init();
+		for (int i = 0; i < 3; i++)
+		{
+			instances[i].init(&animation, 0);
+			instances[i].posed = true;
+			lod.setPosition(lod.add(&instances[i]), Vec3(0.0f, 0.0f, 40.0f * i));
+		}
+		const int framesN = 8;
+		int updates[3] = {};
+		std::vector<AnimationInstance*> posed;
+		for (int frame = 0; frame < framesN; frame++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				instances[i].poseDirty = true;
+			}
+			lod.schedule(Vec3(0.0f, 0.0f, 0.0f), posed);
+			for (int i = 0; i < posed.size(); i++)
+			{
+				updates[posed[i] - instances.data()]++;
+			}
+		}
+		check(updates[0] == 8 && updates[1] == 4 && updates[2] == 2, "updates follow each level's interval, got " + std::to_string(updates[0]) + ", " + std::to_string(updates[1]) + ", " + std::to_string(updates[2]));
+		check(instances[0].lodLevel == 0 && instances[1].lodLevel == 1 && instances[2].lodLevel == 2, "each instance samples its level's bones");
+
+		// Six instances up close with room for two full skeletons a frame
+		std::vector<AnimationInstance> crowd(6);
+		AnimationLODManager budgeted;
+		budgeted.init();
+		budgeted.boneBudget = 10;
+		for (int i = 0; i < 6; i++)
+		{
+			crowd[i].init(&animation, 0);
+			crowd[i].posed = true;
+			budgeted.setPosition(budgeted.add(&crowd[i]), Vec3((float)i, 0.0f, 0.0f));
+		}
+		int crowdUpdates[6] = {};
+		bool withinBudget = true;
+		for (int frame = 0; frame < 12; frame++)
+		{
+			for (int i = 0; i < 6; i++)
+			{
+				crowd[i].poseDirty = true;
+			}
+			budgeted.schedule(Vec3(0.0f, 0.0f, 0.0f), posed);
+			withinBudget = withinBudget && budgeted.bonesScheduled <= budgeted.boneBudget && posed.size() == 2;
+			for (int i = 0; i < posed.size(); i++)
+			{
+				crowdUpdates[posed[i] - crowd.data()]++;
+			}
+		}
+		bool fair = true;
+		for (int i = 0; i < 6; i++)
+		{
+			fair = fair && crowdUpdates[i] == 4;
+		}
+		check(withinBudget, "the budget holds each frame to two skeletons");
+		check(fair, "the budget delays poses in turn rather than starving any instance");
+	}
+
+	// Box mips of a known 4x4 pattern are the exact 2x2 averages, sRGB colour is averaged in linear space while
+	// alpha is not, and the Kaiser filter keeps a flat texture flat and gives the same chain on any thread count
+	void mipGenerator()
+	{
+		begin("MipGenerator");
+		std::vector<MipLevel> levels;
+		std::vector<unsigned char> texels(MipGenerator::layout(4, 4, 0, levels));
+		check(levels.size() == 3, "a 4x4 texture has 3 levels");
+		for (int y = 0; y < 4; y++)
+		{
+			for (int x = 0; x < 4; x++)
+			{
+				unsigned char* texel = texels.data() + levels[0].offset + (y * levels[0].rowPitch) + (x * 4);
+				unsigned char v = (unsigned char)(16 * ((y * 4) + x));
+				texel[0] = v;
+				texel[1] = (unsigned char)(255 - v);
+				texel[2] = 77;
+				texel[3] = v;
+			}
+		}
+		MipSettings linear;
+		linear.srgb = false;
+		linear.filter = MipFilter::Box;
+		MipGenerator::generate(nullptr, texels.data(), levels, linear);
+		bool averaged = true;
+		for (int y = 0; y < 2; y++)
+		{
+			for (int x = 0; x < 2; x++)
+			{
+				const unsigned char* texel = texels.data() + levels[1].offset + (y * levels[1].rowPitch) + (x * 4);
+				int expected = (16 * ((8 * y) + (2 * x))) + 40; // Mean of 16 * (0, 1, 4, 5) offset to this block
+				averaged = averaged && texel[0] == expected && texel[1] == 255 - expected && texel[2] == 77 && texel[3] == expected;
+			}
+		}
+		check(averaged, "level 1 is the 2x2 box average");
+		const unsigned char* last = texels.data() + levels[2].offset;
+		check(last[0] == 120 && last[1] == 135 && last[2] == 77 && last[3] == 120, "level 2 is the mean of the whole texture");
+
+		// Black and white averaged in linear light is 0.5, which sRGB encodes as 188, not the 128 of averaging bytes
+		std::vector<unsigned char> checker(MipGenerator::layout(2, 2, 0, levels));
+		for (int i = 0; i < 4; i++)
+		{
+			unsigned char v = (i == 0 || i == 3) ? 255 : 0;
+			unsigned char* texel = checker.data() + ((i / 2) * levels[0].rowPitch) + ((i % 2) * 4);
+			texel[0] = v;
+			texel[1] = v;
+			texel[2] = v;
+			texel[3] = v;
+		}
+		MipSettings srgb;
+		srgb.filter = MipFilter::Box;
+		MipGenerator::generate(nullptr, checker.data(), levels, srgb);
+		last = checker.data() + levels[1].offset;
+		check(last[0] == 188 && last[1] == 188 && last[2] == 188, "sRGB colour is averaged in linear space, got " + std::to_string(last[0]));
+		check(last[3] == 128, "alpha is averaged as it is");
+
+		const int size = 64;
+		std::vector<unsigned char> flat(MipGenerator::layout(size, size, 0, levels));
+		std::vector<unsigned char> noisy(flat.size());
+		unsigned int seed = 99;
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size * 4; x++)
+			{
+				flat[(y * levels[0].rowPitch) + x] = 90;
+				seed = (seed * 1103515245) + 12345;
+				noisy[(y * levels[0].rowPitch) + x] = (unsigned char)(seed >> 16);
+			}
+		}
+		MipSettings kaiser;
+		MipGenerator::generate(nullptr, flat.data(), levels, kaiser);
+		bool stayedFlat = true;
+		for (int l = 1; l < levels.size(); l++)
+		{
+			for (int y = 0; y < levels[l].height; y++)
+			{
+				for (int x = 0; x < levels[l].width * 4; x++)
+				{
+					int v = flat[levels[l].offset + (y * levels[l].rowPitch) + x];
+					stayedFlat = stayedFlat && v >= 89 && v <= 91;
+				}
+			}
+		}
+		check(stayedFlat, "Kaiser keeps a flat texture flat on every level");
+
+		std::vector<unsigned char> threaded(noisy);
+		JobSystem jobs;
+		jobs.init(4);
+		MipGenerator::generate(nullptr, noisy.data(), levels, kaiser);
+		MipGenerator::generate(&jobs, threaded.data(), levels, kaiser);
+		check(noisy == threaded, "the chain is the same with and without jobs");
+	}
+
+	// A normal map's black and white checker must average to 128 like any other data, where the same checker as
+	// albedo averages in linear light to 188. Written as uncompressed TGAs so no encoder is needed.
+	void linearTextures()
+	{
+		begin("Linear texture mips");
+		const char* names[2] = { "tests_albedo.tga", "tests_nh.tga" };
+		for (int n = 0; n < 2; n++)
+		{
+			unsigned char header[18] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 32, 0x28 };
+			unsigned char texels[16];
+			for (int i = 0; i < 4; i++)
+			{
+				unsigned char v = (i == 0 || i == 3) ? 255 : 0;
+				texels[(i * 4) + 0] = v;
+				texels[(i * 4) + 1] = v;
+				texels[(i * 4) + 2] = v;
+				texels[(i * 4) + 3] = 255;
+			}
+			std::ofstream file(names[n], std::ios::binary);
+			file.write((const char*)header, sizeof(header));
+			file.write((const char*)texels, sizeof(texels));
+		}
+
+		MipSettings box;
+		box.filter = MipFilter::Box;
+		DecodedTexture albedo;
+		DecodedTexture normals;
+		bool decoded = TextureDecoder::decodeSource(names[0], albedo, nullptr, box) && TextureDecoder::decodeSource(names[1], normals, nullptr, box);
+		remove(names[0]);
+		remove(names[1]);
+		check(decoded && albedo.levels.size() == 2 && normals.levels.size() == 2, "both textures decode with two levels");
+		if (!decoded || albedo.levels.size() != 2 || normals.levels.size() != 2)
+		{
+			return;
+		}
+		const unsigned char* colour = albedo.texels.data() + albedo.levels[1].offset;
+		const unsigned char* data = normals.texels.data() + normals.levels[1].offset;
+		check(albedo.srgb && colour[0] == 188, "albedo is averaged in linear light, got " + std::to_string(colour[0]));
+		check(!normals.srgb && data[0] == 128 && data[1] == 128 && data[2] == 128, "a normal map is averaged as stored, got " + std::to_string(data[0]));
+
+		bool srgb = true;
+		check(TextureCache::formatFor("rock_nh.png", false, false, srgb) == TextureFormat::BC5 && !srgb, "_nh cooks to linear BC5");
+		check(TextureCache::formatFor("rock_RMAX.png", false, false, srgb) == TextureFormat::BC3 && !srgb, "_rmax cooks to linear BC3");
+		check(TextureCache::formatFor("rock_alb.png", false, false, srgb) == TextureFormat::BC1 && srgb, "albedo cooks to sRGB BC1");
+		check(!TextureDecoder::mipSettingsFor("Textures/rock_Nh.tga").srgb && TextureDecoder::mipSettingsFor("Textures/rock.tga").srgb, "mip settings follow the name");
+	}
+
+	// Each encoder against decodeBlock: a solid block comes back to within its endpoint precision, a gradient the
+	// encoder can hit exactly to within that plus, in fast mode, the sixteenth its endpoints are pulled in by, and a
+	// smooth image keeps its PSNR. Also the bit layouts that are easy to get silently wrong: a BC1 block whose two
+	// colours match, BC1 never picking the transparent entry for opaque texels, and the BC7 mode bits.
+	void blockCompression()
+	{
+		begin("Block compression");
+		const TextureFormat formats[] = { TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC5, TextureFormat::BC7 };
+		// Per format: the channels it keeps and how far a solid colour can round, 565 for BC1 colour, a shared
+		// low bit for BC7, exact for BC4's 8 bit ends
+		const int channels[] = { 3, 4, 2, 4 };
+		const int solidTolerance[] = { 4, 4, 0, 1 };
+		const double minPSNR[] = { 35.0, 35.0, 45.0, 38.0 };
+
+		unsigned char solid[64];
+		unsigned char gradient[64];
+		for (int i = 0; i < 16; i++)
+		{
+			solid[(i * 4) + 0] = 200;
+			solid[(i * 4) + 1] = 100;
+			solid[(i * 4) + 2] = 50;
+			solid[(i * 4) + 3] = 180;
+			// Four steps along a line, which every palette here holds exactly
+			unsigned char v = (unsigned char)((i % 4) * 85);
+			gradient[(i * 4) + 0] = v;
+			gradient[(i * 4) + 1] = (unsigned char)(255 - v);
+			gradient[(i * 4) + 2] = 64;
+			gradient[(i * 4) + 3] = v;
+		}
+		auto maxError = [](const unsigned char* a, const unsigned char* b, int channelsN)
+		{
+			int worst = 0;
+			for (int i = 0; i < 16; i++)
+			{
+				for (int c = 0; c < channelsN; c++)
+				{
+					int d = abs((int)a[(i * 4) + c] - (int)b[(i * 4) + c]);
+					worst = d > worst ? d : worst;
+				}
+			}
+			return worst;
+		};
+
+		// A smooth image with alpha, whole blocks only
+		const int width = 64;
+		const int height = 64;
+		std::vector<MipLevel> levels;
+		size_t bytes = MipGenerator::layout(width, height, 1, levels);
+		std::vector<unsigned char> image(bytes);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				unsigned char* texel = image.data() + ((size_t)y * levels[0].rowPitch) + (x * 4);
+				texel[0] = (unsigned char)(x * 4);
+				texel[1] = (unsigned char)(y * 4);
+				texel[2] = (unsigned char)((x + y) * 2);
+				texel[3] = (unsigned char)(255 - (x * 2));
+			}
+		}
+
+		for (int f = 0; f < 4; f++)
+		{
+			TextureFormat format = formats[f];
+			std::string name = BlockCompression::name(format);
+			for (int q = 0; q < 2; q++)
+			{
+				BlockQuality quality = q == 0 ? BlockQuality::Fast : BlockQuality::Quality;
+				std::string mode = name + (q == 0 ? " fast" : " quality");
+				unsigned char encoded[16];
+				unsigned char decoded[64];
+
+				BlockCompression::encodeBlock(format, quality, solid, encoded);
+				BlockCompression::decodeBlock(format, encoded, decoded);
+				int error = maxError(solid, decoded, channels[f]);
+				check(error <= solidTolerance[f], mode + " keeps a solid block, off by " + std::to_string(error));
+				if (format == TextureFormat::BC1)
+				{
+					check(encoded[0] == encoded[2] && encoded[1] == encoded[3], "BC1 writes a solid block with matching colours");
+				}
+				if (format == TextureFormat::BC7)
+				{
+					check((encoded[0] & 0x7f) == 0x40, "BC7 writes a block of constant alpha in mode 6");
+				}
+
+				BlockCompression::encodeBlock(format, quality, gradient, encoded);
+				BlockCompression::decodeBlock(format, encoded, decoded);
+				error = maxError(gradient, decoded, channels[f]);
+				int gradientTolerance = solidTolerance[f] + (q == 0 ? 255 / 16 : 0);
+				check(error <= gradientTolerance, mode + " keeps a gradient, off by " + std::to_string(error));
+				if (format == TextureFormat::BC1)
+				{
+					bool opaque = true;
+					for (int i = 0; i < 16; i++)
+					{
+						opaque = opaque && decoded[(i * 4) + 3] == 255;
+					}
+					check(opaque, mode + " orders its colours so no opaque texel decodes as transparent");
+				}
+
+				std::vector<MipLevel> blockLevels;
+				std::vector<unsigned char> blocks(BlockCompression::layout(width, height, 1, format, blockLevels));
+				std::vector<unsigned char> back(bytes);
+				BlockCompression::compress(nullptr, image.data(), levels, format, quality, blocks.data(), blockLevels);
+				BlockCompression::decompress(format, blocks.data() + blockLevels[0].offset, blockLevels[0], back.data(), levels[0].rowPitch);
+				double psnr = BlockCompression::psnr(format, image.data(), back.data(), width, height, levels[0].rowPitch);
+				check(psnr >= minPSNR[f], mode + " PSNR " + std::to_string(psnr) + " dB on a smooth image");
+				if (format == TextureFormat::BC7)
+				{
+					bool modes = true;
+					for (int by = 0; by < blockLevels[0].rowsN; by++)
+					{
+						for (int bx = 0; bx < width / 4; bx++)
+						{
+							unsigned char first = blocks[blockLevels[0].offset + ((size_t)by * blockLevels[0].rowPitch) + (bx * 16)];
+							modes = modes && ((first & 0x7f) == 0x40 || (first & 0x3f) == 0x20);
+						}
+					}
+					check(modes, mode + " only writes modes 5 and 6");
+				}
+			}
+		}
+
+		// Equal colours make BC1 three colour, where index 3 is transparent black but 0 to 2 are all that colour
+		unsigned char equal[8];
+		unsigned short red = 0xf800;
+		unsigned int indices = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			indices |= (unsigned int)(i % 3) << (i * 2);
+		}
+		memcpy(equal, &red, 2);
+		memcpy(equal + 2, &red, 2);
+		memcpy(equal + 4, &indices, 4);
+		unsigned char decoded[64];
+		BlockCompression::decodeBlock(TextureFormat::BC1, equal, decoded);
+		bool allRed = true;
+		for (int i = 0; i < 16; i++)
+		{
+			allRed = allRed && decoded[(i * 4) + 0] == 255 && decoded[(i * 4) + 1] == 0 && decoded[(i * 4) + 2] == 0 && decoded[(i * 4) + 3] == 255;
+		}
+		check(allRed, "a BC1 block with c0 == c1 decodes to that colour");
+	}
+
+	// Drives the streamer headless with room for exactly two textures above their tails: requested textures load
+	// in full, the least recently used one is evicted to make room, textures asked for this frame are never
+	// evicted, and what will be resident once the loads land never goes over the budget
+	void textureStreaming()
+	{
+		begin("TextureStreamer budget");
+		const int texturesN = 8;
+		SimulatedTextureSource source;
+		TextureStreamer streamer;
+		for (int i = 0; i < texturesN; i++)
+		{
+			streamer.add("texture" + std::to_string(i), "", 1024, 1024, MipGenerator::levelsN(1024, 1024), TextureFormat::RGBA8, -1);
+		}
+		const StreamedTexture& first = streamer.textures[0];
+		check(first.tailMip == 3, "mips no bigger than 128 are the tail");
+		size_t tail = first.chainBytes[first.tailMip];
+		size_t extra = first.chainBytes[0] - tail;
+		streamer.init((tail * texturesN) + (extra * 2), &source, nullptr, false);
+		check(streamer.residentBytes() == tail * texturesN, "textures start with only their tails");
+
+		bool withinBudget = true;
+		auto update = [&]()
+		{
+			streamer.update();
+			withinBudget = withinBudget && streamer.frameStats.bytesBudgeted <= streamer.budgetBytes;
+		};
+		streamer.request(0, 0);
+		update();
+		streamer.request(1, 0);
+		update();
+		update();
+		check(streamer.textures[0].residentMip == 0 && streamer.textures[1].residentMip == 0, "requested textures load in full");
+		check(streamer.residentBytes() == streamer.budgetBytes, "two full textures fill the budget");
+
+		streamer.request(2, 0);
+		update();
+		check(streamer.frameStats.evictions == 1 && streamer.textures[0].pendingMip == first.tailMip, "the least recently used texture is evicted first");
+		check(streamer.textures[1].pendingMip < 0 && streamer.textures[1].residentMip == 0, "the more recently used one is kept");
+		update();
+		check(streamer.textures[0].residentMip == first.tailMip && streamer.textures[2].residentMip == 0, "the eviction and the load land together");
+
+		streamer.request(1, 0);
+		streamer.request(2, 0);
+		streamer.request(3, 0);
+		update();
+		check(streamer.frameStats.requests == 3 && streamer.frameStats.hits == 2, "resident textures count as hits");
+		check(streamer.frameStats.evictions == 0 && streamer.textures[3].pendingMip < 0, "textures asked for this frame are not evicted, so the third waits");
+
+		streamer.budgetBytes = tail * texturesN;
+		update();
+		update();
+		check(streamer.residentBytes() == tail * texturesN, "a shrunk budget evicts everything unused down to its tail");
+		check(withinBudget, "what is resident once the loads in flight land never went over the budget");
+	}
+
+	// Packed rectangles, padding included, stay inside their page and never overlap, their UVs land on their
+	// texels, and compose repeats each texture's edge into its padding
+	void atlasPacking()
+	{
+		begin("AtlasPacker");
+		AtlasPacker packer;
+		packer.pageSize = 512;
+		unsigned int seed = 7;
+		std::vector<std::pair<int, int>> sizes;
+		for (int i = 0; i < 120; i++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			int width = 8 + (int)((seed >> 16) % 120);
+			seed = (seed * 1103515245) + 12345;
+			int height = 8 + (int)((seed >> 16) % 120);
+			sizes.push_back(std::make_pair(width, height));
+		}
+		std::vector<AtlasRect> rects;
+		int pagesN = packer.pack(sizes, rects);
+		check(pagesN > 1 && rects.size() == sizes.size(), "everything is packed, over several pages");
+
+		bool inside = true;
+		bool separate = true;
+		bool mapped = true;
+		for (int i = 0; i < rects.size(); i++)
+		{
+			const AtlasRect& a = rects[i];
+			inside = inside && a.page >= 0 && a.page < pagesN && a.width == sizes[i].first && a.height == sizes[i].second;
+			inside = inside && a.x - packer.padding >= 0 && a.y - packer.padding >= 0 && a.x + a.width + packer.padding <= packer.pageSize && a.y + a.height + packer.padding <= packer.pageSize;
+			mapped = mapped && near(a.uvOffset[0] * packer.pageSize, (float)a.x, 1e-3f) && near((a.uvOffset[1] + a.uvScale[1]) * packer.pageSize, (float)(a.y + a.height), 1e-3f);
+			for (int j = i + 1; j < rects.size(); j++)
+			{
+				const AtlasRect& b = rects[j];
+				if (a.page != b.page)
+				{
+					continue;
+				}
+				int p = packer.padding;
+				bool apart = a.x + a.width + p <= b.x - p || b.x + b.width + p <= a.x - p || a.y + a.height + p <= b.y - p || b.y + b.height + p <= a.y - p;
+				separate = separate && apart;
+			}
+		}
+		check(inside, "every rectangle and its padding is inside its page");
+		check(separate, "no two padded rectangles on a page overlap");
+		check(mapped, "UV offset and scale land on the rectangle's texels");
+		float occupancy = packer.occupancy(rects, pagesN);
+		check(occupancy > 0.5f && occupancy <= 1.0f, "pages are more than half used, " + std::to_string(occupancy));
+
+		std::vector<std::pair<int, int>> tooBig(1, std::make_pair(packer.pageSize, 16));
+		check(packer.pack(tooBig, rects) == 0, "a rectangle that cannot fit with its padding fails the pack");
+
+		// A 2x2 texture in an otherwise empty page, its corner texel repeated across the padding
+		DecodedTexture small;
+		small.width = 2;
+		small.height = 2;
+		small.rowPitch = 8;
+		small.format = TextureFormat::RGBA8;
+		small.texels.resize(16);
+		for (int i = 0; i < 16; i++)
+		{
+			small.texels[i] = (unsigned char)(i + 1);
+		}
+		std::vector<std::pair<int, int>> one(1, std::make_pair(2, 2));
+		packer.pageSize = 16;
+		packer.pack(one, rects);
+		std::vector<unsigned char> page(16 * 16 * 4, 0);
+		std::vector<const DecodedTexture*> textures(1, &small);
+		packer.compose(textures, rects, 0, page.data(), 16 * 4);
+		const unsigned char* corner = page.data() + ((rects[0].y - packer.padding) * 16 * 4) + ((rects[0].x - packer.padding) * 4);
+		const unsigned char* texel = page.data() + (rects[0].y * 16 * 4) + (rects[0].x * 4);
+		check(memcmp(corner, small.texels.data(), 4) == 0 && memcmp(texel, small.texels.data(), 4) == 0, "compose copies the texture and repeats its edge into the padding");
+	}
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "JobSystem.h"
+#include "TextureDecoder.h"
+#include "BlockCompression.h"
+#include "DDSFile.h"
+
+// What cooking one texture did, for the log and the benchmark
+struct TextureCookResult
+{
+	std::string filename;
+	TextureFormat format = TextureFormat::RGBA8;
+	int width = 0;
+	int height = 0;
+	int levelsN = 0;
+	bool cooked = false; // false when it was already up to date or could not be compressed
+	double psnr = 0; // Of the top level against the source
+	double encodeMs = 0;
+	double mpixelsPerSecond = 0;
+};
+
+// Compresses the images under Resources into block compressed .dds files next to them, which
+// TextureDecoder::decode picks up in place of the image while their stamp matches it.
+class TextureCache
+{
+public:
+	static bool isSource(const std::string& filename)
+	{
+		size_t dot = filename.find_last_of('.');
+		std::string extension = dot == std::string::npos ? "" : filename.substr(dot);
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		return extension == ".png" || extension == ".jpg" || extension == ".tga";
+	}
+
+	// Every image under directory, including its sub directories
+	static void sourceFiles(const std::string& directory, std::vector<std::string>& filenames)
+	{
+		WIN32_FIND_DATAA found;
+		HANDLE search = FindFirstFileA((directory + "*").c_str(), &found);
+		if (search == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		do
+		{
+			std::string name = found.cFileName;
+			if (name == "." || name == "..")
+			{
+				continue;
+			}
+			if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				sourceFiles(directory + name + "/", filenames);
+				continue;
+			}
+			if (isSource(name))
+			{
+				filenames.push_back(directory + name);
+			}
+		} while (FindNextFileA(search, &found));
+		FindClose(search);
+	}
+
+	// Normal maps (_nh) keep two linear channels in BC5, packed roughness/metal maps (_rmax) are linear BC3, and
+	// everything else is sRGB albedo, BC1 when it is opaque and BC3 when it is not. useBC7 swaps BC3 for BC7.
+	// The srgb flag depends only on the name, TextureDecoder::linearData, so it is known before decoding.
+	static TextureFormat formatFor(const std::string& filename, bool hasAlpha, bool useBC7, bool& srgb)
+	{
+		std::string lower = filename;
+		std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		srgb = !TextureDecoder::linearData(filename);
+		if (lower.find("_nh.") != std::string::npos)
+		{
+			return TextureFormat::BC5;
+		}
+		if (lower.find("_rmax.") != std::string::npos)
+		{
+			return useBC7 ? TextureFormat::BC7 : TextureFormat::BC3;
+		}
+		if (!hasAlpha)
+		{
+			return TextureFormat::BC1;
+		}
+		return useBC7 ? TextureFormat::BC7 : TextureFormat::BC3;
+	}
+
+	static bool upToDate(const std::string& filename)
+	{
+		GEMLoader::GEMMappedFile file;
+		DDSInfo info;
+		return TextureDecoder::openCooked(filename, file, info);
+	}
+
+	// Decodes filename, builds its mips, compresses them and writes the .dds
+	static bool cook(JobSystem* jobs, const std::string& filename, BlockQuality quality, bool useBC7, TextureCookResult& result)
+	{
+		result = TextureCookResult();
+		result.filename = filename;
+		AssetSourceStamp stamp;
+		DecodedTexture decoded;
+		// Linear maps have to be filtered linear too, so the settings come from the name before anything is decoded
+		MipSettings mips = TextureDecoder::mipSettingsFor(filename);
+		if (!AssetCache::stamp(filename, stamp) || !TextureDecoder::decodeSource(filename, decoded, nullptr, mips, jobs))
+		{
+			return false;
+		}
+		result.width = decoded.width;
+		result.height = decoded.height;
+		result.levelsN = (int)decoded.levels.size();
+		// D3D12 wants the top level of a block compressed texture to be whole blocks
+		if ((decoded.width % 4) != 0 || (decoded.height % 4) != 0)
+		{
+			return false;
+		}
+
+		bool hasAlpha = false;
+		for (int y = 0; y < decoded.height && !hasAlpha; y++)
+		{
+			const unsigned char* row = decoded.texels.data() + ((size_t)y * decoded.rowPitch);
+			for (int x = 0; x < decoded.width; x++)
+			{
+				hasAlpha = hasAlpha || row[(x * 4) + 3] != 255;
+			}
+		}
+		bool srgb = mips.srgb;
+		result.format = formatFor(filename, hasAlpha, useBC7, srgb);
+
+		std::vector<MipLevel> blockLevels;
+		std::vector<unsigned char> blocks(BlockCompression::layout(decoded.width, decoded.height, result.levelsN, result.format, blockLevels));
+		auto start = std::chrono::high_resolution_clock::now();
+		BlockCompression::compress(jobs, decoded.texels.data(), decoded.levels, result.format, quality, blocks.data(), blockLevels);
+		result.encodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		size_t texelsN = 0;
+		for (int l = 0; l < decoded.levels.size(); l++)
+		{
+			texelsN += (size_t)decoded.levels[l].width * decoded.levels[l].height;
+		}
+		result.mpixelsPerSecond = result.encodeMs > 0 ? (texelsN / 1000000.0) / (result.encodeMs / 1000.0) : 0;
+
+		std::vector<unsigned char> restored((size_t)decoded.rowPitch * decoded.height);
+		BlockCompression::decompress(result.format, blocks.data(), blockLevels[0], restored.data(), decoded.rowPitch);
+		result.psnr = BlockCompression::psnr(result.format, decoded.texels.data(), restored.data(), decoded.width, decoded.height, decoded.rowPitch);
+
+		result.cooked = DDSFile::write(DDSFile::cookedFilename(filename), result.format, srgb, blockLevels, blocks.data(), stamp);
+		return result.cooked;
+	}
+
+	// Brings every image under directory up to date, returns how many had to be cooked
+	static int cookAll(JobSystem* jobs, const std::string& directory, BlockQuality quality, bool useBC7)
+	{
+		std::vector<std::string> filenames;
+		sourceFiles(directory, filenames);
+		int cookedN = 0;
+		for (int i = 0; i < filenames.size(); i++)
+		{
+			if (upToDate(filenames[i]))
+			{
+				continue;
+			}
+			TextureCookResult result;
+			std::string msg;
+			if (cook(jobs, filenames[i], quality, useBC7, result))
+			{
+				cookedN++;
+				msg = "[TextureCache] " + filenames[i] + " " + BlockCompression::name(result.format) + " " + std::to_string(result.width) + "x" + std::to_string(result.height) + ", " +
+					std::to_string(result.levelsN) + " levels, " + std::to_string(result.psnr) + " dB, " + std::to_string(result.encodeMs) + " ms, " + std::to_string(result.mpixelsPerSecond) + " Mpixels/s\n";
+			}
+			else
+			{
+				msg = "[TextureCache] Could not cook " + filenames[i] + "\n";
+			}
+			OutputDebugStringA(msg.c_str());
+		}
+		std::string msg = "[TextureCache] Cooked " + std::to_string(cookedN) + " textures in " + directory + "\n";
+		OutputDebugStringA(msg.c_str());
+		return cookedN;
+	}
+};
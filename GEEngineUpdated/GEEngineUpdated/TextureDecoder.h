@@ -0,0 +1,329 @@
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "stb_image.h"
+#include "JobSystem.h"
+#include "MipGenerator.h"
+#include "BlockCompression.h"
+#include "DDSFile.h"
+
+// Recycles the RGBA8 buffers textures are decoded into. Decoded texels are already laid out with the upload
+// row pitch, so the buffer that was decoded into is the one handed to the upload and then comes back here.
+class TextureBufferPool
+{
+public:
+	int allocations = 0; // Buffers that had to grow or be created
+	int reuses = 0; // Buffers that came back out of the pool big enough
+
+	// At most this many bytes are kept around between uses
+	void init(size_t _maxBytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		maxBytes = _maxBytes;
+		trim();
+	}
+
+	// The smallest free buffer that fits, otherwise the largest one grown to size
+	void acquire(size_t bytes, std::vector<unsigned char>& buffer)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			int best = -1;
+			for (int i = 0; i < buffers.size(); i++)
+			{
+				if (buffers[i].capacity() >= bytes && (best < 0 || buffers[i].capacity() < buffers[best].capacity()))
+				{
+					best = i;
+				}
+			}
+			if (best < 0)
+			{
+				for (int i = 0; i < buffers.size(); i++)
+				{
+					if (best < 0 || buffers[i].capacity() > buffers[best].capacity())
+					{
+						best = i;
+					}
+				}
+			}
+			if (best >= 0)
+			{
+				buffer.swap(buffers[best]);
+				freeBytes -= buffer.capacity();
+				buffers.erase(buffers.begin() + best);
+			}
+			if (buffer.capacity() >= bytes)
+			{
+				reuses++;
+			}
+			else
+			{
+				allocations++;
+			}
+		}
+		// Outside the lock, growing a buffer can take a while
+		buffer.resize(bytes);
+	}
+
+	void release(std::vector<unsigned char>& buffer)
+	{
+		if (buffer.capacity() == 0)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		freeBytes += buffer.capacity();
+		buffers.push_back(std::vector<unsigned char>());
+		buffers.back().swap(buffer);
+		trim();
+	}
+
+	size_t pooledBytes()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return freeBytes;
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<std::vector<unsigned char>> buffers;
+	size_t freeBytes = 0;
+	size_t maxBytes = 256 * 1024 * 1024;
+
+	// Drops the smallest buffers first, the big ones are the expensive ones to get back
+	void trim()
+	{
+		while (freeBytes > maxBytes && !buffers.empty())
+		{
+			int smallest = 0;
+			for (int i = 1; i < buffers.size(); i++)
+			{
+				if (buffers[i].capacity() < buffers[smallest].capacity())
+				{
+					smallest = i;
+				}
+			}
+			freeBytes -= buffers[smallest].capacity();
+			buffers.erase(buffers.begin() + smallest);
+		}
+	}
+};
+
+// An image decoded to RGBA8, or loaded block compressed from its cooked file, with each row starting rowPitch
+// bytes after the last, which is the layout a texture upload copies from, followed by its mip levels. The buffer
+// goes back to its pool when this is destroyed.
+struct DecodedTexture
+{
+	std::string name; // What TextureManager knows it as
+	std::string filename;
+	int width = 0;
+	int height = 0;
+	unsigned int rowPitch = 0;
+	int firstMip = 0; // The mip of the whole texture levels[0] is, when only the smaller levels were loaded
+	TextureFormat format = TextureFormat::RGBA8;
+	bool srgb = true;
+	int arraySize = 1; // Slices of a texture array, each with levels.size() / arraySize levels, one after another
+	std::vector<MipLevel> levels; // Level 0 is the image itself
+	std::vector<unsigned char> texels; // Every level
+	TextureBufferPool* pool = nullptr;
+
+	DecodedTexture() = default;
+	DecodedTexture(const DecodedTexture&) = delete;
+	DecodedTexture(DecodedTexture&&) = default; // Leaves the moved-from texture without a buffer to release
+	DecodedTexture& operator=(const DecodedTexture&) = delete;
+
+	~DecodedTexture()
+	{
+		release();
+	}
+
+	bool valid() const
+	{
+		return !texels.empty();
+	}
+	size_t bytes() const
+	{
+		return texels.size();
+	}
+
+	void release()
+	{
+		if (pool != nullptr)
+		{
+			pool->release(texels);
+		}
+		texels.clear();
+		texels.shrink_to_fit();
+	}
+};
+
+class TextureDecoder
+{
+public:
+	static unsigned int rowPitch(int width)
+	{
+		return MipGenerator::rowPitch(width);
+	}
+
+	// Normal maps (_nh) and packed roughness/metal maps (_rmax) hold data rather than colour, so they are
+	// filtered and stored linear whatever the settings they are loaded with ask for
+	static bool linearData(const std::string& filename)
+	{
+		std::string lower = filename;
+		std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		return lower.find("_nh.") != std::string::npos || lower.find("_rmax.") != std::string::npos;
+	}
+
+	// mips with srgb turned off for linear data
+	static MipSettings mipSettingsFor(const std::string& filename, const MipSettings& mips = MipSettings())
+	{
+		MipSettings settings = mips;
+		settings.srgb = mips.srgb && !linearData(filename);
+		return settings;
+	}
+
+	// Loads one file into texture, from its cooked .dds when that is up to date and otherwise by decoding it and
+	// building its mips. The buffer comes from pool when there is one. Safe to call from any thread.
+	// A cooked texture only loads its levels no wider or taller than maxSize when that is set, for streaming.
+	static bool decode(const std::string& filename, DecodedTexture& texture, TextureBufferPool* pool, const MipSettings& mips = MipSettings(), JobSystem* jobs = nullptr, int maxSize = 0)
+	{
+		if (mips.enabled && decodeCooked(filename, texture, pool, 0, maxSize))
+		{
+			return true;
+		}
+		return decodeSource(filename, texture, pool, mips, jobs);
+	}
+
+	// Maps the cooked .dds for filename when its stamp matches the source
+	static bool openCooked(const std::string& filename, GEMLoader::GEMMappedFile& file, DDSInfo& info)
+	{
+		AssetSourceStamp stamp;
+		if (!AssetCache::stamp(filename, stamp) || !DDSFile::open(DDSFile::cookedFilename(filename), file, info))
+		{
+			return false;
+		}
+		return info.source.bytes == stamp.bytes && info.source.writeTime == stamp.writeTime;
+	}
+
+	// Loads the cooked .dds for filename from firstMip down, or from the first level that fits in maxSize when
+	// that is smaller, copying the levels into the upload layout
+	static bool decodeCooked(const std::string& filename, DecodedTexture& texture, TextureBufferPool* pool, int firstMip = 0, int maxSize = 0)
+	{
+		GEMLoader::GEMMappedFile file;
+		DDSInfo info;
+		if (!openCooked(filename, file, info))
+		{
+			return false;
+		}
+		std::vector<MipLevel> cookedLevels;
+		BlockCompression::layout(info.width, info.height, info.levelsN, info.format, cookedLevels);
+		int lastMip = BlockCompression::lastTopLevel(info.width, info.height, info.levelsN, info.format);
+		firstMip = min(firstMip, lastMip);
+		while (maxSize > 0 && firstMip < lastMip && max(cookedLevels[firstMip].width, cookedLevels[firstMip].height) > maxSize)
+		{
+			firstMip++;
+		}
+		const unsigned char* data = info.data;
+		for (int l = 0; l < firstMip; l++)
+		{
+			data += (size_t)cookedLevels[l].rowBytes * cookedLevels[l].rowsN;
+		}
+
+		texture.release();
+		texture.filename = filename;
+		texture.pool = pool;
+		texture.width = cookedLevels[firstMip].width;
+		texture.height = cookedLevels[firstMip].height;
+		texture.firstMip = firstMip;
+		texture.arraySize = 1;
+		texture.format = info.format;
+		texture.srgb = info.srgb;
+		size_t bytes = BlockCompression::layout(texture.width, texture.height, info.levelsN - firstMip, info.format, texture.levels);
+		texture.rowPitch = texture.levels[0].rowPitch;
+		acquire(bytes, texture, pool);
+		for (int l = 0; l < texture.levels.size(); l++)
+		{
+			const MipLevel& level = texture.levels[l];
+			for (int y = 0; y < level.rowsN; y++)
+			{
+				memcpy(texture.texels.data() + level.offset + ((size_t)y * level.rowPitch), data, level.rowBytes);
+				data += level.rowBytes;
+			}
+		}
+		return true;
+	}
+
+	// Decodes the image itself to RGBA8 and builds its mips, which are split across jobs when there are any
+	static bool decodeSource(const std::string& filename, DecodedTexture& texture, TextureBufferPool* pool, const MipSettings& mips = MipSettings(), JobSystem* jobs = nullptr)
+	{
+		texture.release();
+		texture.filename = filename;
+		texture.pool = pool;
+		texture.firstMip = 0;
+		texture.arraySize = 1;
+		texture.format = TextureFormat::RGBA8;
+		MipSettings settings = mipSettingsFor(filename, mips);
+		texture.srgb = settings.srgb;
+		int channels = 0;
+		unsigned char* texels = stbi_load(filename.c_str(), &texture.width, &texture.height, &channels, 4);
+		if (texels == nullptr)
+		{
+			OutputDebugStringA(("Failed to load texture: " + filename + "\n").c_str());
+			texture.width = 0;
+			texture.height = 0;
+			texture.levels.clear();
+			return false;
+		}
+		size_t bytes = MipGenerator::layout(texture.width, texture.height, settings.enabled ? 0 : 1, texture.levels);
+		texture.rowPitch = texture.levels[0].rowPitch;
+		acquire(bytes, texture, pool);
+		size_t rowBytes = (size_t)texture.width * 4;
+		if (rowBytes == texture.rowPitch)
+		{
+			memcpy(texture.texels.data(), texels, rowBytes * texture.height);
+		}
+		else
+		{
+			for (int y = 0; y < texture.height; y++)
+			{
+				memcpy(texture.texels.data() + ((size_t)y * texture.rowPitch), texels + (y * rowBytes), rowBytes);
+			}
+		}
+		stbi_image_free(texels);
+		MipGenerator::generate(jobs, texture.texels.data(), texture.levels, settings);
+		return true;
+	}
+
+	// Decodes a batch of (name, file) pairs at the same time, one job per file. textures[i] is files[i].
+	static void decodeBatch(JobSystem& jobs, const std::vector<std::pair<std::string, std::string>>& files, std::vector<DecodedTexture>& textures, TextureBufferPool* pool, const MipSettings& mips = MipSettings())
+	{
+		textures.clear();
+		textures.resize(files.size());
+		jobs.parallelFor((int)files.size(), 1, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				textures[i].name = files[i].first;
+				decode(files[i].second, textures[i], pool, mips, &jobs);
+			}
+		});
+	}
+
+private:
+	static void acquire(size_t bytes, DecodedTexture& texture, TextureBufferPool* pool)
+	{
+		if (pool != nullptr)
+		{
+			pool->acquire(bytes, texture.texels);
+		}
+		else
+		{
+			texture.texels.resize(bytes);
+		}
+	}
+};
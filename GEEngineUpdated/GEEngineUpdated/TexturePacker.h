@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+#include "maths.h"
+#include "MipGenerator.h"
+#include "BlockCompression.h"
+#include "TextureDecoder.h"
+
+// Where one texture went in an atlas page. uvOffset and uvScale take the texture's own 0 to 1 UVs to the page's.
+struct AtlasRect
+{
+	int page = 0;
+	int x = 0; // Of the texture itself, inside its padding
+	int y = 0;
+	int width = 0;
+	int height = 0;
+	float uvOffset[2] = { 0, 0 };
+	float uvScale[2] = { 1, 1 };
+};
+
+// Packs rectangles into square pages with the skyline bottom-left heuristic: each rectangle goes wherever its
+// top edge ends up lowest, tallest rectangles first. Each one is surrounded by padding texels of its own edge
+// so filtering and the first few mips do not bleed between neighbours. Works on sizes only, so it runs headless.
+// Materials are not loaded into atlases: most mesh UVs wrap, which only texture arrays allow, and compose only
+// takes RGBA8, not cooked block compressed textures. Meshes share descriptors through TextureArrayPacker instead.
+class AtlasPacker
+{
+public:
+	int pageSize = 2048;
+	int padding = 4;
+	int alignment = 4; // Positions and padded sizes are multiples of this, 4 keeps block compressed pages whole
+
+	// rects[i] is where sizes[i] (width, height) went. Returns how many pages it took, or 0 when a rectangle is
+	// bigger than a page.
+	int pack(const std::vector<std::pair<int, int>>& sizes, std::vector<AtlasRect>& rects) const
+	{
+		rects.assign(sizes.size(), AtlasRect());
+		std::vector<int> order(sizes.size());
+		for (int i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			return sizes[a].second != sizes[b].second ? sizes[a].second > sizes[b].second : sizes[a].first > sizes[b].first;
+		});
+
+		std::vector<std::vector<SkylineNode>> pages;
+		for (int o = 0; o < order.size(); o++)
+		{
+			int i = order[o];
+			int width = paddedSize(sizes[i].first);
+			int height = paddedSize(sizes[i].second);
+			if (width > pageSize || height > pageSize)
+			{
+				return 0;
+			}
+			int page = -1;
+			int x = 0;
+			int y = 0;
+			for (int p = 0; p < pages.size() && page < 0; p++)
+			{
+				if (place(pages[p], width, height, x, y))
+				{
+					page = p;
+				}
+			}
+			if (page < 0)
+			{
+				pages.push_back(std::vector<SkylineNode>(1, SkylineNode{ 0, 0, pageSize }));
+				page = (int)pages.size() - 1;
+				place(pages[page], width, height, x, y);
+			}
+			AtlasRect& rect = rects[i];
+			rect.page = page;
+			rect.x = x + padding;
+			rect.y = y + padding;
+			rect.width = sizes[i].first;
+			rect.height = sizes[i].second;
+			rect.uvOffset[0] = (float)rect.x / pageSize;
+			rect.uvOffset[1] = (float)rect.y / pageSize;
+			rect.uvScale[0] = (float)rect.width / pageSize;
+			rect.uvScale[1] = (float)rect.height / pageSize;
+		}
+		return (int)pages.size();
+	}
+
+	// Fraction of the pages the textures themselves cover
+	float occupancy(const std::vector<AtlasRect>& rects, int pagesN) const
+	{
+		double used = 0;
+		for (int i = 0; i < rects.size(); i++)
+		{
+			used += (double)rects[i].width * rects[i].height;
+		}
+		return pagesN == 0 ? 0.0f : (float)(used / ((double)pageSize * pageSize * pagesN));
+	}
+
+	// Texture coordinates only survive the move into an atlas when they stay inside the texture. Ones that wrap
+	// need a texture array instead. uvs points at the first u, with stride bytes from one vertex to the next.
+	static bool uvsInside(const void* uvs, size_t stride, size_t count)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(uvs);
+		for (size_t i = 0; i < count; i++)
+		{
+			const float* uv = reinterpret_cast<const float*>(p + (i * stride));
+			if (uv[0] < -0.001f || uv[0] > 1.001f || uv[1] < -0.001f || uv[1] > 1.001f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static void remapUVs(const AtlasRect& rect, void* uvs, size_t stride, size_t count)
+	{
+		unsigned char* p = static_cast<unsigned char*>(uvs);
+		for (size_t i = 0; i < count; i++)
+		{
+			float* uv = reinterpret_cast<float*>(p + (i * stride));
+			uv[0] = rect.uvOffset[0] + (uv[0] * rect.uvScale[0]);
+			uv[1] = rect.uvOffset[1] + (uv[1] * rect.uvScale[1]);
+		}
+	}
+
+	// Copies the top level of every RGBA8 texture on page into texels, repeating each one's edge texels into its
+	// padding. Build the page's mips from it afterwards.
+	void compose(const std::vector<const DecodedTexture*>& textures, const std::vector<AtlasRect>& rects, int page, unsigned char* texels, unsigned int rowPitch) const
+	{
+		for (int i = 0; i < textures.size(); i++)
+		{
+			const AtlasRect& rect = rects[i];
+			const DecodedTexture& texture = *textures[i];
+			if (rect.page != page || texture.format != TextureFormat::RGBA8)
+			{
+				continue;
+			}
+			for (int y = -padding; y < rect.height + padding; y++)
+			{
+				int sy = clamp(y, 0, rect.height - 1);
+				const unsigned char* src = texture.texels.data() + ((size_t)sy * texture.rowPitch);
+				unsigned char* dst = texels + ((size_t)(rect.y + y) * rowPitch);
+				for (int x = -padding; x < rect.width + padding; x++)
+				{
+					int sx = clamp(x, 0, rect.width - 1);
+					memcpy(dst + ((rect.x + x) * 4), src + (sx * 4), 4);
+				}
+			}
+		}
+	}
+
+private:
+	struct SkylineNode
+	{
+		int x;
+		int y;
+		int width;
+	};
+
+	int paddedSize(int size) const
+	{
+		int padded = size + (2 * padding);
+		return ((padded + alignment - 1) / alignment) * alignment;
+	}
+
+	// Finds the lowest spot along the skyline, then raises the skyline over it
+	bool place(std::vector<SkylineNode>& skyline, int width, int height, int& outX, int& outY) const
+	{
+		int best = -1;
+		int bestY = pageSize;
+		int bestWidth = pageSize;
+		for (int i = 0; i < skyline.size(); i++)
+		{
+			int x = skyline[i].x;
+			if (x + width > pageSize)
+			{
+				break;
+			}
+			int y = 0;
+			int covered = 0;
+			for (int j = i; j < skyline.size() && covered < width; j++)
+			{
+				y = max(y, skyline[j].y);
+				covered += skyline[j].width;
+			}
+			if (y + height > pageSize)
+			{
+				continue;
+			}
+			if (y < bestY || (y == bestY && skyline[i].width < bestWidth))
+			{
+				best = i;
+				bestY = y;
+				bestWidth = skyline[i].width;
+			}
+		}
+		if (best < 0)
+		{
+			return false;
+		}
+		outX = skyline[best].x;
+		outY = bestY;
+
+		SkylineNode node = { outX, outY + height, width };
+		skyline.insert(skyline.begin() + best, node);
+		// Cut the nodes the new one now covers
+		for (int i = best + 1; i < skyline.size(); i++)
+		{
+			int end = skyline[i - 1].x + skyline[i - 1].width;
+			if (skyline[i].x >= end)
+			{
+				break;
+			}
+			int shrink = end - skyline[i].x;
+			skyline[i].x += shrink;
+			skyline[i].width -= shrink;
+			if (skyline[i].width > 0)
+			{
+				break;
+			}
+			skyline.erase(skyline.begin() + i);
+			i--;
+		}
+		// Merge neighbours at the same height
+		for (int i = 0; i + 1 < skyline.size(); i++)
+		{
+			if (skyline[i].y == skyline[i + 1].y)
+			{
+				skyline[i].width += skyline[i + 1].width;
+				skyline.erase(skyline.begin() + i + 1);
+				i--;
+			}
+		}
+		return true;
+	}
+};
+
+// Groups textures that can share a texture array, the same size, format, colour space and mip count, and builds
+// the arrays. A mesh with several materials can then bind one array and pick its slice per draw.
+class TextureArrayPacker
+{
+public:
+	static bool compatible(const DecodedTexture& a, const DecodedTexture& b)
+	{
+		return a.width == b.width && a.height == b.height && a.format == b.format && a.srgb == b.srgb &&
+			a.levels.size() == b.levels.size() && a.arraySize == 1 && b.arraySize == 1;
+	}
+
+	// groups[g] lists the indices of textures in array g, in order, with at most maxSlices each. Textures that
+	// match nothing else end up in a group of one.
+	static void group(const std::vector<const DecodedTexture*>& textures, int maxSlices, std::vector<std::vector<int>>& groups)
+	{
+		groups.clear();
+		for (int i = 0; i < textures.size(); i++)
+		{
+			int found = -1;
+			for (int g = 0; g < groups.size() && found < 0; g++)
+			{
+				if (groups[g].size() < maxSlices && compatible(*textures[groups[g][0]], *textures[i]))
+				{
+					found = g;
+				}
+			}
+			if (found < 0)
+			{
+				groups.push_back(std::vector<int>());
+				found = (int)groups.size() - 1;
+			}
+			groups[found].push_back(i);
+		}
+	}
+
+	// Copies the slices one after another into array, each laid out as the upload wants a slice. The buffer comes
+	// from the first slice's pool when it has one.
+	static void build(const std::vector<const DecodedTexture*>& slices, DecodedTexture& array)
+	{
+		const DecodedTexture& first = *slices[0];
+		array.release();
+		array.width = first.width;
+		array.height = first.height;
+		array.rowPitch = first.rowPitch;
+		array.firstMip = first.firstMip;
+		array.format = first.format;
+		array.srgb = first.srgb;
+		array.arraySize = (int)slices.size();
+		array.pool = first.pool;
+
+		std::vector<MipLevel> sliceLevels;
+		size_t alignment = MipGenerator::placementAlignment;
+		size_t sliceBytes = BlockCompression::layout(first.width, first.height, (int)first.levels.size(), first.format, sliceLevels);
+		sliceBytes = (sliceBytes + alignment - 1) & ~(alignment - 1);
+		size_t bytes = sliceBytes * slices.size();
+		if (array.pool != nullptr)
+		{
+			array.pool->acquire(bytes, array.texels);
+		}
+		else
+		{
+			array.texels.resize(bytes);
+		}
+
+		array.levels.clear();
+		for (int s = 0; s < slices.size(); s++)
+		{
+			const DecodedTexture& slice = *slices[s];
+			for (int l = 0; l < sliceLevels.size(); l++)
+			{
+				MipLevel level = sliceLevels[l];
+				level.offset += s * sliceBytes;
+				const MipLevel& src = slice.levels[l];
+				for (int y = 0; y < level.rowsN; y++)
+				{
+					memcpy(array.texels.data() + level.offset + ((size_t)y * level.rowPitch), slice.texels.data() + src.offset + ((size_t)y * src.rowPitch), level.rowBytes);
+				}
+				array.levels.push_back(level);
+			}
+		}
+	}
+};
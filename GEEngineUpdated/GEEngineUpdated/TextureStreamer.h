@@ -0,0 +1,454 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "maths.h"
+#include "BlockCompression.h"
+#include "TextureDecoder.h"
+
+// One texture the streamer looks after. Mips from residentMip down to the last are on the GPU, and the mip tail
+// from tailMip down is never evicted.
+struct StreamedTexture
+{
+	std::string name;
+	std::string filename;
+	int width = 0;
+	int height = 0;
+	int levelsN = 0;
+	TextureFormat format = TextureFormat::RGBA8;
+	std::vector<size_t> chainBytes; // chainBytes[m] is the size of mips m to the last, chainBytes[levelsN] is 0
+	int tailMip = 0;
+	int residentMip = 0;
+	int pendingMip = -1; // The chain a load in flight will replace the resident one with
+	int wantedMip = 0; // The most detailed mip asked for this frame
+	unsigned long long lastUsed = 0; // Frame it was last asked for
+	bool failed = false; // A load failed, so it stays as it is
+};
+
+// What the streamer did over one update, or added up over every update
+struct TextureStreamStats
+{
+	int requests = 0; // Textures asked for
+	int hits = 0; // Of those, ones already resident at the mip asked for
+	int loadsIssued = 0;
+	int loadsCompleted = 0;
+	int evictions = 0;
+	size_t bytesResident = 0;
+	size_t bytesBudgeted = 0; // What will be resident once the loads in flight land
+	size_t bytesLoaded = 0;
+
+	float hitRate() const
+	{
+		return requests == 0 ? 1.0f : (float)hits / requests;
+	}
+};
+
+// Reads a chain of mips from firstMip down to the last. Called from the streaming thread.
+class TextureStreamSource
+{
+public:
+	virtual ~TextureStreamSource() {}
+	virtual bool load(const StreamedTexture& texture, int firstMip, DecodedTexture& chain) = 0;
+};
+
+// Reads the chain from the cooked .dds
+class CookedTextureSource : public TextureStreamSource
+{
+public:
+	TextureBufferPool* pool = nullptr;
+
+	bool load(const StreamedTexture& texture, int firstMip, DecodedTexture& chain) override
+	{
+		return TextureDecoder::decodeCooked(texture.filename, chain, pool, firstMip) && chain.firstMip == firstMip;
+	}
+};
+
+// Lays the chain out without reading anything, for running the policy headless
+class SimulatedTextureSource : public TextureStreamSource
+{
+public:
+	bool load(const StreamedTexture& texture, int firstMip, DecodedTexture& chain) override
+	{
+		chain.filename = texture.filename;
+		chain.width = max(texture.width >> firstMip, 1);
+		chain.height = max(texture.height >> firstMip, 1);
+		chain.firstMip = firstMip;
+		chain.format = texture.format;
+		BlockCompression::layout(chain.width, chain.height, texture.levelsN - firstMip, texture.format, chain.levels);
+		chain.rowPitch = chain.levels[0].rowPitch;
+		return true;
+	}
+};
+
+// Replaces a texture's GPU copy with a newly loaded chain. Called from update(), on the thread that owns the device.
+class TextureStreamTarget
+{
+public:
+	virtual ~TextureStreamTarget() {}
+	virtual void apply(int id, DecodedTexture& chain) = 0;
+};
+
+// Keeps the textures that are asked for at the detail they are asked for, within a fixed budget of GPU memory.
+// Textures start with only their mip tail. Each frame the renderer asks for the mip every visible texture needs
+// from its size on screen, and update() loads the missing mips in the background. When a load would go over
+// budget, textures nobody asked for this frame lose everything above their tail, least recently used first.
+// Changing residency always swaps in a whole new chain, so evicting reloads the kept mips, a quarter at most of
+// what it frees.
+class TextureStreamer
+{
+public:
+	size_t budgetBytes = 256 * 1024 * 1024;
+	int tailSize = 128; // Mips no wider or taller than this are the tail
+	int maxLoadsInFlight = 8;
+	std::vector<StreamedTexture> textures;
+	TextureStreamStats frameStats; // From the last update
+	TextureStreamStats totals;
+
+	~TextureStreamer()
+	{
+		shutdown();
+	}
+
+	// background runs the loads on a thread of their own, otherwise they run inside update() and land at the
+	// next one, which keeps headless runs repeatable
+	void init(size_t _budgetBytes, TextureStreamSource* _source, TextureStreamTarget* _target, bool background = true)
+	{
+		shutdown();
+		budgetBytes = _budgetBytes;
+		source = _source;
+		target = _target;
+		frame = 1;
+		if (background)
+		{
+			running = true;
+			thread = std::thread(&TextureStreamer::ioLoop, this);
+		}
+	}
+
+	void shutdown()
+	{
+		if (!thread.joinable())
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+
+	// Registers a texture whose mips from residentMip down are already on the GPU, or only its tail for -1.
+	// Returns its id.
+	int add(const std::string& name, const std::string& filename, int width, int height, int levelsN, TextureFormat format, int residentMip)
+	{
+		StreamedTexture texture;
+		texture.name = name;
+		texture.filename = filename;
+		texture.width = width;
+		texture.height = height;
+		texture.levelsN = levelsN;
+		texture.format = format;
+		std::vector<MipLevel> levels;
+		BlockCompression::layout(width, height, levelsN, format, levels);
+		texture.chainBytes.resize(levelsN + 1, 0);
+		for (int l = levelsN - 1; l >= 0; l--)
+		{
+			texture.chainBytes[l] = texture.chainBytes[l + 1] + ((size_t)levels[l].rowBytes * levels[l].rowsN);
+		}
+		int lastMip = BlockCompression::lastTopLevel(width, height, levelsN, format);
+		texture.tailMip = lastMip;
+		while (texture.tailMip > 0 && max(levels[texture.tailMip - 1].width, levels[texture.tailMip - 1].height) <= tailSize)
+		{
+			texture.tailMip--;
+		}
+		texture.residentMip = residentMip < 0 ? texture.tailMip : min(residentMip, lastMip);
+		texture.wantedMip = texture.levelsN;
+		textures.push_back(texture);
+		return (int)textures.size() - 1;
+	}
+
+	// Registers a texture loaded from its cooked .dds, which has to be up to date for it to stream
+	int add(const std::string& name, const std::string& filename, int residentMip)
+	{
+		GEMLoader::GEMMappedFile file;
+		DDSInfo info;
+		if (!TextureDecoder::openCooked(filename, file, info))
+		{
+			return -1;
+		}
+		return add(name, filename, info.width, info.height, info.levelsN, info.format, residentMip);
+	}
+
+	// Texels across the texture per pixel on screen halve with each mip, so the mip to use is how many times
+	// the texture is bigger than it appears
+	static int mipForScreenSize(int width, int height, int levelsN, float screenPixels)
+	{
+		float texels = (float)max(width, height);
+		if (screenPixels >= texels)
+		{
+			return 0;
+		}
+		int mip = (int)floorf(log2f(texels / max(screenPixels, 1.0f)));
+		return clamp(mip, 0, levelsN - 1);
+	}
+
+	// Height in pixels of a sphere of the given radius at distance, with a vertical field of view in degrees
+	static float screenSize(float radius, float distance, float fovDegrees, int screenHeight)
+	{
+		float tanHalfFov = tanf((fovDegrees / 180.0f) * (float)M_PI / 2.0f);
+		return (radius * screenHeight) / (max(distance, radius) * tanHalfFov);
+	}
+
+	// Asks for texture id to have mip and everything below resident. Called any number of times a frame.
+	void request(int id, int mip)
+	{
+		StreamedTexture& texture = textures[id];
+		if (texture.lastUsed != frame)
+		{
+			texture.lastUsed = frame;
+			texture.wantedMip = texture.levelsN;
+		}
+		texture.wantedMip = min(texture.wantedMip, mip);
+	}
+
+	void requestScreenSize(int id, float screenPixels)
+	{
+		const StreamedTexture& texture = textures[id];
+		request(id, mipForScreenSize(texture.width, texture.height, texture.levelsN, screenPixels));
+	}
+
+	// Lands the loads that have finished, counts hits for this frame's requests, then starts the loads the
+	// requests need. Once a frame, before any of them are drawn.
+	void update()
+	{
+		frameStats = TextureStreamStats();
+		applyCompleted();
+
+		std::vector<int> wanted;
+		for (int i = 0; i < textures.size(); i++)
+		{
+			StreamedTexture& texture = textures[i];
+			if (texture.lastUsed != frame)
+			{
+				continue;
+			}
+			int mip = max(texture.wantedMip, 0);
+			frameStats.requests++;
+			frameStats.hits += texture.residentMip <= mip ? 1 : 0;
+			if (mip < texture.residentMip && texture.pendingMip < 0 && !texture.failed)
+			{
+				wanted.push_back(i);
+			}
+		}
+		// The textures furthest from what they need go first
+		std::sort(wanted.begin(), wanted.end(), [&](int a, int b)
+		{
+			int shortA = textures[a].residentMip - textures[a].wantedMip;
+			int shortB = textures[b].residentMip - textures[b].wantedMip;
+			return shortA != shortB ? shortA > shortB : a < b;
+		});
+
+		size_t budgeted = budgetedBytes();
+		for (int i = 0; i < wanted.size() && loadsInFlight < maxLoadsInFlight; i++)
+		{
+			StreamedTexture& texture = textures[wanted[i]];
+			int mip = max(texture.wantedMip, 0);
+			while (mip < texture.residentMip && budgeted + (texture.chainBytes[mip] - texture.chainBytes[texture.residentMip]) > budgetBytes)
+			{
+				if (!evictOne(budgeted))
+				{
+					mip++; // Nothing left to evict, so settle for less
+				}
+			}
+			if (mip < texture.residentMip)
+			{
+				budgeted += texture.chainBytes[mip] - texture.chainBytes[texture.residentMip];
+				issue(wanted[i], mip);
+			}
+		}
+
+		// Drop detail nobody needs any more while over budget, which happens when the budget shrinks
+		while (budgeted > budgetBytes && evictOne(budgeted))
+		{
+		}
+
+		frameStats.bytesResident = residentBytes();
+		frameStats.bytesBudgeted = budgeted;
+		totals.requests += frameStats.requests;
+		totals.hits += frameStats.hits;
+		totals.loadsIssued += frameStats.loadsIssued;
+		totals.loadsCompleted += frameStats.loadsCompleted;
+		totals.evictions += frameStats.evictions;
+		totals.bytesLoaded += frameStats.bytesLoaded;
+		totals.bytesResident = frameStats.bytesResident;
+		totals.bytesBudgeted = frameStats.bytesBudgeted;
+		frame++;
+	}
+
+	// Blocks until every load in flight has landed, for shutting down and for tests
+	void finish()
+	{
+		while (loadsInFlight > 0)
+		{
+			if (!thread.joinable())
+			{
+				applyCompleted();
+				continue;
+			}
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				done.wait(lock, [this]() { return !completed.empty(); });
+			}
+			applyCompleted();
+		}
+	}
+
+	size_t residentBytes() const
+	{
+		size_t bytes = 0;
+		for (int i = 0; i < textures.size(); i++)
+		{
+			bytes += textures[i].chainBytes[textures[i].residentMip];
+		}
+		return bytes;
+	}
+
+	size_t budgetedBytes() const
+	{
+		size_t bytes = 0;
+		for (int i = 0; i < textures.size(); i++)
+		{
+			const StreamedTexture& texture = textures[i];
+			bytes += texture.chainBytes[texture.pendingMip >= 0 ? texture.pendingMip : texture.residentMip];
+		}
+		return bytes;
+	}
+
+private:
+	struct Load
+	{
+		int id = 0;
+		int mip = 0;
+		StreamedTexture texture; // A copy, so the streaming thread never reads textures while it grows
+		bool loaded = false;
+		DecodedTexture chain;
+	};
+
+	TextureStreamSource* source = nullptr;
+	TextureStreamTarget* target = nullptr;
+	unsigned long long frame = 1;
+	int loadsInFlight = 0;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool running = false;
+	std::deque<Load> queued;
+	std::vector<Load> completed;
+
+	// Drops the least recently used texture that was not asked for this frame down to its tail
+	bool evictOne(size_t& budgeted)
+	{
+		int victim = -1;
+		for (int i = 0; i < textures.size(); i++)
+		{
+			const StreamedTexture& texture = textures[i];
+			if (texture.lastUsed == frame || texture.pendingMip >= 0 || texture.residentMip >= texture.tailMip || texture.failed)
+			{
+				continue;
+			}
+			if (victim < 0 || texture.lastUsed < textures[victim].lastUsed)
+			{
+				victim = i;
+			}
+		}
+		if (victim < 0)
+		{
+			return false;
+		}
+		StreamedTexture& texture = textures[victim];
+		budgeted -= texture.chainBytes[texture.residentMip] - texture.chainBytes[texture.tailMip];
+		issue(victim, texture.tailMip);
+		frameStats.evictions++;
+		return true;
+	}
+
+	void issue(int id, int mip)
+	{
+		StreamedTexture& texture = textures[id];
+		texture.pendingMip = mip;
+		loadsInFlight++;
+		frameStats.loadsIssued++;
+		Load load;
+		load.id = id;
+		load.mip = mip;
+		load.texture = texture;
+		if (!thread.joinable())
+		{
+			load.loaded = source->load(texture, mip, load.chain);
+			completed.push_back(std::move(load));
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queued.push_back(std::move(load));
+		}
+		wake.notify_one();
+	}
+
+	void applyCompleted()
+	{
+		std::vector<Load> landed;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			landed.swap(completed);
+		}
+		for (int i = 0; i < landed.size(); i++)
+		{
+			Load& load = landed[i];
+			StreamedTexture& texture = textures[load.id];
+			texture.pendingMip = -1;
+			loadsInFlight--;
+			frameStats.loadsCompleted++;
+			if (!load.loaded)
+			{
+				texture.failed = true;
+				continue;
+			}
+			if (target != nullptr)
+			{
+				target->apply(load.id, load.chain);
+			}
+			load.chain.release();
+			frameStats.bytesLoaded += texture.chainBytes[load.mip];
+			texture.residentMip = load.mip;
+		}
+	}
+
+	void ioLoop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [this]() { return !running || !queued.empty(); });
+			if (!running)
+			{
+				return;
+			}
+			Load load(std::move(queued.front()));
+			queued.pop_front();
+			lock.unlock();
+			load.loaded = source->load(load.texture, load.mip, load.chain);
+			lock.lock();
+			completed.push_back(std::move(load));
+			done.notify_all();
+		}
+	}
+};
@@ -11,6 +11,10 @@
 #pragma comment(lib, "d3dcompiler.lib")    // libraries
 
 #include "core.h"
+#include "JobSystem.h"
+#include "TextureDecoder.h"
+#include "TextureStreamer.h"
+#include "TexturePacker.h"
 #include <string>
 #include <map>
 
@@ -18,35 +22,29 @@ class Texture {
 
 public:
 	ID3D12Resource* tex = nullptr;
-	int heapOffset = -1;
+	DescriptorHandle descriptor;
+	int heapOffset = -1; // descriptor.index, or -1 before it has one
+	UploadToken uploaded = 0; // When its texels have landed
 	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
 
 	void init(Core* core, const std::string& filename) {
-		int width = 0;
-		int height = 0;
-		int channels = 0;
-		unsigned char* texels = stbi_load(filename.c_str(), &width, &height, &channels, 4);
-		channels = 4;
-		if (!texels)
-		{
-			OutputDebugStringA(("Failed to load texture: " + filename + "\n").c_str());
+		DecodedTexture decoded;
+		if (!TextureDecoder::decode(filename, decoded, nullptr)) {
 			return;
 		}
-		if (channels == 3) {
-			channels = 4;
-			unsigned char* texelsWithAlpha = new unsigned char[width * height * channels];
-			for (int i = 0; i < (width * height); i++) {
-				texelsWithAlpha[i * 4] = texels[i * 3];
-				texelsWithAlpha[(i * 4) + 1] = texels[(i * 3) + 1];
-				texelsWithAlpha[(i * 4) + 2] = texels[(i * 3) + 2];
-				texelsWithAlpha[(i * 4) + 3] = 255;
-			}
-			// Initialize texture using width, height, channels, and texelsWithAlpha
-			delete[] texelsWithAlpha;
-		}
-		else {
-			// Initialize texture using width, height, channels, and texels
-		}
+		init(core, decoded);
+	}
+
+	// Creates the texture and all of its mip levels from a texture already decoded to RGBA8 or loaded block
+	// compressed. When the decoder laid the levels out the way the upload wants them, they are uploaded as they are.
+	// Called again on a texture that already exists, it replaces it and moves heapOffset to the new view, so
+	// streaming can swap a chain in without touching anything that draws with it. A decoded array becomes a texture array.
+	void init(Core* core, const DecodedTexture& decoded) {
+		int channels = 4;
+		ID3D12Resource* previous = tex;
+		UINT subresourcesN = (UINT)decoded.levels.size();
+		UINT levelsN = subresourcesN / decoded.arraySize;
+		format = (DXGI_FORMAT)DDSFile::dxgiFormat(decoded.format, decoded.srgb);
 
 		// Create GPU Texture
 		D3D12_HEAP_PROPERTIES heapProps = {};
@@ -54,10 +52,10 @@ public:
 
 		D3D12_RESOURCE_DESC textureDesc = {};
 		textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-		textureDesc.Width = width;
-		textureDesc.Height = height;
-		textureDesc.DepthOrArraySize = 1;
-		textureDesc.MipLevels = 1;
+		textureDesc.Width = decoded.width;
+		textureDesc.Height = decoded.height;
+		textureDesc.DepthOrArraySize = (UINT16)decoded.arraySize;
+		textureDesc.MipLevels = levelsN;
 		textureDesc.Format = format;
 		textureDesc.SampleDesc.Count = 1;
 		textureDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
@@ -65,71 +63,150 @@ public:
 		HRESULT hr = core->device->CreateCommittedResource(
 			&heapProps, D3D12_HEAP_FLAG_NONE,
 			&textureDesc,
-			D3D12_RESOURCE_STATE_COPY_DEST,
+			D3D12_RESOURCE_STATE_COMMON,
 			nullptr,
 			IID_PPV_ARGS(&tex)
 		);
 
 		if (FAILED(hr)) {
 			OutputDebugStringA("CreateCommittedResource failed in Texture\n");
+			tex = previous;
 			return;
 		}
 
 		// 
 
-		D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
+		std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints(subresourcesN);
 		UINT64 totalBytes = 0;
 
 		core->device->GetCopyableFootprints(
 			&textureDesc,
-			0, 1, 0,
-			&footprint,
+			0, subresourcesN, 0,
+			footprints.data(),
 			nullptr, nullptr, &totalBytes
 		);
 
-		UINT rowPitch = footprint.Footprint.RowPitch;
-
-		// uploadData
-		unsigned char* uploadData = new unsigned char[rowPitch * height];
-
-		for (UINT y = 0; y < height; y++)
-		{
-			memcpy(uploadData + y * rowPitch,
-				texels + y * width * channels,
-				width * channels);
+		// uploadData, only needed when the decoder laid the levels out differently
+		bool matches = true;
+		for (UINT i = 0; i < subresourcesN; i++) {
+			matches = matches && footprints[i].Offset == decoded.levels[i].offset && footprints[i].Footprint.RowPitch == decoded.levels[i].rowPitch;
+		}
+		matches = matches && decoded.texels.size() >= totalBytes;
+		const unsigned char* uploadData = decoded.texels.data();
+		std::vector<unsigned char> repacked;
+		if (!matches) {
+			repacked.resize((size_t)totalBytes);
+			for (UINT i = 0; i < subresourcesN; i++) {
+				const MipLevel& level = decoded.levels[i];
+				for (int y = 0; y < level.rowsN; y++)
+				{
+					memcpy(repacked.data() + footprints[i].Offset + ((size_t)y * footprints[i].Footprint.RowPitch),
+						decoded.texels.data() + level.offset + ((size_t)y * level.rowPitch),
+						level.rowBytes);
+				}
+			}
+			uploadData = repacked.data();
 		}
 
-		core->uploadResource(
+		uploaded = core->uploadSubresources(
 			tex,
 			uploadData,
-			rowPitch * height,
-			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-			&footprint
+			totalBytes,
+			footprints.data(),
+			subresourcesN
 		);
 
-		delete[] uploadData;
-
-		stbi_image_free(texels);
+		// Frames still in flight may be drawing with the old one, so it and its view stay until they are done and the
+		// new chain gets a view of its own. Draws pick the new one up through heapOffset.
+		if (previous != nullptr) {
+			core->deferRelease(previous, descriptor);
+			descriptor = DescriptorHandle();
+		}
 
-		D3D12_CPU_DESCRIPTOR_HANDLE h = core->srvHeap.getNextCPUHandle();
+		if (!descriptor.valid()) {
+			descriptor = core->srvHeap.allocate();
+			if (!descriptor.valid()) {
+				return;
+			}
+			heapOffset = (int)descriptor.index;
+		}
+		D3D12_CPU_DESCRIPTOR_HANDLE h = core->srvHeap.getCPUHandle(descriptor);
 
 		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 		srvDesc.Format = format;
-		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		// Always an array, a lone texture is an array of one, so the pixel shaders sample every texture the same way
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
 		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-		srvDesc.Texture2D.MipLevels = 1;
+		srvDesc.Texture2DArray.MipLevels = levelsN;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = decoded.arraySize;
 
 		core->device->CreateShaderResourceView(tex, &srvDesc, h);
+	}
 
-		heapOffset = core->srvHeap.used - 1;
-
+	// Waits for the GPU to finish with the texture, then releases it and hands its descriptor back
+	void free(Core* core) {
+		core->flushGraphicsQueue();
+		if (tex != nullptr) {
+			tex->Release();
+			tex = nullptr;
+		}
+		if (descriptor.valid()) {
+			core->srvHeap.free(descriptor);
+		}
+		heapOffset = -1;
 	}
 };
 
-class TextureManager
+class TextureManager : public TextureStreamTarget
 {
 public:
 	std::map<std::string, Texture*> textures;
+	TextureBufferPool buffers; // Decode buffers, reused as the upload source
+	CookedTextureSource streamSource;
+	TextureStreamer streamer; // After its source, so its thread stops before the source goes
+	std::map<std::string, int> streamIds;
+	std::vector<Texture*> streamed; // By streamer id
+	bool streaming = false;
+	Core* streamCore = nullptr;
+	bool packing = false; // Uploaders pack what they load with loadTexturesPacked
+	int maxSlices = 64;
+	std::map<std::string, unsigned int> slices; // Of the textures that went into an array
+
+	// From here on, textures loaded from a cooked .dds stream their higher mips in on request within budgetBytes.
+	// Load them with AssetLoader::streamTextures(streamer.tailSize) so only their tails are read up front.
+	void initStreaming(size_t budgetBytes) {
+		streamSource.pool = &buffers;
+		streamer.init(budgetBytes, &streamSource, this);
+		streaming = true;
+	}
+
+	// Asks for the mips a texture needs to cover screenPixels on screen. Textures that do not stream are ignored.
+	void requestTexture(const std::string& name, float screenPixels) {
+		auto it = streamIds.find(name);
+		if (it != streamIds.end()) {
+			streamer.requestScreenSize(it->second, screenPixels);
+		}
+	}
+
+	void requestTextures(const std::vector<std::string>& names, float screenPixels) {
+		for (int i = 0; i < names.size(); i++) {
+			requestTexture(names[i], screenPixels);
+		}
+	}
+
+	// Swaps in the chains that finished loading and starts the loads this frame's requests need. Uploads go
+	// through the command list, so this runs outside a frame, before beginFrame.
+	void updateStreaming(Core* core) {
+		if (streaming) {
+			streamCore = core;
+			streamer.update();
+		}
+	}
+
+	void apply(int id, DecodedTexture& chain) override {
+		streamed[id]->init(streamCore, chain);
+	}
 
 	Texture* loadTexture(Core* core, const std::string& name, const std::string& file) {
 		auto it = textures.find(name);
@@ -143,10 +220,131 @@ public:
 		return t;
 	}
 
+	// Same, from a texture decoded elsewhere. Its buffer goes back to its pool once uploaded.
+	Texture* loadTexture(Core* core, DecodedTexture& decoded) {
+		auto it = textures.find(decoded.name);
+		if (it != textures.end()) {
+			decoded.release();
+			return it->second;
+		}
+
+		Texture* t = new Texture();
+		if (decoded.valid()) {
+			t->init(core, decoded);
+			if (streaming && BlockCompression::isBlock(decoded.format)) {
+				int id = streamer.add(decoded.name, decoded.filename, decoded.firstMip);
+				if (id >= 0) {
+					streamIds[decoded.name] = id;
+					streamed.push_back(t);
+				}
+			}
+		}
+		decoded.release();
+
+		textures[decoded.name] = t;
+		return t;
+	}
+
+	// Decodes a batch of (name, file) pairs at the same time on jobs, then uploads them in order.
+	// Names that are already loaded, or repeated in the batch, are skipped.
+	void loadTextures(Core* core, JobSystem& jobs, const std::vector<std::pair<std::string, std::string>>& batch) {
+		std::vector<std::pair<std::string, std::string>> files;
+		for (int i = 0; i < batch.size(); i++) {
+			bool repeated = false;
+			for (int j = 0; j < files.size(); j++) {
+				repeated = repeated || files[j].first == batch[i].first;
+			}
+			if (!repeated && textures.find(batch[i].first) == textures.end()) {
+				files.push_back(batch[i]);
+			}
+		}
+
+		std::vector<DecodedTexture> decoded;
+		TextureDecoder::decodeBatch(jobs, files, decoded, &buffers);
+		for (int i = 0; i < decoded.size(); i++) {
+			loadTexture(core, decoded[i]);
+		}
+	}
+
+	// Uploads a batch, packing the textures that match each other into texture arrays so the meshes using them
+	// share one descriptor table and only change slice between draws. Textures that stream are loaded alone, as
+	// the streamer swaps whole resources.
+	void loadTexturesPacked(Core* core, const std::vector<DecodedTexture*>& batch) {
+		std::vector<DecodedTexture*> packable;
+		std::vector<const DecodedTexture*> slicesIn;
+		for (int i = 0; i < batch.size(); i++) {
+			DecodedTexture* decoded = batch[i];
+			bool repeated = false;
+			for (int j = 0; j < packable.size(); j++) {
+				repeated = repeated || packable[j]->name == decoded->name;
+			}
+			if (repeated) {
+				continue;
+			}
+			if (textures.find(decoded->name) != textures.end() || !decoded->valid() ||
+				decoded->firstMip > 0 || (streaming && BlockCompression::isBlock(decoded->format))) {
+				loadTexture(core, *decoded);
+				continue;
+			}
+			packable.push_back(decoded);
+			slicesIn.push_back(decoded);
+		}
+
+		std::vector<std::vector<int>> groups;
+		TextureArrayPacker::group(slicesIn, maxSlices, groups);
+		for (int g = 0; g < groups.size(); g++) {
+			if (groups[g].size() == 1) {
+				loadTexture(core, *packable[groups[g][0]]);
+				continue;
+			}
+			std::vector<const DecodedTexture*> group;
+			for (int s = 0; s < groups[g].size(); s++) {
+				group.push_back(slicesIn[groups[g][s]]);
+			}
+			DecodedTexture array;
+			TextureArrayPacker::build(group, array);
+			Texture* t = new Texture();
+			t->init(core, array);
+			array.release();
+			for (int s = 0; s < groups[g].size(); s++) {
+				DecodedTexture* decoded = packable[groups[g][s]];
+				textures[decoded->name] = t;
+				slices[decoded->name] = s;
+				decoded->release();
+			}
+		}
+	}
+
+	// Drops a texture so it can be loaded again, freeing it once no other name (another slice of its array) uses it.
+	// Streamed textures stay, as the streamer keeps swapping their chains in.
+	bool unload(Core* core, const std::string& name) {
+		auto it = textures.find(name);
+		if (it == textures.end() || streamIds.find(name) != streamIds.end()) {
+			return false;
+		}
+		Texture* t = it->second;
+		textures.erase(it);
+		slices.erase(name);
+		for (auto& other : textures) {
+			if (other.second == t) {
+				return true;
+			}
+		}
+		t->free(core);
+		delete t;
+		return true;
+	}
+
 	int find(const std::string& name) {
 		auto it = textures.find(name);
 		if (it == textures.end()) return -1;
 		return it->second->heapOffset;
 	}
+
+	unsigned int findSlice(const std::string& name) {
+		auto it = slices.find(name);
+		if (it == slices.end()) return 0;
+		return it->second;
+	}
 };
 
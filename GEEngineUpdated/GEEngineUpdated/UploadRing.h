@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+// The fence value of the batch an upload went out in. An upload is done once the queue's fence reaches it.
+typedef unsigned long long UploadToken;
+
+// Where a batch of copies goes. Core submits to the copy queue, the benchmark to FakeUploadQueue.
+class UploadQueue
+{
+public:
+	virtual ~UploadQueue() {}
+	// Executes the copies recorded since the last submit, then signals fenceValue
+	virtual void submit(UploadToken fenceValue) = 0;
+	virtual UploadToken completed() = 0;
+	// Blocks until completed() reaches fenceValue
+	virtual void wait(UploadToken fenceValue) = 0;
+};
+
+// A queue whose batches finish when finishUpTo says so, or straight away when waited on
+class FakeUploadQueue : public UploadQueue
+{
+public:
+	std::vector<UploadToken> submitted;
+	UploadToken done = 0;
+	int waitsN = 0;
+
+	void submit(UploadToken fenceValue) override
+	{
+		submitted.push_back(fenceValue);
+	}
+
+	UploadToken completed() override
+	{
+		return done;
+	}
+
+	void wait(UploadToken fenceValue) override
+	{
+		waitsN++;
+		finishUpTo(fenceValue);
+	}
+
+	void finishUpTo(UploadToken fenceValue)
+	{
+		if (fenceValue > done && !submitted.empty())
+		{
+			done = fenceValue < submitted.back() ? fenceValue : submitted.back();
+		}
+	}
+};
+
+// Where an upload's bytes go in the ring. data is offset bytes into the ring's memory.
+struct UploadAllocation
+{
+	size_t offset = 0;
+	unsigned char* data = nullptr;
+	UploadToken token = 0;
+};
+
+// Stages uploads in one persistently mapped buffer, used as a ring. Copies pile up in an open batch until
+// submit sends them all at once, and each submitted batch keeps its part of the ring until the queue's fence
+// passes its token. Only when the ring is full does allocate wait, for the oldest batches.
+class UploadRing
+{
+public:
+	size_t capacity = 0;
+	int submitsN = 0;
+	int stallsN = 0; // Times allocate had to wait for the queue
+	size_t bytesStaged = 0;
+
+	// capacity must be a multiple of every alignment asked for
+	void init(unsigned char* _memory, size_t _capacity, UploadQueue* _queue)
+	{
+		memory = _memory;
+		capacity = _capacity;
+		queue = _queue;
+		head = 0;
+		tail = 0;
+		openCopies = false;
+		lastSubmitted = 0;
+		inFlight.clear();
+	}
+
+	// Space for bytes, aligned, in the open batch. False when it could never fit in the ring.
+	bool allocate(size_t bytes, size_t alignment, UploadAllocation& allocation)
+	{
+		if (bytes > capacity)
+		{
+			return false;
+		}
+		retire();
+		unsigned long long start = 0;
+		while (!fits(bytes, alignment, start))
+		{
+			if (openCopies)
+			{
+				submit();
+			}
+			if (inFlight.empty())
+			{
+				return false;
+			}
+			stallsN++;
+			queue->wait(inFlight.front().token);
+			retire();
+		}
+		head = start + bytes;
+		openCopies = true;
+		bytesStaged += bytes;
+		allocation.offset = (size_t)(start % capacity);
+		allocation.data = memory + allocation.offset;
+		allocation.token = openToken();
+		return true;
+	}
+
+	// The token the open batch will get
+	UploadToken openToken() const
+	{
+		return lastSubmitted + 1;
+	}
+
+	// Puts a copy staged somewhere other than the ring into the open batch, so submit sends it
+	UploadToken addExternal()
+	{
+		openCopies = true;
+		return openToken();
+	}
+
+	// Sends the open batch, when it has anything in it. Returns the token of the last batch sent.
+	UploadToken submit()
+	{
+		if (!openCopies)
+		{
+			return lastSubmitted;
+		}
+		openCopies = false;
+		lastSubmitted++;
+		queue->submit(lastSubmitted);
+		inFlight.push_back(Batch{ head, lastSubmitted });
+		submitsN++;
+		return lastSubmitted;
+	}
+
+	// Frees the parts of the ring whose batches the queue has finished
+	void retire()
+	{
+		UploadToken done = queue->completed();
+		while (!inFlight.empty() && inFlight.front().token <= done)
+		{
+			tail = inFlight.front().end;
+			inFlight.pop_front();
+		}
+		// Empty, so start again at the front. Anything that skipped there from part way round could need more
+		// than the whole ring.
+		if (inFlight.empty() && !openCopies && capacity > 0)
+		{
+			head = ((head + capacity - 1) / capacity) * capacity;
+			tail = head;
+		}
+	}
+
+	bool isComplete(UploadToken token)
+	{
+		return token <= lastSubmitted && token <= queue->completed();
+	}
+
+	// Sends the open batch if token is in it, then blocks until the queue is done with it
+	void wait(UploadToken token)
+	{
+		if (token > lastSubmitted)
+		{
+			submit();
+		}
+		if (token <= lastSubmitted && queue->completed() < token)
+		{
+			queue->wait(token);
+		}
+		retire();
+	}
+
+	size_t used() const
+	{
+		return (size_t)(head - tail);
+	}
+
+private:
+	struct Batch
+	{
+		unsigned long long end; // Where the batch's last allocation ends
+		UploadToken token;
+	};
+
+	unsigned char* memory = nullptr;
+	UploadQueue* queue = nullptr;
+	// Positions count up forever, the ring offset is position % capacity. Everything from tail to head is in use.
+	unsigned long long head = 0;
+	unsigned long long tail = 0;
+	bool openCopies = false;
+	UploadToken lastSubmitted = 0;
+	std::deque<Batch> inFlight;
+
+	// Where bytes would start, skipping to the start of the ring rather than wrapping part way through
+	bool fits(size_t bytes, size_t alignment, unsigned long long& start) const
+	{
+		unsigned long long position = ((head + alignment - 1) / alignment) * alignment;
+		unsigned long long offset = position % capacity;
+		if (offset + bytes > capacity)
+		{
+			position += capacity - offset;
+		}
+		start = position;
+		return position + bytes - tail <= capacity;
+	}
+};
@@ -4,6 +4,12 @@
 #include <dxgi1_6.h>       // more functionality
 #include <d3dcompiler.h>   // compiler
 #include <vector>               // vector
+#include "DescriptorAllocator.h"
+#include "UploadRing.h"
+#include "FramePacing.h"
+#include "CommandRecording.h"
+#include "ConstantAllocator.h"
+#include <chrono>
 #pragma comment(lib, "d3d12")         // libraries
 #pragma comment(lib, "dxgi")              // libraries
 #pragma comment(lib, "d3dcompiler.lib")    // libraries
@@ -58,6 +64,7 @@ public:
 };
 
 
+// The shader visible CBV/SRV/UAV heap, with its slots handed out by a DescriptorAllocator
 class DescriptorHeap
 {
 public:
@@ -65,9 +72,10 @@ public:
 	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle;
 	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle;
 	unsigned int incrementSize;
-	int used;
+	DescriptorAllocator allocator;
 
-	void init(ID3D12Device5* device, int num)
+	// The last transientNum slots are shared by framesN frames in flight
+	void init(ID3D12Device5* device, int num, int transientNum, int framesN)
 	{
 		D3D12_DESCRIPTOR_HEAP_DESC uavcbvHeapDesc = {};
 		uavcbvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
@@ -77,20 +85,152 @@ public:
 		cpuHandle = heap->GetCPUDescriptorHandleForHeapStart();
 		gpuHandle = heap->GetGPUDescriptorHandleForHeapStart();
 		incrementSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-		used = 0;
+		allocator.init(num, transientNum, framesN);
 	}
 
-	D3D12_CPU_DESCRIPTOR_HANDLE getNextCPUHandle()
+	DescriptorHandle allocate(unsigned int count = 1)
 	{
-		if (used > 0)
+		DescriptorHandle handle = allocator.allocateRange(count);
+		if (!handle.valid())
 		{
-			cpuHandle.ptr += incrementSize;
+			OutputDebugStringA("Descriptor heap is full\n");
 		}
-		used++;
-		return cpuHandle;
+		return handle;
 	}
 
+	void free(DescriptorHandle& handle)
+	{
+		if (!allocator.free(handle))
+		{
+			OutputDebugStringA("Freeing a descriptor that was already freed\n");
+		}
+	}
+
+	DescriptorHandle allocateTransient(unsigned int count)
+	{
+		DescriptorHandle handle = allocator.allocateTransient(count);
+		if (!handle.valid())
+		{
+			OutputDebugStringA("Out of transient descriptors this frame\n");
+		}
+		return handle;
+	}
+
+	// Slot i of handle. A stale handle is reported, as it now points at someone else's descriptor.
+	D3D12_CPU_DESCRIPTOR_HANDLE getCPUHandle(const DescriptorHandle& handle, unsigned int i = 0)
+	{
+		check(handle);
+		D3D12_CPU_DESCRIPTOR_HANDLE h = cpuHandle;
+		h.ptr += (SIZE_T)(handle.index + i) * incrementSize;
+		return h;
+	}
+
+	D3D12_GPU_DESCRIPTOR_HANDLE getGPUHandle(const DescriptorHandle& handle, unsigned int i = 0)
+	{
+		check(handle);
+		D3D12_GPU_DESCRIPTOR_HANDLE h = gpuHandle;
+		h.ptr += (UINT64)(handle.index + i) * incrementSize;
+		return h;
+	}
 
+	void check(const DescriptorHandle& handle)
+	{
+		if (!allocator.isLive(handle))
+		{
+			OutputDebugStringA("Using a descriptor handle after it was freed\n");
+		}
+	}
+};
+
+// Runs the upload ring's batches on the copy queue. Copies are recorded into getCommandList() while a batch is
+// open, and each batch's allocator is reused once the fence has passed it.
+class CopyQueueUploader : public UploadQueue
+{
+public:
+	ID3D12CommandQueue* queue = nullptr;
+	ID3D12Fence* fence = nullptr;
+	HANDLE eventHandle = NULL;
+
+	void init(ID3D12Device5* _device, ID3D12CommandQueue* _queue)
+	{
+		device = _device;
+		queue = _queue;
+		device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
+		eventHandle = CreateEvent(NULL, FALSE, FALSE, NULL);
+		device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&allocator));
+		device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, allocator, NULL, IID_PPV_ARGS(&commandList));
+		commandList->Close();
+	}
+
+	// The copy list of the open batch, reset the first time a batch asks for it
+	ID3D12GraphicsCommandList4* getCommandList()
+	{
+		if (!recording)
+		{
+			commandList->Reset(allocator, NULL);
+			recording = true;
+		}
+		return commandList;
+	}
+
+	void submit(UploadToken fenceValue) override
+	{
+		if (recording)
+		{
+			commandList->Close();
+			ID3D12CommandList* lists[] = { commandList };
+			queue->ExecuteCommandLists(1, lists);
+			recording = false;
+		}
+		queue->Signal(fence, fenceValue);
+
+		// The allocator holds the batch's commands until the GPU has run them
+		retired.push_back(std::make_pair(fenceValue, allocator));
+		allocator = nullptr;
+		UploadToken done = completed();
+		for (int i = 0; i < retired.size() && allocator == nullptr; i++)
+		{
+			if (retired[i].first <= done)
+			{
+				allocator = retired[i].second;
+				retired.erase(retired.begin() + i);
+				allocator->Reset();
+			}
+		}
+		if (allocator == nullptr)
+		{
+			device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&allocator));
+		}
+	}
+
+	UploadToken completed() override
+	{
+		return fence->GetCompletedValue();
+	}
+
+	void wait(UploadToken fenceValue) override
+	{
+		if (fence->GetCompletedValue() < fenceValue)
+		{
+			fence->SetEventOnCompletion(fenceValue, eventHandle);
+			WaitForSingleObject(eventHandle, INFINITE);
+		}
+	}
+
+	~CopyQueueUploader()
+	{
+		if (eventHandle != NULL)
+		{
+			CloseHandle(eventHandle);
+		}
+	}
+
+private:
+	ID3D12Device5* device = nullptr;
+	ID3D12CommandAllocator* allocator = nullptr;
+	ID3D12GraphicsCommandList4* commandList = nullptr;
+	bool recording = false;
+	std::vector<std::pair<UploadToken, ID3D12CommandAllocator*>> retired;
 };
 
 class Core
@@ -105,16 +245,45 @@ public:
 	ID3D12CommandQueue* computeQueue;
 	IDXGISwapChain3* swapchain;
 
+	// Frames the CPU may record ahead of the GPU, each with its own allocator, list and fence. The swap chain has
+	// as many back buffers, but which one a frame draws to is up to the swap chain, so the two indices are separate.
+	static const int maxFramesInFlight = 4;
+	int framesInFlight = 2;
+	unsigned int frame = 0; // The frame being recorded, 0 to framesInFlight - 1
+	unsigned long long frameNumber = 0;
+
 	// Member variables - one for each frame
-	ID3D12CommandAllocator* graphicsCommandAllocator[2];
-	ID3D12GraphicsCommandList4* graphicsCommandList[2];
+	ID3D12CommandAllocator* graphicsCommandAllocator[maxFramesInFlight];
+	ID3D12GraphicsCommandList4* graphicsCommandList[maxFramesInFlight];
+
+	// Lists recorded on other threads, one slot per worker per frame. Once they are executed the frame's own
+	// recording carries on in one of its continuation lists, which share the frame's allocator.
+	static const int maxRecordingLists = 8;
+	int recordingListsN = 0;
+	ID3D12CommandAllocator* recordingAllocators[maxFramesInFlight][maxRecordingLists];
+	ID3D12GraphicsCommandList4* recordingLists[maxFramesInFlight][maxRecordingLists];
+	unsigned long long recordingAllocatorFrames[maxFramesInFlight][maxRecordingLists]; // frameNumber of the last reset
+	std::vector<ID3D12GraphicsCommandList4*> continuationLists[maxFramesInFlight];
+	int continuationsUsed = 0;
+	ID3D12GraphicsCommandList4* mainList = NULL; // Where the frame is being recorded on the main thread
+	D3D12_CPU_DESCRIPTOR_HANDLE renderTarget; // The back buffer's view this frame
 
 	// Backbuffer members
 	ID3D12DescriptorHeap* backbufferHeap;
 	ID3D12Resource** backbuffers;
+	unsigned int backbuffersN;
 
 	// Fences
-	GPUFence graphicsQueueFence[2];
+	GPUFence graphicsQueueFence[maxFramesInFlight];
+
+	// Low latency mode waits on the swap chain until at most maxFrameLatency frames are queued for present, before
+	// recording rather than after, so input is read as late as possible
+	bool lowLatency = false;
+	HANDLE frameLatencyWaitable = NULL;
+
+	// CPU frame time and the time beginFrame waited, for tuning framesInFlight against latency
+	FramePacing pacing;
+	std::chrono::high_resolution_clock::time_point lastFrameStart;
 
 	// Descriptor Heap
 	ID3D12DescriptorHeap* dsvHeap;
@@ -130,9 +299,35 @@ public:
 
 	DescriptorHeap srvHeap;
 
+	// Uploads, staged in a mapped ring and copied on the copy queue
+	CopyQueueUploader uploadQueue;
+	UploadRing uploads;
+	ID3D12Resource* uploadBuffer;
+	UploadToken uploadsWaitedFor = 0; // Latest batch the graphics queue has been told to wait for
+	std::vector<std::pair<UploadToken, ID3D12Resource*>> oversizedUploads; // Staging too big for the ring, by batch
+
+	// Every draw's constants, from one mapped buffer split between the frames in flight
+	size_t constantBytesPerFrame = 8 * 1024 * 1024;
+	ID3D12Resource* constantBuffer;
+	D3D12_GPU_VIRTUAL_ADDRESS constantsGPUAddress;
+	FrameConstantAllocator constants;
+
+	struct DeferredRelease
+	{
+		ID3D12Resource* resource;
+		DescriptorHandle descriptor;
+		UINT64 graphicsValues[maxFramesInFlight];
+		UploadToken upload;
+	};
+	std::vector<DeferredRelease> deferredReleases;
+
 
-	void init(HWND hwnd, int _width, int _height)     // handle to window and width and height of window
+	// _framesInFlight is clamped to 2 to 4. With _lowLatency, at most maxFrameLatency frames wait for present.
+	void init(HWND hwnd, int _width, int _height, int _framesInFlight = 2, bool _lowLatency = false, int maxFrameLatency = 1)     // handle to window and width and height of window
 	{
+		framesInFlight = _framesInFlight < 2 ? 2 : (_framesInFlight > maxFramesInFlight ? maxFramesInFlight : _framesInFlight);
+		lowLatency = _lowLatency;
+
 		ID3D12Debug1* debug;
 		D3D12GetDebugInterface(IID_PPV_ARGS(&debug));
 		debug->EnableDebugLayer();
@@ -189,20 +384,29 @@ public:
 		scDesc.Height = _height;
 		scDesc.SampleDesc.Count = 1; // MSAA here
 		scDesc.SampleDesc.Quality = 0;
-		scDesc.BufferCount = 2;                             // Double buffering
+		scDesc.BufferCount = framesInFlight;                // Double, triple or quadruple buffering
 		scDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+		scDesc.Flags = lowLatency ? DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT : 0;
 
 		// Create a swapchain for the window
 		IDXGISwapChain1* swapChain1;                              // create a Swapchain 1 and can eventually cast to Swapchain 3
 		factory->CreateSwapChainForHwnd(graphicsQueue, hwnd, &scDesc, NULL, NULL, &swapChain1);
 		swapChain1->QueryInterface(&swapchain);
 		swapChain1->Release();
+		backbuffersN = scDesc.BufferCount;
+		if (lowLatency)
+		{
+			swapchain->SetMaximumFrameLatency(maxFrameLatency < 1 ? 1 : maxFrameLatency);
+			frameLatencyWaitable = swapchain->GetFrameLatencyWaitableObject();
+		}
 
 		// Create command allocators and command lists
-		device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&graphicsCommandAllocator[0]));
-		device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&graphicsCommandList[0]));
-		device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&graphicsCommandAllocator[1]));
-		device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&graphicsCommandList[1]));
+		for (int f = 0; f < framesInFlight; f++)
+		{
+			device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&graphicsCommandAllocator[f]));
+			device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&graphicsCommandList[f]));
+		}
+		mainList = graphicsCommandList[0];
 
 		// Create HEAP
 		D3D12_DESCRIPTOR_HEAP_DESC renderTargetViewHeapDesc = {};
@@ -216,16 +420,18 @@ public:
 		// Get backbuffers and create views on heap
 		D3D12_CPU_DESCRIPTOR_HANDLE renderTargetViewHandle = backbufferHeap->GetCPUDescriptorHandleForHeapStart();
 		unsigned int renderTargetViewDescriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);  // how much space a view takes up
-		for (unsigned int i = 0; i < 2; i++)     // create 2 render target views
+		for (unsigned int i = 0; i < backbuffersN; i++)     // create a render target view per back buffer
 		{
 			swapchain->GetBuffer(i, IID_PPV_ARGS(&backbuffers[i]));
 			device->CreateRenderTargetView(backbuffers[i], nullptr, renderTargetViewHandle);
 			renderTargetViewHandle.ptr += renderTargetViewDescriptorSize;
 		}
 
-		// Create fences
-		graphicsQueueFence[0].create(device);
-		graphicsQueueFence[1].create(device);
+		// Create fences, all of them so each one has something to release
+		for (int f = 0; f < maxFramesInFlight; f++)
+		{
+			graphicsQueueFence[f].create(device);
+		}
 
 		// Create Descriptor Heap
 		D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc;
@@ -313,6 +519,15 @@ public:
 		rootParameterTex.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 		parameters.push_back(rootParameterTex);
 
+		// The array slice the pixel shader samples at b1, set per draw without changing the descriptor table
+		D3D12_ROOT_PARAMETER rootParameterSlice;
+		rootParameterSlice.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		rootParameterSlice.Constants.ShaderRegister = 1; // Register(b1)
+		rootParameterSlice.Constants.RegisterSpace = 0;
+		rootParameterSlice.Constants.Num32BitValues = 1;
+		rootParameterSlice.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+		parameters.push_back(rootParameterSlice);
+
 		D3D12_STATIC_SAMPLER_DESC staticSampler = {};
 		staticSampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
 		staticSampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
@@ -343,31 +558,206 @@ public:
 		device->CreateRootSignature(0, serialized->GetBufferPointer(), serialized -> GetBufferSize(), IID_PPV_ARGS(&rootSignature));
 		serialized->Release();
 
-		srvHeap.init(device, 16384);
+		srvHeap.init(device, 16384, 2048, framesInFlight);
+
+		// 64MB upload ring, mapped for good
+		D3D12_HEAP_PROPERTIES uploadHeapProps = {};
+		uploadHeapProps.Type = D3D12_HEAP_TYPE_UPLOAD;
+		D3D12_RESOURCE_DESC uploadDesc = {};
+		uploadDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		uploadDesc.Width = 64 * 1024 * 1024;
+		uploadDesc.Height = 1;
+		uploadDesc.DepthOrArraySize = 1;
+		uploadDesc.MipLevels = 1;
+		uploadDesc.SampleDesc.Count = 1;
+		uploadDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+		device->CreateCommittedResource(&uploadHeapProps, D3D12_HEAP_FLAG_NONE, &uploadDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&uploadBuffer));
+		void* uploadMemory = NULL;
+		uploadBuffer->Map(0, NULL, &uploadMemory);
+		uploadQueue.init(device, copyQueue);
+		uploads.init(static_cast<unsigned char*>(uploadMemory), (size_t)uploadDesc.Width, &uploadQueue);
+
+		// Constants, a part per frame in flight, also mapped for good
+		D3D12_RESOURCE_DESC constantDesc = uploadDesc;
+		constantDesc.Width = constantBytesPerFrame * framesInFlight;
+		device->CreateCommittedResource(&uploadHeapProps, D3D12_HEAP_FLAG_NONE, &constantDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&constantBuffer));
+		void* constantMemory = NULL;
+		D3D12_RANGE readRange = { 0, 0 };
+		constantBuffer->Map(0, &readRange, &constantMemory);
+		constantsGPUAddress = constantBuffer->GetGPUVirtualAddress();
+		constants.init(static_cast<unsigned char*>(constantMemory), (size_t)constantDesc.Width, framesInFlight);
 
 		factory->Release();
 	}
 
-	// ensures all work is completed before mobing on
+	// ensures all work is completed before mobing on, uploads included
 	void flushGraphicsQueue()
 	{
+		submitUploads();
 		graphicsQueueFence[0].signal(graphicsQueue);
 		graphicsQueueFence[0].wait();
+		releaseDeferred();
+	}
+
+	// Sends the uploads staged so far to the copy queue, and has the graphics queue wait for them before it runs
+	// anything submitted after this. The CPU does not wait.
+	void submitUploads()
+	{
+		UploadToken token = uploads.submit();
+		if (token > uploadsWaitedFor)
+		{
+			graphicsQueue->Wait(uploadQueue.fence, token);
+			uploadsWaitedFor = token;
+		}
+		for (int i = 0; i < oversizedUploads.size(); i++)
+		{
+			if (uploads.isComplete(oversizedUploads[i].first))
+			{
+				oversizedUploads[i].second->Release();
+				oversizedUploads.erase(oversizedUploads.begin() + i);
+				i--;
+			}
+		}
+	}
+
+	bool isUploadComplete(UploadToken token)
+	{
+		return uploads.isComplete(token);
+	}
+
+	// Blocks until the upload behind token has landed
+	void waitForUpload(UploadToken token)
+	{
+		uploads.wait(token);
+	}
+
+	// Releases resource, and frees its view, once neither frame in flight nor a pending upload can still use them
+	void deferRelease(ID3D12Resource* resource, DescriptorHandle descriptor = DescriptorHandle())
+	{
+		DeferredRelease release;
+		release.resource = resource;
+		release.descriptor = descriptor;
+		for (int f = 0; f < maxFramesInFlight; f++)
+		{
+			release.graphicsValues[f] = graphicsQueueFence[f].value;
+		}
+		release.upload = uploads.openToken();
+		deferredReleases.push_back(release);
+	}
+
+	void releaseDeferred()
+	{
+		for (int i = 0; i < deferredReleases.size(); i++)
+		{
+			DeferredRelease& release = deferredReleases[i];
+			bool done = uploads.isComplete(release.upload);
+			for (int f = 0; f < maxFramesInFlight && done; f++)
+			{
+				done = graphicsQueueFence[f].fence->GetCompletedValue() >= release.graphicsValues[f];
+			}
+			if (done)
+			{
+				release.resource->Release();
+				if (release.descriptor.valid())
+				{
+					srvHeap.free(release.descriptor);
+				}
+				deferredReleases.erase(deferredReleases.begin() + i);
+				i--;
+			}
+		}
 	}
 
 	// Resets the command list
 	void resetCommandList()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		graphicsCommandAllocator[frameIndex]->Reset();
-		graphicsCommandList[frameIndex]->Reset(graphicsCommandAllocator[frameIndex], NULL);
+		graphicsCommandAllocator[frame]->Reset();
+		graphicsCommandList[frame]->Reset(graphicsCommandAllocator[frame], NULL);
+		mainList = graphicsCommandList[frame];
+		continuationsUsed = 0;
 	}
 
-	// Gets current command list
+	// Gets current command list, the worker list a thread has open or else the frame's own
 	ID3D12GraphicsCommandList4* getCommandList()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		return graphicsCommandList[frameIndex];
+		ID3D12GraphicsCommandList4* list = threadCommandList();
+		return list != NULL ? list : mainList;
+	}
+
+	// Creates listsN worker lists for every frame in flight
+	void initRecordingLists(int listsN)
+	{
+		recordingListsN = listsN > maxRecordingLists ? maxRecordingLists : listsN;
+		for (int f = 0; f < framesInFlight; f++)
+		{
+			for (int i = 0; i < recordingListsN; i++)
+			{
+				device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&recordingAllocators[f][i]));
+				device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&recordingLists[f][i]));
+				recordingAllocatorFrames[f][i] = ~0ull;
+			}
+		}
+	}
+
+	// Opens worker list slot on the calling thread, getCommandList() there returns it until endRecordingList
+	void beginRecordingList(int list)
+	{
+		// A slot can be recorded more than once a frame, but its allocator is only free to reset the first time
+		if (recordingAllocatorFrames[frame][list] != frameNumber)
+		{
+			recordingAllocators[frame][list]->Reset();
+			recordingAllocatorFrames[frame][list] = frameNumber;
+		}
+		recordingLists[frame][list]->Reset(recordingAllocators[frame][list], NULL);
+		setupCommandList(recordingLists[frame][list]);
+		threadCommandList() = recordingLists[frame][list];
+	}
+
+	void endRecordingList(int list)
+	{
+		recordingLists[frame][list]->Close();
+		threadCommandList() = NULL;
+	}
+
+	// Executes the frame's list so far then worker lists 0 to count - 1, in order in one ExecuteCommandLists, and
+	// moves the frame on to a fresh list for whatever it records next
+	void executeRecordingLists(int count)
+	{
+		submitUploads();
+		mainList->Close();
+		ID3D12CommandList* lists[maxRecordingLists + 1];
+		lists[0] = mainList;
+		for (int i = 0; i < count; i++)
+		{
+			lists[i + 1] = recordingLists[frame][i];
+		}
+		graphicsQueue->ExecuteCommandLists(count + 1, lists);
+
+		if (continuationsUsed == continuationLists[frame].size())
+		{
+			ID3D12GraphicsCommandList4* list;
+			device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&list));
+			continuationLists[frame].push_back(list);
+		}
+		mainList = continuationLists[frame][continuationsUsed++];
+		mainList->Reset(graphicsCommandAllocator[frame], NULL);
+		setupCommandList(mainList);
+	}
+
+	// State a list does not inherit from the one before it
+	void setupCommandList(ID3D12GraphicsCommandList4* list)
+	{
+		list->OMSetRenderTargets(1, &renderTarget, FALSE, &dsvHandle);
+		list->RSSetViewports(1, &viewport);
+		list->RSSetScissorRects(1, &scissorRect);
+		list->SetGraphicsRootSignature(rootSignature);
+		list->SetDescriptorHeaps(1, &srvHeap.heap);
+	}
+
+	static ID3D12GraphicsCommandList4*& threadCommandList()
+	{
+		thread_local ID3D12GraphicsCommandList4* list = NULL;
+		return list;
 	}
 
 	// Close and execute the command list
@@ -380,15 +770,35 @@ public:
 
 	void beginFrame()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-
-		graphicsQueueFence[frameIndex].wait();
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		frame = (unsigned int)(frameNumber % framesInFlight);
+		if (frameLatencyWaitable != NULL)
+		{
+			WaitForSingleObjectEx(frameLatencyWaitable, 1000, TRUE);
+		}
+		// The GPU is done with the last frame that used this frame's allocator, transient descriptors and constants
+		graphicsQueueFence[frame].wait();
+		srvHeap.allocator.beginFrame(frame);
+		if (constants.overflowsThisFrame() > 0)
+		{
+			OutputDebugStringA("Out of constant space last frame, raise constantBytesPerFrame\n");
+		}
+		constants.beginFrame(frame);
+		releaseDeferred();
+		std::chrono::high_resolution_clock::time_point waited = std::chrono::high_resolution_clock::now();
+		if (frameNumber > 0)
+		{
+			pacing.add(std::chrono::duration<float, std::milli>(start - lastFrameStart).count(), std::chrono::duration<float, std::milli>(waited - start).count());
+		}
+		lastFrameStart = start;
 
+		unsigned int backbufferIndex = swapchain->GetCurrentBackBufferIndex();
 		D3D12_CPU_DESCRIPTOR_HANDLE renderTargetViewHandle = backbufferHeap -> GetCPUDescriptorHandleForHeapStart();
 		unsigned int renderTargetViewDescriptorSize = device -> GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-		renderTargetViewHandle.ptr += frameIndex * renderTargetViewDescriptorSize;
+		renderTargetViewHandle.ptr += backbufferIndex * renderTargetViewDescriptorSize;
+		renderTarget = renderTargetViewHandle;
 		resetCommandList();
-		Barrier::add(backbuffers[frameIndex], D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET, getCommandList());
+		Barrier::add(backbuffers[backbufferIndex], D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET, getCommandList());
 		getCommandList()->OMSetRenderTargets(1, &renderTargetViewHandle, FALSE, &dsvHandle);
 		float color[4];                    // colour of screen, currently blue
 		color[0] = 0;
@@ -402,62 +812,78 @@ public:
 
 	void finishFrame()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		Barrier::add(backbuffers[frameIndex], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT, getCommandList());
+		unsigned int backbufferIndex = swapchain->GetCurrentBackBufferIndex();
+		Barrier::add(backbuffers[backbufferIndex], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT, getCommandList());
+		submitUploads();
 		runCommandList();
-		graphicsQueueFence[frameIndex].signal(graphicsQueue);
+		graphicsQueueFence[frame].signal(graphicsQueue);
 		swapchain->Present(1, 0);
+		frameNumber++;
 	}
 
-	// Copies some data (pointer to memory), allocate memory in upload heap
-	void uploadResource(ID3D12Resource* dstResource, const void* data, unsigned int size, D3D12_RESOURCE_STATES targetState, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* texFootprint = NULL)
+	// Stages data in the upload ring and records its copy on the copy queue, without waiting. The returned token
+	// says when it has landed, and anything the graphics queue runs after the next submitUploads sees it. Resources
+	// go from COMMON to COPY_DEST and back on the copy queue by themselves, and the graphics queue promotes them
+	// from COMMON to the read state a draw needs, so no barriers are recorded.
+	UploadToken uploadResource(ID3D12Resource* dstResource, const void* data, unsigned int size)
 	{
-		ID3D12Resource* uploadBuffer;
-		D3D12_HEAP_PROPERTIES heapProps = {};
-		heapProps.Type = D3D12_HEAP_TYPE_UPLOAD;
-		D3D12_RESOURCE_DESC bufferDesc = {};
-		bufferDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-		bufferDesc.Width = size;
-		bufferDesc.Height = 1;
-		bufferDesc.DepthOrArraySize = 1;
-		bufferDesc.MipLevels = 1;
-		bufferDesc.SampleDesc.Count = 1;
-		bufferDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-		device->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&uploadBuffer));
-
-		void* mappeddata = NULL;                          // Initialises data
-		uploadBuffer->Map(0, NULL, &mappeddata);
-		memcpy(mappeddata, data, size);
-		uploadBuffer->Unmap(0, NULL);
+		return uploadSubresources(dstResource, data, size, NULL, 0);
+	}
 
-		resetCommandList();
+	// Same, copying subresource i of a texture from texFootprints[i], e.g. a whole mip chain in one go
+	UploadToken uploadSubresources(ID3D12Resource* dstResource, const void* data, UINT64 size, const D3D12_PLACED_SUBRESOURCE_FOOTPRINT* texFootprints, unsigned int subresourcesN)
+	{
+		UploadAllocation allocation;
+		ID3D12Resource* source = uploadBuffer;
+		if (!uploads.allocate((size_t)size, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, allocation))
+		{
+			// Bigger than the whole ring, so it gets staging of its own, released once its batch is done
+			D3D12_HEAP_PROPERTIES heapProps = {};
+			heapProps.Type = D3D12_HEAP_TYPE_UPLOAD;
+			D3D12_RESOURCE_DESC bufferDesc = {};
+			bufferDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+			bufferDesc.Width = size;
+			bufferDesc.Height = 1;
+			bufferDesc.DepthOrArraySize = 1;
+			bufferDesc.MipLevels = 1;
+			bufferDesc.SampleDesc.Count = 1;
+			bufferDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			device->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&source));
+			void* mappeddata = NULL;
+			source->Map(0, NULL, &mappeddata);
+			allocation.offset = 0;
+			allocation.data = static_cast<unsigned char*>(mappeddata);
+			allocation.token = uploads.addExternal();
+			oversizedUploads.push_back(std::make_pair(allocation.token, source));
+		}
+		memcpy(allocation.data, data, (size_t)size);
+		if (source != uploadBuffer)
+		{
+			source->Unmap(0, NULL);
+		}
 
-		if (texFootprint != NULL)
+		ID3D12GraphicsCommandList4* commandList = uploadQueue.getCommandList();
+		if (subresourcesN > 0)
 		{
-			D3D12_TEXTURE_COPY_LOCATION src = {};
-			src.pResource = uploadBuffer;
-			src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
-			src.PlacedFootprint = *texFootprint;
-			D3D12_TEXTURE_COPY_LOCATION dst = {};
-			dst.pResource = dstResource;
-			dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-			dst.SubresourceIndex = 0;
-			getCommandList()->CopyTextureRegion(&dst, 0, 0, 0, &src, NULL);
+			for (unsigned int i = 0; i < subresourcesN; i++)
+			{
+				D3D12_TEXTURE_COPY_LOCATION src = {};
+				src.pResource = source;
+				src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+				src.PlacedFootprint = texFootprints[i];
+				src.PlacedFootprint.Offset += allocation.offset;
+				D3D12_TEXTURE_COPY_LOCATION dst = {};
+				dst.pResource = dstResource;
+				dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+				dst.SubresourceIndex = i;
+				commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, NULL);
+			}
 		}
 		else
 		{
-			getCommandList()->CopyBufferRegion(dstResource, 0, uploadBuffer, 0, size);
+			commandList->CopyBufferRegion(dstResource, 0, source, allocation.offset, size);
 		}
-
-		// Transition buffer to final state after copying
-		Barrier::add(dstResource, D3D12_RESOURCE_STATE_COPY_DEST, targetState, getCommandList());
-
-		runCommandList();    // close and execute command lists
-
-		flushGraphicsQueue();   // wait for command to finish
-
-		uploadBuffer->Release();  //  release upload heap memory
-
+		return allocation.token;
 	}
 
 	// Functionality to set common draw functionality
@@ -470,10 +896,43 @@ public:
 	}
 
 
-	// Frame index
+	// Frame index, of the frame being recorded rather than of its back buffer
 	int frameIndex()
 	{
-		return swapchain->GetCurrentBackBufferIndex();
+		return frame;
 	}
 
 };
+
+// Runs ParallelRecorder's lists on Core's per frame worker lists
+class CoreRecordingBackend : public RecordingBackend
+{
+public:
+	Core* core = NULL;
+
+	void init(Core* _core, int listsN)
+	{
+		core = _core;
+		core->initRecordingLists(listsN);
+	}
+
+	int listsN() const override
+	{
+		return core->recordingListsN;
+	}
+
+	void begin(int list) override
+	{
+		core->beginRecordingList(list);
+	}
+
+	void end(int list) override
+	{
+		core->endRecordingList(list);
+	}
+
+	void execute(int count) override
+	{
+		core->executeRecordingLists(count);
+	}
+};
@@ -5,14 +5,52 @@
 #include "TRex.h" 
 #include "Objects.h" 
 #include "Collision.h" 
+#include "Benchmark.h"
+#include "Tests.h"
+#include "AnimationLOD.h"
+#include "AssetCache.h"
+#include "TextureCache.h"
+#include "AssetLoader.h"
+#include "JobSystem.h"
 
 // [REMOVED DrawSolidBox Function]
 
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nCmdShow) {
+    // Headless benchmarks, no window or device
+    if (strstr(lpCmdLine, "-bench") != nullptr) {
+        Benchmark::run();
+        return 0;
+    }
+
+    // Headless checks, the exit code is the number that failed
+    if (strstr(lpCmdLine, "-test") != nullptr) {
+        return Tests::run();
+    }
+
+    // Cook every model into its .gemc file and every texture into its .dds file, also headless.
+    // "-fast" trades compression quality for cooking time, "-bc7" uses BC7 where BC3 would be used.
+    if (strstr(lpCmdLine, "-cook") != nullptr) {
+        AssetCache::cookAll("Resources/Models/");
+        JobSystem cookJobs;
+        cookJobs.init();
+        BlockQuality quality = strstr(lpCmdLine, "-fast") != nullptr ? BlockQuality::Fast : BlockQuality::Quality;
+        TextureCache::cookAll(&cookJobs, "Resources/Models/Textures/", quality, strstr(lpCmdLine, "-bc7") != nullptr);
+        return 0;
+    }
+
+    // "-frames N" lets the CPU run up to N (2 to 4) frames ahead of the GPU, "-lowlatency" waits on the swap chain
+    // so only one frame is queued for present. "-pacing" logs a frame pacing report every 600 frames.
+    int framesInFlight = 2;
+    const char* framesArg = strstr(lpCmdLine, "-frames");
+    if (framesArg != nullptr) {
+        framesInFlight = atoi(framesArg + strlen("-frames"));
+    }
+    bool logPacing = strstr(lpCmdLine, "-pacing") != nullptr;
+
     Window win;
     win.initialize("Game Engine", 1024, 1024);
     Core core;
-    core.init(win.hwnd, 1024, 1024);
+    core.init(win.hwnd, 1024, 1024, framesInFlight, strstr(lpCmdLine, "-lowlatency") != nullptr);
     GamesEngineeringBase::Timer tim;
 
     Shaders shaders;
@@ -39,26 +77,43 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
 
 
     // --- 2. LOAD ASSETS ---
-    textureManager.loadTexture(&core, "MuzzleFlashTex", "Resources/Models/Textures/muzzleflash.png");
-    textureManager.loadTexture(&core, "GrassTexture", "Resources/Models/Textures/TX_Grass_Sets_01a_ALB.png");
+    // Files are read, parsed and decoded on the job system, then uploaded here in one go
+    JobSystem jobs;
+    jobs.init();
+    // Cooked textures start with their mip tails and stream the rest in as they come into view
+    textureManager.initStreaming(256 * 1024 * 1024);
+    // The rest that match share texture arrays, so meshes change slice rather than descriptor table
+    textureManager.packing = true;
+    AssetLoader assets;
+    assets.init(&jobs, &textureManager.buffers);
+    assets.streamTextures(textureManager.streamer.tailSize);
+    assets.loadImage("MuzzleFlashTex", "Resources/Models/Textures/muzzleflash.png");
+    assets.loadImage("GrassTexture", "Resources/Models/Textures/TX_Grass_Sets_01a_ALB.png");
+    AssetFuture<LoadedModel> grassAsset = assets.loadModel("Resources/Models/Grass_Sets_01a.gem", false);
+    AssetFuture<LoadedModel> gunAsset = assets.loadModel("Resources/Models/AutomaticCarbine.gem", true);
+    AssetFuture<LoadedModel> trexAsset = assets.loadModel("Resources/Models/TRex.gem", true);
+    AssetFuture<LoadedModel> treeAsset = assets.loadModel("Resources/Models/Ash_Tree_Full_01j.gem", false);
+    AssetFuture<LoadedModel> ammoAsset = assets.loadModel("Resources/Models/Ammo_Boxes_01a.gem", false);
+    CoreAssetUploader uploader(&core, &textureManager);
+    assets.finish(uploader);
 
     Grass grassField;
-    grassField.init(&core, &psos, &shaders, "Resources/Models/Grass_Sets_01a.gem", 10000);
+    grassField.init(&core, &psos, &shaders, *grassAsset.get(), 10000);
 
     Plane floor; floor.init(&core, &psos, &shaders);
     Sphere sphere; sphere.init(&core, &psos, &shaders, 20, 20, 20);
 
     Player player;
-    player.init(&core, &psos, &shaders, &textureManager);
-    player.setFlashMesh(&floor);
+    player.init(&core, &psos, &shaders, *gunAsset.get());
+    player.setFlashMesh(&shaders, &floor);
 
     TRex trex;
-    trex.init(&core, &psos, &shaders, &textureManager);
+    trex.init(&core, &psos, &shaders, *trexAsset.get());
 
     staticModel tree;
-    tree.init(&core, &psos, &shaders, "Resources/Models/Ash_Tree_Full_01j.gem", &textureManager);
+    tree.init(&core, &psos, &shaders, *treeAsset.get());
     staticModel ammoBox;
-    ammoBox.init(&core, &psos, &shaders, "Resources/Models/Ammo_Boxes_01a.gem", &textureManager);
+    ammoBox.init(&core, &psos, &shaders, *ammoAsset.get());
 
     // Define tree transform
     Matrix treeMatrix;
@@ -69,21 +124,54 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     ammoMatrix.scaling(Vec3(5.0f, 5.0f, 5.0f));
     ammoMatrix.translation(Vec3(10, 0, 0));
 
+    // Neither moves, so their world space bounds are worked out once, for how big they appear on screen
+    BoundingBox treeBounds = tree.worldBounds(treeMatrix);
+    BoundingBox ammoBounds = ammoBox.worldBounds(ammoMatrix);
+    Vec3 treeExtent = treeBounds.max - treeBounds.min;
+    Vec3 ammoExtent = ammoBounds.max - ammoBounds.min;
+    float treeRadius = treeExtent.length(treeExtent) * 0.5f;
+    float ammoRadius = ammoExtent.length(ammoExtent) * 0.5f;
+
+    // Distant animated models update less often and skip their leaf bones
+    AnimationLODManager animationLOD;
+    animationLOD.init();
+    int trexLOD = animationLOD.add(&trex.animInstance);
+    std::vector<AnimationInstance*> posed;
+
     ShowCursor(FALSE);
 
     // --- 3. GAME LOOP ---
     while (true) {
+        textureManager.updateStreaming(&core);
         core.beginFrame();
+        if (logPacing && core.pacing.count() >= 600) {
+            std::string label = std::to_string(core.framesInFlight) + " frames in flight" + (core.lowLatency ? ", low latency" : "");
+            OutputDebugStringA(core.pacing.report(label).c_str());
+            core.pacing.reset();
+        }
         win.processMessages();
         float dt = tim.dt();
 
         // Logic
         Matrix vp = player.update(win, dt);
         trex.update(dt, win, player.position);
-        tree.update(&shaders, treeMatrix);
-        ammoBox.update(&shaders, ammoMatrix);
+        animationLOD.setPosition(trexLOD, trex.position);
+        animationLOD.schedule(player.position, posed);
+        for (AnimationInstance* instance : posed) {
+            instance->evaluatePose();
+        }
         player.handleShooting(trex);
 
+        // Ask for the texture detail each model needs at its distance, it streams in over the next frames
+        Vec3 toTree = treeBounds.getCenter() - player.position;
+        Vec3 toAmmo = ammoBounds.getCenter() - player.position;
+        Vec3 toTRex = trex.position - player.position;
+        textureManager.requestTextures(tree.mesh.textureFilenames, TextureStreamer::screenSize(treeRadius, toTree.length(toTree), 60.0f, 1024));
+        textureManager.requestTextures(ammoBox.mesh.textureFilenames, TextureStreamer::screenSize(ammoRadius, toAmmo.length(toAmmo), 60.0f, 1024));
+        textureManager.requestTextures(trex.model.mesh.textureFilenames, TextureStreamer::screenSize(5.0f, toTRex.length(toTRex), 60.0f, 1024));
+        textureManager.requestTextures(player.gunModel.mesh.textureFilenames, 1024.0f);
+        textureManager.requestTexture("GrassTexture", 1024.0f);
+
         // Render Setup
         shaders.updateConstantVS("static", "staticMeshBuffer", "VP", &vp);
         core.beginRenderPass();
@@ -198,8 +286,6 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
 
         trex.update(dt, win);
 
-        tree.update(&shaders, treeMatrix);
-
         player.handleShooting(trex);
 
         // RENDER
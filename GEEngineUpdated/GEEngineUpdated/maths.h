@@ -6,6 +6,18 @@
 #include <iostream>
 #include "GamesEngineeringBase.h"
 
+// SIMD backend - picked at compile time. AVX2 (+FMA) when the compiler targets it, SSE on any x64 build,
+// otherwise the scalar reference code. Define MATHS_FORCE_SCALAR to build the scalar path only.
+#if !defined(MATHS_FORCE_SCALAR)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATHS_SIMD_SSE
+#include <immintrin.h>
+#endif
+#if defined(MATHS_SIMD_SSE) && defined(__AVX2__) && (defined(_MSC_VER) || defined(__FMA__))
+#define MATHS_SIMD_AVX2
+#endif
+#endif
+
 using namespace std;
 
 // Macro - square - useful for squaring functions
@@ -448,6 +460,172 @@ public:
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+#if defined(MATHS_SIMD_SSE)
+#define MATHS_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define MATHS_SWIZZLE(a, x, y, z, w) _mm_shuffle_ps(a, a, _MM_SHUFFLE(w, z, y, x))
+
+// out = l * r, every output row is a linear combination of the rows of r
+inline void simdMultiply(const float* l, const float* r, float* out)
+{
+#if defined(MATHS_SIMD_AVX2)
+	// two output rows per iteration, each 128 bit lane holds one row
+	__m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(r));
+	__m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(r + 4));
+	__m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(r + 8));
+	__m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(r + 12));
+	for (int i = 0; i < 16; i += 8)
+	{
+		__m256 rows = _mm256_loadu_ps(l + i);
+		__m256 acc = _mm256_mul_ps(_mm256_permute_ps(rows, 0x00), b0);
+		acc = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0x55), b1, acc);
+		acc = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0xAA), b2, acc);
+		acc = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0xFF), b3, acc);
+		_mm256_storeu_ps(out + i, acc);
+	}
+#else
+	__m128 b0 = _mm_loadu_ps(r);
+	__m128 b1 = _mm_loadu_ps(r + 4);
+	__m128 b2 = _mm_loadu_ps(r + 8);
+	__m128 b3 = _mm_loadu_ps(r + 12);
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 row = _mm_loadu_ps(l + i);
+		__m128 acc = _mm_mul_ps(MATHS_SWIZZLE(row, 0, 0, 0, 0), b0);
+		acc = _mm_add_ps(acc, _mm_mul_ps(MATHS_SWIZZLE(row, 1, 1, 1, 1), b1));
+		acc = _mm_add_ps(acc, _mm_mul_ps(MATHS_SWIZZLE(row, 2, 2, 2, 2), b2));
+		acc = _mm_add_ps(acc, _mm_mul_ps(MATHS_SWIZZLE(row, 3, 3, 3, 3), b3));
+		_mm_storeu_ps(out + i, acc);
+	}
+#endif
+}
+
+// 2x2 row major blocks packed in one register as (m00, m01, m10, m11)
+inline __m128 simdMat2Mul(__m128 a, __m128 b)      // A * B
+{
+	return _mm_add_ps(_mm_mul_ps(a, MATHS_SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(MATHS_SWIZZLE(a, 1, 0, 3, 2), MATHS_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+inline __m128 simdMat2AdjMul(__m128 a, __m128 b)   // adjugate(A) * B
+{
+	return _mm_sub_ps(_mm_mul_ps(MATHS_SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(MATHS_SWIZZLE(a, 1, 1, 2, 2), MATHS_SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+inline __m128 simdMat2MulAdj(__m128 a, __m128 b)   // A * adjugate(B)
+{
+	return _mm_sub_ps(_mm_mul_ps(a, MATHS_SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(MATHS_SWIZZLE(a, 1, 0, 3, 2), MATHS_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// General 4x4 inverse using 2x2 blocks, M = | A B |
+//                                          | C D |
+inline void simdInvert(const float* m, float* out)
+{
+	__m128 r0 = _mm_loadu_ps(m);
+	__m128 r1 = _mm_loadu_ps(m + 4);
+	__m128 r2 = _mm_loadu_ps(m + 8);
+	__m128 r3 = _mm_loadu_ps(m + 12);
+
+	__m128 A = _mm_movelh_ps(r0, r1);
+	__m128 B = _mm_movehl_ps(r1, r0);
+	__m128 C = _mm_movelh_ps(r2, r3);
+	__m128 D = _mm_movehl_ps(r3, r2);
+
+	// determinants of the four blocks as (|A|, |B|, |C|, |D|)
+	__m128 detSub = _mm_sub_ps(
+		_mm_mul_ps(MATHS_SHUFFLE(r0, r2, 0, 2, 0, 2), MATHS_SHUFFLE(r1, r3, 1, 3, 1, 3)),
+		_mm_mul_ps(MATHS_SHUFFLE(r0, r2, 1, 3, 1, 3), MATHS_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+	__m128 detA = MATHS_SWIZZLE(detSub, 0, 0, 0, 0);
+	__m128 detB = MATHS_SWIZZLE(detSub, 1, 1, 1, 1);
+	__m128 detC = MATHS_SWIZZLE(detSub, 2, 2, 2, 2);
+	__m128 detD = MATHS_SWIZZLE(detSub, 3, 3, 3, 3);
+
+	__m128 D_C = simdMat2AdjMul(D, C);
+	__m128 A_B = simdMat2AdjMul(A, B);
+	__m128 X_ = _mm_sub_ps(_mm_mul_ps(detD, A), simdMat2Mul(B, D_C));
+	__m128 W_ = _mm_sub_ps(_mm_mul_ps(detA, D), simdMat2Mul(C, A_B));
+	__m128 Y_ = _mm_sub_ps(_mm_mul_ps(detB, C), simdMat2MulAdj(D, A_B));
+	__m128 Z_ = _mm_sub_ps(_mm_mul_ps(detC, B), simdMat2MulAdj(A, D_C));
+
+	// |M| = |A||D| + |B||C| - trace((A#B)(D#C))
+	__m128 tr = _mm_mul_ps(A_B, MATHS_SWIZZLE(D_C, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, _mm_movehl_ps(tr, tr));
+	tr = _mm_add_ps(tr, MATHS_SWIZZLE(tr, 1, 0, 1, 0));
+	__m128 detM = _mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC));
+	detM = _mm_sub_ps(detM, MATHS_SWIZZLE(tr, 0, 0, 0, 0));
+
+	__m128 rDetM = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), detM);
+	X_ = _mm_mul_ps(X_, rDetM);
+	Y_ = _mm_mul_ps(Y_, rDetM);
+	Z_ = _mm_mul_ps(Z_, rDetM);
+	W_ = _mm_mul_ps(W_, rDetM);
+
+	// adjugate of each block and transpose back into rows
+	_mm_storeu_ps(out, MATHS_SHUFFLE(X_, Y_, 3, 1, 3, 1));
+	_mm_storeu_ps(out + 4, MATHS_SHUFFLE(X_, Y_, 2, 0, 2, 0));
+	_mm_storeu_ps(out + 8, MATHS_SHUFFLE(Z_, W_, 3, 1, 3, 1));
+	_mm_storeu_ps(out + 12, MATHS_SHUFFLE(Z_, W_, 2, 0, 2, 0));
+}
+
+// Loads four packed Vec3s (12 floats) and splits them into x, y and z lanes
+inline void simdLoadVec3x4(const float* p, __m128& x, __m128& y, __m128& z)
+{
+	__m128 a = _mm_loadu_ps(p);       // x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(p + 4);   // y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(p + 8);   // z2 x3 y3 z3
+	__m128 x2y2x3y3 = MATHS_SHUFFLE(b, c, 2, 3, 1, 2);
+	__m128 y0z0y1z1 = MATHS_SHUFFLE(a, b, 1, 2, 0, 1);
+	x = MATHS_SHUFFLE(a, x2y2x3y3, 0, 3, 0, 2);
+	y = MATHS_SHUFFLE(y0z0y1z1, x2y2x3y3, 0, 2, 1, 3);
+	z = MATHS_SHUFFLE(y0z0y1z1, c, 1, 3, 0, 3);
+}
+
+// Interleaves x, y and z lanes back into four packed Vec3s
+inline void simdStoreVec3x4(float* p, __m128 x, __m128 y, __m128 z)
+{
+	__m128 xy01 = _mm_unpacklo_ps(x, y);   // x0 y0 x1 y1
+	__m128 xy23 = _mm_unpackhi_ps(x, y);   // x2 y2 x3 y3
+	__m128 z0x1 = MATHS_SHUFFLE(z, xy01, 0, 0, 2, 2);
+	__m128 y1z1 = MATHS_SHUFFLE(xy01, z, 3, 3, 1, 1);
+	__m128 z2z3 = MATHS_SHUFFLE(z, xy23, 2, 3, 2, 3);
+	_mm_storeu_ps(p, MATHS_SHUFFLE(xy01, z0x1, 0, 1, 0, 2));
+	_mm_storeu_ps(p + 4, MATHS_SHUFFLE(y1z1, xy23, 0, 2, 0, 1));
+	_mm_storeu_ps(p + 8, MATHS_SWIZZLE(z2z3, 0, 2, 3, 1));
+}
+
+inline __m128 simdMulAdd(__m128 a, __m128 b, __m128 c)   // a * b + c
+{
+#if defined(MATHS_SIMD_AVX2)
+	return _mm_fmadd_ps(a, b, c);
+#else
+	return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// Transforms n packed Vec3s by the top three rows of m, w is 1 for points and 0 for directions.
+// Works on four elements at a time in x/y/z lanes, the remainder goes through the scalar loop.
+inline size_t simdTransformVec3(const float* m, const float* in, float* out, size_t n, bool isPoint)
+{
+	__m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]);
+	__m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]);
+	__m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]);
+	__m128 tx = isPoint ? _mm_set1_ps(m[3]) : _mm_setzero_ps();
+	__m128 ty = isPoint ? _mm_set1_ps(m[7]) : _mm_setzero_ps();
+	__m128 tz = isPoint ? _mm_set1_ps(m[11]) : _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x, y, z;
+		simdLoadVec3x4(in + i * 3, x, y, z);
+		__m128 ox = simdMulAdd(z, m2, simdMulAdd(y, m1, simdMulAdd(x, m0, tx)));
+		__m128 oy = simdMulAdd(z, m6, simdMulAdd(y, m5, simdMulAdd(x, m4, ty)));
+		__m128 oz = simdMulAdd(z, m10, simdMulAdd(y, m9, simdMulAdd(x, m8, tz)));
+		simdStoreVec3x4(out + i * 3, ox, oy, oz);
+	}
+	return i;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
 class Matrix    // row major, not column major
 {
 public:
@@ -487,7 +665,7 @@ public:
 		m[15] = 1.0f;
 	}
 
-	Vec4 mul(const Vec4& pVec)   // multiply matrix by input vec4
+	Vec4 mul(const Vec4& pVec) const   // multiply matrix by input vec4
 	{
 		return Vec4(
 			pVec.x * m[0] + pVec.y * m[1] + pVec.z * m[2] + pVec.w * m[3],
@@ -498,7 +676,9 @@ public:
 	}
 
 
-	Vec3 mulPoint(const Vec3& pVec)  // multiply matrix by vec3 to store posiiton
+	// Single vector transforms stay scalar, a lone Vec3 has to be shuffled into SIMD lanes and back
+	// which costs more than the nine multiplies it would save - use transformPoints/transformVectors for arrays
+	Vec3 mulPoint(const Vec3& pVec) const  // multiply matrix by vec3 to store posiiton
 	{
 		return Vec3(
 			(pVec.x * m[0] + pVec.y * m[1] + pVec.z * m[2]) + m[3],
@@ -508,7 +688,7 @@ public:
 	}
 
 
-	Vec3 mulVec(const Vec3& pVec)   // multiply matrix by vec3 to store directions
+	Vec3 mulVec(const Vec3& pVec) const   // multiply matrix by vec3 to store directions
 	{
 		return Vec3(
 			(pVec.x * m[0] + pVec.y * m[1] + pVec.z * m[2]),
@@ -518,6 +698,34 @@ public:
 	}
 
 
+	// Transform n points by this matrix, in and out may be the same array
+	void transformPoints(const Vec3* in, Vec3* out, size_t n) const
+	{
+		size_t i = 0;
+#if defined(MATHS_SIMD_SSE)
+		i = simdTransformVec3(m, reinterpret_cast<const float*>(in), reinterpret_cast<float*>(out), n, true);
+#endif
+		for (; i < n; i++)
+		{
+			out[i] = mulPoint(in[i]);
+		}
+	}
+
+
+	// Transform n directions by this matrix (translation ignored), in and out may be the same array
+	void transformVectors(const Vec3* in, Vec3* out, size_t n) const
+	{
+		size_t i = 0;
+#if defined(MATHS_SIMD_SSE)
+		i = simdTransformVec3(m, reinterpret_cast<const float*>(in), reinterpret_cast<float*>(out), n, false);
+#endif
+		for (; i < n; i++)
+		{
+			out[i] = mulVec(in[i]);
+		}
+	}
+
+
 	void translation(const Vec3& pVec)   // Translate a 4x4 matrix
 	{
 		m[3] += pVec.x;
@@ -562,6 +770,18 @@ public:
 
 
 	Matrix multiply(const Matrix& matrix) const    // multiply this matrix by input matrix
+	{
+#if defined(MATHS_SIMD_SSE)
+		Matrix ret;
+		simdMultiply(m, matrix.m, ret.m);
+		return ret;
+#else
+		return multiplyScalar(matrix);
+#endif
+	}
+
+
+	Matrix multiplyScalar(const Matrix& matrix) const
 	{
 		Matrix ret;
 		ret.m[0] = m[0] * matrix.m[0] + m[1] * matrix.m[4] + m[2] * matrix.m[8] + m[3] * matrix.m[12];
@@ -590,7 +810,19 @@ public:
 	}
 
 
-	Matrix invert()    // inverse of a 4x4 matrix
+	Matrix invert() const    // inverse of a 4x4 matrix
+	{
+#if defined(MATHS_SIMD_SSE)
+		Matrix inv;
+		simdInvert(m, inv.m);
+		return inv;
+#else
+		return invertScalar();
+#endif
+	}
+
+
+	Matrix invertScalar() const
 	{
 		Matrix inv;
 		inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
@@ -941,7 +1173,7 @@ public:
 		// which axis is more perpendicular to N? choose either x or y
 		Vec3 helper = (fabs(N.x) > cos(45 * 3.14 / 180.0f) ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(1.0f, 0.0f, 0.0f));
 
-		// GramSchmidt: T = helper - projection(helper onto N)
+		// Gram-Schmidt: T = helper - projection(helper onto N)
 		T = helper - N * helper.Dot(N);
 
 		// Normalise T so it is unit length